@@ -474,6 +474,18 @@ bool gpt_params_parse_ex(int argc, char ** argv, gpt_params & params) {
             params.simple_io = true;
         } else if (arg == "-cb" || arg == "--cont-batching") {
             params.cont_batching = true;
+        } else if (arg == "--prefix-cache") {
+            params.prefix_cache = true;
+        } else if (arg == "--no-flash-attn") {
+            params.flash_attn = false;
+        } else if (arg == "--no-fused-ops") {
+            params.fused_ops = false;
+        } else if (arg == "--no-graph-reuse") {
+            params.reuse_graph = false;
+        } else if (arg == "--no-rope-cache") {
+            params.rope_cache = false;
+        } else if (arg == "--no-kv-paged") {
+            params.kv_paged = false;
         } else if (arg == "--color") {
             params.use_color = true;
         } else if (arg == "--mlock") {
@@ -542,8 +554,40 @@ bool gpt_params_parse_ex(int argc, char ** argv, gpt_params & params) {
 #endif // GGML_USE_CUBLAS
         } else if (arg == "--no-mmap") {
             params.use_mmap = false;
+        } else if (arg == "--fuse-weights") {
+            params.fuse_weights = true;
+        } else if (arg == "--repack-weights") {
+            params.repack_weights = true;
+        } else if (arg == "-dt" || arg == "--defrag-thold") {
+            if (++i >= argc) {
+                invalid_param = true;
+                break;
+            }
+            params.defrag_thold = std::stof(argv[i]);
+        } else if (arg == "--hugepages") {
+            if (++i >= argc) {
+                invalid_param = true;
+                break;
+            }
+            std::string value(argv[i]);
+            /**/ if (value == "none") { params.hugepages = LLAMA_HUGEPAGES_NONE; }
+            else if (value == "thp")  { params.hugepages = LLAMA_HUGEPAGES_THP; }
+            else if (value == "2M")   { params.hugepages = LLAMA_HUGEPAGES_2M; }
+            else if (value == "1G")   { params.hugepages = LLAMA_HUGEPAGES_1G; }
+            else { invalid_param = true; break; }
         } else if (arg == "--numa") {
             params.numa = true;
+        } else if (arg == "--numa-placement") {
+            if (++i >= argc) {
+                invalid_param = true;
+                break;
+            }
+            std::string value(argv[i]);
+            /**/ if (value == "none")       { params.numa_placement = GGML_NUMA_PLACEMENT_NONE; }
+            else if (value == "interleave") { params.numa_placement = GGML_NUMA_PLACEMENT_INTERLEAVE; }
+            else if (value == "replicate")  { params.numa_placement = GGML_NUMA_PLACEMENT_REPLICATE; }
+            else { invalid_param = true; break; }
+            params.numa = true;
         } else if (arg == "--verbose-prompt") {
             params.verbose_prompt = true;
         } else if (arg == "-r" || arg == "--reverse-prompt") {
@@ -562,6 +606,12 @@ bool gpt_params_parse_ex(int argc, char ** argv, gpt_params & params) {
             if (params.logdir.back() != DIRECTORY_SEPARATOR) {
                 params.logdir += DIRECTORY_SEPARATOR;
             }
+        } else if (arg == "--trace") {
+            if (++i >= argc) {
+                invalid_param = true;
+                break;
+            }
+            params.trace_file = argv[i];
         } else if (arg == "--perplexity" || arg == "--all-logits") {
             params.logits_all = true;
         } else if (arg == "--ppl-stride") {
@@ -681,6 +731,10 @@ bool gpt_params_parse_ex(int argc, char ** argv, gpt_params & params) {
         throw std::invalid_argument("error: --prompt-cache-all not supported in interactive mode yet\n");
     }
 
+    if (params.n_parallel < 1 || params.n_parallel > LLAMA_MAX_SEQ) {
+        throw std::invalid_argument("error: --parallel must be between 1 and " + std::to_string(LLAMA_MAX_SEQ) + "\n");
+    }
+
     if (params.escape) {
         process_escapes(params.prompt);
         process_escapes(params.input_prefix);
@@ -779,6 +833,12 @@ void gpt_print_usage(int /*argc*/, char ** argv, const gpt_params & params) {
     printf("  -np N, --parallel N   number of parallel sequences to decode (default: %d)\n", params.n_parallel);
     printf("  -ns N, --sequences N  number of sequences to decode (default: %d)\n", params.n_sequences);
     printf("  -cb, --cont-batching  enable continuous batching (a.k.a dynamic batching) (default: disabled)\n");
+    printf("  --prefix-cache        keep the KV cache of the prompts and reuse it for the prompts that start with the same tokens (default: disabled)\n");
+    printf("  --no-flash-attn       compute KQ, soft_max and KQV as separate ops instead of the fused attention op\n");
+    printf("  --no-fused-ops        compute the norms, the SwiGLU and the residual adds with the separate element-wise ops\n");
+    printf("  --no-graph-reuse      build a new graph for every decode call instead of reusing the previous one\n");
+    printf("  --no-rope-cache       compute the RoPE rotations in every decode call instead of precomputing them\n");
+    printf("  --no-kv-paged         store the new K and V in contiguous cells of the KV cache, disables --prefix-cache\n");
     printf("  --mmproj MMPROJ_FILE  path to a multimodal projector file for LLaVA. see examples/llava/README.md\n");
     printf("  --image IMAGE_FILE    path to an image file. use with multimodal models\n");
     if (llama_mlock_supported()) {
@@ -787,9 +847,20 @@ void gpt_print_usage(int /*argc*/, char ** argv, const gpt_params & params) {
     if (llama_mmap_supported()) {
         printf("  --no-mmap             do not memory-map model (slower load but may reduce pageouts if not using mlock)\n");
     }
+    printf("  --fuse-weights        load the Q, K, V and the gate, up projections as one matrix each (CPU only)\n");
+    printf("  --repack-weights      interleave the rows of the q4_0, q8_0 and q4_K weights for the faster mul_mat kernels (CPU only)\n");
+    printf("  -dt N, --defrag-thold N\n");
+    printf("                        defragment the KV cache when more than this fraction of its used part is free (default: %.1f, < 0 - disabled)\n", params.defrag_thold);
+    printf("  --hugepages {none,thp,2M,1G}\n");
+    printf("                        back the weights, the KV cache and the compute buffers with huge pages (Linux only, default: none)\n");
+    printf("                        2M and 1G need pages reserved in /proc/sys/vm/nr_hugepages, the weights are read instead of mmap-ed\n");
     printf("  --numa                attempt optimizations that help on some NUMA systems\n");
     printf("                        if run without this previously, it is recommended to drop the system page cache before using this\n");
     printf("                        see https://github.com/ggerganov/llama.cpp/issues/1437\n");
+    printf("  --numa-placement {none,interleave,replicate}\n");
+    printf("                        place the weights on the NUMA nodes, implies --numa (default: none)\n");
+    printf("                        interleave: the rows of each matrix are split across the nodes and multiplied by the threads of their node\n");
+    printf("                        replicate: each node has a copy of the weights, read by the threads of the node\n");
 #ifdef LLAMA_SUPPORTS_GPU_OFFLOAD
     printf("  -ngl N, --n-gpu-layers N\n");
     printf("                        number of layers to store in VRAM\n");
@@ -815,6 +886,7 @@ void gpt_print_usage(int /*argc*/, char ** argv, const gpt_params & params) {
     printf("                        draft model for speculative decoding (default: %s)\n", params.model.c_str());
     printf("  -ld LOGDIR, --logdir LOGDIR\n");
     printf("                        path under which to save YAML logs (no logging if unset)\n");
+    printf("  --trace FNAME         save the time spent by each thread on each op of the graphs as Chrome trace events (JSON)\n");
     printf("\n");
 #ifndef LOG_DISABLE_LOGS
     log_print_usage();
@@ -865,6 +937,10 @@ struct llama_model_params llama_model_params_from_gpt_params(const gpt_params &
     mparams.tensor_split    = params.tensor_split;
     mparams.use_mmap        = params.use_mmap;
     mparams.use_mlock       = params.use_mlock;
+    mparams.fuse_weights    = params.fuse_weights;
+    mparams.repack_weights  = params.repack_weights;
+    mparams.hugepages       = params.hugepages;
+    mparams.numa_placement  = params.numa_placement;
 
     return mparams;
 }
@@ -882,6 +958,7 @@ struct llama_context_params llama_context_params_from_gpt_params(const gpt_param
     cparams.logits_all        = params.logits_all;
     cparams.embedding         = params.embedding;
     cparams.rope_scaling_type = params.rope_scaling_type;
+    cparams.hugepages         = params.hugepages;
     cparams.rope_freq_base    = params.rope_freq_base;
     cparams.rope_freq_scale   = params.rope_freq_scale;
     cparams.yarn_ext_factor   = params.yarn_ext_factor;
@@ -889,6 +966,13 @@ struct llama_context_params llama_context_params_from_gpt_params(const gpt_param
     cparams.yarn_beta_fast    = params.yarn_beta_fast;
     cparams.yarn_beta_slow    = params.yarn_beta_slow;
     cparams.yarn_orig_ctx     = params.yarn_orig_ctx;
+    cparams.defrag_thold      = params.defrag_thold;
+    cparams.prefix_cache      = params.prefix_cache;
+    cparams.flash_attn        = params.flash_attn;
+    cparams.fused_ops         = params.fused_ops;
+    cparams.reuse_graph       = params.reuse_graph;
+    cparams.rope_cache        = params.rope_cache;
+    cparams.kv_paged          = params.kv_paged;
 
     return cparams;
 }
@@ -915,6 +999,11 @@ void llama_batch_add(
 }
 
 std::tuple<struct llama_model *, struct llama_context *> llama_init_from_gpt_params(gpt_params & params) {
+    if (params.n_parallel < 1 || params.n_parallel > LLAMA_MAX_SEQ) {
+        fprintf(stderr, "%s: error: n_parallel = %d, the number of sequences is at most %d\n", __func__, params.n_parallel, LLAMA_MAX_SEQ);
+        return std::make_tuple(nullptr, nullptr);
+    }
+
     auto mparams = llama_model_params_from_gpt_params(params);
 
     llama_model * model  = llama_load_model_from_file(params.model.c_str(), mparams);
@@ -963,6 +1052,11 @@ std::tuple<struct llama_model *, struct llama_context *> llama_init_from_gpt_par
         llama_reset_timings(lctx);
     }
 
+    // trace the graphs computed after the warm-up run
+    if (!params.trace_file.empty()) {
+        llama_trace_start(lctx);
+    }
+
     return std::make_tuple(model, lctx);
 }
 
@@ -1206,6 +1300,7 @@ void dump_non_result_info_yaml(FILE * stream, const gpt_params & params, const l
     fprintf(stream, "cpu_has_avx512: %s\n",      ggml_cpu_has_avx512()      ? "true" : "false");
     fprintf(stream, "cpu_has_avx512_vbmi: %s\n", ggml_cpu_has_avx512_vbmi() ? "true" : "false");
     fprintf(stream, "cpu_has_avx512_vnni: %s\n", ggml_cpu_has_avx512_vnni() ? "true" : "false");
+    fprintf(stream, "cpu_has_avx512_bf16: %s\n", ggml_cpu_has_avx512_bf16() ? "true" : "false");
     fprintf(stream, "cpu_has_blas: %s\n",        ggml_cpu_has_blas()        ? "true" : "false");
     fprintf(stream, "cpu_has_cublas: %s\n",      ggml_cpu_has_cublas()      ? "true" : "false");
     fprintf(stream, "cpu_has_clblast: %s\n",     ggml_cpu_has_clblast()     ? "true" : "false");
@@ -1249,13 +1344,17 @@ void dump_non_result_info_yaml(FILE * stream, const gpt_params & params, const l
     fprintf(stream, "chunks: %d # default: -1 (unlimited)\n", params.n_chunks);
     fprintf(stream, "color: %s # default: false\n", params.use_color ? "true" : "false");
     fprintf(stream, "ctx_size: %d # default: 512\n", params.n_ctx);
+    fprintf(stream, "defrag_thold: %f # default: -1.0\n", params.defrag_thold);
     fprintf(stream, "escape: %s # default: false\n", params.escape ? "true" : "false");
     fprintf(stream, "file: # never logged, see prompt instead. Can still be specified for input.\n");
     fprintf(stream, "frequency_penalty: %f # default: 0.0 \n", sparams.penalty_freq);
+    fprintf(stream, "fuse_weights: %s # default: false\n", params.fuse_weights ? "true" : "false");
+    fprintf(stream, "repack_weights: %s # default: false\n", params.repack_weights ? "true" : "false");
     dump_string_yaml_multiline(stream, "grammar", sparams.grammar.c_str());
     fprintf(stream, "grammar-file: # never logged, see grammar instead. Can still be specified for input.\n");
     fprintf(stream, "hellaswag: %s # default: false\n", params.hellaswag ? "true" : "false");
     fprintf(stream, "hellaswag_tasks: %zu # default: 400\n", params.hellaswag_tasks);
+    fprintf(stream, "hugepages: %d # default: 0\n", params.hugepages);
 
     const auto logit_bias_eos = sparams.logit_bias.find(llama_token_eos(llama_get_model(lctx)));
     const bool ignore_eos = logit_bias_eos != sparams.logit_bias.end() && logit_bias_eos->second == -INFINITY;
@@ -1305,12 +1404,19 @@ void dump_non_result_info_yaml(FILE * stream, const gpt_params & params, const l
     fprintf(stream, "n_gpu_layers: %d # default: -1\n", params.n_gpu_layers);
     fprintf(stream, "n_predict: %d # default: -1 (unlimited)\n", params.n_predict);
     fprintf(stream, "n_probs: %d # only used by server binary, default: 0\n", sparams.n_probs);
+    fprintf(stream, "no_flash_attn: %s # default: false\n", !params.flash_attn ? "true" : "false");
+    fprintf(stream, "no_fused_ops: %s # default: false\n", !params.fused_ops ? "true" : "false");
+    fprintf(stream, "no_graph_reuse: %s # default: false\n", !params.reuse_graph ? "true" : "false");
+    fprintf(stream, "no_kv_paged: %s # default: false\n", !params.kv_paged ? "true" : "false");
     fprintf(stream, "no_mmap: %s # default: false\n", !params.use_mmap ? "true" : "false");
     fprintf(stream, "no_mul_mat_q: %s # default: false\n", !params.mul_mat_q ? "true" : "false");
     fprintf(stream, "no_penalize_nl: %s # default: false\n", !sparams.penalize_nl ? "true" : "false");
+    fprintf(stream, "no_rope_cache: %s # default: false\n", !params.rope_cache ? "true" : "false");
     fprintf(stream, "numa: %s # default: false\n", params.numa ? "true" : "false");
+    fprintf(stream, "numa_placement: %d # default: 0\n", params.numa_placement);
     fprintf(stream, "ppl_output_type: %d # default: 0\n", params.ppl_output_type);
     fprintf(stream, "ppl_stride: %d # default: 0\n", params.ppl_stride);
+    fprintf(stream, "prefix_cache: %s # default: false\n", params.prefix_cache ? "true" : "false");
     fprintf(stream, "presence_penalty: %f # default: 0.0\n", sparams.penalty_present);
     dump_string_yaml_multiline(stream, "prompt", params.prompt.c_str());
     fprintf(stream, "prompt_cache: %s\n", params.path_prompt_cache.c_str());
@@ -1345,6 +1451,7 @@ void dump_non_result_info_yaml(FILE * stream, const gpt_params & params, const l
     fprintf(stream, "threads: %d # default: %d\n", params.n_threads, std::thread::hardware_concurrency());
     fprintf(stream, "top_k: %d # default: 40\n", sparams.top_k);
     fprintf(stream, "top_p: %f # default: 0.95\n", sparams.top_p);
+    fprintf(stream, "trace: %s # default: unset (no tracing)\n", params.trace_file.c_str());
     fprintf(stream, "min_p: %f # default: 0.0\n", sparams.min_p);
     fprintf(stream, "typical_p: %f # default: 1.0\n", sparams.typical_p);
     fprintf(stream, "verbose_prompt: %s # default: false\n", params.verbose_prompt ? "true" : "false");
@@ -66,7 +66,10 @@ struct gpt_params {
     float   yarn_beta_fast                  = 32.0f;// YaRN low correction dim
     float   yarn_beta_slow                  = 1.0f; // YaRN high correction dim
     int32_t yarn_orig_ctx                   = 0;    // YaRN original context length
+    float   defrag_thold                    = -1.0f;// KV cache defragmentation threshold
     int8_t  rope_scaling_type               = LLAMA_ROPE_SCALING_UNSPECIFIED;
+    int8_t  hugepages                       = LLAMA_HUGEPAGES_NONE; // huge pages for the weights, the KV cache and the compute buffers
+    int8_t  numa_placement                  = GGML_NUMA_PLACEMENT_NONE; // placement of the weights on the NUMA nodes
 
     // // sampling parameters
     struct llama_sampling_params sparams;
@@ -81,6 +84,7 @@ struct gpt_params {
     std::string input_suffix      = "";  // string to suffix user inputs with
     std::vector<std::string> antiprompt; // string upon seeing which more user input is prompted
     std::string logdir            = "";  // directory in which to save YAML log files
+    std::string trace_file        = "";  // file in which to save a Chrome trace of the computed graphs
 
     // TODO: avoid tuple, use struct
     std::vector<std::tuple<std::string, float>> lora_adapter; // lora adapter path with user defined scale
@@ -107,6 +111,12 @@ struct gpt_params {
     bool multiline_input   = false; // reverse the usage of `\`
     bool simple_io         = false; // improves compatibility with subprocesses and limited consoles
     bool cont_batching     = false; // insert new sequences for decoding on-the-fly
+    bool prefix_cache      = false; // keep the KV cells of the decoded prompts to reuse their common prefixes
+    bool flash_attn        = true;  // compute the attention with one fused op instead of KQ, soft_max and KQV (CPU only)
+    bool fused_ops         = true;  // replace the element-wise ops by fused ops (CPU only)
+    bool reuse_graph       = true;  // reuse the graph of the previous decode call when possible (CPU only)
+    bool rope_cache        = true;  // precompute the RoPE rotations of the context positions (CPU only)
+    bool kv_paged          = true;  // store the new K and V in any free cells of the KV cache (CPU only)
 
     bool input_prefix_bos  = false; // prefix BOS to user inputs, preceding input_prefix
     bool ignore_eos        = false; // ignore generated EOS tokens
@@ -114,6 +124,8 @@ struct gpt_params {
     bool logits_all        = false; // return logits for all tokens in the batch
     bool use_mmap          = true;  // use mmap for faster loads
     bool use_mlock         = false; // use mlock to keep model in memory
+    bool fuse_weights      = false; // load the Q, K, V and the gate, up projections as one matrix each
+    bool repack_weights    = false; // interleave the rows of the quantized weights for the faster mul_mat kernels
     bool numa              = false; // attempt optimizations that help on some NUMA systems
     bool verbose_prompt    = false; // print prompt tokens before generation
     bool infill            = false; // use infill mode
@@ -11,6 +11,9 @@
 
 typedef std::string mt19937_state;
 
+// capacity of the forward and backward graphs of the training examples
+#define LLAMA_TRAIN_MAX_NODES 16384
+
 struct train_state {
     struct ggml_opt_context * opt;
 
@@ -59,12 +59,14 @@ class DataType:
 
 @dataclass(frozen=True)
 class UnquantizedDataType(DataType):
-    pass
+    # for the types numpy does not have, stored as raw integers of the same size
+    ggml_type: gguf.GGMLQuantizationType | None = None
 
-DT_F16  = UnquantizedDataType('F16', dtype = np.dtype(np.float16), valid_conversions = ['F32', 'Q8_0'])
-DT_F32  = UnquantizedDataType('F32', dtype = np.dtype(np.float32), valid_conversions = ['F16', 'Q8_0'])
+DT_F16  = UnquantizedDataType('F16', dtype = np.dtype(np.float16), valid_conversions = ['F32', 'BF16', 'Q8_0'])
+DT_F32  = UnquantizedDataType('F32', dtype = np.dtype(np.float32), valid_conversions = ['F16', 'BF16', 'Q8_0'])
 DT_I32  = UnquantizedDataType('I32', dtype = np.dtype(np.int16), valid_conversions = [])
-DT_BF16 = UnquantizedDataType('BF16', dtype = np.dtype(np.uint16), valid_conversions = ['F32', 'F16', 'Q8_0'])
+DT_BF16 = UnquantizedDataType('BF16', dtype = np.dtype(np.uint16), valid_conversions = ['F32', 'F16', 'Q8_0'],
+                              ggml_type = gguf.GGMLQuantizationType.BF16)
 
 @dataclass(frozen=True)
 class QuantizedDataType(DataType):
@@ -122,6 +124,7 @@ class GGMLFileType(enum.IntEnum):
     AllF32     = 0
     MostlyF16  = 1  # except 1d tensors
     MostlyQ8_0 = 7  # except 1d tensors
+    MostlyBF16 = 32 # except 1d tensors
 
     def type_for_tensor(self, name: str, tensor: LazyTensor) -> DataType:
         dt = GGML_FILE_TYPE_TO_DATA_TYPE.get(self)
@@ -134,6 +137,7 @@ GGML_FILE_TYPE_TO_DATA_TYPE: dict[GGMLFileType, DataType] = {
     GGMLFileType.AllF32    : DT_F32,
     GGMLFileType.MostlyF16 : DT_F16,
     GGMLFileType.MostlyQ8_0: DT_Q8_0,
+    GGMLFileType.MostlyBF16: DT_BF16,
 }
 
 #
@@ -445,6 +449,15 @@ def bf16_to_fp32(bf16_arr: np.ndarray[Any, np.dtype[np.uint16]]) -> NDArray:
     return fp32_arr.view(np.float32)
 
 
+def fp32_to_bf16(fp32_arr: NDArray) -> np.ndarray[Any, np.dtype[np.uint16]]:
+    assert fp32_arr.dtype == np.float32, f"Input array should be of dtype float32, but got {fp32_arr.dtype}"
+    n = fp32_arr.view(np.uint32)
+    # round to nearest even like ggml_fp32_to_bf16, the NaNs stay quiet NaNs
+    rounded = (n + np.uint32(0x7fff) + ((n >> np.uint32(16)) & np.uint32(1))) >> np.uint32(16)
+    quiet   = (n >> np.uint32(16)) | np.uint32(64)
+    return np.where((n & np.uint32(0x7fffffff)) > np.uint32(0x7f800000), quiet, rounded).astype(np.uint16)
+
+
 class UnquantizedTensor(Tensor):
     def __init__(self, ndarray: NDArray) -> None:
         assert isinstance(ndarray, np.ndarray)
@@ -455,6 +468,8 @@ class UnquantizedTensor(Tensor):
         dtype = data_type.dtype
         if self.data_type == DT_BF16:
             self.ndarray = bf16_to_fp32(self.ndarray)
+        if data_type == DT_BF16:
+            return UnquantizedTensor(fp32_to_bf16(self.ndarray.astype(np.float32)))
         return UnquantizedTensor(self.ndarray.astype(dtype))
 
     def to_ggml(self) -> UnquantizedTensor:
@@ -948,6 +963,8 @@ def pick_output_type(model: LazyModel, output_type_str: str | None) -> GGMLFileT
         return GGMLFileType.MostlyF16
     if output_type_str == "q8_0":
         return GGMLFileType.MostlyQ8_0
+    if output_type_str == "bf16":
+        return GGMLFileType.MostlyBF16
 
     name_to_type = {name: lazy_tensor.data_type for (name, lazy_tensor) in model.items()}
 
@@ -1095,6 +1112,7 @@ def default_outfile(model_paths: list[Path], file_type: GGMLFileType) -> Path:
         GGMLFileType.AllF32:    "f32",
         GGMLFileType.MostlyF16: "f16",
         GGMLFileType.MostlyQ8_0:"q8_0",
+        GGMLFileType.MostlyBF16:"bf16",
     }[file_type]
     ret = model_paths[0].parent / f"ggml-model-{namestr}.gguf"
     if ret in model_paths:
@@ -1118,7 +1136,7 @@ def main(args_in: list[str] | None = None) -> None:
     parser.add_argument("--dump",        action="store_true",    help="don't convert, just show what's in the model")
     parser.add_argument("--dump-single", action="store_true",    help="don't convert, just show what's in a single model file")
     parser.add_argument("--vocab-only",  action="store_true",    help="extract only the vocab")
-    parser.add_argument("--outtype",     choices=["f32", "f16", "q8_0"], help="output format - note: q8_0 may be very slow (default: f16 or f32 based on input)")
+    parser.add_argument("--outtype",     choices=["f32", "f16", "bf16", "q8_0"], help="output format - note: q8_0 may be very slow (default: f16 or f32 based on input)")
     parser.add_argument("--vocab-dir",   type=Path,              help="directory containing tokenizer.model, if separate from model file")
     parser.add_argument("--outfile",     type=Path,              help="path to write to; default: based on input")
     parser.add_argument("model",         type=Path,              help="directory containing model file, or model file itself (*.pth, *.pt, *.bin)")
@@ -1159,6 +1177,7 @@ def main(args_in: list[str] | None = None) -> None:
             "f32": GGMLFileType.AllF32,
             "f16": GGMLFileType.MostlyF16,
             "q8_0": GGMLFileType.MostlyQ8_0,
+            "bf16": GGMLFileType.MostlyBF16,
         }[args.outtype]
 
     print(f"params = {params}")
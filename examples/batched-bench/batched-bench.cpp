@@ -80,6 +80,13 @@ int main(int argc, char ** argv) {
         n_pl = parse_list(argv[8]);
     }
 
+    for (const int pl : n_pl) {
+        if (pl < 1 || pl > LLAMA_MAX_SEQ) {
+            fprintf(stderr, "%s: error: PL = %d, the number of sequences is at most %d\n", __func__, pl, LLAMA_MAX_SEQ);
+            return 1;
+        }
+    }
+
     // init LLM
 
     llama_backend_init(params.numa);
@@ -48,6 +48,11 @@ int main(int argc, char ** argv) {
         params.prompt = "Hello my name is";
     }
 
+    if (n_parallel < 1 || n_parallel > LLAMA_MAX_SEQ) {
+        fprintf(stderr, "%s: error: n_parallel = %d, the number of sequences is at most %d\n", __func__, n_parallel, LLAMA_MAX_SEQ);
+        return 1;
+    }
+
     // init LLM
 
     llama_backend_init(params.numa);
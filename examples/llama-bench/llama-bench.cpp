@@ -131,10 +131,14 @@ struct cmd_params {
     std::vector<int> n_gpu_layers;
     std::vector<int> main_gpu;
     std::vector<bool> mul_mat_q;
+    std::vector<bool> fuse_weights;
+    std::vector<bool> repack_weights;
+    std::vector<std::string> numa_placement;
     std::vector<std::array<float, LLAMA_MAX_DEVICES>> tensor_split;
     int reps;
     bool verbose;
     output_formats output_format;
+    std::string trace;
 };
 
 static const cmd_params cmd_params_defaults = {
@@ -147,12 +151,28 @@ static const cmd_params cmd_params_defaults = {
     /* n_gpu_layers  */ {99},
     /* main_gpu      */ {0},
     /* mul_mat_q     */ {true},
+    /* fuse_weights  */ {false},
+    /* repack_weights*/ {false},
+    /* numa_placement*/ {"none"},
     /* tensor_split  */ {{}},
     /* reps          */ 5,
     /* verbose       */ false,
-    /* output_format */ MARKDOWN
+    /* output_format */ MARKDOWN,
+    /* trace         */ ""
 };
 
+// with several tests, the index of the test is inserted before the extension: trace.json -> trace.1.json
+static std::string trace_file_name(const std::string & fname, size_t i_test, size_t n_tests) {
+    if (n_tests <= 1) {
+        return fname;
+    }
+    size_t pos = fname.find_last_of('.');
+    if (pos == std::string::npos || fname.find_first_of("/\\", pos) != std::string::npos) {
+        pos = fname.size();
+    }
+    return fname.substr(0, pos) + "." + std::to_string(i_test) + fname.substr(pos);
+}
+
 static void print_usage(int /* argc */, char ** argv) {
     printf("usage: %s [options]\n", argv[0]);
     printf("\n");
@@ -167,10 +187,14 @@ static void print_usage(int /* argc */, char ** argv) {
     printf("  -ngl, --n-gpu-layers <n>          (default: %s)\n", join(cmd_params_defaults.n_gpu_layers, ",").c_str());
     printf("  -mg, --main-gpu <i>               (default: %s)\n", join(cmd_params_defaults.main_gpu, ",").c_str());
     printf("  -mmq, --mul-mat-q <0|1>           (default: %s)\n", join(cmd_params_defaults.mul_mat_q, ",").c_str());
+    printf("  -fw, --fuse-weights <0|1>         (default: %s)\n", join(cmd_params_defaults.fuse_weights, ",").c_str());
+    printf("  -rw, --repack-weights <0|1>       (default: %s)\n", join(cmd_params_defaults.repack_weights, ",").c_str());
+    printf("  -nump, --numa-placement <none|interleave|replicate> (default: %s)\n", join(cmd_params_defaults.numa_placement, ",").c_str());
     printf("  -ts, --tensor_split <ts0/ts1/..>               \n");
     printf("  -r, --repetitions <n>             (default: %d)\n", cmd_params_defaults.reps);
     printf("  -o, --output <csv|json|md|sql>    (default: %s)\n", cmd_params_defaults.output_format == CSV ? "csv" : cmd_params_defaults.output_format == JSON ? "json" : cmd_params_defaults.output_format == MARKDOWN ? "md" : "sql");
     printf("  -v, --verbose                     (default: %s)\n", cmd_params_defaults.verbose ? "1" : "0");
+    printf("  --trace <filename>                write a Chrome trace of the timed runs, one file per test\n");
     printf("\n");
     printf("Multiple values can be given for each parameter by separating them with ',' or by specifying the parameter multiple times.\n");
 
@@ -186,6 +210,7 @@ static cmd_params parse_cmd_params(int argc, char ** argv) {
     params.verbose = cmd_params_defaults.verbose;
     params.output_format = cmd_params_defaults.output_format;
     params.reps = cmd_params_defaults.reps;
+    params.trace = cmd_params_defaults.trace;
 
     for (int i = 1; i < argc; i++) {
         arg = argv[i];
@@ -258,6 +283,32 @@ static cmd_params parse_cmd_params(int argc, char ** argv) {
             }
             auto p = split<bool>(argv[i], split_delim);
             params.mul_mat_q.insert(params.mul_mat_q.end(), p.begin(), p.end());
+        } else if (arg == "-fw" || arg == "--fuse-weights") {
+            if (++i >= argc) {
+                invalid_param = true;
+                break;
+            }
+            auto p = split<bool>(argv[i], split_delim);
+            params.fuse_weights.insert(params.fuse_weights.end(), p.begin(), p.end());
+        } else if (arg == "-rw" || arg == "--repack-weights") {
+            if (++i >= argc) {
+                invalid_param = true;
+                break;
+            }
+            auto p = split<bool>(argv[i], split_delim);
+            params.repack_weights.insert(params.repack_weights.end(), p.begin(), p.end());
+        } else if (arg == "-nump" || arg == "--numa-placement") {
+            if (++i >= argc) {
+                invalid_param = true;
+                break;
+            }
+            auto p = split<std::string>(argv[i], split_delim);
+            for (const auto & v : p) {
+                if (v != "none" && v != "interleave" && v != "replicate") {
+                    invalid_param = true;
+                }
+            }
+            params.numa_placement.insert(params.numa_placement.end(), p.begin(), p.end());
         } else if (arg == "-ts" || arg == "--tensor-split") {
             if (++i >= argc) {
                 invalid_param = true;
@@ -305,6 +356,12 @@ static cmd_params parse_cmd_params(int argc, char ** argv) {
             }
         } else if (arg == "-v" || arg == "--verbose") {
             params.verbose = true;
+        } else if (arg == "--trace") {
+            if (++i >= argc) {
+                invalid_param = true;
+                break;
+            }
+            params.trace = argv[i];
         } else {
             invalid_param = true;
             break;
@@ -325,6 +382,9 @@ static cmd_params parse_cmd_params(int argc, char ** argv) {
     if (params.n_gpu_layers.empty()) { params.n_gpu_layers = cmd_params_defaults.n_gpu_layers; }
     if (params.main_gpu.empty())     { params.main_gpu = cmd_params_defaults.main_gpu; }
     if (params.mul_mat_q.empty())    { params.mul_mat_q = cmd_params_defaults.mul_mat_q; }
+    if (params.fuse_weights.empty()) { params.fuse_weights = cmd_params_defaults.fuse_weights; }
+    if (params.repack_weights.empty()) { params.repack_weights = cmd_params_defaults.repack_weights; }
+    if (params.numa_placement.empty()) { params.numa_placement = cmd_params_defaults.numa_placement; }
     if (params.tensor_split.empty()) { params.tensor_split = cmd_params_defaults.tensor_split; }
     if (params.n_threads.empty())    { params.n_threads = cmd_params_defaults.n_threads; }
 
@@ -341,6 +401,9 @@ struct cmd_params_instance {
     int n_gpu_layers;
     int main_gpu;
     bool mul_mat_q;
+    bool fuse_weights;
+    bool repack_weights;
+    std::string numa_placement;
     std::array<float, LLAMA_MAX_DEVICES> tensor_split;
 
     llama_model_params to_llama_mparams() const {
@@ -349,6 +412,10 @@ struct cmd_params_instance {
         mparams.n_gpu_layers = n_gpu_layers;
         mparams.main_gpu = main_gpu;
         mparams.tensor_split = tensor_split.data();
+        mparams.fuse_weights = fuse_weights;
+        mparams.repack_weights = repack_weights;
+        mparams.numa_placement = numa_placement == "interleave" ? GGML_NUMA_PLACEMENT_INTERLEAVE :
+                                 numa_placement == "replicate"  ? GGML_NUMA_PLACEMENT_REPLICATE  : GGML_NUMA_PLACEMENT_NONE;
 
         return mparams;
     }
@@ -357,6 +424,9 @@ struct cmd_params_instance {
         return model == other.model &&
                n_gpu_layers == other.n_gpu_layers &&
                main_gpu == other.main_gpu &&
+               fuse_weights == other.fuse_weights &&
+               repack_weights == other.repack_weights &&
+               numa_placement == other.numa_placement &&
                tensor_split == other.tensor_split;
     }
 
@@ -379,6 +449,9 @@ static std::vector<cmd_params_instance> get_cmd_params_instances_int(const cmd_p
     for (const auto & nl : params.n_gpu_layers)
     for (const auto & mg : params.main_gpu)
     for (const auto & ts : params.tensor_split)
+    for (const auto & fw : params.fuse_weights)
+    for (const auto & rw : params.repack_weights)
+    for (const auto & np : params.numa_placement)
     for (const auto & nb : params.n_batch)
     for (const auto & fk : params.f32_kv)
     for (const auto & mmq : params.mul_mat_q)
@@ -393,6 +466,9 @@ static std::vector<cmd_params_instance> get_cmd_params_instances_int(const cmd_p
             /* .n_gpu_layers = */ nl,
             /* .main_gpu     = */ mg,
             /* .mul_mat_q    = */ mmq,
+            /* .fuse_weights = */ fw,
+            /* .repack_weights = */ rw,
+            /* .numa_placement = */ np,
             /* .tensor_split = */ ts,
         };
         instances.push_back(instance);
@@ -409,6 +485,9 @@ static std::vector<cmd_params_instance> get_cmd_params_instances(const cmd_param
     for (const auto & nl : params.n_gpu_layers)
     for (const auto & mg : params.main_gpu)
     for (const auto & ts : params.tensor_split)
+    for (const auto & fw : params.fuse_weights)
+    for (const auto & rw : params.repack_weights)
+    for (const auto & np : params.numa_placement)
     for (const auto & nb : params.n_batch)
     for (const auto & fk : params.f32_kv)
     for (const auto & mmq : params.mul_mat_q)
@@ -427,6 +506,9 @@ static std::vector<cmd_params_instance> get_cmd_params_instances(const cmd_param
                 /* .n_gpu_layers = */ nl,
                 /* .main_gpu     = */ mg,
                 /* .mul_mat_q    = */ mmq,
+                /* .fuse_weights = */ fw,
+                /* .repack_weights = */ rw,
+                /* .numa_placement = */ np,
                 /* .tensor_split = */ ts,
             };
             instances.push_back(instance);
@@ -446,6 +528,9 @@ static std::vector<cmd_params_instance> get_cmd_params_instances(const cmd_param
                 /* .n_gpu_layers = */ nl,
                 /* .main_gpu     = */ mg,
                 /* .mul_mat_q    = */ mmq,
+                /* .fuse_weights = */ fw,
+                /* .repack_weights = */ rw,
+                /* .numa_placement = */ np,
                 /* .tensor_split = */ ts,
             };
             instances.push_back(instance);
@@ -493,6 +578,9 @@ struct test {
     int n_gpu_layers;
     int main_gpu;
     bool mul_mat_q;
+    bool fuse_weights;
+    bool repack_weights;
+    std::string numa_placement;
     std::array<float, LLAMA_MAX_DEVICES> tensor_split;
     int n_prompt;
     int n_gen;
@@ -512,6 +600,9 @@ struct test {
         n_gpu_layers = inst.n_gpu_layers;
         main_gpu = inst.main_gpu;
         mul_mat_q = inst.mul_mat_q;
+        fuse_weights = inst.fuse_weights;
+        repack_weights = inst.repack_weights;
+        numa_placement = inst.numa_placement;
         tensor_split = inst.tensor_split;
         n_prompt = inst.n_prompt;
         n_gen = inst.n_gen;
@@ -572,7 +663,7 @@ struct test {
             "cpu_info", "gpu_info",
             "model_filename", "model_type", "model_size", "model_n_params",
             "n_batch", "n_threads", "f16_kv",
-            "n_gpu_layers", "main_gpu", "mul_mat_q", "tensor_split",
+            "n_gpu_layers", "main_gpu", "mul_mat_q", "fuse_weights", "repack_weights", "numa_placement", "tensor_split",
             "n_prompt", "n_gen", "test_time",
             "avg_ns", "stddev_ns",
             "avg_ts", "stddev_ts"
@@ -591,7 +682,8 @@ struct test {
             return INT;
         }
         if (field == "cuda" || field == "opencl" || field == "metal" || field == "gpu_blas" || field == "blas" ||
-            field == "f16_kv" || field == "mul_mat_q") {
+            field == "f16_kv" || field == "mul_mat_q" || field == "fuse_weights" ||
+            field == "repack_weights") {
             return BOOL;
         }
         if (field == "avg_ts" || field == "stddev_ts") {
@@ -622,7 +714,7 @@ struct test {
             cpu_info, gpu_info,
             model_filename, model_type, std::to_string(model_size), std::to_string(model_n_params),
             std::to_string(n_batch), std::to_string(n_threads), std::to_string(!f32_kv),
-            std::to_string(n_gpu_layers), std::to_string(main_gpu), std::to_string(mul_mat_q), tensor_split_str,
+            std::to_string(n_gpu_layers), std::to_string(main_gpu), std::to_string(mul_mat_q), std::to_string(fuse_weights), std::to_string(repack_weights), numa_placement, tensor_split_str,
             std::to_string(n_prompt), std::to_string(n_gen), test_time,
             std::to_string(avg_ns()), std::to_string(stdev_ns()),
             std::to_string(avg_ts()), std::to_string(stdev_ts())
@@ -783,6 +875,15 @@ struct markdown_printer : public printer {
         if (field == "mul_mat_q") {
             return "mmq";
         }
+        if (field == "fuse_weights") {
+            return "fw";
+        }
+        if (field == "repack_weights") {
+            return "rw";
+        }
+        if (field == "numa_placement") {
+            return "numa";
+        }
         if (field == "tensor_split") {
             return "ts";
         }
@@ -814,6 +915,15 @@ struct markdown_printer : public printer {
         if (params.mul_mat_q.size() > 1 || params.mul_mat_q != cmd_params_defaults.mul_mat_q) {
             fields.push_back("mul_mat_q");
         }
+        if (params.fuse_weights.size() > 1 || params.fuse_weights != cmd_params_defaults.fuse_weights) {
+            fields.push_back("fuse_weights");
+        }
+        if (params.repack_weights.size() > 1 || params.repack_weights != cmd_params_defaults.repack_weights) {
+            fields.push_back("repack_weights");
+        }
+        if (params.numa_placement.size() > 1 || params.numa_placement != cmd_params_defaults.numa_placement) {
+            fields.push_back("numa_placement");
+        }
         if (params.tensor_split.size() > 1 || params.tensor_split != cmd_params_defaults.tensor_split) {
             fields.push_back("tensor_split");
         }
@@ -982,7 +1092,8 @@ int main(int argc, char ** argv) {
     if (!params.verbose) {
         llama_log_set(llama_null_log_callback, NULL);
     }
-    bool numa = false;
+    // with a NUMA placement the threads are bound to the nodes in all the tests, so that the placements are compared with the same threads
+    bool numa = std::any_of(params.numa_placement.begin(), params.numa_placement.end(), [](const std::string & np) { return np != "none"; });
     llama_backend_init(numa);
 
     // initialize printer
@@ -1012,7 +1123,9 @@ int main(int argc, char ** argv) {
     llama_model * lmodel = nullptr;
     const cmd_params_instance * prev_inst = nullptr;
 
-    for (const auto & inst : params_instances) {
+    for (size_t i_inst = 0; i_inst < params_instances.size(); i_inst++) {
+        const auto & inst = params_instances[i_inst];
+
         // keep the same model between tests when possible
         if (!lmodel || !prev_inst || !inst.equal_mparams(*prev_inst)) {
             if (lmodel) {
@@ -1046,6 +1159,10 @@ int main(int argc, char ** argv) {
             test_gen(ctx, 1, 0, t.n_threads);
         }
 
+        if (!params.trace.empty()) {
+            llama_trace_start(ctx);
+        }
+
         for (int i = 0; i < params.reps; i++) {
             llama_kv_cache_clear(ctx);
 
@@ -1060,6 +1177,10 @@ int main(int argc, char ** argv) {
             t.samples_ns.push_back(t_ns);
         }
 
+        if (!params.trace.empty()) {
+            llama_trace_stop(ctx, trace_file_name(params.trace, i_inst, params_instances.size()).c_str());
+        }
+
         p->print_test(t);
 
         llama_print_timings(ctx);
@@ -94,6 +94,9 @@ static void sigint_handler(int signo) {
             printf("\n");
             llama_print_timings(*g_ctx);
             write_logfile(*g_ctx, *g_params, *g_model, *g_input_tokens, g_output_ss->str(), *g_output_tokens);
+            if (!g_params->trace_file.empty()) {
+                llama_trace_stop(*g_ctx, g_params->trace_file.c_str());
+            }
             _exit(130);
         }
     }
@@ -824,6 +827,10 @@ int main(int argc, char ** argv) {
     llama_print_timings(ctx);
     write_logfile(ctx, params, model, input_tokens, output_ss.str(), output_tokens);
 
+    if (!params.trace_file.empty()) {
+        llama_trace_stop(ctx, params.trace_file.c_str());
+    }
+
     if (ctx_guidance) { llama_free(ctx_guidance); }
     llama_free(ctx);
     llama_free_model(model);
@@ -501,6 +501,7 @@ struct llama_server_context
     bool multimodal         = false;
     bool clean_kv_cache     = true;
     bool all_slots_are_idle = false;
+    bool trace_pending      = false; // graphs have been traced since the trace file was last written
 
     int32_t id_gen;
     int32_t n_ctx;  // total context for all clients / slots
@@ -1429,6 +1430,13 @@ struct llama_server_context
 
         if (all_slots_are_idle)
         {
+            // save the trace of the requests processed since the server was last idle
+            if (trace_pending)
+            {
+                llama_trace_stop(ctx, params.trace_file.c_str());
+                llama_trace_start(ctx);
+                trace_pending = false;
+            }
             if (system_prompt.empty() && clean_kv_cache)
             {
                 LOG_TEE("all slots are idle and system prompt is empty, clear the KV cache\n");
@@ -1609,6 +1617,22 @@ struct llama_server_context
 
                     llama_kv_cache_seq_rm(ctx, slot.id, system_tokens.size() + slot.n_past, -1);
 
+                    // take the KV cache of the previous prompts that start with the same tokens, leaving the last token to evaluate
+                    if (params.prefix_cache && slot.images.empty())
+                    {
+                        std::vector<llama_token> seq_tokens = system_tokens;
+                        seq_tokens.insert(seq_tokens.end(), prompt_tokens.begin(), prompt_tokens.end());
+
+                        const int n_seq = llama_kv_cache_seq_attach(ctx, slot.id, seq_tokens.data(), seq_tokens.size() - 1);
+                        if (n_seq > (int) system_tokens.size() + slot.n_past)
+                        {
+                            LOG_TEE("slot %d : prefix cache: %i more tokens\n", slot.id, n_seq - (int) system_tokens.size() - slot.n_past);
+
+                            slot.n_past = n_seq - system_tokens.size();
+                            slot.num_prompt_tokens_processed = slot.num_prompt_tokens - slot.n_past;
+                        }
+                    }
+
                     slot.cache_tokens = prompt_tokens;
 
                     if (slot.n_past == slot.num_prompt_tokens)
@@ -1673,6 +1697,7 @@ struct llama_server_context
             };
 
             const int ret = llama_decode(ctx, batch_view);
+            trace_pending = !params.trace_file.empty();
             if (ret != 0)
             {
                 if (n_batch == 1 || ret < 0)
@@ -1798,8 +1823,17 @@ static void server_print_usage(const char *argv0, const gpt_params &params,
     printf("  --path PUBLIC_PATH    path from which to serve static files (default %s)\n", sparams.public_path.c_str());
     printf("  -to N, --timeout N    server read/write timeout in seconds (default: %d)\n", sparams.read_timeout);
     printf("  --embedding           enable embedding vector output (default: %s)\n", params.embedding ? "enabled" : "disabled");
+    printf("  --trace FNAME         when the server becomes idle, save the time spent on each op of the last requests as Chrome trace events (JSON)\n");
     printf("  -np N, --parallel N   number of slots for process requests (default: %d)\n", params.n_parallel);
+    printf("  -dt N, --defrag-thold N\n");
+    printf("                        defragment the KV cache when more than this fraction of its used part is free (default: %.1f, < 0 - disabled)\n", params.defrag_thold);
     printf("  -cb, --cont-batching  enable continuous batching (a.k.a dynamic batching) (default: disabled)\n");
+    printf("  --prefix-cache        keep the KV cache of the prompts and reuse it for the prompts that start with the same tokens (default: disabled)\n");
+    printf("  --no-flash-attn       compute KQ, soft_max and KQV as separate ops instead of the fused attention op\n");
+    printf("  --no-fused-ops        compute the norms, the SwiGLU and the residual adds with the separate element-wise ops\n");
+    printf("  --no-graph-reuse      build a new graph for every decode call instead of reusing the previous one\n");
+    printf("  --no-rope-cache       compute the RoPE rotations in every decode call instead of precomputing them\n");
+    printf("  --no-kv-paged         store the new K and V in contiguous cells of the KV cache, disables --prefix-cache\n");
     printf("    -spf FNAME, --system-prompt-file FNAME\n");
     printf("                        Set a file to load a system prompt (initial prompt of all slots), this is useful for chat applications.\n");
     printf("  --mmproj MMPROJ_FILE  path to a multimodal projector file for LLaVA.\n");
@@ -2107,10 +2141,43 @@ static void server_params_parse(int argc, char **argv, server_params &sparams,
         {
             params.embedding = true;
         }
+        else if (arg == "--trace")
+        {
+            if (++i >= argc)
+            {
+                invalid_param = true;
+                break;
+            }
+            params.trace_file = argv[i];
+        }
         else if (arg == "-cb" || arg == "--cont-batching")
         {
             params.cont_batching = true;
         }
+        else if (arg == "--prefix-cache")
+        {
+            params.prefix_cache = true;
+        }
+        else if (arg == "--no-flash-attn")
+        {
+            params.flash_attn = false;
+        }
+        else if (arg == "--no-fused-ops")
+        {
+            params.fused_ops = false;
+        }
+        else if (arg == "--no-graph-reuse")
+        {
+            params.reuse_graph = false;
+        }
+        else if (arg == "--no-rope-cache")
+        {
+            params.rope_cache = false;
+        }
+        else if (arg == "--no-kv-paged")
+        {
+            params.kv_paged = false;
+        }
         else if (arg == "-np" || arg == "--parallel")
         {
             if (++i >= argc)
@@ -2119,6 +2186,21 @@ static void server_params_parse(int argc, char **argv, server_params &sparams,
                 break;
             }
             params.n_parallel = std::stoi(argv[i]);
+            if (params.n_parallel < 1 || params.n_parallel > LLAMA_MAX_SEQ)
+            {
+                fprintf(stderr, "error: --parallel must be between 1 and %d\n", LLAMA_MAX_SEQ);
+                invalid_param = true;
+                break;
+            }
+        }
+        else if (arg == "-dt" || arg == "--defrag-thold")
+        {
+            if (++i >= argc)
+            {
+                invalid_param = true;
+                break;
+            }
+            params.defrag_thold = std::stof(argv[i]);
         } else if (arg == "-n" || arg == "--n-predict")
         {
             if (++i >= argc)
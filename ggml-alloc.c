@@ -1,6 +1,7 @@
 #include "ggml-alloc.h"
 #include "ggml-backend.h"
 #include "ggml.h"
+#include "ggml-impl.h"
 #include <assert.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -10,7 +11,6 @@
 
 #define UNUSED(x) (void)(x)
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
-#define GGML_MAX_CONCUR (2*GGML_MAX_NODES)
 
 //#define GGML_ALLOCATOR_DEBUG
 
@@ -23,12 +23,12 @@ struct hash_node {
     int n_views;
 };
 
-static size_t hash(void * p) {
-    return (size_t)p % GGML_GRAPH_HASHTABLE_SIZE;
+static size_t hash(void * p, size_t hash_size) {
+    return (size_t)p % hash_size;
 }
 
-static struct hash_node * hash_get(struct hash_node hash_table[], struct ggml_tensor * t) {
-    size_t h = hash(t);
+static struct hash_node * hash_get(struct hash_node hash_table[], size_t hash_size, struct ggml_tensor * t) {
+    size_t h = hash(t, hash_size);
 
     // linear probing
     size_t i = h;
@@ -36,7 +36,7 @@ static struct hash_node * hash_get(struct hash_node hash_table[], struct ggml_te
         if (hash_table[i].t == t) {
             return &hash_table[i];
         }
-        i = (i + 1) % GGML_GRAPH_HASHTABLE_SIZE;
+        i = (i + 1) % hash_size;
         if (i == h) {
             // hash table is full
             GGML_ASSERT(false);
@@ -68,10 +68,12 @@ struct ggml_allocr {
     size_t alignment;
     int n_free_blocks;
     struct free_block free_blocks[MAX_FREE_BLOCKS];
-    struct hash_node hash_table[GGML_GRAPH_HASHTABLE_SIZE];
+    struct hash_node * hash_table; // sized for the graphs being allocated, see ggml_allocr_alloc_graph_n()
+    size_t hash_size;
+    size_t hash_capacity;
     size_t max_size;
     bool measure;
-    int parse_seq[GGML_MAX_CONCUR];
+    int * parse_seq;
     int parse_seq_len;
 
 #ifdef GGML_ALLOCATOR_DEBUG
@@ -254,6 +256,10 @@ static void ggml_allocr_free_tensor(struct ggml_allocr * alloc, struct ggml_tens
 }
 
 void ggml_allocr_set_parse_seq(struct ggml_allocr * alloc, const int * list, int n) {
+    free(alloc->parse_seq);
+    alloc->parse_seq = malloc(sizeof(int) * n);
+    GGML_ASSERT(n == 0 || alloc->parse_seq != NULL);
+
     for (int i = 0; i < n; i++) {
         alloc->parse_seq[i] = list[i];
     }
@@ -279,10 +285,12 @@ struct ggml_allocr * ggml_allocr_new(void * data, size_t size, size_t alignment)
         /*.alignment     = */ alignment,
         /*.n_free_blocks = */ 0,
         /*.free_blocks   = */ {{0}},
-        /*.hash_table    = */ {{0}},
+        /*.hash_table    = */ NULL,
+        /*.hash_size     = */ 0,
+        /*.hash_capacity = */ 0,
         /*.max_size      = */ 0,
         /*.measure       = */ false,
-        /*.parse_seq     = */ {0},
+        /*.parse_seq     = */ NULL,
         /*.parse_seq_len = */ 0,
 #ifdef GGML_ALLOCATOR_DEBUG
         /*.allocated_tensors = */ {0},
@@ -311,10 +319,12 @@ struct ggml_allocr * ggml_allocr_new_from_buffer(struct ggml_backend_buffer * bu
         /*.alignment     = */ ggml_backend_buffer_get_alignment(buffer),
         /*.n_free_blocks = */ 0,
         /*.free_blocks   = */ {{0}},
-        /*.hash_table    = */ {{0}},
+        /*.hash_table    = */ NULL,
+        /*.hash_size     = */ 0,
+        /*.hash_capacity = */ 0,
         /*.max_size      = */ 0,
         /*.measure       = */ false,
-        /*.parse_seq     = */ {0},
+        /*.parse_seq     = */ NULL,
         /*.parse_seq_len = */ 0,
 #ifdef GGML_ALLOCATOR_DEBUG
         /*.allocated_tensors = */ {0},
@@ -330,6 +340,8 @@ void ggml_allocr_free(struct ggml_allocr * alloc) {
     if (alloc->buffer_owned) {
         ggml_backend_buffer_free(alloc->buffer);
     }
+    free(alloc->hash_table);
+    free(alloc->parse_seq);
     free(alloc);
 }
 
@@ -410,11 +422,11 @@ static void allocate_node(struct ggml_allocr * alloc, struct ggml_tensor * node)
                         continue;
                     }
 
-                    struct hash_node * p_hn = hash_get(ht, parent);
+                    struct hash_node * p_hn = hash_get(ht, alloc->hash_size, parent);
                     if (parent->data != NULL && p_hn->n_children == 1 && p_hn->n_views == 0 && ggml_are_same_layout(node, parent)) {
                         if (ggml_is_view(parent)) {
                             struct ggml_tensor * view_src = parent->view_src;
-                            struct hash_node * view_src_hn = hash_get(ht, view_src);
+                            struct hash_node * view_src_hn = hash_get(ht, alloc->hash_size, view_src);
                             if (view_src_hn->n_views == 1 && view_src_hn->n_children == 0 && view_src->data == parent->data) {
                                 // TODO: the offset of the view parent must be kept to ensure that the op doesn't overwrite
                                 // the parent's data that it will need later (same layout requirement). the problem is that then
@@ -448,9 +460,32 @@ size_t ggml_allocr_alloc_graph_n(
     struct ggml_cgraph ** graphs, int n_graphs,
     struct ggml_tensor *** inputs, struct ggml_tensor *** outputs) {
 
+    // the hash table has room for all the tensors used by the graphs: the nodes, their sources and the sources of their views
+    size_t n_tensors = 0;
+    for (int g = 0; g < n_graphs; g++) {
+        struct ggml_cgraph * gf = graphs[g];
+        for (int i = 0; i < gf->n_nodes; i++) {
+            struct ggml_tensor * node = gf->nodes[i];
+
+            n_tensors += 1 + (node->view_src != NULL);
+            for (int j = 0; j < GGML_MAX_SRC && node->src[j] != NULL; j++) {
+                n_tensors++;
+            }
+        }
+    }
+
+    // keep the hash table load below 1/2
+    alloc->hash_size = ggml_hash_size(2*n_tensors);
+    if (alloc->hash_capacity < alloc->hash_size) {
+        free(alloc->hash_table);
+        alloc->hash_table = malloc(sizeof(struct hash_node) * alloc->hash_size);
+        GGML_ASSERT(alloc->hash_table != NULL);
+        alloc->hash_capacity = alloc->hash_size;
+    }
+
     // reset hash table
     struct hash_node * ht = alloc->hash_table;
-    memset(ht, 0, sizeof(struct hash_node) * GGML_GRAPH_HASHTABLE_SIZE);
+    memset(ht, 0, sizeof(struct hash_node) * alloc->hash_size);
 
     // count number of children and views
     for (int g = 0; g < n_graphs; g++) {
@@ -460,7 +495,7 @@ size_t ggml_allocr_alloc_graph_n(
 
             if (ggml_is_view(node)) {
                 struct ggml_tensor * view_src = node->view_src;
-                hash_get(ht, view_src)->n_views += 1;
+                hash_get(ht, alloc->hash_size, view_src)->n_views += 1;
                 if (node->buffer == NULL && node->data != NULL) {
                     // view of a pre-allocated tensor, didn't call init_view() yet
                     init_view(alloc, node);
@@ -472,7 +507,7 @@ size_t ggml_allocr_alloc_graph_n(
                 if (parent == NULL) {
                     break;
                 }
-                hash_get(ht, parent)->n_children += 1;
+                hash_get(ht, alloc->hash_size, parent)->n_children += 1;
                 if (ggml_is_view(parent) && parent->buffer == NULL && parent->data != NULL) {
                     init_view(alloc, parent);
                 }
@@ -543,7 +578,7 @@ size_t ggml_allocr_alloc_graph_n(
                         if (parent == NULL) {
                             break;
                         }
-                        struct hash_node * p_hn = hash_get(ht, parent);
+                        struct hash_node * p_hn = hash_get(ht, alloc->hash_size, parent);
                         p_hn->n_children -= 1;
 
                         //AT_PRINTF("parent %s: %d children, %d views\n", parent->name, parent->n_children, parent->n_views);
@@ -551,7 +586,7 @@ size_t ggml_allocr_alloc_graph_n(
                         if (p_hn->n_children == 0 && p_hn->n_views == 0) {
                             if (ggml_is_view(parent)) {
                                 struct ggml_tensor * view_src = parent->view_src;
-                                struct hash_node * view_src_hn = hash_get(ht, view_src);
+                                struct hash_node * view_src_hn = hash_get(ht, alloc->hash_size, view_src);
                                 view_src_hn->n_views -= 1;
                                 AT_PRINTF("view_src %s: %d children, %d views\n", view_src->name, view_src_hn->n_children, view_src_hn->n_views);
                                 if (view_src_hn->n_views == 0 && view_src_hn->n_children == 0 && view_src->data != node->data) {
@@ -230,6 +230,50 @@ inline static float ggml_lookup_fp16_to_fp32(ggml_fp16_t f) {
 
 #endif
 
+// BF16 <-> FP32
+// a BF16 is the upper half of an FP32, the conversion to FP32 is exact
+// the conversion from FP32 rounds to nearest even, NaNs stay quiet NaNs and are not rounded to infinity
+
+static inline float ggml_compute_bf16_to_fp32(ggml_bf16_t h) {
+    const uint32_t w = (uint32_t) h.bits << 16;
+    float f;
+    memcpy(&f, &w, sizeof(float));
+    return f;
+}
+
+static inline ggml_bf16_t ggml_compute_fp32_to_bf16(float f) {
+    uint32_t w;
+    memcpy(&w, &f, sizeof(float));
+    ggml_bf16_t h;
+    if ((w & 0x7fffffff) > 0x7f800000) {
+        h.bits = (w >> 16) | 64; // force quiet
+        return h;
+    }
+    h.bits = (w + (0x7fff + ((w >> 16) & 1))) >> 16;
+    return h;
+}
+
+#define GGML_BF16_TO_FP32(x) ggml_compute_bf16_to_fp32(x)
+#define GGML_FP32_TO_BF16(x) ggml_compute_fp32_to_bf16(x)
+
+// hash set of tensor pointers, sized with ggml_hash_size()
+
+#define GGML_HASHTABLE_FULL           ((size_t)-1)
+#define GGML_HASHTABLE_ALREADY_EXISTS ((size_t)-2)
+
+// smallest prime in a table of primes that is >= min_sz
+size_t ggml_hash_size(size_t min_sz);
+
+// index of key in the set, or of the empty slot where it would be inserted; GGML_HASHTABLE_FULL if neither exists
+size_t ggml_hash_find          (const struct ggml_hash_set hash_set, struct ggml_tensor * key);
+bool   ggml_hash_contains      (const struct ggml_hash_set hash_set, struct ggml_tensor * key);
+
+// returns GGML_HASHTABLE_ALREADY_EXISTS if key was already in the set, otherwise the index where it was inserted
+size_t ggml_hash_insert        (      struct ggml_hash_set hash_set, struct ggml_tensor * key);
+
+// returns the index of key, inserting it if needed
+size_t ggml_hash_find_or_insert(      struct ggml_hash_set hash_set, struct ggml_tensor * key);
+
     // TODO: backend v2 PR
 
 #ifdef __cplusplus
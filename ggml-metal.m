@@ -23,7 +23,8 @@
 
 #define UNUSED(x) (void)(x)
 
-#define GGML_MAX_CONCUR (2*GGML_MAX_NODES)
+// the concurrency list is only built for graphs of up to GGML_MAX_CONCUR/2 nodes
+#define GGML_MAX_CONCUR (2*8192)
 
 struct ggml_metal_buffer {
     const char * name;
@@ -603,9 +604,15 @@ void ggml_metal_graph_find_concurrency(
     int nodes_unused[GGML_MAX_CONCUR];
 
     for (int i = 0; i < GGML_MAX_CONCUR; i++) { ctx->concur_list[i] = 0; }
-    for (int i = 0; i < gf->n_nodes;     i++) { nodes_unused[i]     = 1; }
     ctx->concur_list_len = 0;
 
+    if (gf->n_nodes > GGML_MAX_CONCUR/2) {
+        GGML_METAL_LOG_WARN("%s: graph too large for metal ctx->concur_list, the nodes are computed serially\n", __func__);
+        return;
+    }
+
+    for (int i = 0; i < gf->n_nodes;     i++) { nodes_unused[i]     = 1; }
+
     int n_left    = gf->n_nodes;
     int n_start   = 0; // all nodes before n_start at nodes_unused array have been sorted and store back to ctx->concur_list
     int level_pos = 0; // at ctx->concur_list, the last layer (level) ends at level_pos
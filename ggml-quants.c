@@ -282,6 +282,48 @@ static inline float hsum_float_4x4(const __m128 a, const __m128 b, const __m128
 #endif // __AVX__ || __AVX2__ || __AVX512F__
 #endif // defined(__AVX__) || defined(__AVX2__) || defined(__AVX512F__) || defined(__SSSE3__)
 
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+// multiply unsigned int8 ax with signed int8 sy and add the sums of groups of 4 products to acc
+static inline __m512i mul_add_us8_quads_512(const __m512i acc, const __m512i ax, const __m512i sy) {
+#if defined(__AVX512VNNI__)
+    return _mm512_dpbusd_epi32(acc, ax, sy);
+#else
+    const __m512i dot = _mm512_maddubs_epi16(ax, sy);
+    return _mm512_add_epi32(acc, _mm512_madd_epi16(_mm512_set1_epi16(1), dot));
+#endif
+}
+
+// multiply int8_t, add the results in groups of 4 and return as int32 vector
+static inline __m512i mul_sum_i8_quads_512(const __m512i x, const __m512i y) {
+    // Get absolute values of x vectors
+    const __m512i ax = _mm512_abs_epi8(x);
+    // Sign the values of the y vectors
+    const __m512i sy = _mm512_mask_sub_epi8(y, _mm512_movepi8_mask(x), _mm512_setzero_si512(), y);
+    return mul_add_us8_quads_512(_mm512_setzero_si512(), ax, sy);
+}
+
+// multiply int16_t and add the sums of pairs of products to acc
+static inline __m512i mul_add_i16_pairs_512(const __m512i acc, const __m512i x, const __m512i y) {
+#if defined(__AVX512VNNI__)
+    return _mm512_dpwssd_epi32(acc, x, y);
+#else
+    return _mm512_add_epi32(acc, _mm512_madd_epi16(x, y));
+#endif
+}
+
+// load the quants of two blocks of 32 into a single vector
+static inline __m512i load_2x32_512(const void * a, const void * b) {
+    return _mm512_inserti64x4(_mm512_castsi256_si512(_mm256_loadu_si256((const __m256i *) a)), _mm256_loadu_si256((const __m256i *) b), 1);
+}
+
+// spread the 4-bit values of 32 bytes into 64 bytes: first the low nibbles, then the high nibbles
+// the bytes are broadcast and shifted with a mask, which avoids the shuffle port
+static inline __m512i bytes_from_nibbles_64(const uint8_t * rsi) {
+    const __m512i bytes = _mm512_broadcast_i64x4(_mm256_loadu_si256((const __m256i *) rsi));
+    return _mm512_and_si512(_mm512_mask_srli_epi16(bytes, 0xFFFF0000, bytes, 4), _mm512_set1_epi8(0xF));
+}
+#endif // defined(__AVX512F__) && defined(__AVX512BW__)
+
 #if defined(__ARM_NEON)
 
 #if !defined(__aarch64__)
@@ -2308,6 +2350,22 @@ static inline __m256i get_scale_shuffle_k4(int i) {
     };
     return _mm256_loadu_si256((const __m256i*)k_shuffle + i);
 }
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+// the shuffles of get_scale_shuffle_k4(2*i) and get_scale_shuffle_k4(2*i+1) in a single vector
+static inline __m512i get_scale_shuffle_k4_512(int i) {
+    static const uint8_t k_shuffle[256] = {
+         0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1,
+         2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3,
+         4, 5, 4, 5, 4, 5, 4, 5, 4, 5, 4, 5, 4, 5, 4, 5, 4, 5, 4, 5, 4, 5, 4, 5, 4, 5, 4, 5, 4, 5, 4, 5,
+         6, 7, 6, 7, 6, 7, 6, 7, 6, 7, 6, 7, 6, 7, 6, 7, 6, 7, 6, 7, 6, 7, 6, 7, 6, 7, 6, 7, 6, 7, 6, 7,
+         8, 9, 8, 9, 8, 9, 8, 9, 8, 9, 8, 9, 8, 9, 8, 9, 8, 9, 8, 9, 8, 9, 8, 9, 8, 9, 8, 9, 8, 9, 8, 9,
+        10,11,10,11,10,11,10,11,10,11,10,11,10,11,10,11,10,11,10,11,10,11,10,11,10,11,10,11,10,11,10,11,
+        12,13,12,13,12,13,12,13,12,13,12,13,12,13,12,13,12,13,12,13,12,13,12,13,12,13,12,13,12,13,12,13,
+        14,15,14,15,14,15,14,15,14,15,14,15,14,15,14,15,14,15,14,15,14,15,14,15,14,15,14,15,14,15,14,15
+    };
+    return _mm512_loadu_si512((const __m512i*)k_shuffle + i);
+}
+#endif
 static inline __m128i get_scale_shuffle(int i) {
     static const uint8_t k_shuffle[128] = {
          0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
@@ -2323,6 +2381,47 @@ static inline __m128i get_scale_shuffle(int i) {
 }
 #endif
 
+// compute a tile of dot products with the single row vec_dot, used when there is no faster implementation
+static inline void ggml_vec_dot_tile_by_rows(ggml_vec_dot_t vec_dot, const int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by) {
+    for (int c = 0; c < QK_TILE_NC; ++c) {
+        for (int r = 0; r < QK_TILE_NR; ++r) {
+            vec_dot(n, s + c*bs + r, (const char *) vx + r*bx, (const char *) vy + c*by);
+        }
+    }
+}
+
+// the same for nc columns of a group of interleaved rows (see ggml_repack), the blocks of each row are copied together
+// in chunks that vec_dot can use
+static void ggml_vec_dot_tile_by_rows_x4(ggml_vec_dot_t vec_dot, const int qk, const size_t bx, const size_t by0,
+        const int n, float * restrict s, size_t bs, const void * restrict vx, const void * restrict vy, size_t by, const int nc) {
+    const int nb = n / qk;
+
+    char row[16*sizeof(block_q4_K)];
+    const int nchunk = sizeof(row)/bx;
+
+    for (int c = 0; c < nc; ++c) {
+        for (int r = 0; r < QK_TILE_NR; ++r) {
+            s[c*bs + r] = 0.0f;
+        }
+    }
+
+    for (int i0 = 0; i0 < nb; i0 += nchunk) {
+        const int ni = MIN(nchunk, nb - i0);
+
+        for (int r = 0; r < QK_TILE_NR; ++r) {
+            for (int i = 0; i < ni; ++i) {
+                memcpy(row + i*bx, (const char *) vx + ((i0 + i)*QK_TILE_NR + r)*bx, bx);
+            }
+
+            for (int c = 0; c < nc; ++c) {
+                float sumf;
+                vec_dot(ni*qk, &sumf, row, (const char *) vy + c*by + i0*by0);
+                s[c*bs + r] += sumf;
+            }
+        }
+    }
+}
+
 void ggml_vec_dot_q4_0_q8_0(int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
     const int qk = QK8_0;
     const int nb = n / qk;
@@ -2397,6 +2496,52 @@ void ggml_vec_dot_q4_0_q8_0(int n, float * restrict s, const void * restrict vx,
     }
 
     *s = vaddvq_f32(sumv0) + vaddvq_f32(sumv1);
+#elif defined(__AVX512F__) && defined(__AVX512BW__)
+    __m512 acc = _mm512_setzero_ps();
+
+    const __m512i m4  = _mm512_set1_epi8(0xF);
+    const __m512i off = _mm512_set1_epi8(8);
+
+    int i = 0;
+
+    // two blocks per iteration
+    for (; i + 1 < nb; i += 2) {
+        // 4-bit -> 8-bit, in [ 0 .. 15 ]: the low nibbles of each block, then its high nibbles
+        __m512i bx = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) x[i + 0].qs));
+        bx = _mm512_mask_broadcast_i32x4(bx, 0xFF00, _mm_loadu_si128((const __m128i *) x[i + 1].qs));
+        bx = _mm512_and_si512(_mm512_mask_srli_epi16(bx, 0xFF00FF00, bx, 4), m4);
+
+        const __m512i by = load_2x32_512(y[i + 0].qs, y[i + 1].qs);
+
+        // the quants are offset by 8: x*y - 8*y
+        const __m512i sumi = _mm512_sub_epi32(mul_add_us8_quads_512(_mm512_setzero_si512(), bx,  by),
+                                              mul_add_us8_quads_512(_mm512_setzero_si512(), off, by));
+
+        // the first 8 sums belong to the first block, the last 8 to the second
+        const __m512 d = _mm512_mask_blend_ps(0xFF00,
+                _mm512_set1_ps(GGML_FP16_TO_FP32(x[i + 0].d)*GGML_FP16_TO_FP32(y[i + 0].d)),
+                _mm512_set1_ps(GGML_FP16_TO_FP32(x[i + 1].d)*GGML_FP16_TO_FP32(y[i + 1].d)));
+
+        acc = _mm512_fmadd_ps(d, _mm512_cvtepi32_ps(sumi), acc);
+    }
+
+    float sumf = _mm512_reduce_add_ps(acc);
+
+    // leftover block
+    for (; i < nb; ++i) {
+        int sumi = 0;
+
+        for (int j = 0; j < qk/2; ++j) {
+            const int v0 = (x[i].qs[j] & 0x0F) - 8;
+            const int v1 = (x[i].qs[j] >>   4) - 8;
+
+            sumi += (v0 * y[i].qs[j]) + (v1 * y[i].qs[j + qk/2]);
+        }
+
+        sumf += sumi*GGML_FP16_TO_FP32(x[i].d)*GGML_FP16_TO_FP32(y[i].d);
+    }
+
+    *s = sumf;
 #elif defined(__AVX2__)
     // Initialize accumulator with zeros
     __m256 acc = _mm256_setzero_ps();
@@ -2633,6 +2778,93 @@ void ggml_vec_dot_q4_0_q8_0(int n, float * restrict s, const void * restrict vx,
 #endif
 }
 
+// block i of row r of x is at vx + r*bx + i*bi, bi is the size of a block for the plain layout and QK_TILE_NR times
+// that for the interleaved layout
+static inline void ggml_vec_dot_q4_0_q8_0_tile_impl(const int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, size_t bi,
+        const void * restrict vy, size_t by, const int nc) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+    assert(nc <= QK_TILE_NC);
+
+#if defined(__AVX2__)
+    const char       * restrict x[QK_TILE_NR];
+    const block_q8_0 * restrict y[QK_TILE_NC];
+
+    for (int r = 0; r < QK_TILE_NR; ++r) {
+        x[r] = (const char *) vx + r*bx;
+    }
+    for (int c = 0; c < nc; ++c) {
+        y[c] = (const block_q8_0 *) ((const char *) vy + c*by);
+    }
+
+    __m256 acc[QK_TILE_NR][QK_TILE_NC];
+    for (int r = 0; r < QK_TILE_NR; ++r) {
+        for (int c = 0; c < nc; ++c) {
+            acc[r][c] = _mm256_setzero_ps();
+        }
+    }
+
+    const __m256i off = _mm256_set1_epi8(8);
+
+    for (int i = 0; i < nb; ++i) {
+        // unpack the blocks of x once and reuse them for all the columns
+        // the nibbles are multiplied without their offset of 8, which is subtracted with the sums of y
+        __m256i qx[QK_TILE_NR];
+        __m256  dx[QK_TILE_NR];
+
+        for (int r = 0; r < QK_TILE_NR; ++r) {
+            const block_q4_0 * restrict xb = (const block_q4_0 *) (x[r] + i*bi);
+
+            qx[r] = bytes_from_nibbles_32(xb->qs);
+            dx[r] = _mm256_set1_ps(GGML_FP16_TO_FP32(xb->d));
+        }
+
+        for (int c = 0; c < nc; ++c) {
+            const __m256i qy = _mm256_loadu_si256((const __m256i *) y[c][i].qs);
+            const __m256  dy = _mm256_set1_ps(GGML_FP16_TO_FP32(y[c][i].d));
+            const __m256  sy = mul_sum_us8_pairs_float(off, qy);
+
+            for (int r = 0; r < QK_TILE_NR; ++r) {
+                const __m256 q = _mm256_sub_ps(mul_sum_us8_pairs_float(qx[r], qy), sy);
+
+                acc[r][c] = _mm256_fmadd_ps(_mm256_mul_ps(dx[r], dy), q, acc[r][c]);
+            }
+        }
+    }
+
+    for (int c = 0; c < nc; ++c) {
+        for (int r = 0; r < QK_TILE_NR; ++r) {
+            s[c*bs + r] = hsum_float_8(acc[r][c]);
+        }
+    }
+#else
+    GGML_UNUSED(nb);
+
+    if (bi == sizeof(block_q4_0)) {
+        assert(nc == QK_TILE_NC);
+        ggml_vec_dot_tile_by_rows(ggml_vec_dot_q4_0_q8_0, n, s, bs, vx, bx, vy, by);
+    } else {
+        ggml_vec_dot_tile_by_rows_x4(ggml_vec_dot_q4_0_q8_0, qk, sizeof(block_q4_0), sizeof(block_q8_0), n, s, bs, vx, vy, by, nc);
+    }
+#endif
+}
+
+void ggml_vec_dot_q4_0_q8_0_tile(const int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by) {
+    ggml_vec_dot_q4_0_q8_0_tile_impl(n, s, bs, vx, bx, sizeof(block_q4_0), vy, by, QK_TILE_NC);
+}
+
+void ggml_gemv_q4_0_x4_q8_0(const int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by) {
+    GGML_UNUSED(bx);
+    ggml_vec_dot_q4_0_q8_0_tile_impl(n, s, bs, vx, sizeof(block_q4_0), QK_TILE_NR*sizeof(block_q4_0), vy, by, 1);
+}
+
+void ggml_gemm_q4_0_x4_q8_0(const int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by) {
+    GGML_UNUSED(bx);
+    ggml_vec_dot_q4_0_q8_0_tile_impl(n, s, bs, vx, sizeof(block_q4_0), QK_TILE_NR*sizeof(block_q4_0), vy, by, QK_TILE_NC);
+}
+
 void ggml_vec_dot_q4_1_q8_1(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
     const int qk = QK8_1;
     const int nb = n / qk;
@@ -3481,6 +3713,38 @@ void ggml_vec_dot_q8_0_q8_0(const int n, float * restrict s, const void * restri
     }
 
     *s = vaddvq_f32(sumv0) + vaddvq_f32(sumv1);
+#elif defined(__AVX512F__) && defined(__AVX512BW__)
+    __m512 acc = _mm512_setzero_ps();
+
+    int i = 0;
+
+    // two blocks per iteration
+    for (; i + 1 < nb; i += 2) {
+        const __m512i bx = load_2x32_512(x[i + 0].qs, x[i + 1].qs);
+        const __m512i by = load_2x32_512(y[i + 0].qs, y[i + 1].qs);
+
+        // the first 8 sums belong to the first block, the last 8 to the second
+        const __m512 d = _mm512_mask_blend_ps(0xFF00,
+                _mm512_set1_ps(GGML_FP16_TO_FP32(x[i + 0].d)*GGML_FP16_TO_FP32(y[i + 0].d)),
+                _mm512_set1_ps(GGML_FP16_TO_FP32(x[i + 1].d)*GGML_FP16_TO_FP32(y[i + 1].d)));
+
+        acc = _mm512_fmadd_ps(d, _mm512_cvtepi32_ps(mul_sum_i8_quads_512(bx, by)), acc);
+    }
+
+    float sumf = _mm512_reduce_add_ps(acc);
+
+    // leftover block
+    for (; i < nb; ++i) {
+        int sumi = 0;
+
+        for (int j = 0; j < qk; j++) {
+            sumi += x[i].qs[j]*y[i].qs[j];
+        }
+
+        sumf += sumi*(GGML_FP16_TO_FP32(x[i].d)*GGML_FP16_TO_FP32(y[i].d));
+    }
+
+    *s = sumf;
 #elif defined(__AVX2__) || defined(__AVX__)
     // Initialize accumulator with zeros
     __m256 acc = _mm256_setzero_ps();
@@ -3541,6 +3805,89 @@ void ggml_vec_dot_q8_0_q8_0(const int n, float * restrict s, const void * restri
 #endif
 }
 
+// block i of row r of x is at vx + r*bx + i*bi, see ggml_vec_dot_q4_0_q8_0_tile_impl
+static inline void ggml_vec_dot_q8_0_q8_0_tile_impl(const int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, size_t bi,
+        const void * restrict vy, size_t by, const int nc) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+
+    assert(n % qk == 0);
+    assert(nc <= QK_TILE_NC);
+
+#if defined(__AVX2__)
+    const char       * restrict x[QK_TILE_NR];
+    const block_q8_0 * restrict y[QK_TILE_NC];
+
+    for (int r = 0; r < QK_TILE_NR; ++r) {
+        x[r] = (const char *) vx + r*bx;
+    }
+    for (int c = 0; c < nc; ++c) {
+        y[c] = (const block_q8_0 *) ((const char *) vy + c*by);
+    }
+
+    __m256 acc[QK_TILE_NR][QK_TILE_NC];
+    for (int r = 0; r < QK_TILE_NR; ++r) {
+        for (int c = 0; c < nc; ++c) {
+            acc[r][c] = _mm256_setzero_ps();
+        }
+    }
+
+    for (int i = 0; i < nb; ++i) {
+        __m256i qx[QK_TILE_NR];
+        __m256i ax[QK_TILE_NR];
+        __m256  dx[QK_TILE_NR];
+
+        for (int r = 0; r < QK_TILE_NR; ++r) {
+            const block_q8_0 * restrict xb = (const block_q8_0 *) (x[r] + i*bi);
+
+            qx[r] = _mm256_loadu_si256((const __m256i *) xb->qs);
+            ax[r] = _mm256_sign_epi8(qx[r], qx[r]);
+            dx[r] = _mm256_set1_ps(GGML_FP16_TO_FP32(xb->d));
+        }
+
+        for (int c = 0; c < nc; ++c) {
+            const __m256i qy = _mm256_loadu_si256((const __m256i *) y[c][i].qs);
+            const __m256  dy = _mm256_set1_ps(GGML_FP16_TO_FP32(y[c][i].d));
+
+            for (int r = 0; r < QK_TILE_NR; ++r) {
+                const __m256 q = mul_sum_us8_pairs_float(ax[r], _mm256_sign_epi8(qy, qx[r]));
+
+                acc[r][c] = _mm256_fmadd_ps(_mm256_mul_ps(dx[r], dy), q, acc[r][c]);
+            }
+        }
+    }
+
+    for (int c = 0; c < nc; ++c) {
+        for (int r = 0; r < QK_TILE_NR; ++r) {
+            s[c*bs + r] = hsum_float_8(acc[r][c]);
+        }
+    }
+#else
+    GGML_UNUSED(nb);
+
+    if (bi == sizeof(block_q8_0)) {
+        assert(nc == QK_TILE_NC);
+        ggml_vec_dot_tile_by_rows(ggml_vec_dot_q8_0_q8_0, n, s, bs, vx, bx, vy, by);
+    } else {
+        ggml_vec_dot_tile_by_rows_x4(ggml_vec_dot_q8_0_q8_0, qk, sizeof(block_q8_0), sizeof(block_q8_0), n, s, bs, vx, vy, by, nc);
+    }
+#endif
+}
+
+void ggml_vec_dot_q8_0_q8_0_tile(const int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by) {
+    ggml_vec_dot_q8_0_q8_0_tile_impl(n, s, bs, vx, bx, sizeof(block_q8_0), vy, by, QK_TILE_NC);
+}
+
+void ggml_gemv_q8_0_x4_q8_0(const int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by) {
+    GGML_UNUSED(bx);
+    ggml_vec_dot_q8_0_q8_0_tile_impl(n, s, bs, vx, sizeof(block_q8_0), QK_TILE_NR*sizeof(block_q8_0), vy, by, 1);
+}
+
+void ggml_gemm_q8_0_x4_q8_0(const int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by) {
+    GGML_UNUSED(bx);
+    ggml_vec_dot_q8_0_q8_0_tile_impl(n, s, bs, vx, sizeof(block_q8_0), QK_TILE_NR*sizeof(block_q8_0), vy, by, QK_TILE_NC);
+}
+
 #if QK_K == 256
 void ggml_vec_dot_q2_K_q8_K(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
 
@@ -5215,6 +5562,57 @@ void ggml_vec_dot_q4_K_q8_K(const int n, float * restrict s, const void * restri
 
     *s = sumf;
 
+#elif defined(__AVX512F__) && defined(__AVX512BW__)
+
+    __m512 acc   = _mm512_setzero_ps();
+    __m128 acc_m = _mm_setzero_ps();
+
+    for (int i = 0; i < nb; ++i) {
+
+        const float d = y[i].d * GGML_FP16_TO_FP32(x[i].d);
+        const float dmin = -y[i].d * GGML_FP16_TO_FP32(x[i].dmin);
+
+        memcpy(utmp, x[i].scales, 12);
+        utmp[3] = ((utmp[2] >> 4) & kmask2) | (((utmp[1] >> 6) & kmask3) << 4);
+        const uint32_t uaux = utmp[1] & kmask1;
+        utmp[1] = (utmp[2] & kmask2) | (((utmp[0] >> 6) & kmask3) << 4);
+        utmp[2] = uaux;
+        utmp[0] &= kmask1;
+
+        const uint8_t * restrict q4 = x[i].qs;
+        const int8_t  * restrict q8 = y[i].qs;
+
+        const __m256i mins_and_scales = _mm256_cvtepu8_epi16(_mm_set_epi32(utmp[3], utmp[2], utmp[1], utmp[0]));
+
+        const __m256i q8sums = _mm256_loadu_si256((const __m256i*)y[i].bsums);
+        const __m128i q8s = _mm_hadd_epi16(_mm256_extracti128_si256(q8sums, 0), _mm256_extracti128_si256(q8sums, 1));
+        const __m128i prod = _mm_madd_epi16(_mm256_extracti128_si256(mins_and_scales, 1), q8s);
+        acc_m = _mm_fmadd_ps(_mm_set1_ps(dmin), _mm_cvtepi32_ps(prod), acc_m);
+
+        const __m512i scales = _mm512_broadcast_i32x4(_mm256_extracti128_si256(mins_and_scales, 0));
+
+        // two accumulators to shorten the dependency chain
+        __m512i sumi[2] = { _mm512_setzero_si512(), _mm512_setzero_si512() };
+
+        // 64 quants per iteration: the low nibbles of 32 bytes and then the high nibbles
+        for (int j = 0; j < QK_K/64; ++j) {
+
+            const __m512i scale = _mm512_shuffle_epi8(scales, get_scale_shuffle_k4_512(j));
+
+            const __m512i q4x = bytes_from_nibbles_64(q4); q4 += 32;
+            const __m512i q8y = _mm512_loadu_si512((const __m512i*)q8); q8 += 64;
+
+            sumi[j%2] = mul_add_i16_pairs_512(sumi[j%2], scale, _mm512_maddubs_epi16(q4x, q8y));
+        }
+
+        acc = _mm512_fmadd_ps(_mm512_set1_ps(d), _mm512_cvtepi32_ps(_mm512_add_epi32(sumi[0], sumi[1])), acc);
+    }
+
+    acc_m = _mm_add_ps(acc_m, _mm_movehl_ps(acc_m, acc_m));
+    acc_m = _mm_add_ss(acc_m, _mm_movehdup_ps(acc_m));
+
+    *s = _mm512_reduce_add_ps(acc) + _mm_cvtss_f32(acc_m);
+
 #elif defined __AVX2__
 
     const __m256i m4 = _mm256_set1_epi8(0xF);
@@ -5760,6 +6158,142 @@ void ggml_vec_dot_q4_K_q8_K(const int n, float * restrict s, const void * restri
 }
 #endif
 
+// block i of row r of x is at vx + r*bx + i*bi, see ggml_vec_dot_q4_0_q8_0_tile_impl
+static inline void ggml_vec_dot_q4_K_q8_K_tile_impl(const int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, size_t bi,
+        const void * restrict vy, size_t by, const int nc) {
+    assert(n % QK_K == 0);
+    assert(nc <= QK_TILE_NC);
+
+    const int nb = n / QK_K;
+
+#if defined(__AVX2__) && QK_K == 256
+    static const uint32_t kmask1 = 0x3f3f3f3f;
+    static const uint32_t kmask2 = 0x0f0f0f0f;
+    static const uint32_t kmask3 = 0x03030303;
+
+    uint32_t utmp[4];
+
+    const char       * restrict x[QK_TILE_NR];
+    const block_q8_K * restrict y[QK_TILE_NC];
+
+    for (int r = 0; r < QK_TILE_NR; ++r) {
+        x[r] = (const char *) vx + r*bx;
+    }
+    for (int c = 0; c < nc; ++c) {
+        y[c] = (const block_q8_K *) ((const char *) vy + c*by);
+    }
+
+    const __m256i m4 = _mm256_set1_epi8(0xF);
+
+    __m256 acc  [QK_TILE_NR][QK_TILE_NC];
+    __m128 acc_m[QK_TILE_NR][QK_TILE_NC];
+    for (int r = 0; r < QK_TILE_NR; ++r) {
+        for (int c = 0; c < nc; ++c) {
+            acc  [r][c] = _mm256_setzero_ps();
+            acc_m[r][c] = _mm_setzero_ps();
+        }
+    }
+
+    for (int i = 0; i < nb; ++i) {
+        // the sums of the 32 element groups of each column, for the mins
+        __m128i q8s[QK_TILE_NC];
+        for (int c = 0; c < nc; ++c) {
+            const __m256i q8sums = _mm256_loadu_si256((const __m256i *) y[c][i].bsums);
+            q8s[c] = _mm_hadd_epi16(_mm256_extracti128_si256(q8sums, 0), _mm256_extracti128_si256(q8sums, 1));
+        }
+
+        for (int r = 0; r < QK_TILE_NR; ++r) {
+            const block_q4_K * restrict xb = (const block_q4_K *) (x[r] + i*bi);
+
+            const float d    = GGML_FP16_TO_FP32(xb->d);
+            const float dmin = GGML_FP16_TO_FP32(xb->dmin);
+
+            memcpy(utmp, xb->scales, 12);
+            utmp[3] = ((utmp[2] >> 4) & kmask2) | (((utmp[1] >> 6) & kmask3) << 4);
+            const uint32_t uaux = utmp[1] & kmask1;
+            utmp[1] = (utmp[2] & kmask2) | (((utmp[0] >> 6) & kmask3) << 4);
+            utmp[2] = uaux;
+            utmp[0] &= kmask1;
+
+            const __m256i mins_and_scales = _mm256_cvtepu8_epi16(_mm_set_epi32(utmp[3], utmp[2], utmp[1], utmp[0]));
+
+            const __m128i mins   = _mm256_extracti128_si256(mins_and_scales, 1);
+            const __m128i sc128  = _mm256_extracti128_si256(mins_and_scales, 0);
+            const __m256i scales = MM256_SET_M128I(sc128, sc128);
+
+            __m256i sumi[QK_TILE_NC];
+            for (int c = 0; c < nc; ++c) {
+                sumi[c] = _mm256_setzero_si256();
+            }
+
+            const uint8_t * restrict q4 = xb->qs;
+
+            for (int j = 0; j < QK_K/64; ++j) {
+                // unpack the quants of x once and reuse them for all the columns
+                const __m256i scale_l = _mm256_shuffle_epi8(scales, get_scale_shuffle_k4(2*j+0));
+                const __m256i scale_h = _mm256_shuffle_epi8(scales, get_scale_shuffle_k4(2*j+1));
+
+                const __m256i q4bits = _mm256_loadu_si256((const __m256i *) q4); q4 += 32;
+                const __m256i q4l = _mm256_and_si256(q4bits, m4);
+                const __m256i q4h = _mm256_and_si256(_mm256_srli_epi16(q4bits, 4), m4);
+
+                for (int c = 0; c < nc; ++c) {
+                    const int8_t * restrict q8 = y[c][i].qs + 64*j;
+
+                    const __m256i q8l = _mm256_loadu_si256((const __m256i *) (q8 +  0));
+                    const __m256i q8h = _mm256_loadu_si256((const __m256i *) (q8 + 32));
+
+                    const __m256i p16l = _mm256_madd_epi16(scale_l, _mm256_maddubs_epi16(q4l, q8l));
+                    const __m256i p16h = _mm256_madd_epi16(scale_h, _mm256_maddubs_epi16(q4h, q8h));
+
+                    sumi[c] = _mm256_add_epi32(sumi[c], _mm256_add_epi32(p16l, p16h));
+                }
+            }
+
+            for (int c = 0; c < nc; ++c) {
+                const __m128i prod = _mm_madd_epi16(mins, q8s[c]);
+
+                acc  [r][c] = _mm256_fmadd_ps(_mm256_set1_ps( d   *y[c][i].d), _mm256_cvtepi32_ps(sumi[c]), acc[r][c]);
+                acc_m[r][c] = _mm_fmadd_ps   (_mm_set1_ps   (-dmin*y[c][i].d), _mm_cvtepi32_ps(prod), acc_m[r][c]);
+            }
+        }
+    }
+
+    for (int c = 0; c < nc; ++c) {
+        for (int r = 0; r < QK_TILE_NR; ++r) {
+            __m128 acc_m_r = acc_m[r][c];
+            acc_m_r = _mm_add_ps(acc_m_r, _mm_movehl_ps(acc_m_r, acc_m_r));
+            acc_m_r = _mm_add_ss(acc_m_r, _mm_movehdup_ps(acc_m_r));
+
+            s[c*bs + r] = hsum_float_8(acc[r][c]) + _mm_cvtss_f32(acc_m_r);
+        }
+    }
+#else
+    GGML_UNUSED(nb);
+
+    if (bi == sizeof(block_q4_K)) {
+        assert(nc == QK_TILE_NC);
+        ggml_vec_dot_tile_by_rows(ggml_vec_dot_q4_K_q8_K, n, s, bs, vx, bx, vy, by);
+    } else {
+        ggml_vec_dot_tile_by_rows_x4(ggml_vec_dot_q4_K_q8_K, QK_K, sizeof(block_q4_K), sizeof(block_q8_K), n, s, bs, vx, vy, by, nc);
+    }
+#endif
+}
+
+void ggml_vec_dot_q4_K_q8_K_tile(const int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by) {
+    ggml_vec_dot_q4_K_q8_K_tile_impl(n, s, bs, vx, bx, sizeof(block_q4_K), vy, by, QK_TILE_NC);
+}
+
+void ggml_gemv_q4_K_x4_q8_K(const int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by) {
+    GGML_UNUSED(bx);
+    ggml_vec_dot_q4_K_q8_K_tile_impl(n, s, bs, vx, sizeof(block_q4_K), QK_TILE_NR*sizeof(block_q4_K), vy, by, 1);
+}
+
+void ggml_gemm_q4_K_x4_q8_K(const int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by) {
+    GGML_UNUSED(bx);
+    ggml_vec_dot_q4_K_q8_K_tile_impl(n, s, bs, vx, sizeof(block_q4_K), QK_TILE_NR*sizeof(block_q4_K), vy, by, QK_TILE_NC);
+}
+
 #if QK_K == 256
 void ggml_vec_dot_q5_K_q8_K(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
     assert(n % QK_K == 0);
@@ -5864,6 +6398,66 @@ void ggml_vec_dot_q5_K_q8_K(const int n, float * restrict s, const void * restri
 
     *s = sumf;
 
+#elif defined(__AVX512F__) && defined(__AVX512BW__)
+
+    const __m512i m16 = _mm512_set1_epi8(16);
+
+    __m512 acc   = _mm512_setzero_ps();
+    __m128 acc_m = _mm_setzero_ps();
+
+    for (int i = 0; i < nb; ++i) {
+
+        const float d = y[i].d * GGML_FP16_TO_FP32(x[i].d);
+        const float dmin = -y[i].d * GGML_FP16_TO_FP32(x[i].dmin);
+
+        memcpy(utmp, x[i].scales, 12);
+        utmp[3] = ((utmp[2] >> 4) & kmask2) | (((utmp[1] >> 6) & kmask3) << 4);
+        const uint32_t uaux = utmp[1] & kmask1;
+        utmp[1] = (utmp[2] & kmask2) | (((utmp[0] >> 6) & kmask3) << 4);
+        utmp[2] = uaux;
+        utmp[0] &= kmask1;
+
+        const uint8_t * restrict q5 = x[i].qs;
+        const int8_t  * restrict q8 = y[i].qs;
+
+        const __m256i mins_and_scales = _mm256_cvtepu8_epi16(_mm_set_epi32(utmp[3], utmp[2], utmp[1], utmp[0]));
+
+        const __m256i q8sums = _mm256_loadu_si256((const __m256i*)y[i].bsums);
+        const __m128i q8s = _mm_hadd_epi16(_mm256_extracti128_si256(q8sums, 0), _mm256_extracti128_si256(q8sums, 1));
+        const __m128i prod = _mm_madd_epi16(_mm256_extracti128_si256(mins_and_scales, 1), q8s);
+        acc_m = _mm_fmadd_ps(_mm_set1_ps(dmin), _mm_cvtepi32_ps(prod), acc_m);
+
+        const __m512i scales = _mm512_broadcast_i32x4(_mm256_extracti128_si256(mins_and_scales, 0));
+
+        // the high bits of the first 32 quants of each iteration are in the even bits, of the next 32 in the odd bits
+        const __m256i hbits256 = _mm256_loadu_si256((const __m256i*)x[i].qh);
+        const __m512i hbits = _mm512_inserti64x4(_mm512_castsi256_si512(hbits256), _mm256_srli_epi16(hbits256, 1), 1);
+
+        // two accumulators to shorten the dependency chain
+        __m512i sumi[2] = { _mm512_setzero_si512(), _mm512_setzero_si512() };
+
+        for (int j = 0; j < QK_K/64; ++j) {
+
+            const __m512i scale = _mm512_shuffle_epi8(scales, get_scale_shuffle_k4_512(j));
+
+            const __mmask64 q5h = _mm512_test_epi8_mask(hbits, _mm512_set1_epi8(1 << 2*j));
+
+            __m512i q5x = bytes_from_nibbles_64(q5); q5 += 32;
+            q5x = _mm512_mask_add_epi8(q5x, q5h, q5x, m16);
+
+            const __m512i q8y = _mm512_loadu_si512((const __m512i*)q8); q8 += 64;
+
+            sumi[j%2] = mul_add_i16_pairs_512(sumi[j%2], scale, _mm512_maddubs_epi16(q5x, q8y));
+        }
+
+        acc = _mm512_fmadd_ps(_mm512_set1_ps(d), _mm512_cvtepi32_ps(_mm512_add_epi32(sumi[0], sumi[1])), acc);
+    }
+
+    acc_m = _mm_add_ps(acc_m, _mm_movehl_ps(acc_m, acc_m));
+    acc_m = _mm_add_ss(acc_m, _mm_movehdup_ps(acc_m));
+
+    *s = _mm512_reduce_add_ps(acc) + _mm_cvtss_f32(acc_m);
+
 #elif defined __AVX2__
 
     const __m256i m4 = _mm256_set1_epi8(0xF);
@@ -6638,6 +7232,67 @@ void ggml_vec_dot_q6_K_q8_K(const int n, float * restrict s, const void * restri
     }
     *s = sum;
 
+#elif defined(__AVX512F__) && defined(__AVX512BW__)
+
+    const __m512i m4 = _mm512_set1_epi8(0xF);
+    const __m512i m2 = _mm512_set1_epi8(3);
+
+    __m512 acc = _mm512_setzero_ps();
+
+    for (int i = 0; i < nb; ++i) {
+
+        const float d = y[i].d * GGML_FP16_TO_FP32(x[i].d);
+
+        const uint8_t * restrict q4 = x[i].ql;
+        const uint8_t * restrict qh = x[i].qh;
+        const int8_t  * restrict q8 = y[i].qs;
+
+        const __m128i scales = _mm_loadu_si128((const __m128i*)x[i].scales);
+
+        // the quants are stored with an offset of 32, which is subtracted once for each block of 16 using the sums of q8
+        const __m256i q8sums = _mm256_loadu_si256((const __m256i*)y[i].bsums);
+        const __m256i q8sums_scaled = _mm256_slli_epi32(_mm256_madd_epi16(_mm256_cvtepi8_epi16(scales), q8sums), 5);
+
+        // two accumulators to shorten the dependency chain
+        __m512i sumi[2] = {
+            _mm512_inserti64x4(_mm512_setzero_si512(), _mm256_sub_epi32(_mm256_setzero_si256(), q8sums_scaled), 0),
+            _mm512_setzero_si512(),
+        };
+
+        int is = 0;
+
+        // 128 quants per iteration
+        for (int j = 0; j < QK_K/128; ++j) {
+
+            const __m512i scale_0 = _mm512_cvtepi8_epi16(MM256_SET_M128I(
+                        _mm_shuffle_epi8(scales, get_scale_shuffle(is + 1)), _mm_shuffle_epi8(scales, get_scale_shuffle(is + 0))));
+            const __m512i scale_1 = _mm512_cvtepi8_epi16(MM256_SET_M128I(
+                        _mm_shuffle_epi8(scales, get_scale_shuffle(is + 3)), _mm_shuffle_epi8(scales, get_scale_shuffle(is + 2))));
+            is += 4;
+
+            const __m512i q4bits = _mm512_loadu_si512((const __m512i*)q4); q4 += 64;
+
+            // bits 0-1 of qh for the first 32 quants, bits 2-3 for the next 32, and so on
+            const __m256i q4bitsH256 = _mm256_loadu_si256((const __m256i*)qh); qh += 32;
+            const __m512i q4bitsH = _mm512_inserti64x4(_mm512_castsi256_si512(q4bitsH256), _mm256_srli_epi16(q4bitsH256, 2), 1);
+
+            const __m512i q6_0 = _mm512_or_si512(_mm512_and_si512(q4bits, m4),
+                    _mm512_slli_epi16(_mm512_and_si512(q4bitsH, m2), 4));
+            const __m512i q6_1 = _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi16(q4bits, 4), m4),
+                    _mm512_slli_epi16(_mm512_and_si512(_mm512_srli_epi16(q4bitsH, 4), m2), 4));
+
+            const __m512i q8_0 = _mm512_loadu_si512((const __m512i*)q8); q8 += 64;
+            const __m512i q8_1 = _mm512_loadu_si512((const __m512i*)q8); q8 += 64;
+
+            sumi[0] = mul_add_i16_pairs_512(sumi[0], scale_0, _mm512_maddubs_epi16(q6_0, q8_0));
+            sumi[1] = mul_add_i16_pairs_512(sumi[1], scale_1, _mm512_maddubs_epi16(q6_1, q8_1));
+        }
+
+        acc = _mm512_fmadd_ps(_mm512_set1_ps(d), _mm512_cvtepi32_ps(_mm512_add_epi32(sumi[0], sumi[1])), acc);
+    }
+
+    *s = _mm512_reduce_add_ps(acc);
+
 #elif defined __AVX2__
 
     const __m256i m4 = _mm256_set1_epi8(0xF);
@@ -7280,3 +7935,122 @@ void ggml_vec_dot_q6_K_q8_K(const int n, float * restrict s, const void * restri
 }
 
 #endif
+
+// BF16 dot product with FP32 accumulation
+// vdpbf16ps multiplies pairs of BF16 and adds them to FP32 sums, without it the BF16 are widened to FP32 with a shift
+void ggml_vec_dot_bf16(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
+    const ggml_bf16_t * restrict x = vx;
+    const ggml_bf16_t * restrict y = vy;
+
+    int i = 0;
+    float sumf = 0.0f;
+
+#if defined(__AVX512BF16__)
+    __m512 c1 = _mm512_setzero_ps();
+    __m512 c2 = _mm512_setzero_ps();
+    for (; i + 63 < n; i += 64) {
+        c1 = _mm512_dpbf16_ps(c1, (__m512bh) _mm512_loadu_ps((const float *)(x + i)),      (__m512bh) _mm512_loadu_ps((const float *)(y + i)));
+        c2 = _mm512_dpbf16_ps(c2, (__m512bh) _mm512_loadu_ps((const float *)(x + i + 32)), (__m512bh) _mm512_loadu_ps((const float *)(y + i + 32)));
+    }
+    sumf += _mm512_reduce_add_ps(_mm512_add_ps(c1, c2));
+#endif
+
+#if defined(__AVX512F__)
+#define LOAD_BF16_AS_F32(p) _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(p))), 16))
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    for (; i + 31 < n; i += 32) {
+        acc0 = _mm512_fmadd_ps(LOAD_BF16_AS_F32(x + i),      LOAD_BF16_AS_F32(y + i),      acc0);
+        acc1 = _mm512_fmadd_ps(LOAD_BF16_AS_F32(x + i + 16), LOAD_BF16_AS_F32(y + i + 16), acc1);
+    }
+    sumf += _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+#undef LOAD_BF16_AS_F32
+#elif defined(__AVX2__)
+#define LOAD_BF16_AS_F32(p) _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(p))), 16))
+#if defined(__FMA__)
+#define MADD256(a, b, c) _mm256_fmadd_ps(a, b, c)
+#else
+#define MADD256(a, b, c) _mm256_add_ps(_mm256_mul_ps(a, b), c)
+#endif
+    __m256 acc[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+    for (; i + 31 < n; i += 32) {
+        for (int j = 0; j < 4; ++j) {
+            acc[j] = MADD256(LOAD_BF16_AS_F32(x + i + 8*j), LOAD_BF16_AS_F32(y + i + 8*j), acc[j]);
+        }
+    }
+    sumf += hsum_float_8(_mm256_add_ps(_mm256_add_ps(acc[0], acc[1]), _mm256_add_ps(acc[2], acc[3])));
+#undef MADD256
+#undef LOAD_BF16_AS_F32
+#endif
+
+    for (; i < n; ++i) {
+        sumf += GGML_BF16_TO_FP32(x[i])*GGML_BF16_TO_FP32(y[i]);
+    }
+
+    *s = sumf;
+}
+
+#ifdef GGML_QUANTS_VARIANT
+// only the activation quantizers are replaced: the weight quantizers are scalar code anyway, and keeping
+// them as they are makes quantized models independent of the host that made them
+void ggml_quants_set_type_traits(ggml_type_traits_t * traits) {
+    traits[GGML_TYPE_Q4_0].to_float        = (ggml_to_float_t) dequantize_row_q4_0;
+    traits[GGML_TYPE_Q4_0].vec_dot         = ggml_vec_dot_q4_0_q8_0;
+    traits[GGML_TYPE_Q4_0].vec_dot_tile    = ggml_vec_dot_q4_0_q8_0_tile;
+    traits[GGML_TYPE_Q4_0].vec_dot_tile_nr = QK_TILE_NR;
+    traits[GGML_TYPE_Q4_0].vec_dot_tile_nc = QK_TILE_NC;
+
+    traits[GGML_TYPE_Q4_1].to_float        = (ggml_to_float_t) dequantize_row_q4_1;
+    traits[GGML_TYPE_Q4_1].vec_dot         = ggml_vec_dot_q4_1_q8_1;
+
+    traits[GGML_TYPE_Q5_0].to_float        = (ggml_to_float_t) dequantize_row_q5_0;
+    traits[GGML_TYPE_Q5_0].vec_dot         = ggml_vec_dot_q5_0_q8_0;
+
+    traits[GGML_TYPE_Q5_1].to_float        = (ggml_to_float_t) dequantize_row_q5_1;
+    traits[GGML_TYPE_Q5_1].vec_dot         = ggml_vec_dot_q5_1_q8_1;
+
+    traits[GGML_TYPE_Q8_0].to_float        = (ggml_to_float_t) dequantize_row_q8_0;
+    traits[GGML_TYPE_Q8_0].from_float      = quantize_row_q8_0;
+    traits[GGML_TYPE_Q8_0].vec_dot         = ggml_vec_dot_q8_0_q8_0;
+    traits[GGML_TYPE_Q8_0].vec_dot_tile    = ggml_vec_dot_q8_0_q8_0_tile;
+    traits[GGML_TYPE_Q8_0].vec_dot_tile_nr = QK_TILE_NR;
+    traits[GGML_TYPE_Q8_0].vec_dot_tile_nc = QK_TILE_NC;
+
+    traits[GGML_TYPE_Q8_1].from_float      = quantize_row_q8_1;
+
+    traits[GGML_TYPE_Q2_K].to_float        = (ggml_to_float_t) dequantize_row_q2_K;
+    traits[GGML_TYPE_Q2_K].vec_dot         = ggml_vec_dot_q2_K_q8_K;
+
+    traits[GGML_TYPE_Q3_K].to_float        = (ggml_to_float_t) dequantize_row_q3_K;
+    traits[GGML_TYPE_Q3_K].vec_dot         = ggml_vec_dot_q3_K_q8_K;
+
+    traits[GGML_TYPE_Q4_K].to_float        = (ggml_to_float_t) dequantize_row_q4_K;
+    traits[GGML_TYPE_Q4_K].vec_dot         = ggml_vec_dot_q4_K_q8_K;
+    traits[GGML_TYPE_Q4_K].vec_dot_tile    = ggml_vec_dot_q4_K_q8_K_tile;
+    traits[GGML_TYPE_Q4_K].vec_dot_tile_nr = QK_TILE_NR;
+    traits[GGML_TYPE_Q4_K].vec_dot_tile_nc = QK_TILE_NC;
+
+    traits[GGML_TYPE_Q5_K].to_float        = (ggml_to_float_t) dequantize_row_q5_K;
+    traits[GGML_TYPE_Q5_K].vec_dot         = ggml_vec_dot_q5_K_q8_K;
+
+    traits[GGML_TYPE_Q6_K].to_float        = (ggml_to_float_t) dequantize_row_q6_K;
+    traits[GGML_TYPE_Q6_K].vec_dot         = ggml_vec_dot_q6_K_q8_K;
+
+    traits[GGML_TYPE_Q4_0_X4].vec_dot_tile    = ggml_gemm_q4_0_x4_q8_0;
+    traits[GGML_TYPE_Q4_0_X4].vec_dot_tile_1  = ggml_gemv_q4_0_x4_q8_0;
+    traits[GGML_TYPE_Q4_0_X4].vec_dot_tile_nr = QK_TILE_NR;
+    traits[GGML_TYPE_Q4_0_X4].vec_dot_tile_nc = QK_TILE_NC;
+
+    traits[GGML_TYPE_Q8_0_X4].vec_dot_tile    = ggml_gemm_q8_0_x4_q8_0;
+    traits[GGML_TYPE_Q8_0_X4].vec_dot_tile_1  = ggml_gemv_q8_0_x4_q8_0;
+    traits[GGML_TYPE_Q8_0_X4].vec_dot_tile_nr = QK_TILE_NR;
+    traits[GGML_TYPE_Q8_0_X4].vec_dot_tile_nc = QK_TILE_NC;
+
+    traits[GGML_TYPE_Q4_K_X4].vec_dot_tile    = ggml_gemm_q4_K_x4_q8_K;
+    traits[GGML_TYPE_Q4_K_X4].vec_dot_tile_1  = ggml_gemv_q4_K_x4_q8_K;
+    traits[GGML_TYPE_Q4_K_X4].vec_dot_tile_nr = QK_TILE_NR;
+    traits[GGML_TYPE_Q4_K_X4].vec_dot_tile_nc = QK_TILE_NC;
+
+    traits[GGML_TYPE_BF16].vec_dot            = ggml_vec_dot_bf16;
+}
+#endif
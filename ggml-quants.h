@@ -1,5 +1,88 @@
 #pragma once
 
+// when GGML_QUANTS_VARIANT is defined, ggml-quants.c is compiled once more for an additional instruction set
+// the exported functions get the variant as a suffix, so that several builds can be linked into the same binary
+// and ggml_init() can pick the best one supported by the CPU (see GGML_USE_CPU_DISPATCH in ggml.c)
+#ifdef GGML_QUANTS_VARIANT
+#define GGML_QUANTS_NAME_IMPL(name, variant) name ## _ ## variant
+#define GGML_QUANTS_NAME_EXP(name, variant)  GGML_QUANTS_NAME_IMPL(name, variant)
+#define GGML_QUANTS_NAME(name)               GGML_QUANTS_NAME_EXP(name, GGML_QUANTS_VARIANT)
+
+#define quantize_row_q4_0_reference GGML_QUANTS_NAME(quantize_row_q4_0_reference)
+#define quantize_row_q4_1_reference GGML_QUANTS_NAME(quantize_row_q4_1_reference)
+#define quantize_row_q5_0_reference GGML_QUANTS_NAME(quantize_row_q5_0_reference)
+#define quantize_row_q5_1_reference GGML_QUANTS_NAME(quantize_row_q5_1_reference)
+#define quantize_row_q8_0_reference GGML_QUANTS_NAME(quantize_row_q8_0_reference)
+#define quantize_row_q8_1_reference GGML_QUANTS_NAME(quantize_row_q8_1_reference)
+
+#define quantize_row_q2_K_reference GGML_QUANTS_NAME(quantize_row_q2_K_reference)
+#define quantize_row_q3_K_reference GGML_QUANTS_NAME(quantize_row_q3_K_reference)
+#define quantize_row_q4_K_reference GGML_QUANTS_NAME(quantize_row_q4_K_reference)
+#define quantize_row_q5_K_reference GGML_QUANTS_NAME(quantize_row_q5_K_reference)
+#define quantize_row_q6_K_reference GGML_QUANTS_NAME(quantize_row_q6_K_reference)
+#define quantize_row_q8_K_reference GGML_QUANTS_NAME(quantize_row_q8_K_reference)
+
+#define quantize_row_q4_0           GGML_QUANTS_NAME(quantize_row_q4_0)
+#define quantize_row_q4_1           GGML_QUANTS_NAME(quantize_row_q4_1)
+#define quantize_row_q5_0           GGML_QUANTS_NAME(quantize_row_q5_0)
+#define quantize_row_q5_1           GGML_QUANTS_NAME(quantize_row_q5_1)
+#define quantize_row_q8_0           GGML_QUANTS_NAME(quantize_row_q8_0)
+#define quantize_row_q8_1           GGML_QUANTS_NAME(quantize_row_q8_1)
+
+#define quantize_row_q2_K           GGML_QUANTS_NAME(quantize_row_q2_K)
+#define quantize_row_q3_K           GGML_QUANTS_NAME(quantize_row_q3_K)
+#define quantize_row_q4_K           GGML_QUANTS_NAME(quantize_row_q4_K)
+#define quantize_row_q5_K           GGML_QUANTS_NAME(quantize_row_q5_K)
+#define quantize_row_q6_K           GGML_QUANTS_NAME(quantize_row_q6_K)
+#define quantize_row_q8_K           GGML_QUANTS_NAME(quantize_row_q8_K)
+
+#define dequantize_row_q4_0         GGML_QUANTS_NAME(dequantize_row_q4_0)
+#define dequantize_row_q4_1         GGML_QUANTS_NAME(dequantize_row_q4_1)
+#define dequantize_row_q5_0         GGML_QUANTS_NAME(dequantize_row_q5_0)
+#define dequantize_row_q5_1         GGML_QUANTS_NAME(dequantize_row_q5_1)
+#define dequantize_row_q8_0         GGML_QUANTS_NAME(dequantize_row_q8_0)
+
+#define dequantize_row_q2_K         GGML_QUANTS_NAME(dequantize_row_q2_K)
+#define dequantize_row_q3_K         GGML_QUANTS_NAME(dequantize_row_q3_K)
+#define dequantize_row_q4_K         GGML_QUANTS_NAME(dequantize_row_q4_K)
+#define dequantize_row_q5_K         GGML_QUANTS_NAME(dequantize_row_q5_K)
+#define dequantize_row_q6_K         GGML_QUANTS_NAME(dequantize_row_q6_K)
+#define dequantize_row_q8_K         GGML_QUANTS_NAME(dequantize_row_q8_K)
+
+#define ggml_vec_dot_q4_0_q8_0      GGML_QUANTS_NAME(ggml_vec_dot_q4_0_q8_0)
+#define ggml_vec_dot_q4_1_q8_1      GGML_QUANTS_NAME(ggml_vec_dot_q4_1_q8_1)
+#define ggml_vec_dot_q5_0_q8_0      GGML_QUANTS_NAME(ggml_vec_dot_q5_0_q8_0)
+#define ggml_vec_dot_q5_1_q8_1      GGML_QUANTS_NAME(ggml_vec_dot_q5_1_q8_1)
+#define ggml_vec_dot_q8_0_q8_0      GGML_QUANTS_NAME(ggml_vec_dot_q8_0_q8_0)
+
+#define ggml_vec_dot_q2_K_q8_K      GGML_QUANTS_NAME(ggml_vec_dot_q2_K_q8_K)
+#define ggml_vec_dot_q3_K_q8_K      GGML_QUANTS_NAME(ggml_vec_dot_q3_K_q8_K)
+#define ggml_vec_dot_q4_K_q8_K      GGML_QUANTS_NAME(ggml_vec_dot_q4_K_q8_K)
+#define ggml_vec_dot_q5_K_q8_K      GGML_QUANTS_NAME(ggml_vec_dot_q5_K_q8_K)
+#define ggml_vec_dot_q6_K_q8_K      GGML_QUANTS_NAME(ggml_vec_dot_q6_K_q8_K)
+
+#define ggml_vec_dot_q4_0_q8_0_tile GGML_QUANTS_NAME(ggml_vec_dot_q4_0_q8_0_tile)
+#define ggml_vec_dot_q8_0_q8_0_tile GGML_QUANTS_NAME(ggml_vec_dot_q8_0_q8_0_tile)
+#define ggml_vec_dot_q4_K_q8_K_tile GGML_QUANTS_NAME(ggml_vec_dot_q4_K_q8_K_tile)
+
+#define ggml_gemv_q4_0_x4_q8_0      GGML_QUANTS_NAME(ggml_gemv_q4_0_x4_q8_0)
+#define ggml_gemm_q4_0_x4_q8_0      GGML_QUANTS_NAME(ggml_gemm_q4_0_x4_q8_0)
+#define ggml_gemv_q8_0_x4_q8_0      GGML_QUANTS_NAME(ggml_gemv_q8_0_x4_q8_0)
+#define ggml_gemm_q8_0_x4_q8_0      GGML_QUANTS_NAME(ggml_gemm_q8_0_x4_q8_0)
+#define ggml_gemv_q4_K_x4_q8_K      GGML_QUANTS_NAME(ggml_gemv_q4_K_x4_q8_K)
+#define ggml_gemm_q4_K_x4_q8_K      GGML_QUANTS_NAME(ggml_gemm_q4_K_x4_q8_K)
+
+#define ggml_vec_dot_bf16           GGML_QUANTS_NAME(ggml_vec_dot_bf16)
+
+#define ggml_quantize_q2_K          GGML_QUANTS_NAME(ggml_quantize_q2_K)
+#define ggml_quantize_q3_K          GGML_QUANTS_NAME(ggml_quantize_q3_K)
+#define ggml_quantize_q4_K          GGML_QUANTS_NAME(ggml_quantize_q4_K)
+#define ggml_quantize_q5_K          GGML_QUANTS_NAME(ggml_quantize_q5_K)
+#define ggml_quantize_q6_K          GGML_QUANTS_NAME(ggml_quantize_q6_K)
+
+#define ggml_quants_set_type_traits GGML_QUANTS_NAME(ggml_quants_set_type_traits)
+#endif
+
 #include "ggml-impl.h"
 
 // GGML internal header
@@ -222,3 +305,33 @@ void ggml_vec_dot_q3_K_q8_K(int n, float * restrict s, const void * restrict vx,
 void ggml_vec_dot_q4_K_q8_K(int n, float * restrict s, const void * restrict vx, const void * restrict vy);
 void ggml_vec_dot_q5_K_q8_K(int n, float * restrict s, const void * restrict vx, const void * restrict vy);
 void ggml_vec_dot_q6_K_q8_K(int n, float * restrict s, const void * restrict vx, const void * restrict vy);
+
+void ggml_vec_dot_bf16(int n, float * restrict s, const void * restrict vx, const void * restrict vy);
+
+// Dot products of a tile of QK_TILE_NR rows of x with QK_TILE_NC columns of y
+// s[c*bs + r] = dot(x + r*bx, y + c*by)
+#define QK_TILE_NR 4
+#if defined(__AVX512F__)
+// 32 vector registers are enough to keep a 4x4 tile of accumulators
+#define QK_TILE_NC 4
+#else
+#define QK_TILE_NC 2
+#endif
+
+void ggml_vec_dot_q4_0_q8_0_tile(int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by);
+void ggml_vec_dot_q8_0_q8_0_tile(int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by);
+void ggml_vec_dot_q4_K_q8_K_tile(int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by);
+
+// The same for the rows of x interleaved in groups of QK_TILE_NR (see ggml_repack), vx points to the first block of a group
+// and bx is unused. gemv computes a single column, gemm QK_TILE_NC columns.
+void ggml_gemv_q4_0_x4_q8_0(int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by);
+void ggml_gemm_q4_0_x4_q8_0(int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by);
+void ggml_gemv_q8_0_x4_q8_0(int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by);
+void ggml_gemm_q8_0_x4_q8_0(int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by);
+void ggml_gemv_q4_K_x4_q8_K(int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by);
+void ggml_gemm_q4_K_x4_q8_K(int n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, const void * restrict vy, size_t by);
+
+#ifdef GGML_QUANTS_VARIANT
+// install the kernels of this variant into the type traits
+void ggml_quants_set_type_traits(ggml_type_traits_t * traits);
+#endif
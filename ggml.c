@@ -94,12 +94,21 @@ typedef void * thread_ret_t;
 #include <sys/stat.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
 #endif
 
 #ifdef GGML_USE_CPU_HBM
 #include <hbwmalloc.h>
 #endif
 
+#if defined(GGML_USE_CPU_DISPATCH) && !defined(_MSC_VER)
+#include <cpuid.h>
+#endif
+
 /*#define GGML_PERF*/
 #define GGML_DEBUG 0
 #define GGML_GELU_FP16
@@ -109,6 +118,10 @@ typedef void * thread_ret_t;
 // #define GGML_FLASH_ATTN_EXP_FP16
 
 #define GGML_SOFT_MAX_UNROLL 4
+#define GGML_MUL_MAT_CHUNK_SIZE (32*1024) // target size in bytes of the src0 rows of a mul_mat work chunk
+#define GGML_SMALL_NODE_NELEMENTS 8192 // cheap element-wise nodes up to this size are computed by a single thread
+#define GGML_MAX_CONCURRENT       8    // max number of independent nodes computed at the same time
+#define GGML_CONCURRENT_LOOKAHEAD 32   // how far ggml_graph_reorder_concurrent() looks for independent nodes
 #define GGML_VEC_DOT_UNROLL  2
 #define GGML_VEC_MAD_UNROLL  32
 
@@ -282,6 +295,57 @@ void ggml_fp32_to_fp16_row(const float * x, ggml_fp16_t * y, int n) {
     }
 }
 
+float ggml_bf16_to_fp32(ggml_bf16_t x) {
+    return GGML_BF16_TO_FP32(x);
+}
+
+ggml_bf16_t ggml_fp32_to_bf16(float x) {
+    return GGML_FP32_TO_BF16(x);
+}
+
+void ggml_bf16_to_fp32_row(const ggml_bf16_t * x, float * y, int n) {
+    int i = 0;
+#if defined(__AVX512F__)
+    for (; i + 15 < n; i += 16) {
+        _mm512_storeu_ps(y + i, _mm512_castsi512_ps(_mm512_slli_epi32(
+                        _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(x + i))), 16)));
+    }
+#endif
+#if defined(__AVX2__)
+    for (; i + 7 < n; i += 8) {
+        _mm256_storeu_ps(y + i, _mm256_castsi256_ps(_mm256_slli_epi32(
+                        _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(x + i))), 16)));
+    }
+#endif
+    for (; i < n; i++) {
+        y[i] = GGML_BF16_TO_FP32(x[i]);
+    }
+}
+
+void ggml_fp32_to_bf16_row(const float * x, ggml_bf16_t * y, int n) {
+    int i = 0;
+#if defined(__AVX2__)
+    // same rounding as GGML_FP32_TO_BF16: vcvtneps2bf16 would flush the denormals to zero
+    const __m256i nan  = _mm256_set1_epi32(0x7f800000);
+    const __m256i abs  = _mm256_set1_epi32(0x7fffffff);
+    const __m256i bias = _mm256_set1_epi32(0x7fff);
+    const __m256i one  = _mm256_set1_epi32(1);
+    const __m256i quiet = _mm256_set1_epi32(64);
+    for (; i + 7 < n; i += 8) {
+        const __m256i w = _mm256_castps_si256(_mm256_loadu_ps(x + i));
+        const __m256i r = _mm256_srli_epi32(_mm256_add_epi32(w, _mm256_add_epi32(bias, _mm256_and_si256(_mm256_srli_epi32(w, 16), one))), 16);
+        const __m256i q = _mm256_or_si256(_mm256_srli_epi32(w, 16), quiet);
+        const __m256i h = _mm256_blendv_epi8(r, q, _mm256_cmpgt_epi32(_mm256_and_si256(w, abs), nan));
+        // the 16-bit results are in the low halves, packus keeps them in the order of the 128-bit lanes
+        const __m256i p = _mm256_permute4x64_epi64(_mm256_packus_epi32(h, h), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i *)(y + i), _mm256_castsi256_si128(p));
+    }
+#endif
+    for (; i < n; i++) {
+        y[i] = GGML_FP32_TO_BF16(x[i]);
+    }
+}
+
 //
 // timing
 //
@@ -309,6 +373,12 @@ int64_t ggml_time_us(void) {
     QueryPerformanceCounter(&t);
     return ((t.QuadPart-timer_start) * 1000000) / timer_freq;
 }
+int64_t ggml_time_ns(void) {
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    const int64_t ticks = t.QuadPart - timer_start;
+    return (ticks / timer_freq) * 1000000000 + ((ticks % timer_freq) * 1000000000) / timer_freq;
+}
 #else
 void ggml_time_init(void) {}
 int64_t ggml_time_ms(void) {
@@ -322,6 +392,12 @@ int64_t ggml_time_us(void) {
     clock_gettime(CLOCK_MONOTONIC, &ts);
     return (int64_t)ts.tv_sec*1000000 + (int64_t)ts.tv_nsec/1000;
 }
+
+int64_t ggml_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec*1000000000 + (int64_t)ts.tv_nsec;
+}
 #endif
 
 int64_t ggml_cycles(void) {
@@ -363,7 +439,7 @@ static const size_t CACHE_LINE_SIZE_F32 = CACHE_LINE_SIZE/sizeof(float);
 static void ggml_vec_dot_f32(const int n, float * restrict s, const float * restrict x, const float * restrict y);
 static void ggml_vec_dot_f16(const int n, float * restrict s, ggml_fp16_t * restrict x, ggml_fp16_t * restrict y);
 
-static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
+static ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
     [GGML_TYPE_I8] = {
         .type_name                = "i8",
         .blck_size                = 1,
@@ -401,6 +477,17 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .vec_dot                  = (ggml_vec_dot_t) ggml_vec_dot_f16,
         .vec_dot_type             = GGML_TYPE_F16,
     },
+    [GGML_TYPE_BF16] = {
+        .type_name                = "bf16",
+        .blck_size                = 1,
+        .type_size                = sizeof(ggml_bf16_t),
+        .is_quantized             = false,
+        .to_float                 = (ggml_to_float_t) ggml_bf16_to_fp32_row,
+        .from_float               = (ggml_from_float_t) ggml_fp32_to_bf16_row,
+        .from_float_reference     = (ggml_from_float_t) ggml_fp32_to_bf16_row,
+        .vec_dot                  = ggml_vec_dot_bf16,
+        .vec_dot_type             = GGML_TYPE_BF16,
+    },
     [GGML_TYPE_Q4_0] = {
         .type_name                = "q4_0",
         .blck_size                = QK4_0,
@@ -411,6 +498,9 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .from_float_reference     = (ggml_from_float_t) quantize_row_q4_0_reference,
         .vec_dot                  = ggml_vec_dot_q4_0_q8_0,
         .vec_dot_type             = GGML_TYPE_Q8_0,
+        .vec_dot_tile             = ggml_vec_dot_q4_0_q8_0_tile,
+        .vec_dot_tile_nr          = QK_TILE_NR,
+        .vec_dot_tile_nc          = QK_TILE_NC,
     },
     [GGML_TYPE_Q4_1] = {
         .type_name                = "q4_1",
@@ -477,6 +567,9 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .from_float_reference     = (ggml_from_float_t) quantize_row_q8_0_reference,
         .vec_dot                  = ggml_vec_dot_q8_0_q8_0,
         .vec_dot_type             = GGML_TYPE_Q8_0,
+        .vec_dot_tile             = ggml_vec_dot_q8_0_q8_0_tile,
+        .vec_dot_tile_nr          = QK_TILE_NR,
+        .vec_dot_tile_nc          = QK_TILE_NC,
     },
     [GGML_TYPE_Q8_1] = {
         .type_name                = "q8_1",
@@ -519,6 +612,9 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .from_float_reference     = (ggml_from_float_t) quantize_row_q4_K_reference,
         .vec_dot                  = ggml_vec_dot_q4_K_q8_K,
         .vec_dot_type             = GGML_TYPE_Q8_K,
+        .vec_dot_tile             = ggml_vec_dot_q4_K_q8_K_tile,
+        .vec_dot_tile_nr          = QK_TILE_NR,
+        .vec_dot_tile_nc          = QK_TILE_NC,
     },
     [GGML_TYPE_Q5_K] = {
         .type_name                = "q5_K",
@@ -547,8 +643,42 @@ static const ggml_type_traits_t type_traits[GGML_TYPE_COUNT] = {
         .blck_size                = QK_K,
         .type_size                = sizeof(block_q8_K),
         .is_quantized             = true,
+        .to_float                 = (ggml_to_float_t) dequantize_row_q8_K,
         .from_float               = quantize_row_q8_K,
-    }
+    },
+    [GGML_TYPE_Q4_0_X4] = {
+        .type_name                = "q4_0_x4",
+        .blck_size                = QK4_0,
+        .type_size                = sizeof(block_q4_0),
+        .is_quantized             = true,
+        .vec_dot_type             = GGML_TYPE_Q8_0,
+        .vec_dot_tile             = ggml_gemm_q4_0_x4_q8_0,
+        .vec_dot_tile_1           = ggml_gemv_q4_0_x4_q8_0,
+        .vec_dot_tile_nr          = QK_TILE_NR,
+        .vec_dot_tile_nc          = QK_TILE_NC,
+    },
+    [GGML_TYPE_Q8_0_X4] = {
+        .type_name                = "q8_0_x4",
+        .blck_size                = QK8_0,
+        .type_size                = sizeof(block_q8_0),
+        .is_quantized             = true,
+        .vec_dot_type             = GGML_TYPE_Q8_0,
+        .vec_dot_tile             = ggml_gemm_q8_0_x4_q8_0,
+        .vec_dot_tile_1           = ggml_gemv_q8_0_x4_q8_0,
+        .vec_dot_tile_nr          = QK_TILE_NR,
+        .vec_dot_tile_nc          = QK_TILE_NC,
+    },
+    [GGML_TYPE_Q4_K_X4] = {
+        .type_name                = "q4_K_x4",
+        .blck_size                = QK_K,
+        .type_size                = sizeof(block_q4_K),
+        .is_quantized             = true,
+        .vec_dot_type             = GGML_TYPE_Q8_K,
+        .vec_dot_tile             = ggml_gemm_q4_K_x4_q8_K,
+        .vec_dot_tile_1           = ggml_gemv_q4_K_x4_q8_K,
+        .vec_dot_tile_nr          = QK_TILE_NR,
+        .vec_dot_tile_nc          = QK_TILE_NC,
+    },
 };
 
 // For internal test use
@@ -557,6 +687,186 @@ ggml_type_traits_t ggml_internal_get_type_traits(enum ggml_type type) {
     return type_traits[type];
 }
 
+//
+// runtime selection of the quantized kernels
+//
+
+#define GGML_CPU_FEATURE_AVX         (1 << 0)
+#define GGML_CPU_FEATURE_AVX2        (1 << 1)
+#define GGML_CPU_FEATURE_FMA         (1 << 2)
+#define GGML_CPU_FEATURE_F16C        (1 << 3)
+#define GGML_CPU_FEATURE_AVX512      (1 << 4)
+#define GGML_CPU_FEATURE_AVX512_VNNI (1 << 5)
+#define GGML_CPU_FEATURE_AVX512_BF16 (1 << 6)
+
+#if defined(GGML_USE_CPU_DISPATCH)
+
+// ggml-quants.c is compiled once for each of these, see GGML_QUANTS_VARIANT in ggml-quants.h
+void ggml_quants_set_type_traits_avx2       (ggml_type_traits_t * traits);
+void ggml_quants_set_type_traits_avx512     (ggml_type_traits_t * traits);
+void ggml_quants_set_type_traits_avx512_vnni(ggml_type_traits_t * traits);
+void ggml_quants_set_type_traits_avx512_bf16(ggml_type_traits_t * traits);
+
+struct ggml_cpu_kernels {
+    const char * name;
+    int          features; // GGML_CPU_FEATURE_* the kernels were compiled with
+    void      (* set_type_traits)(ggml_type_traits_t * traits);
+};
+
+#define GGML_CPU_FEATURES_AVX2 (GGML_CPU_FEATURE_AVX | GGML_CPU_FEATURE_AVX2 | GGML_CPU_FEATURE_FMA | GGML_CPU_FEATURE_F16C)
+
+// in order of preference
+static const struct ggml_cpu_kernels ggml_cpu_kernels_list[] = {
+    { "avx512_bf16", GGML_CPU_FEATURES_AVX2 | GGML_CPU_FEATURE_AVX512 | GGML_CPU_FEATURE_AVX512_VNNI | GGML_CPU_FEATURE_AVX512_BF16, ggml_quants_set_type_traits_avx512_bf16 },
+    { "avx512_vnni", GGML_CPU_FEATURES_AVX2 | GGML_CPU_FEATURE_AVX512 | GGML_CPU_FEATURE_AVX512_VNNI, ggml_quants_set_type_traits_avx512_vnni },
+    { "avx512",      GGML_CPU_FEATURES_AVX2 | GGML_CPU_FEATURE_AVX512,                                ggml_quants_set_type_traits_avx512      },
+    { "avx2",        GGML_CPU_FEATURES_AVX2,                                                          ggml_quants_set_type_traits_avx2        },
+};
+
+static void ggml_cpuid(int leaf, int subleaf, uint32_t regs[4]) {
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, leaf, subleaf);
+    for (int i = 0; i < 4; ++i) {
+        regs[i] = (uint32_t) r[i];
+    }
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t ggml_xgetbv(void) {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t eax;
+    uint32_t edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t) edx << 32) | eax;
+#endif
+}
+
+static int ggml_cpu_get_features(void) {
+    uint32_t regs[4];
+
+    ggml_cpuid(0, 0, regs);
+    const uint32_t max_leaf = regs[0];
+    if (max_leaf < 7) {
+        return 0;
+    }
+
+    ggml_cpuid(1, 0, regs);
+    const uint32_t ecx1 = regs[2];
+
+    // the OS must save the YMM (and ZMM) registers on context switches
+    if (!(ecx1 & (1u << 27))) {
+        return 0;
+    }
+    const uint64_t xcr0 = ggml_xgetbv();
+    const bool os_avx    = (xcr0 & 0x06) == 0x06;
+    const bool os_avx512 = (xcr0 & 0xe6) == 0xe6;
+
+    ggml_cpuid(7, 0, regs);
+    const uint32_t max_subleaf7 = regs[0];
+    const uint32_t ebx7 = regs[1];
+    const uint32_t ecx7 = regs[2];
+
+    uint32_t eax7_1 = 0;
+    if (max_subleaf7 >= 1) {
+        ggml_cpuid(7, 1, regs);
+        eax7_1 = regs[0];
+    }
+
+    int features = 0;
+    if (os_avx) {
+        if (ecx1 & (1u << 28)) features |= GGML_CPU_FEATURE_AVX;
+        if (ecx1 & (1u << 12)) features |= GGML_CPU_FEATURE_FMA;
+        if (ecx1 & (1u << 29)) features |= GGML_CPU_FEATURE_F16C;
+        if (ebx7 & (1u <<  5)) features |= GGML_CPU_FEATURE_AVX2;
+    }
+    if (os_avx512) {
+        // the AVX-512 kernels need both the foundation and the byte/word instructions
+        if ((ebx7 & (1u << 16)) && (ebx7 & (1u << 30))) features |= GGML_CPU_FEATURE_AVX512;
+        if (ecx7 & (1u << 11))                           features |= GGML_CPU_FEATURE_AVX512_VNNI;
+        if (eax7_1 & (1u << 5))                          features |= GGML_CPU_FEATURE_AVX512_BF16;
+    }
+
+    return features;
+}
+
+// the best kernels supported by the CPU, or NULL to keep the ones ggml-quants.c was compiled with
+// the selection can be lowered by setting GGML_CPU_KERNELS to the name of other kernels, or to "base"
+static const struct ggml_cpu_kernels * ggml_cpu_select_kernels(void) {
+    const int features = ggml_cpu_get_features();
+    const char * name = getenv("GGML_CPU_KERNELS");
+
+    for (size_t i = 0; i < sizeof(ggml_cpu_kernels_list)/sizeof(ggml_cpu_kernels_list[0]); ++i) {
+        const struct ggml_cpu_kernels * kernels = &ggml_cpu_kernels_list[i];
+        if ((kernels->features & features) != kernels->features) {
+            continue;
+        }
+        if (name != NULL && *name != '\0' && strcmp(name, kernels->name) != 0) {
+            continue;
+        }
+        return kernels;
+    }
+
+    return NULL;
+}
+
+static void ggml_cpu_init_kernels(void) {
+    const struct ggml_cpu_kernels * kernels = ggml_cpu_select_kernels();
+    if (kernels != NULL) {
+        kernels->set_type_traits(type_traits);
+    }
+
+    // a misspelled or unsupported name falls back to the compiled kernels, which benchmarks must not take for the asked ones
+    const char * name = getenv("GGML_CPU_KERNELS");
+    if (kernels == NULL && name != NULL && *name != '\0' && strcmp(name, "base") != 0) {
+        char supported[128] = "base";
+        const int features = ggml_cpu_get_features();
+        for (size_t i = 0; i < sizeof(ggml_cpu_kernels_list)/sizeof(ggml_cpu_kernels_list[0]); ++i) {
+            if ((ggml_cpu_kernels_list[i].features & features) == ggml_cpu_kernels_list[i].features) {
+                strncat(supported, ", ",                        sizeof(supported) - strlen(supported) - 1);
+                strncat(supported, ggml_cpu_kernels_list[i].name, sizeof(supported) - strlen(supported) - 1);
+            }
+        }
+        fprintf(stderr, "%s: warning: GGML_CPU_KERNELS=%s does not name kernels supported by this CPU (%s), using the base kernels\n",
+                __func__, name, supported);
+    }
+}
+
+// 1 if the selected kernels use the given GGML_CPU_FEATURE_*
+inline static int ggml_cpu_kernels_have(int feature) {
+    const struct ggml_cpu_kernels * kernels = ggml_cpu_select_kernels();
+    return kernels != NULL && (kernels->features & feature) ? 1 : 0;
+}
+
+const char * ggml_cpu_kernels_name(void) {
+    const struct ggml_cpu_kernels * kernels = ggml_cpu_select_kernels();
+    return kernels != NULL ? kernels->name : "base";
+}
+
+#else
+
+static void ggml_cpu_init_kernels(void) {
+    const char * name = getenv("GGML_CPU_KERNELS");
+    if (name != NULL && *name != '\0' && strcmp(name, "base") != 0) {
+        fprintf(stderr, "%s: warning: GGML_CPU_KERNELS=%s is ignored, ggml was built without LLAMA_CPU_DISPATCH\n", __func__, name);
+    }
+}
+
+inline static int ggml_cpu_kernels_have(int feature) {
+    GGML_UNUSED(feature);
+    return 0;
+}
+
+const char * ggml_cpu_kernels_name(void) {
+    return "base";
+}
+
+#endif
+
 //
 // simd mappings
 //
@@ -1087,6 +1397,7 @@ inline static void ggml_vec_set_i16(const int n, int16_t * x, const int16_t v) {
 inline static void ggml_vec_set_i32(const int n, int32_t * x, const int32_t v) { for (int i = 0; i < n; ++i) x[i] = v; }
 
 inline static void ggml_vec_set_f16(const int n, ggml_fp16_t * x, const int32_t v) { for (int i = 0; i < n; ++i) x[i] = v; }
+inline static void ggml_vec_set_bf16(const int n, ggml_bf16_t * x, const ggml_bf16_t v) { for (int i = 0; i < n; ++i) x[i] = v; }
 
 inline static void ggml_vec_add_f32 (const int n, float * z, const float * x, const float * y) { for (int i = 0; i < n; ++i) z[i]  = x[i] + y[i]; }
 inline static void ggml_vec_add1_f32(const int n, float * z, const float * x, const float   v) { for (int i = 0; i < n; ++i) z[i]  = x[i] + v;    }
@@ -1342,6 +1653,39 @@ inline static void ggml_vec_scale_f32(const int n, float * y, const float   v) {
 #endif
 }
 
+// z = (x*v)*y, rounded like ggml_vec_scale_f32 followed by ggml_vec_mul_f32
+inline static void ggml_vec_scale_mul_f32(const int n, float * z, const float * x, const float v, const float * y) {
+#if defined(GGML_SIMD)
+    const int np = (n & ~(GGML_F32_STEP - 1));
+
+    GGML_F32_VEC vv = GGML_F32_VEC_SET1(v);
+
+    GGML_F32_VEC ax[GGML_F32_ARR];
+    GGML_F32_VEC ay[GGML_F32_ARR];
+
+    for (int i = 0; i < np; i += GGML_F32_STEP) {
+        for (int j = 0; j < GGML_F32_ARR; j++) {
+            ax[j] = GGML_F32_VEC_LOAD(x + i + j*GGML_F32_EPR);
+            ay[j] = GGML_F32_VEC_LOAD(y + i + j*GGML_F32_EPR);
+            ax[j] = GGML_F32_VEC_MUL(ax[j], vv);
+            ax[j] = GGML_F32_VEC_MUL(ax[j], ay[j]);
+
+            GGML_F32_VEC_STORE(z + i + j*GGML_F32_EPR, ax[j]);
+        }
+    }
+
+    // leftovers
+    for (int i = np; i < n; ++i) {
+        z[i] = (x[i]*v)*y[i];
+    }
+#else
+    // scalar
+    for (int i = 0; i < n; ++i) {
+        z[i] = (x[i]*v)*y[i];
+    }
+#endif
+}
+
 inline static void ggml_vec_norm_f32 (const int n, float * s, const float * x) { ggml_vec_dot_f32(n, s, x, x); *s = sqrtf(*s);   }
 inline static void ggml_vec_sqr_f32  (const int n, float * y, const float * x) { for (int i = 0; i < n; ++i) y[i] = x[i]*x[i];   }
 inline static void ggml_vec_sqrt_f32 (const int n, float * y, const float * x) { for (int i = 0; i < n; ++i) y[i] = sqrtf(x[i]); }
@@ -1520,6 +1864,140 @@ inline static void ggml_vec_argmax_f32(const int n, int * s, const float * x) {
     *s = idx;
 }
 
+// vectorized expf, within 1 ulp of expf for the float range
+// exp(x) = 2^n*exp(b), with n = round(x/ln2) and b = x - n*ln2, and exp(b) - 1 computed as a polynomial of b
+// 2^n is built in the exponent bits, the inputs with |n| > 126 are scaled in two steps and underflow to 0 or overflow to inf
+// -INFINITY gives 0, as needed by the masked positions of soft_max
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+
+inline static float32x4_t ggml_v_expf(float32x4_t x) {
+    const float32x4_t r = vdupq_n_f32(0x1.8p23f);
+    const float32x4_t z = vfmaq_f32(r, x, vdupq_n_f32(0x1.715476p+0f));
+    const float32x4_t n = vsubq_f32(z, r);
+    const float32x4_t b = vfmsq_f32(vfmsq_f32(x, n, vdupq_n_f32(0x1.62e4p-1f)), n,
+                                    vdupq_n_f32(0x1.7f7d1cp-20f));
+    const uint32x4_t e = vshlq_n_u32(vreinterpretq_u32_f32(z), 23);
+    const float32x4_t k = vreinterpretq_f32_u32(vaddq_u32(e, vreinterpretq_u32_f32(vdupq_n_f32(1))));
+    const uint32x4_t c = vcagtq_f32(n, vdupq_n_f32(126));
+    const float32x4_t u = vmulq_f32(b, b);
+    const float32x4_t j = vfmaq_f32(
+        vmulq_f32(vdupq_n_f32(0x1.ffffecp-1f), b),
+        vfmaq_f32(vfmaq_f32(vdupq_n_f32(0x1.fffdb6p-2f), vdupq_n_f32(0x1.555e66p-3f), b),
+                  vfmaq_f32(vdupq_n_f32(0x1.573e2ep-5f), vdupq_n_f32(0x1.0e4020p-7f), b), u), u);
+    if (!vpaddd_u64(vreinterpretq_u64_u32(c))) {
+        return vfmaq_f32(k, j, k);
+    }
+    const uint32x4_t d = vandq_u32(vclezq_f32(n), vdupq_n_u32(0x82000000));
+    const float32x4_t s1 = vreinterpretq_f32_u32(vaddq_u32(d, vdupq_n_u32(0x7f000000)));
+    const float32x4_t s2 = vreinterpretq_f32_u32(vsubq_u32(e, d));
+    return vbslq_f32(vcagtq_f32(n, vdupq_n_f32(192)), vmulq_f32(s1, s1),
+                     vbslq_f32(c, vmulq_f32(vfmaq_f32(s2, s2, j), s1), vfmaq_f32(k, k, j)));
+}
+
+#elif defined(__AVX512F__) && defined(__AVX512DQ__)
+
+inline static __m512 ggml_v_expf(__m512 x) {
+    const __m512 r = _mm512_set1_ps(0x1.8p23f);
+    const __m512 z = _mm512_fmadd_ps(x, _mm512_set1_ps(0x1.715476p+0f), r);
+    const __m512 n = _mm512_sub_ps(z, r);
+    const __m512 b = _mm512_fnmadd_ps(n, _mm512_set1_ps(0x1.7f7d1cp-20f),
+                                      _mm512_fnmadd_ps(n, _mm512_set1_ps(0x1.62e4p-1f), x));
+    const __m512i e = _mm512_slli_epi32(_mm512_castps_si512(z), 23);
+    const __m512 k = _mm512_castsi512_ps(_mm512_add_epi32(e, _mm512_castps_si512(_mm512_set1_ps(1))));
+    const __mmask16 c = _mm512_cmp_ps_mask(_mm512_abs_ps(n), _mm512_set1_ps(126), _CMP_GT_OQ);
+    const __m512 u = _mm512_mul_ps(b, b);
+    const __m512 j = _mm512_fmadd_ps(_mm512_fmadd_ps(_mm512_fmadd_ps(_mm512_set1_ps(0x1.0e4020p-7f), b,
+                                                                     _mm512_set1_ps(0x1.573e2ep-5f)), u,
+                                                     _mm512_fmadd_ps(_mm512_set1_ps(0x1.555e66p-3f), b,
+                                                                     _mm512_set1_ps(0x1.fffdb6p-2f))),
+                                     u, _mm512_mul_ps(_mm512_set1_ps(0x1.ffffecp-1f), b));
+    if (_mm512_kortestz(c, c)) {
+        return _mm512_fmadd_ps(j, k, k);
+    }
+    const __m512i g = _mm512_and_si512(
+        _mm512_movm_epi32(_mm512_cmp_ps_mask(n, _mm512_setzero_ps(), _CMP_LE_OQ)),
+        _mm512_set1_epi32(0x82000000u));
+    const __m512 s1 = _mm512_castsi512_ps(_mm512_add_epi32(g, _mm512_set1_epi32(0x7f000000u)));
+    const __m512 s2 = _mm512_castsi512_ps(_mm512_sub_epi32(e, g));
+    const __mmask16 d = _mm512_cmp_ps_mask(_mm512_abs_ps(n), _mm512_set1_ps(192), _CMP_GT_OQ);
+    return _mm512_mask_blend_ps(
+        d, _mm512_mask_blend_ps(c, _mm512_fmadd_ps(k, j, k), _mm512_mul_ps(_mm512_fmadd_ps(s2, j, s2), s1)),
+        _mm512_mul_ps(s1, s1));
+}
+
+#elif defined(__AVX2__) && defined(__FMA__)
+
+inline static __m256 ggml_v_expf(__m256 x) {
+    const __m256 r = _mm256_set1_ps(0x1.8p23f);
+    const __m256 z = _mm256_fmadd_ps(x, _mm256_set1_ps(0x1.715476p+0f), r);
+    const __m256 n = _mm256_sub_ps(z, r);
+    const __m256 b = _mm256_fnmadd_ps(n, _mm256_set1_ps(0x1.7f7d1cp-20f),
+                                      _mm256_fnmadd_ps(n, _mm256_set1_ps(0x1.62e4p-1f), x));
+    const __m256i e = _mm256_slli_epi32(_mm256_castps_si256(z), 23);
+    const __m256 k = _mm256_castsi256_ps(_mm256_add_epi32(e, _mm256_castps_si256(_mm256_set1_ps(1))));
+    const __m256i c = _mm256_castps_si256(_mm256_cmp_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.f), n),
+                                                        _mm256_set1_ps(126), _CMP_GT_OQ));
+    const __m256 u = _mm256_mul_ps(b, b);
+    const __m256 j = _mm256_fmadd_ps(_mm256_fmadd_ps(_mm256_fmadd_ps(_mm256_set1_ps(0x1.0e4020p-7f), b,
+                                                                     _mm256_set1_ps(0x1.573e2ep-5f)), u,
+                                                     _mm256_fmadd_ps(_mm256_set1_ps(0x1.555e66p-3f), b,
+                                                                     _mm256_set1_ps(0x1.fffdb6p-2f))),
+                                     u, _mm256_mul_ps(_mm256_set1_ps(0x1.ffffecp-1f), b));
+    if (!_mm256_movemask_ps(_mm256_castsi256_ps(c))) {
+        return _mm256_fmadd_ps(j, k, k);
+    }
+    const __m256i g = _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(n, _mm256_setzero_ps(), _CMP_LE_OQ)),
+                                       _mm256_set1_epi32(0x82000000u));
+    const __m256 s1 = _mm256_castsi256_ps(_mm256_add_epi32(g, _mm256_set1_epi32(0x7f000000u)));
+    const __m256 s2 = _mm256_castsi256_ps(_mm256_sub_epi32(e, g));
+    const __m256i d = _mm256_castps_si256(_mm256_cmp_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.f), n),
+                                                        _mm256_set1_ps(192), _CMP_GT_OQ));
+    return _mm256_or_ps(
+        _mm256_and_ps(_mm256_castsi256_ps(d), _mm256_mul_ps(s1, s1)),
+        _mm256_andnot_ps(
+            _mm256_castsi256_ps(d),
+            _mm256_or_ps(
+                _mm256_and_ps(_mm256_castsi256_ps(c), _mm256_mul_ps(_mm256_fmadd_ps(s2, j, s2), s1)),
+                _mm256_andnot_ps(_mm256_castsi256_ps(c), _mm256_fmadd_ps(k, j, k)))));
+}
+
+#endif
+
+// y[i] = exp(x[i] - max), returns the sum of y
+static ggml_float ggml_vec_soft_max_f32(const int n, float * y, const float * x, float max) {
+    int i = 0;
+    ggml_float sum = 0.0;
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 3 < n; i += 4) {
+        float32x4_t val = ggml_v_expf(vsubq_f32(vld1q_f32(x + i), vdupq_n_f32(max)));
+        vst1q_f32(y + i, val);
+        sum += (ggml_float)vaddvq_f32(val);
+    }
+#elif defined(__AVX512F__) && defined(__AVX512DQ__)
+    for (; i + 15 < n; i += 16) {
+        __m512 val = ggml_v_expf(_mm512_sub_ps(_mm512_loadu_ps(x + i), _mm512_set1_ps(max)));
+        _mm512_storeu_ps(y + i, val);
+        sum += (ggml_float)_mm512_reduce_add_ps(val);
+    }
+#elif defined(__AVX2__) && defined(__FMA__)
+    for (; i + 7 < n; i += 8) {
+        __m256 val = ggml_v_expf(_mm256_sub_ps(_mm256_loadu_ps(x + i), _mm256_set1_ps(max)));
+        _mm256_storeu_ps(y + i, val);
+        __m128 val2 = _mm_add_ps(_mm256_extractf128_ps(val, 1), _mm256_castps256_ps128(val));
+        val2 = _mm_add_ps(val2, _mm_movehl_ps(val2, val2));
+        val2 = _mm_add_ss(val2, _mm_movehdup_ps(val2));
+        sum += (ggml_float)_mm_cvtss_f32(val2);
+    }
+#endif
+    for (; i < n; ++i) {
+        const float val = expf(x[i] - max);
+        sum += (ggml_float)val;
+        y[i] = val;
+    }
+    return sum;
+}
+
 //
 // data types
 //
@@ -1549,6 +2027,9 @@ static const char * GGML_OP_NAME[GGML_OP_COUNT] = {
     "RMS_NORM",
     "RMS_NORM_BACK",
     "GROUP_NORM",
+    "RMS_NORM_MUL",
+    "ADD_RMS_NORM",
+    "SWIGLU",
 
     "MUL_MAT",
     "OUT_PROD",
@@ -1563,6 +2044,7 @@ static const char * GGML_OP_NAME[GGML_OP_COUNT] = {
     "TRANSPOSE",
     "GET_ROWS",
     "GET_ROWS_BACK",
+    "SET_ROWS",
     "DIAG",
     "DIAG_MASK_INF",
     "DIAG_MASK_ZERO",
@@ -1585,6 +2067,7 @@ static const char * GGML_OP_NAME[GGML_OP_COUNT] = {
     "UPSCALE",
 
     "FLASH_ATTN",
+    "FLASH_ATTN_EXT",
     "FLASH_FF",
     "FLASH_ATTN_BACK",
     "WIN_PART",
@@ -1609,7 +2092,7 @@ static const char * GGML_OP_NAME[GGML_OP_COUNT] = {
     "CROSS_ENTROPY_LOSS_BACK",
 };
 
-static_assert(GGML_OP_COUNT == 73, "GGML_OP_COUNT != 73");
+static_assert(GGML_OP_COUNT == 78, "GGML_OP_COUNT != 78");
 
 static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "none",
@@ -1636,6 +2119,9 @@ static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "rms_norm(x)",
     "rms_norm_back(x)",
     "group_norm(x)",
+    "rms_norm_mul(x)",
+    "add_rms_norm(x)",
+    "swiglu(x)",
 
     "X*Y",
     "X*Y",
@@ -1650,6 +2136,7 @@ static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "transpose(x)",
     "get_rows(x)",
     "get_rows_back(x)",
+    "set_rows(x)",
     "diag(x)",
     "diag_mask_inf(x)",
     "diag_mask_zero(x)",
@@ -1672,6 +2159,7 @@ static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "upscale(x)",
 
     "flash_attn(x)",
+    "flash_attn_ext(x)",
     "flash_ff(x)",
     "flash_attn_back(x)",
     "win_part(x)",
@@ -1696,13 +2184,22 @@ static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "cross_entropy_loss_back(x,y)",
 };
 
-static_assert(GGML_OP_COUNT == 73, "GGML_OP_COUNT != 73");
+static_assert(GGML_OP_COUNT == 78, "GGML_OP_COUNT != 78");
 
 static_assert(GGML_OP_POOL_COUNT == 2, "GGML_OP_POOL_COUNT != 2");
 
 static_assert(sizeof(struct ggml_object)%GGML_MEM_ALIGN == 0, "ggml_object size must be a multiple of GGML_MEM_ALIGN");
 static_assert(sizeof(struct ggml_tensor)%GGML_MEM_ALIGN == 0, "ggml_tensor size must be a multiple of GGML_MEM_ALIGN");
 
+// returns the index of the next chunk of work of the current node that has not been taken by another thread
+static int ggml_graph_compute_next_chunk(const struct ggml_compute_params * params);
+
+// same, for the chunks of the rows of a mul_mat that are placed on a NUMA node
+static int ggml_graph_compute_next_numa_chunk(const struct ggml_compute_params * params, int node);
+
+// the NUMA node of the thread, -1 if there are no placed weights or the thread is not from ggml_graph_compute
+static int ggml_graph_compute_numa_node(const struct ggml_compute_params * params);
+
 // WARN:
 // Mis-confguration can lead to problem that's hard to reason about:
 // * At best  it crash or talks nosense.
@@ -1713,6 +2210,13 @@ static_assert(sizeof(struct ggml_tensor)%GGML_MEM_ALIGN == 0, "ggml_tensor size
 static bool GGML_OP_HAS_INIT    [GGML_OP_COUNT] = { 0 };
 static bool GGML_OP_HAS_FINALIZE[GGML_OP_COUNT] = { 0 };
 
+// ops whose INIT and FINALIZE passes are split across all n_tasks threads using params->ith/nth
+// the other ops run these passes on a single thread
+static bool GGML_OP_HAS_PARALLEL_PASS[GGML_OP_COUNT] = { 0 };
+
+// ops that can be computed at the same time as independent nodes of the same op, on separate threads
+static bool GGML_OP_CAN_CONCURRENT[GGML_OP_COUNT] = { 0 };
+
 static void ggml_setup_op_has_task_pass(void) {
     {   // INIT
         bool * p = GGML_OP_HAS_INIT;
@@ -1742,8 +2246,51 @@ static void ggml_setup_op_has_task_pass(void) {
 
         p[GGML_OP_CROSS_ENTROPY_LOSS     ] = true;
     }
+
+    {   // PARALLEL INIT/FINALIZE
+        bool * p = GGML_OP_HAS_PARALLEL_PASS;
+
+        p[GGML_OP_MUL_MAT                ] = true;
+    }
+
+    {   // CONCURRENT
+        bool * p = GGML_OP_CAN_CONCURRENT;
+
+        p[GGML_OP_DUP                    ] = true;
+        p[GGML_OP_ADD                    ] = true;
+        p[GGML_OP_MUL                    ] = true;
+        p[GGML_OP_NORM                   ] = true;
+        p[GGML_OP_RMS_NORM               ] = true;
+        p[GGML_OP_RMS_NORM_MUL           ] = true;
+        p[GGML_OP_ADD_RMS_NORM           ] = true;
+        p[GGML_OP_SWIGLU                 ] = true;
+        p[GGML_OP_MUL_MAT                ] = true;
+        p[GGML_OP_CPY                    ] = true;
+        p[GGML_OP_SOFT_MAX               ] = true;
+        p[GGML_OP_ROPE                   ] = true;
+        p[GGML_OP_UNARY                  ] = true;
+    }
 }
 
+//
+// NUMA support
+//
+
+#define GGML_NUMA_MAX_NODES 8
+#define GGML_NUMA_MAX_CPUS 512
+
+struct ggml_numa_node {
+    uint32_t cpus[GGML_NUMA_MAX_CPUS]; // hardware threads on this node
+    uint32_t n_cpus;
+};
+
+struct ggml_numa_nodes {
+    struct ggml_numa_node nodes[GGML_NUMA_MAX_NODES];
+    uint32_t n_nodes;
+    uint32_t total_cpus; // hardware threads on system
+    int n_placed; // number of contexts with a placement, see ggml_numa_place()
+};
+
 //
 // ggml context
 //
@@ -1762,6 +2309,11 @@ struct ggml_context {
 
     struct ggml_scratch scratch;
     struct ggml_scratch scratch_save;
+
+    // placement of the first numa_size bytes of the buffer on the NUMA nodes, see ggml_numa_place()
+    enum ggml_numa_placement numa_placement;
+    size_t numa_size;
+    void * numa_replicas[GGML_NUMA_MAX_NODES]; // copy of the buffer on each node, [0] is mem_buffer
 };
 
 struct ggml_context_container {
@@ -1770,24 +2322,6 @@ struct ggml_context_container {
     struct ggml_context context;
 };
 
-//
-// NUMA support
-//
-
-#define GGML_NUMA_MAX_NODES 8
-#define GGML_NUMA_MAX_CPUS 512
-
-struct ggml_numa_node {
-    uint32_t cpus[GGML_NUMA_MAX_CPUS]; // hardware threads on this node
-    uint32_t n_cpus;
-};
-
-struct ggml_numa_nodes {
-    struct ggml_numa_node nodes[GGML_NUMA_MAX_NODES];
-    uint32_t n_nodes;
-    uint32_t total_cpus; // hardware threads on system
-};
-
 //
 // ggml state
 //
@@ -1888,63 +2422,221 @@ bool ggml_is_numa(void) {
     return g_state.numa.n_nodes > 1;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-
-void ggml_print_object(const struct ggml_object * obj) {
-    GGML_PRINT(" - ggml_object: type = %d, offset = %zu, size = %zu, next = %p\n",
-            obj->type, obj->offs, obj->size, (const void *) obj->next);
+int ggml_numa_n_nodes(void) {
+    return g_state.numa.n_nodes;
 }
 
-void ggml_print_objects(const struct ggml_context * ctx) {
-    struct ggml_object * obj = ctx->objects_begin;
-
-    GGML_PRINT("%s: objects in context %p:\n", __func__, (const void *) ctx);
+// the threads are spread over the nodes in contiguous groups, see set_numa_thread_affinity()
+static int ggml_numa_node_of_thread(int ith, int n_threads) {
+    return ith / ((n_threads + g_state.numa.n_nodes - 1) / g_state.numa.n_nodes);
+}
 
-    while (obj != NULL) {
-        ggml_print_object(obj);
-        obj = obj->next;
-    }
+// the rows [*ir0, *ir1) of a matrix with GGML_NUMA_PLACEMENT_INTERLEAVE are on node
+// the rows of the repacked types are kept in their groups
+static void ggml_numa_rows(const struct ggml_tensor * a, int node, int64_t * ir0, int64_t * ir1) {
+    const int64_t n_nodes = g_state.numa.n_nodes;
+    const int64_t ng = type_traits[a->type].vec_dot_tile_1 ? type_traits[a->type].vec_dot_tile_nr : 1;
+    const int64_t dr = (a->ne[1] + ng*n_nodes - 1)/(ng*n_nodes)*ng;
 
-    GGML_PRINT("%s: --- end ---\n", __func__);
+    *ir0 = MIN(dr*node,     a->ne[1]);
+    *ir1 = MIN(*ir0 + dr,   a->ne[1]);
 }
 
-int64_t ggml_nelements(const struct ggml_tensor * tensor) {
-    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
+#if defined(__linux__) && defined(SYS_mbind)
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
 
-    return tensor->ne[0]*tensor->ne[1]*tensor->ne[2]*tensor->ne[3];
-}
+// allocate the pages of [addr, addr + size) on node, the pages already faulted in are moved there
+static bool ggml_numa_bind(void * addr, size_t size, int node) {
+    const uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
 
-int64_t ggml_nrows(const struct ggml_tensor * tensor) {
-    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
+    const uintptr_t p0 = (uintptr_t) addr/page*page;
+    const uintptr_t p1 = ((uintptr_t) addr + size + page - 1)/page*page;
 
-    return tensor->ne[1]*tensor->ne[2]*tensor->ne[3];
+    const unsigned long mask = 1ul << node;
+
+    return syscall(SYS_mbind, (void *) p0, (unsigned long) (p1 - p0), MPOL_BIND, &mask, (unsigned long) (8*sizeof(mask)), MPOL_MF_MOVE) == 0;
 }
 
-size_t ggml_nbytes(const struct ggml_tensor * tensor) {
-    size_t nbytes;
-    size_t blck_size = ggml_blck_size(tensor->type);
-    if (blck_size == 1) {
-        nbytes = ggml_type_size(tensor->type);
-        for (int i = 0; i < GGML_MAX_DIMS; ++i) {
-            nbytes += (tensor->ne[i] - 1)*tensor->nb[i];
+static void ggml_numa_free_replicas(struct ggml_context * ctx) {
+    for (int k = 1; k < GGML_NUMA_MAX_NODES; ++k) {
+        if (ctx->numa_replicas[k]) {
+            munmap(ctx->numa_replicas[k], ctx->numa_size);
+            ctx->numa_replicas[k] = NULL;
         }
     }
-    else {
-        nbytes = tensor->ne[0]*tensor->nb[0]/blck_size;
-        for (int i = 1; i < GGML_MAX_DIMS; ++i) {
-            nbytes += (tensor->ne[i] - 1)*tensor->nb[i];
-        }
+}
+
+bool ggml_numa_place(struct ggml_context * ctx, enum ggml_numa_placement placement) {
+    GGML_ASSERT(ctx->numa_placement == GGML_NUMA_PLACEMENT_NONE && "the context is already placed");
+
+    if (!ggml_is_numa() || placement == GGML_NUMA_PLACEMENT_NONE) {
+        return false;
     }
 
-    return nbytes;
-}
+    const int n_nodes = g_state.numa.n_nodes;
 
-size_t ggml_nbytes_pad(const struct ggml_tensor * tensor) {
-    return GGML_PAD(ggml_nbytes(tensor), GGML_MEM_ALIGN);
-}
+    char * base = ctx->mem_buffer;
 
-size_t ggml_nbytes_split(const struct ggml_tensor * tensor, int nrows_split) {
-    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
+    const size_t size = ggml_used_mem(ctx);
+
+    // the placement is only a hint for the memory policy, the results do not depend on it
+    bool bound = true;
+
+    switch (placement) {
+        case GGML_NUMA_PLACEMENT_INTERLEAVE:
+            {
+                for (struct ggml_tensor * t = ggml_get_first_tensor(ctx); t != NULL; t = ggml_get_next_tensor(ctx, t)) {
+                    if ((char *) t->data < base || (char *) t->data >= base + size || t->view_src != NULL ||
+                        t->ne[2] != 1 || t->ne[3] != 1) {
+                        continue;
+                    }
+
+                    for (int k = 0; k < n_nodes; ++k) {
+                        int64_t ir0;
+                        int64_t ir1;
+                        ggml_numa_rows(t, k, &ir0, &ir1);
+
+                        if (ir1 > ir0) {
+                            bound = ggml_numa_bind((char *) t->data + ir0*t->nb[1], (ir1 - ir0)*t->nb[1], k) && bound;
+                        }
+                    }
+                }
+            } break;
+        case GGML_NUMA_PLACEMENT_REPLICATE:
+            {
+                ctx->numa_size = size;
+                ctx->numa_replicas[0] = base;
+
+                bound = ggml_numa_bind(base, size, 0);
+
+                for (int k = 1; k < n_nodes; ++k) {
+                    void * replica = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                    if (replica == MAP_FAILED) {
+                        fprintf(stderr, "%s: failed to map %.2f MB for the copy on node %d: %s\n", __func__, size/1024.0/1024.0, k, strerror(errno));
+                        ggml_numa_free_replicas(ctx);
+                        ctx->numa_size = 0;
+                        ctx->numa_replicas[0] = NULL;
+                        return false;
+                    }
+
+                    // bind before the copy, so that the pages are allocated on node k when they are first written
+                    bound = ggml_numa_bind(replica, size, k) && bound;
+
+                    memcpy(replica, base, size);
+
+                    ctx->numa_replicas[k] = replica;
+                }
+            } break;
+        default:
+            GGML_ASSERT(false);
+    }
+
+    if (!bound) {
+        fprintf(stderr, "%s: warning: mbind failed (%s), some pages may not be on the node that uses them\n", __func__, strerror(errno));
+    }
+
+    ggml_critical_section_start();
+
+    ctx->numa_size      = size;
+    ctx->numa_placement = placement;
+    g_state.numa.n_placed++;
+
+    ggml_critical_section_end();
+
+    return true;
+}
+#else
+static void ggml_numa_free_replicas(struct ggml_context * ctx) {
+    UNUSED(ctx);
+}
+
+bool ggml_numa_place(struct ggml_context * ctx, enum ggml_numa_placement placement) {
+    UNUSED(ctx);
+    UNUSED(placement);
+    return false;
+}
+#endif
+
+// the placed context whose data contains ptr, NULL if none
+static const struct ggml_context * ggml_numa_find(const void * ptr) {
+    if (g_state.numa.n_placed == 0) {
+        return NULL;
+    }
+
+    for (int i = 0; i < GGML_MAX_CONTEXTS; i++) {
+        const struct ggml_context * ctx = &g_state.contexts[i].context;
+
+        if (g_state.contexts[i].used && ctx->numa_placement != GGML_NUMA_PLACEMENT_NONE &&
+            (const char *) ptr >= (const char *) ctx->mem_buffer && (const char *) ptr < (const char *) ctx->mem_buffer + ctx->numa_size) {
+            return ctx;
+        }
+    }
+
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void ggml_print_object(const struct ggml_object * obj) {
+    GGML_PRINT(" - ggml_object: type = %d, offset = %zu, size = %zu, next = %p\n",
+            obj->type, obj->offs, obj->size, (const void *) obj->next);
+}
+
+void ggml_print_objects(const struct ggml_context * ctx) {
+    struct ggml_object * obj = ctx->objects_begin;
+
+    GGML_PRINT("%s: objects in context %p:\n", __func__, (const void *) ctx);
+
+    while (obj != NULL) {
+        ggml_print_object(obj);
+        obj = obj->next;
+    }
+
+    GGML_PRINT("%s: --- end ---\n", __func__);
+}
+
+int64_t ggml_nelements(const struct ggml_tensor * tensor) {
+    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
+
+    return tensor->ne[0]*tensor->ne[1]*tensor->ne[2]*tensor->ne[3];
+}
+
+int64_t ggml_nrows(const struct ggml_tensor * tensor) {
+    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
+
+    return tensor->ne[1]*tensor->ne[2]*tensor->ne[3];
+}
+
+size_t ggml_nbytes(const struct ggml_tensor * tensor) {
+    size_t nbytes;
+    size_t blck_size = ggml_blck_size(tensor->type);
+    if (blck_size == 1) {
+        nbytes = ggml_type_size(tensor->type);
+        for (int i = 0; i < GGML_MAX_DIMS; ++i) {
+            nbytes += (tensor->ne[i] - 1)*tensor->nb[i];
+        }
+    }
+    else {
+        nbytes = tensor->ne[0]*tensor->nb[0]/blck_size;
+        for (int i = 1; i < GGML_MAX_DIMS; ++i) {
+            nbytes += (tensor->ne[i] - 1)*tensor->nb[i];
+        }
+    }
+
+    return nbytes;
+}
+
+size_t ggml_nbytes_pad(const struct ggml_tensor * tensor) {
+    return GGML_PAD(ggml_nbytes(tensor), GGML_MEM_ALIGN);
+}
+
+size_t ggml_nbytes_split(const struct ggml_tensor * tensor, int nrows_split) {
+    static_assert(GGML_MAX_DIMS == 4, "GGML_MAX_DIMS is not 4 - update this function");
 
     return (nrows_split*tensor->ne[0]*ggml_type_size(tensor->type))/ggml_blck_size(tensor->type);
 }
@@ -2031,6 +2723,7 @@ enum ggml_type ggml_ftype_to_ggml_type(enum ggml_ftype ftype) {
         case GGML_FTYPE_MOSTLY_Q4_K:          wtype = GGML_TYPE_Q4_K;  break;
         case GGML_FTYPE_MOSTLY_Q5_K:          wtype = GGML_TYPE_Q5_K;  break;
         case GGML_FTYPE_MOSTLY_Q6_K:          wtype = GGML_TYPE_Q6_K;  break;
+        case GGML_FTYPE_MOSTLY_BF16:          wtype = GGML_TYPE_BF16;  break;
         case GGML_FTYPE_UNKNOWN:              wtype = GGML_TYPE_COUNT; break;
         case GGML_FTYPE_MOSTLY_Q4_1_SOME_F16: wtype = GGML_TYPE_COUNT; break;
     }
@@ -2168,6 +2861,7 @@ struct ggml_context * ggml_init(struct ggml_init_params params) {
                 /*.numa =*/ {
                     .n_nodes = 0,
                     .total_cpus = 0,
+                    .n_placed = 0,
                 },
             };
 
@@ -2186,6 +2880,8 @@ struct ggml_context * ggml_init(struct ggml_init_params params) {
         ggml_cl_init();
 #endif
 
+        ggml_cpu_init_kernels();
+
         ggml_setup_op_has_task_pass();
 
         is_first_call = false;
@@ -2230,6 +2926,9 @@ struct ggml_context * ggml_init(struct ggml_init_params params) {
         /*.objects_end        =*/ NULL,
         /*.scratch            =*/ { 0, 0, NULL, },
         /*.scratch_save       =*/ { 0, 0, NULL, },
+        /*.numa_placement     =*/ GGML_NUMA_PLACEMENT_NONE,
+        /*.numa_size          =*/ 0,
+        /*.numa_replicas      =*/ { NULL },
     };
 
     GGML_ASSERT(ctx->mem_buffer != NULL);
@@ -2256,6 +2955,12 @@ void ggml_free(struct ggml_context * ctx) {
             GGML_PRINT_DEBUG("%s: context %d has been freed. memory used = %zu\n",
                     __func__, i, ggml_used_mem(ctx));
 
+            if (ctx->numa_placement != GGML_NUMA_PLACEMENT_NONE) {
+                ggml_numa_free_replicas(ctx);
+                ctx->numa_placement = GGML_NUMA_PLACEMENT_NONE;
+                g_state.numa.n_placed--;
+            }
+
             if (ctx->mem_buffer_owned) {
                 GGML_ALIGNED_FREE(ctx->mem_buffer);
             }
@@ -2615,6 +3320,13 @@ struct ggml_tensor * ggml_set_i32 (struct ggml_tensor * tensor, int32_t value) {
                     ggml_vec_set_f16(nc, (ggml_fp16_t *)(data + i*n1), GGML_FP32_TO_FP16(value));
                 }
             } break;
+        case GGML_TYPE_BF16:
+            {
+                assert(tensor->nb[0] == sizeof(ggml_bf16_t));
+                for (int i = 0; i < n; i++) {
+                    ggml_vec_set_bf16(nc, (ggml_bf16_t *)(data + i*n1), GGML_FP32_TO_BF16(value));
+                }
+            } break;
         case GGML_TYPE_F32:
             {
                 assert(tensor->nb[0] == sizeof(float));
@@ -2667,6 +3379,13 @@ struct ggml_tensor * ggml_set_f32(struct ggml_tensor * tensor, float value) {
                     ggml_vec_set_f16(nc, (ggml_fp16_t *)(data + i*n1), GGML_FP32_TO_FP16(value));
                 }
             } break;
+        case GGML_TYPE_BF16:
+            {
+                assert(tensor->nb[0] == sizeof(ggml_bf16_t));
+                for (int i = 0; i < n; i++) {
+                    ggml_vec_set_bf16(nc, (ggml_bf16_t *)(data + i*n1), GGML_FP32_TO_BF16(value));
+                }
+            } break;
         case GGML_TYPE_F32:
             {
                 assert(tensor->nb[0] == sizeof(float));
@@ -2734,6 +3453,11 @@ int32_t ggml_get_i32_1d(const struct ggml_tensor * tensor, int i) {
                 GGML_ASSERT(tensor->nb[0] == sizeof(ggml_fp16_t));
                 return GGML_FP16_TO_FP32(((ggml_fp16_t *)(tensor->data))[i]);
             }
+        case GGML_TYPE_BF16:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(ggml_bf16_t));
+                return GGML_BF16_TO_FP32(((ggml_bf16_t *)(tensor->data))[i]);
+            }
         case GGML_TYPE_F32:
             {
                 GGML_ASSERT(tensor->nb[0] == sizeof(float));
@@ -2776,6 +3500,11 @@ void ggml_set_i32_1d(const struct ggml_tensor * tensor, int i, int32_t value) {
                 GGML_ASSERT(tensor->nb[0] == sizeof(ggml_fp16_t));
                 ((ggml_fp16_t *)(tensor->data))[i] = GGML_FP32_TO_FP16(value);
             } break;
+        case GGML_TYPE_BF16:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(ggml_bf16_t));
+                ((ggml_bf16_t *)(tensor->data))[i] = GGML_FP32_TO_BF16(value);
+            } break;
         case GGML_TYPE_F32:
             {
                 GGML_ASSERT(tensor->nb[0] == sizeof(float));
@@ -2799,6 +3528,8 @@ int32_t ggml_get_i32_nd(const struct ggml_tensor * tensor, int i0, int i1, int i
             return ((int32_t *) data)[0];
         case GGML_TYPE_F16:
             return GGML_FP16_TO_FP32(((ggml_fp16_t *) data)[0]);
+        case GGML_TYPE_BF16:
+            return GGML_BF16_TO_FP32(((ggml_bf16_t *) data)[0]);
         case GGML_TYPE_F32:
             return ((float *) data)[0];
         default:
@@ -2827,6 +3558,10 @@ void ggml_set_i32_nd(const struct ggml_tensor * tensor, int i0, int i1, int i2,
             {
                 ((ggml_fp16_t *)(data))[0] = GGML_FP32_TO_FP16(value);
             } break;
+        case GGML_TYPE_BF16:
+            {
+                ((ggml_bf16_t *)(data))[0] = GGML_FP32_TO_BF16(value);
+            } break;
         case GGML_TYPE_F32:
             {
                 ((float *)(data))[0] = value;
@@ -2865,6 +3600,11 @@ float ggml_get_f32_1d(const struct ggml_tensor * tensor, int i) {
                 GGML_ASSERT(tensor->nb[0] == sizeof(ggml_fp16_t));
                 return GGML_FP16_TO_FP32(((ggml_fp16_t *)(tensor->data))[i]);
             }
+        case GGML_TYPE_BF16:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(ggml_bf16_t));
+                return GGML_BF16_TO_FP32(((ggml_bf16_t *)(tensor->data))[i]);
+            }
         case GGML_TYPE_F32:
             {
                 GGML_ASSERT(tensor->nb[0] == sizeof(float));
@@ -2907,6 +3647,11 @@ void ggml_set_f32_1d(const struct ggml_tensor * tensor, int i, float value) {
                 GGML_ASSERT(tensor->nb[0] == sizeof(ggml_fp16_t));
                 ((ggml_fp16_t *)(tensor->data))[i] = GGML_FP32_TO_FP16(value);
             } break;
+        case GGML_TYPE_BF16:
+            {
+                GGML_ASSERT(tensor->nb[0] == sizeof(ggml_bf16_t));
+                ((ggml_bf16_t *)(tensor->data))[i] = GGML_FP32_TO_BF16(value);
+            } break;
         case GGML_TYPE_F32:
             {
                 GGML_ASSERT(tensor->nb[0] == sizeof(float));
@@ -2930,6 +3675,8 @@ float ggml_get_f32_nd(const struct ggml_tensor * tensor, int i0, int i1, int i2,
             return ((int32_t *) data)[0];
         case GGML_TYPE_F16:
             return GGML_FP16_TO_FP32(((ggml_fp16_t *) data)[0]);
+        case GGML_TYPE_BF16:
+            return GGML_BF16_TO_FP32(((ggml_bf16_t *) data)[0]);
         case GGML_TYPE_F32:
             return ((float *) data)[0];
         default:
@@ -2958,6 +3705,10 @@ void ggml_set_f32_nd(const struct ggml_tensor * tensor, int i0, int i1, int i2,
             {
                 ((ggml_fp16_t *)(data))[0] = GGML_FP32_TO_FP16(value);
             } break;
+        case GGML_TYPE_BF16:
+            {
+                ((ggml_bf16_t *)(data))[0] = GGML_FP32_TO_BF16(value);
+            } break;
         case GGML_TYPE_F32:
             {
                 ((float *)(data))[0] = value;
@@ -3976,6 +4727,92 @@ struct ggml_tensor * ggml_group_norm_inplace(
     return ggml_group_norm_impl(ctx, a, n_groups, true);
 }
 
+// ggml_rms_norm_mul
+
+struct ggml_tensor * ggml_rms_norm_mul(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        float  eps) {
+    GGML_ASSERT(ggml_can_repeat_rows(b, a));
+
+    bool is_node = false;
+
+    if (a->grad || b->grad) {
+        GGML_ASSERT(false); // TODO: implement backward
+        is_node = true;
+    }
+
+    struct ggml_tensor * result = ggml_dup_tensor(ctx, a);
+
+    ggml_set_op_params(result, &eps, sizeof(eps));
+
+    result->op   = GGML_OP_RMS_NORM_MUL;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src[0] = a;
+    result->src[1] = b;
+
+    return result;
+}
+
+// ggml_add_rms_norm
+
+struct ggml_tensor * ggml_add_rms_norm(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * c,
+        float  eps) {
+    GGML_ASSERT(ggml_are_same_shape(a, b));
+    GGML_ASSERT(ggml_can_repeat_rows(c, a));
+    GGML_ASSERT(a->ne[3] == 1);
+
+    bool is_node = false;
+
+    if (a->grad || b->grad || c->grad) {
+        GGML_ASSERT(false); // TODO: implement backward
+        is_node = true;
+    }
+
+    // the sum and the normalized sum
+    struct ggml_tensor * result = ggml_new_tensor_4d(ctx, a->type, a->ne[0], a->ne[1], a->ne[2], 2);
+
+    ggml_set_op_params(result, &eps, sizeof(eps));
+
+    result->op   = GGML_OP_ADD_RMS_NORM;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src[0] = a;
+    result->src[1] = b;
+    result->src[2] = c;
+
+    return result;
+}
+
+// ggml_swiglu
+
+struct ggml_tensor * ggml_swiglu(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b) {
+    GGML_ASSERT(ggml_are_same_shape(a, b));
+
+    bool is_node = false;
+
+    if (a->grad || b->grad) {
+        GGML_ASSERT(false); // TODO: implement backward
+        is_node = true;
+    }
+
+    struct ggml_tensor * result = ggml_dup_tensor(ctx, a);
+
+    result->op   = GGML_OP_SWIGLU;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src[0] = a;
+    result->src[1] = b;
+
+    return result;
+}
+
 // ggml_mul_mat
 
 struct ggml_tensor * ggml_mul_mat(
@@ -4667,6 +5504,34 @@ struct ggml_tensor * ggml_get_rows_back(
     return result;
 }
 
+// ggml_set_rows
+
+struct ggml_tensor * ggml_set_rows(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * c) {
+    GGML_ASSERT(ggml_is_matrix(a) && ggml_is_matrix(b) && ggml_is_vector(c) && c->type == GGML_TYPE_I32);
+    GGML_ASSERT(a->ne[0] == b->ne[0] && b->ne[1] == c->ne[0]);
+    GGML_ASSERT(b->type == GGML_TYPE_F32);
+    GGML_ASSERT(a->type == GGML_TYPE_F32 || a->type == GGML_TYPE_F16 || a->type == GGML_TYPE_BF16);
+
+    if (a->grad || b->grad) {
+        GGML_ASSERT(false); // TODO: implement backward
+    }
+
+    // make a view of the destination
+    struct ggml_tensor * result = ggml_view_tensor(ctx, a);
+
+    result->op     = GGML_OP_SET_ROWS;
+    result->grad   = NULL;
+    result->src[0] = a;
+    result->src[1] = b;
+    result->src[2] = c;
+
+    return result;
+}
+
 // ggml_diag
 
 struct ggml_tensor * ggml_diag(
@@ -4772,18 +5637,33 @@ struct ggml_tensor * ggml_diag_mask_zero_inplace(
 static struct ggml_tensor * ggml_soft_max_impl(
         struct ggml_context * ctx,
         struct ggml_tensor  * a,
+        struct ggml_tensor  * mask,
+        float                 scale,
         bool                  inplace) {
+    GGML_ASSERT(ggml_is_contiguous(a));
+    if (mask) {
+        GGML_ASSERT(mask->type == GGML_TYPE_F32);
+        GGML_ASSERT(ggml_is_contiguous(mask));
+        GGML_ASSERT(mask->ne[0] == a->ne[0]);
+        GGML_ASSERT(mask->ne[1] >= a->ne[1]);
+        GGML_ASSERT(mask->ne[2] == 1 && mask->ne[3] == 1);
+    }
+
     bool is_node = false;
 
     if (a->grad) {
+        GGML_ASSERT(mask == NULL && scale == 1.0f); // TODO: implement backward
         is_node = true;
     }
 
     struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
 
+    ggml_set_op_params(result, &scale, sizeof(scale));
+
     result->op   = GGML_OP_SOFT_MAX;
     result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
     result->src[0] = a;
+    result->src[1] = mask;
 
     return result;
 }
@@ -4791,13 +5671,21 @@ static struct ggml_tensor * ggml_soft_max_impl(
 struct ggml_tensor * ggml_soft_max(
         struct ggml_context * ctx,
         struct ggml_tensor  * a) {
-    return ggml_soft_max_impl(ctx, a, false);
+    return ggml_soft_max_impl(ctx, a, NULL, 1.0f, false);
 }
 
 struct ggml_tensor * ggml_soft_max_inplace(
         struct ggml_context * ctx,
         struct ggml_tensor  * a) {
-    return ggml_soft_max_impl(ctx, a, true);
+    return ggml_soft_max_impl(ctx, a, NULL, 1.0f, true);
+}
+
+struct ggml_tensor * ggml_soft_max_ext(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * mask,
+        float                 scale) {
+    return ggml_soft_max_impl(ctx, a, mask, scale, false);
 }
 
 // ggml_soft_max_back
@@ -4839,10 +5727,40 @@ struct ggml_tensor * ggml_soft_max_back_inplace(
 
 // ggml_rope
 
+static void ggml_rope_set_params(
+        int32_t params[13],
+        int     n_dims,
+        int     mode,
+        int     n_ctx,
+        int     n_orig_ctx,
+        float   freq_base,
+        float   freq_scale,
+        float   ext_factor,
+        float   attn_factor,
+        float   beta_fast,
+        float   beta_slow,
+        float   xpos_base,
+        bool    xpos_down) {
+    memset(params, 0, 13*sizeof(int32_t));
+    params[1] = n_dims;
+    params[2] = mode;
+    params[3] = n_ctx;
+    params[4] = n_orig_ctx;
+    memcpy(params +  5, &freq_base,    sizeof(float));
+    memcpy(params +  6, &freq_scale,   sizeof(float));
+    memcpy(params +  7, &ext_factor,   sizeof(float));
+    memcpy(params +  8, &attn_factor,  sizeof(float));
+    memcpy(params +  9, &beta_fast,    sizeof(float));
+    memcpy(params + 10, &beta_slow,    sizeof(float));
+    memcpy(params + 11, &xpos_base,    sizeof(float));
+    memcpy(params + 12, &xpos_down,    sizeof(bool));
+}
+
 static struct ggml_tensor * ggml_rope_impl(
         struct ggml_context * ctx,
         struct ggml_tensor  * a,
         struct ggml_tensor  * b,
+        struct ggml_tensor  * c,
         int                   n_dims,
         int                   mode,
         int                   n_ctx,
@@ -4868,21 +5786,23 @@ static struct ggml_tensor * ggml_rope_impl(
 
     struct ggml_tensor * result = inplace ? ggml_view_tensor(ctx, a) : ggml_dup_tensor(ctx, a);
 
-    int32_t params[13] = { /*n_past*/ 0, n_dims, mode, n_ctx, n_orig_ctx };
-    memcpy(params +  5, &freq_base,    sizeof(float));
-    memcpy(params +  6, &freq_scale,   sizeof(float));
-    memcpy(params +  7, &ext_factor,   sizeof(float));
-    memcpy(params +  8, &attn_factor,  sizeof(float));
-    memcpy(params +  9, &beta_fast,    sizeof(float));
-    memcpy(params + 10, &beta_slow,    sizeof(float));
-    memcpy(params + 11, &xpos_base,    sizeof(float));
-    memcpy(params + 12, &xpos_down,    sizeof(bool));
+    int32_t params[13];
+    ggml_rope_set_params(params, n_dims, mode, n_ctx, n_orig_ctx, freq_base, freq_scale,
+            ext_factor, attn_factor, beta_fast, beta_slow, xpos_base, xpos_down);
     ggml_set_op_params(result, params, sizeof(params));
 
+    if (c) {
+        // the cache must have been made for the same rotation
+        GGML_ASSERT(c->type == GGML_TYPE_F32);
+        GGML_ASSERT(c->ne[0] == 2*a->ne[0]);
+        GGML_ASSERT(memcmp(c->op_params, params, sizeof(params)) == 0);
+    }
+
     result->op   = GGML_OP_ROPE;
     result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
     result->src[0] = a;
     result->src[1] = b;
+    result->src[2] = c;
 
     return result;
 }
@@ -4895,7 +5815,7 @@ struct ggml_tensor * ggml_rope(
         int                   mode,
         int                   n_ctx) {
     return ggml_rope_impl(
-        ctx, a, b, n_dims, mode, n_ctx, 0, 10000.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, false, false
+        ctx, a, b, NULL, n_dims, mode, n_ctx, 0, 10000.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, false, false
     );
 }
 
@@ -4907,7 +5827,7 @@ struct ggml_tensor * ggml_rope_inplace(
         int                   mode,
         int                   n_ctx) {
     return ggml_rope_impl(
-        ctx, a, b, n_dims, mode, n_ctx, 0, 10000.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, false, true
+        ctx, a, b, NULL, n_dims, mode, n_ctx, 0, 10000.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, false, true
     );
 }
 
@@ -4926,7 +5846,7 @@ struct ggml_tensor * ggml_rope_custom(
         float                 beta_fast,
         float                 beta_slow) {
     return ggml_rope_impl(
-        ctx, a, b, n_dims, mode, n_ctx, n_orig_ctx, freq_base, freq_scale,
+        ctx, a, b, NULL, n_dims, mode, n_ctx, n_orig_ctx, freq_base, freq_scale,
         ext_factor, attn_factor, beta_fast, beta_slow, 0.0f, false, false
     );
 }
@@ -4946,20 +5866,77 @@ struct ggml_tensor * ggml_rope_custom_inplace(
         float                 beta_fast,
         float                 beta_slow) {
     return ggml_rope_impl(
-        ctx, a, b, n_dims, mode, n_ctx, n_orig_ctx, freq_base, freq_scale,
+        ctx, a, b, NULL, n_dims, mode, n_ctx, n_orig_ctx, freq_base, freq_scale,
         ext_factor, attn_factor, beta_fast, beta_slow, 0.0f, false, true
     );
 }
 
-struct ggml_tensor * ggml_rope_xpos_inplace(
+struct ggml_tensor * ggml_rope_custom_cached(
         struct ggml_context * ctx,
         struct ggml_tensor  * a,
         struct ggml_tensor  * b,
+        struct ggml_tensor  * c,
         int                   n_dims,
-        float                 base,
-        bool                  down) {
-    return ggml_rope_impl(ctx, a, b, n_dims, 0, 0, 0, 10000.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, base, down, true);
-}
+        int                   mode,
+        int                   n_ctx,
+        int                   n_orig_ctx,
+        float                 freq_base,
+        float                 freq_scale,
+        float                 ext_factor,
+        float                 attn_factor,
+        float                 beta_fast,
+        float                 beta_slow) {
+    return ggml_rope_impl(
+        ctx, a, b, c, n_dims, mode, n_ctx, n_orig_ctx, freq_base, freq_scale,
+        ext_factor, attn_factor, beta_fast, beta_slow, 0.0f, false, false
+    );
+}
+
+static void ggml_rope_cache_init(
+        const int32_t * params, int64_t ne0, float p, float * cache);
+
+struct ggml_tensor * ggml_rope_cache(
+        struct ggml_context * ctx,
+        int64_t               ne0,
+        int                   n_pos,
+        int                   n_dims,
+        int                   mode,
+        int                   n_ctx,
+        int                   n_orig_ctx,
+        float                 freq_base,
+        float                 freq_scale,
+        float                 ext_factor,
+        float                 attn_factor,
+        float                 beta_fast,
+        float                 beta_slow) {
+    GGML_ASSERT((mode & 4) == 0); // TODO: ChatGLM RoPE
+    GGML_ASSERT(n_dims <= ne0 && n_dims % 2 == 0);
+
+    struct ggml_tensor * result = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, 2*ne0, n_pos);
+
+    GGML_ASSERT(result->data != NULL);
+
+    int32_t params[13];
+    ggml_rope_set_params(params, n_dims, mode, n_ctx, n_orig_ctx, freq_base, freq_scale,
+            ext_factor, attn_factor, beta_fast, beta_slow, 0.0f, false);
+    ggml_set_op_params(result, params, sizeof(params));
+
+    for (int p = 0; p < n_pos; ++p) {
+        ggml_rope_cache_init(params, ne0, (float) p, (float *) ((char *) result->data + p*result->nb[1]));
+    }
+
+    return result;
+}
+
+struct ggml_tensor * ggml_rope_xpos_inplace(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        int                   n_dims,
+        float                 base,
+        bool                  down) {
+    return ggml_rope_impl(ctx, a, b, NULL, n_dims, 0, 0, 0, 10000.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, base, down, true);
+}
 
 // ggml_rope_back
 
@@ -5542,6 +6519,53 @@ struct ggml_tensor * ggml_flash_attn(
     return result;
 }
 
+// ggml_flash_attn_ext
+
+struct ggml_tensor * ggml_flash_attn_ext(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * q,
+        struct ggml_tensor  * k,
+        struct ggml_tensor  * v,
+        struct ggml_tensor  * mask,
+        float                 scale,
+        float                 max_bias) {
+    GGML_ASSERT(ggml_can_mul_mat(k, q));
+    GGML_ASSERT(q->type == GGML_TYPE_F32);
+    GGML_ASSERT(k->type == v->type);
+    GGML_ASSERT(v->ne[0] == k->ne[1]); // n_kv
+    GGML_ASSERT(v->ne[1] == k->ne[0]); // n_embd_head
+    GGML_ASSERT(v->ne[2] == k->ne[2]); // n_head_kv
+    if (mask) {
+        GGML_ASSERT(mask->type == GGML_TYPE_F32);
+        GGML_ASSERT(ggml_is_contiguous(mask));
+        GGML_ASSERT(mask->ne[0] == k->ne[1]);
+        GGML_ASSERT(mask->ne[1] >= q->ne[1]);
+    }
+
+    bool is_node = false;
+
+    if (q->grad || k->grad || v->grad) {
+        GGML_ASSERT(false); // TODO: implement backward
+        is_node = true;
+    }
+
+    // the heads are merged: [n_embd_head, n_head, n_tokens]
+    const int64_t ne[4] = { q->ne[0], q->ne[2], q->ne[1], q->ne[3] };
+    struct ggml_tensor * result = ggml_new_tensor(ctx, GGML_TYPE_F32, 4, ne);
+
+    float params[] = { scale, max_bias };
+    ggml_set_op_params(result, params, sizeof(params));
+
+    result->op   = GGML_OP_FLASH_ATTN_EXT;
+    result->grad = is_node ? ggml_dup_tensor(ctx, result) : NULL;
+    result->src[0] = q;
+    result->src[1] = k;
+    result->src[2] = v;
+    result->src[3] = mask;
+
+    return result;
+}
+
 // ggml_flash_ff
 
 struct ggml_tensor * ggml_flash_ff(
@@ -6589,6 +7613,147 @@ static void ggml_compute_forward_dup_f16(
     }
 }
 
+static void ggml_compute_forward_dup_bf16(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        struct ggml_tensor * dst) {
+    GGML_ASSERT(ggml_nelements(dst) == ggml_nelements(src0));
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    GGML_TENSOR_UNARY_OP_LOCALS
+
+    const int ith = params->ith; // thread index
+    const int nth = params->nth; // number of threads
+
+    if (ggml_is_contiguous(src0) && ggml_is_contiguous(dst) && src0->type == dst->type) {
+        ggml_compute_forward_dup_same_cont(params, src0, dst);
+        return;
+    }
+
+    // parallelize by rows
+    const int nr = ne01;
+    // number of rows per thread
+    const int dr = (nr + nth - 1) / nth;
+    // row range for this thread
+    const int ir0 = dr * ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
+    if (src0->type == dst->type &&
+        ne00 == ne0 &&
+        nb00 == ggml_type_size(src0->type) && nb0 == ggml_type_size(dst->type)) {
+        // copy by rows
+        const size_t rs = ne00*nb00;
+        for (int64_t i03 = 0; i03 < ne03; i03++) {
+            for (int64_t i02 = 0; i02 < ne02; i02++) {
+                for (int64_t i01 = ir0; i01 < ir1; i01++) {
+                    memcpy(
+                        ((char *)  dst->data + i01*nb1  + i02*nb2  + i03*nb3),
+                        ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03),
+                        rs);
+                }
+            }
+        }
+        return;
+    }
+
+    if (ggml_is_contiguous(dst) && nb00 == sizeof(ggml_bf16_t) && (dst->type == GGML_TYPE_F32 || type_traits[dst->type].from_float)) {
+        // whole rows, through an F32 row in wdata unless the destination is F32
+        ggml_from_float_t const from_float = type_traits[dst->type].from_float;
+        float * src0_f32 = (float *) params->wdata + (ne00 + CACHE_LINE_SIZE_F32) * ith;
+
+        size_t id = 0;
+        size_t rs = nb0 * (ne00 / ggml_blck_size(dst->type));
+        char * dst_ptr = (char *) dst->data;
+
+        for (int i03 = 0; i03 < ne03; i03++) {
+            for (int i02 = 0; i02 < ne02; i02++) {
+                id += rs * ir0;
+                for (int i01 = ir0; i01 < ir1; i01++) {
+                    const ggml_bf16_t * src0_ptr = (ggml_bf16_t *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+
+                    if (dst->type == GGML_TYPE_F32) {
+                        ggml_bf16_to_fp32_row(src0_ptr, (float *) (dst_ptr + id), ne00);
+                    } else {
+                        ggml_bf16_to_fp32_row(src0_ptr, src0_f32, ne00);
+                        from_float(src0_f32, dst_ptr + id, ne00);
+                    }
+                    id += rs;
+                }
+                id += rs * (ne01 - ir1);
+            }
+        }
+        return;
+    }
+
+    // element by element, to F32, F16 or BF16
+    GGML_ASSERT(dst->type == GGML_TYPE_F32 || dst->type == GGML_TYPE_F16 || dst->type == GGML_TYPE_BF16);
+
+    // dst counters
+    int64_t i10 = 0;
+    int64_t i11 = 0;
+    int64_t i12 = 0;
+    int64_t i13 = 0;
+
+    for (int64_t i03 = 0; i03 < ne03; i03++) {
+        for (int64_t i02 = 0; i02 < ne02; i02++) {
+            i10 += ne00 * ir0;
+            while (i10 >= ne0) {
+                i10 -= ne0;
+                if (++i11 == ne1) {
+                    i11 = 0;
+                    if (++i12 == ne2) {
+                        i12 = 0;
+                        if (++i13 == ne3) {
+                            i13 = 0;
+                        }
+                    }
+                }
+            }
+            for (int64_t i01 = ir0; i01 < ir1; i01++) {
+                for (int64_t i00 = 0; i00 < ne00; i00++) {
+                    const char * src0_ptr = ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
+                          char * dst_ptr  = ((char *)  dst->data + i10*nb0  + i11*nb1  + i12*nb2  + i13*nb3);
+
+                    switch (dst->type) {
+                        case GGML_TYPE_F32:  *(float       *) dst_ptr = GGML_BF16_TO_FP32(*(const ggml_bf16_t *) src0_ptr); break;
+                        case GGML_TYPE_F16:  *(ggml_fp16_t *) dst_ptr = GGML_FP32_TO_FP16(GGML_BF16_TO_FP32(*(const ggml_bf16_t *) src0_ptr)); break;
+                        default:             *(ggml_bf16_t *) dst_ptr = *(const ggml_bf16_t *) src0_ptr; break;
+                    }
+
+                    if (++i10 == ne0) {
+                        i10 = 0;
+                        if (++i11 == ne1) {
+                            i11 = 0;
+                            if (++i12 == ne2) {
+                                i12 = 0;
+                                if (++i13 == ne3) {
+                                    i13 = 0;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+            i10 += ne00 * (ne01 - ir1);
+            while (i10 >= ne0) {
+                i10 -= ne0;
+                if (++i11 == ne1) {
+                    i11 = 0;
+                    if (++i12 == ne2) {
+                        i12 = 0;
+                        if (++i13 == ne3) {
+                            i13 = 0;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
 static void ggml_compute_forward_dup_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
@@ -6714,6 +7879,24 @@ static void ggml_compute_forward_dup_f32(
                         id += ne00 * (ne01 - ir1);
                     }
                 }
+            } else if (dst->type == GGML_TYPE_BF16) {
+                size_t id = 0;
+                ggml_bf16_t * dst_ptr = (ggml_bf16_t *) dst->data;
+
+                for (int i03 = 0; i03 < ne03; i03++) {
+                    for (int i02 = 0; i02 < ne02; i02++) {
+                        id += ne00 * ir0;
+                        for (int i01 = ir0; i01 < ir1; i01++) {
+                            for (int i00 = 0; i00 < ne00; i00++) {
+                                const float * src0_ptr = (float *) ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
+
+                                dst_ptr[id] = GGML_FP32_TO_BF16(*src0_ptr);
+                                id++;
+                            }
+                        }
+                        id += ne00 * (ne01 - ir1);
+                    }
+                }
             } else {
                 GGML_ASSERT(false); // TODO: implement
             }
@@ -6833,6 +8016,58 @@ static void ggml_compute_forward_dup_f32(
                 }
             }
         }
+    } else if (dst->type == GGML_TYPE_BF16) {
+        for (int64_t i03 = 0; i03 < ne03; i03++) {
+            for (int64_t i02 = 0; i02 < ne02; i02++) {
+                i10 += ne00 * ir0;
+                while (i10 >= ne0) {
+                    i10 -= ne0;
+                    if (++i11 == ne1) {
+                        i11 = 0;
+                        if (++i12 == ne2) {
+                            i12 = 0;
+                            if (++i13 == ne3) {
+                                i13 = 0;
+                            }
+                        }
+                    }
+                }
+                for (int64_t i01 = ir0; i01 < ir1; i01++) {
+                    for (int64_t i00 = 0; i00 < ne00; i00++) {
+                        const char * src0_ptr = ((char *) src0->data + i00*nb00 + i01*nb01 + i02*nb02 + i03*nb03);
+                              char * dst_ptr  = ((char *)  dst->data + i10*nb0  + i11*nb1  + i12*nb2  + i13*nb3);
+
+                        *(ggml_bf16_t *) dst_ptr = GGML_FP32_TO_BF16(*(const float *) src0_ptr);
+
+                        if (++i10 == ne0) {
+                            i10 = 0;
+                            if (++i11 == ne1) {
+                                i11 = 0;
+                                if (++i12 == ne2) {
+                                    i12 = 0;
+                                    if (++i13 == ne3) {
+                                        i13 = 0;
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+                i10 += ne00 * (ne01 - ir1);
+                while (i10 >= ne0) {
+                    i10 -= ne0;
+                    if (++i11 == ne1) {
+                        i11 = 0;
+                        if (++i12 == ne2) {
+                            i12 = 0;
+                            if (++i13 == ne3) {
+                                i13 = 0;
+                            }
+                        }
+                    }
+                }
+            }
+        }
     } else {
         GGML_ASSERT(false); // TODO: implement
     }
@@ -6851,6 +8086,10 @@ static void ggml_compute_forward_dup(
             {
                 ggml_compute_forward_dup_f16(params, src0, dst);
             } break;
+        case GGML_TYPE_BF16:
+            {
+                ggml_compute_forward_dup_bf16(params, src0, dst);
+            } break;
         case GGML_TYPE_F32:
             {
                 ggml_compute_forward_dup_f32(params, src0, dst);
@@ -9375,198 +10614,288 @@ static void ggml_compute_forward_group_norm(
     }
 }
 
-// ggml_compute_forward_mul_mat
-
-#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
-// helper function to determine if it is better to use BLAS or not
-// for large matrices, BLAS is faster
-static bool ggml_compute_forward_mul_mat_use_blas(
-        const struct ggml_tensor * src0,
-        const struct ggml_tensor * src1,
-              struct ggml_tensor * dst) {
-    //const int64_t ne00 = src0->ne[0];
-    //const int64_t ne01 = src0->ne[1];
-
-    const int64_t ne10 = src1->ne[0];
-
-    const int64_t ne0 = dst->ne[0];
-    const int64_t ne1 = dst->ne[1];
-
-    // TODO: find the optimal values for these
-    if (ggml_is_contiguous(src0) &&
-        ggml_is_contiguous(src1) &&
-        (ne0 >= 32 && ne1 >= 32 && ne10 >= 32)) {
+// ggml_compute_forward_rms_norm_mul
 
-        /*printf("BLAS: %d %d %d %d %d\n", ne0, ne1, ne10, ne00, ne01);*/
-        return true;
+// 1/sqrt(mean(x^2) + eps), summed in the same order as ggml_compute_forward_rms_norm_f32
+inline static float ggml_rms_norm_scale_f32(const int64_t n, const float * x, const float eps) {
+    ggml_float sum = 0.0;
+    for (int64_t i = 0; i < n; i++) {
+        sum += (ggml_float)(x[i] * x[i]);
     }
 
-    return false;
+    const float mean = sum/n;
+
+    return 1.0f/sqrtf(mean + eps);
 }
-#endif
 
-static void ggml_compute_forward_mul_mat(
+static void ggml_compute_forward_rms_norm_mul_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
-              struct ggml_tensor * dst) {
-    int64_t t0 = ggml_perf_time_us();
-    UNUSED(t0);
+        struct ggml_tensor * dst) {
+    GGML_ASSERT(ggml_can_repeat_rows(src1, src0) && ggml_are_same_shape(src0, dst));
 
-    GGML_TENSOR_BINARY_OP_LOCALS
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
 
     const int ith = params->ith;
     const int nth = params->nth;
 
-    const enum ggml_type type = src0->type;
+    GGML_TENSOR_BINARY_OP_LOCALS
 
-    const bool src1_cont = ggml_is_contiguous(src1);
+    GGML_ASSERT( nb0 == sizeof(float));
+    GGML_ASSERT(nb00 == sizeof(float));
+    GGML_ASSERT(nb10 == sizeof(float));
 
-    ggml_vec_dot_t    const vec_dot               = type_traits[type].vec_dot;
-    enum ggml_type    const vec_dot_type          = type_traits[type].vec_dot_type;
-    ggml_from_float_t const from_float_to_vec_dot = type_traits[vec_dot_type].from_float;
+    float eps;
+    memcpy(&eps, dst->op_params, sizeof(float));
 
-    GGML_ASSERT(ne0 == ne01);
-    GGML_ASSERT(ne1 == ne11);
-    GGML_ASSERT(ne2 == ne12);
-    GGML_ASSERT(ne3 == ne13);
+    const int64_t nr = ggml_nrows(src0);
 
-    // we don't support permuted src0 or src1
-    GGML_ASSERT(nb00 == ggml_type_size(type));
-    GGML_ASSERT(nb10 == sizeof(float));
+    for (int64_t ir = ith; ir < nr; ir += nth) {
+        const int64_t i03 = ir/(ne02*ne01);
+        const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+        const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
 
-    // dst cannot be transposed or permuted
-    GGML_ASSERT(nb0 == sizeof(float));
-    GGML_ASSERT(nb0 <= nb1);
-    GGML_ASSERT(nb1 <= nb2);
-    GGML_ASSERT(nb2 <= nb3);
+        const int64_t i13 = i03 % ne13;
+        const int64_t i12 = i02 % ne12;
+        const int64_t i11 = i01 % ne11;
 
-    // broadcast factors
-    const int64_t r2 = ne12/ne02;
-    const int64_t r3 = ne13/ne03;
+        const float * x = (float *) ((char *) src0->data + i03*nb03 + i02*nb02 + i01*nb01);
+        const float * w = (float *) ((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11);
+        float       * y = (float *) ((char *) dst->data  + i03*nb3  + i02*nb2  + i01*nb1 );
 
-    // nb01 >= nb00 - src0 is not transposed
-    //   compute by src0 rows
+        ggml_vec_scale_mul_f32(ne00, y, x, ggml_rms_norm_scale_f32(ne00, x, eps), w);
+    }
+}
 
-#if defined(GGML_USE_CLBLAST)
-    if (ggml_cl_can_mul_mat(src0, src1, dst)) {
-        if (params->ith == 0 && params->type == GGML_TASK_COMPUTE) {
-            ggml_cl_mul_mat(src0, src1, dst, params->wdata, params->wsize);
-        }
+static void ggml_compute_forward_rms_norm_mul(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_rms_norm_mul_f32(params, src0, src1, dst);
+            } break;
+        default:
+            {
+                GGML_ASSERT(false);
+            } break;
+    }
+}
+
+// ggml_compute_forward_add_rms_norm
+
+static void ggml_compute_forward_add_rms_norm_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        const struct ggml_tensor * src2,
+        struct ggml_tensor * dst) {
+    GGML_ASSERT(ggml_are_same_shape(src0, src1) && ggml_can_repeat_rows(src2, src0));
+    GGML_ASSERT(ggml_is_contiguous(dst) && dst->ne[3] == 2);
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
-#endif
 
-#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
-    if (ggml_compute_forward_mul_mat_use_blas(src0, src1, dst)) {
-        if (params->ith != 0) {
-            return;
-        }
+    const int ith = params->ith;
+    const int nth = params->nth;
 
-        if (params->type == GGML_TASK_INIT) {
-            return;
-        }
+    GGML_TENSOR_BINARY_OP_LOCALS
+    GGML_TENSOR_LOCALS(int64_t, ne2, src2, ne)
+    GGML_TENSOR_LOCALS(size_t,  nb2, src2, nb)
 
-        if (params->type == GGML_TASK_FINALIZE) {
-            return;
-        }
+    GGML_ASSERT(nb00 == sizeof(float));
+    GGML_ASSERT(nb10 == sizeof(float));
+    GGML_ASSERT(nb20 == sizeof(float));
 
-        for (int64_t i13 = 0; i13 < ne13; i13++) {
-            for (int64_t i12 = 0; i12 < ne12; i12++) {
-                // broadcast src0 into src1 across 2nd,3rd dimension
-                const int64_t i03 = i13/r3;
-                const int64_t i02 = i12/r2;
+    float eps;
+    memcpy(&eps, dst->op_params, sizeof(float));
 
-                const void  * x = (char *)            src0->data + i02*nb02 + i03*nb03;
-                const float * y = (float *) ((char *) src1->data + i12*nb12 + i13*nb13);
+    const int64_t nr = ggml_nrows(src0);
 
-                float * d = (float *) ((char *) dst->data + i12*nb2 + i13*nb3);
+    for (int64_t ir = ith; ir < nr; ir += nth) {
+        const int64_t i02 = ir/ne01;
+        const int64_t i01 = ir - i02*ne01;
 
-                if (type != GGML_TYPE_F32) {
-                            float * const wdata    = params->wdata;
-                    ggml_to_float_t const to_float = type_traits[type].to_float;
+        const int64_t i22 = i02 % ne22;
+        const int64_t i21 = i01 % ne21;
 
-                    size_t id = 0;
-                    for (int64_t i01 = 0; i01 < ne01; ++i01) {
-                        to_float((const char *) x + i01*nb01, wdata + id, ne00);
-                        id += ne00;
-                    }
+        const float * x0 = (float *) ((char *) src0->data + i02*nb02 + i01*nb01);
+        const float * x1 = (float *) ((char *) src1->data + i02*nb12 + i01*nb11);
+        const float * w  = (float *) ((char *) src2->data + i22*nb22 + i21*nb21);
 
-                    assert(id*sizeof(float) <= params->wsize);
-                    x = wdata;
-                }
+        // the sum is in the first half of dst and the normalized sum in the second half
+        float * s = (float *) ((char *) dst->data + i02*nb2 + i01*nb1);
+        float * y = (float *) ((char *) s + nb3);
 
-                cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
-                        ne11, ne01, ne10,
-                        1.0f,    y, ne10,
-                                 x, ne00,
-                        0.0f,    d, ne01);
-            }
-        }
+        ggml_vec_add_f32(ne00, s, x0, x1);
+        ggml_vec_scale_mul_f32(ne00, y, s, ggml_rms_norm_scale_f32(ne00, s, eps), w);
+    }
+}
 
-        //printf("CBLAS = %f ms, %d x %d x %d x %d\n", (ggml_perf_time_us() - t0)/1000.0, ne0, ne1, ne2, ne3);
+static void ggml_compute_forward_add_rms_norm(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        const struct ggml_tensor * src2,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_add_rms_norm_f32(params, src0, src1, src2, dst);
+            } break;
+        default:
+            {
+                GGML_ASSERT(false);
+            } break;
+    }
+}
+
+// ggml_compute_forward_swiglu
+
+static void ggml_compute_forward_swiglu_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    GGML_ASSERT(ggml_are_same_shape(src0, src1) && ggml_are_same_shape(src0, dst));
 
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
-#endif
 
-    if (params->type == GGML_TASK_INIT) {
-        if (src1->type != vec_dot_type) {
-            char * wdata = params->wdata;
-            const size_t row_size = ne10*ggml_type_size(vec_dot_type)/ggml_blck_size(vec_dot_type);
+    const int ith = params->ith;
+    const int nth = params->nth;
 
-            for (int64_t i13 = 0; i13 < ne13; ++i13) {
-                for (int64_t i12 = 0; i12 < ne12; ++i12) {
-                    for (int64_t i11 = 0; i11 < ne11; ++i11) {
-                        from_float_to_vec_dot((float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11), (void *) wdata, ne10);
-                        wdata += row_size;
-                    }
-                }
-            }
-        }
+    GGML_TENSOR_BINARY_OP_LOCALS
 
-        return;
+    GGML_ASSERT( nb0 == sizeof(float));
+    GGML_ASSERT(nb00 == sizeof(float));
+    GGML_ASSERT(nb10 == sizeof(float));
+
+    const int64_t nr = ggml_nrows(src0);
+
+    // rows per thread
+    const int64_t dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int64_t ir0 = dr*ith;
+    const int64_t ir1 = MIN(ir0 + dr, nr);
+
+    for (int64_t ir = ir0; ir < ir1; ++ir) {
+        const int64_t i03 = ir/(ne02*ne01);
+        const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+        const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+        const float * g = (float *) ((char *) src0->data + i03*nb03 + i02*nb02 + i01*nb01);
+        const float * u = (float *) ((char *) src1->data + i03*nb13 + i02*nb12 + i01*nb11);
+        float       * y = (float *) ((char *) dst->data  + i03*nb3  + i02*nb2  + i01*nb1 );
+
+        ggml_vec_silu_f32(ne00, y, g);
+        ggml_vec_mul_f32 (ne00, y, y, u);
     }
+}
 
-    if (params->type == GGML_TASK_FINALIZE) {
-        return;
+static void ggml_compute_forward_swiglu(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_swiglu_f32(params, src0, src1, dst);
+            } break;
+        default:
+            {
+                GGML_ASSERT(false);
+            } break;
     }
+}
 
-    const void * wdata    = (src1->type == vec_dot_type) ? src1->data : params->wdata;
-    const size_t row_size = ne10*ggml_type_size(vec_dot_type)/ggml_blck_size(vec_dot_type);
+// ggml_compute_forward_mul_mat
 
-    const int64_t nr0 = ne01;           // src0 rows
-    const int64_t nr1 = ne11*ne12*ne13; // src1 rows
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+// helper function to determine if it is better to use BLAS or not
+// for large matrices, BLAS is faster
+static bool ggml_compute_forward_mul_mat_use_blas(
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+              struct ggml_tensor * dst) {
+    //const int64_t ne00 = src0->ne[0];
+    //const int64_t ne01 = src0->ne[1];
 
-    //printf("nr0 = %lld, nr1 = %lld\n", nr0, nr1);
+    const int64_t ne10 = src1->ne[0];
+
+    const int64_t ne0 = dst->ne[0];
+    const int64_t ne1 = dst->ne[1];
+
+    // the repacked types cannot be converted to float
+    if (type_traits[src0->type].vec_dot_tile_1 != NULL) {
+        return false;
+    }
+
+    // TODO: find the optimal values for these
+    if (ggml_is_contiguous(src0) &&
+        ggml_is_contiguous(src1) &&
+        src1->type == GGML_TYPE_F32 &&
+        (ne0 >= 32 && ne1 >= 32 && ne10 >= 32)) {
+
+        /*printf("BLAS: %d %d %d %d %d\n", ne0, ne1, ne10, ne00, ne01);*/
+        return true;
+    }
+
+    return false;
+}
+#endif
 
-    // distribute the thread work across the inner or outer loop based on which one is larger
+// compute the dot products of src0 rows [ir0_start, ir0_end) with src1 rows [ir1_start, ir1_end)
+static void ggml_compute_forward_mul_mat_one_chunk(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+              struct ggml_tensor * dst,
+        const int64_t ir0_start, const int64_t ir0_end,
+        const int64_t ir1_start, const int64_t ir1_end) {
+    GGML_TENSOR_BINARY_OP_LOCALS
 
-    const int64_t nth0 = nr0 > nr1 ? nth : 1; // parallelize by src0 rows
-    const int64_t nth1 = nr0 > nr1 ? 1 : nth; // parallelize by src1 rows
+    const enum ggml_type type = src0->type;
 
-    const int64_t ith0 = ith % nth0;
-    const int64_t ith1 = ith / nth0;
+    const bool src1_cont = ggml_is_contiguous(src1);
 
-    const int64_t dr0 = (nr0 + nth0 - 1)/nth0;
-    const int64_t dr1 = (nr1 + nth1 - 1)/nth1;
+    ggml_vec_dot_t      const vec_dot      = type_traits[type].vec_dot;
+    enum ggml_type      const vec_dot_type = type_traits[type].vec_dot_type;
+    ggml_vec_dot_tile_t const vec_dot_tile = type_traits[type].vec_dot_tile;
 
-    const int64_t ir010 = dr0*ith0;
-    const int64_t ir011 = MIN(ir010 + dr0, nr0);
+    // size of the tiles computed at once by vec_dot_tile
+    const int64_t tile_nr = vec_dot_tile ? type_traits[type].vec_dot_tile_nr : 1;
+    const int64_t tile_nc = vec_dot_tile ? type_traits[type].vec_dot_tile_nc : 1;
 
-    const int64_t ir110 = dr1*ith1;
-    const int64_t ir111 = MIN(ir110 + dr1, nr1);
+    // the rows of the repacked types are interleaved in groups of tile_nr, which are always computed together
+    ggml_vec_dot_tile_t const vec_dot_tile_1 = type_traits[type].vec_dot_tile_1;
 
-    //printf("ir010 = %6lld, ir011 = %6lld, ir110 = %6lld, ir111 = %6lld\n", ir010, ir011, ir110, ir111);
+    // broadcast factors
+    const int64_t r2 = ne12/ne02;
+    const int64_t r3 = ne13/ne03;
 
-    // threads with no work simply yield (not sure if it helps)
-    if (ir010 >= ir011 || ir110 >= ir111) {
-        sched_yield();
+    if (ir0_start >= ir0_end || ir1_start >= ir1_end) {
         return;
     }
 
-    assert(ne12 % ne02 == 0);
-    assert(ne13 % ne03 == 0);
+    const void * wdata    = (src1->type == vec_dot_type) ? src1->data : params->wdata;
+    const size_t row_size = ne10*ggml_type_size(vec_dot_type)/ggml_blck_size(vec_dot_type);
+
+    // desc: when src1 is not a contiguous memory block we have to calculate the offset using the strides
+    //       if it is, then we have either copied the data to params->wdata and made it contiguous or we are using
+    //       the original src1 data pointer, so we should index using the indices directly
+    // TODO: this is a bit of a hack, we should probably have a better way to handle this
+    const bool   src1_packed = src1_cont || src1->type != vec_dot_type;
+    const size_t src1_stride = src1_packed ? row_size : nb11;
 
     // block-tiling attempt
     const int64_t blck_0 = 16;
@@ -9575,9 +10904,12 @@ static void ggml_compute_forward_mul_mat(
     // attempt to reduce false-sharing (does not seem to make a difference)
     float tmp[16];
 
-    for (int64_t iir1 = ir110; iir1 < ir111; iir1 += blck_1) {
-        for (int64_t iir0 = ir010; iir0 < ir011; iir0 += blck_0) {
-            for (int64_t ir1 = iir1; ir1 < iir1 + blck_1 && ir1 < ir111; ++ir1) {
+    for (int64_t iir1 = ir1_start; iir1 < ir1_end; iir1 += blck_1) {
+        for (int64_t iir0 = ir0_start; iir0 < ir0_end; iir0 += blck_0) {
+            const int64_t ir0_blck_end = MIN(iir0 + blck_0, ir0_end);
+            const int64_t ir1_blck_end = MIN(iir1 + blck_1, ir1_end);
+
+            for (int64_t ir1 = iir1; ir1 < ir1_blck_end; ) {
                 const int64_t i13 = (ir1/(ne12*ne11));
                 const int64_t i12 = (ir1 - i13*ne12*ne11)/ne11;
                 const int64_t i11 = (ir1 - i13*ne12*ne11 - i12*ne11);
@@ -9592,39 +10924,306 @@ static void ggml_compute_forward_mul_mat(
 
                 const char * src0_row = (const char *) src0->data + (0 + i02*nb02 + i03*nb03);
 
-                // desc: when src1 is not a contiguous memory block we have to calculate the offset using the strides
-                //       if it is, then we have either copied the data to params->wdata and made it contiguous or we are using
-                //       the original src1 data pointer, so we should index using the indices directly
-                // TODO: this is a bit of a hack, we should probably have a better way to handle this
                 const char * src1_col = (const char *) wdata +
-                    (src1_cont || src1->type != vec_dot_type
+                    (src1_packed
                      ? (i11      + i12*ne11 + i13*ne12*ne11)*row_size
                      : (i11*nb11 + i12*nb12 + i13*nb13));
 
                 float * dst_col = (float *) ((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3));
 
-                //for (int64_t ir0 = iir0; ir0 < iir0 + blck_0 && ir0 < ir011; ++ir0) {
+                // the columns of a tile have to use the same src0 matrix
+                if (tile_nc > 1 && ir1 + tile_nc <= ir1_blck_end && i11 + tile_nc <= ne11) {
+                    int64_t ir0 = iir0;
+
+                    // each block of src0 is unpacked once for all the columns of the tile
+                    for (; ir0 + tile_nr <= ir0_blck_end; ir0 += tile_nr) {
+                        vec_dot_tile(ne00, &dst_col[ir0], nb1/sizeof(float), src0_row + ir0*nb01, nb01, src1_col, src1_stride);
+                    }
+
+                    for (; ir0 < ir0_blck_end; ++ir0) {
+                        for (int64_t c = 0; c < tile_nc; ++c) {
+                            vec_dot(ne00, (float *) ((char *) dst_col + c*nb1) + ir0, src0_row + ir0*nb01, src1_col + c*src1_stride);
+                        }
+                    }
+
+                    ir1 += tile_nc;
+                    continue;
+                }
+
+                //for (int64_t ir0 = iir0; ir0 < iir0 + blck_0 && ir0 < ir0_end; ++ir0) {
                 //    vec_dot(ne00, &dst_col[ir0], src0_row + ir0*nb01, src1_col);
                 //}
 
-                for (int64_t ir0 = iir0; ir0 < iir0 + blck_0 && ir0 < ir011; ++ir0) {
-                    vec_dot(ne00, &tmp[ir0 - iir0], src0_row + ir0*nb01, src1_col);
+                if (vec_dot_tile_1) {
+                    for (int64_t ir0 = iir0; ir0 < ir0_blck_end; ir0 += tile_nr) {
+                        vec_dot_tile_1(ne00, &tmp[ir0 - iir0], 0, src0_row + ir0*nb01, nb01, src1_col, src1_stride);
+                    }
+                } else {
+                    for (int64_t ir0 = iir0; ir0 < ir0_blck_end; ++ir0) {
+                        vec_dot(ne00, &tmp[ir0 - iir0], src0_row + ir0*nb01, src1_col);
+                    }
                 }
-                memcpy(&dst_col[iir0], tmp, (MIN(iir0 + blck_0, ir011) - iir0)*sizeof(float));
+                memcpy(&dst_col[iir0], tmp, (ir0_blck_end - iir0)*sizeof(float));
+
+                ir1 += 1;
             }
         }
     }
 }
 
-// ggml_compute_forward_out_prod
+// the work of a mul_mat is split in chunks of (src0 rows) x (src1 rows) that the threads take dynamically, so that a
+// thread that is slowed down (SMT sibling, efficiency core, OS noise) does not hold up the others
+// the src0 rows of a chunk are sized to stay in cache while they are multiplied with the src1 rows of the chunk
+static void ggml_mul_mat_n_chunks(int64_t nr0, int64_t nr1, size_t nb01, int nth, int64_t * nchunk0, int64_t * nchunk1) {
+    const int64_t chunk_rows = MAX(16, GGML_MUL_MAT_CHUNK_SIZE/nb01);
 
-static void ggml_compute_forward_out_prod_f32(
+    *nchunk0 = (nr0 + chunk_rows - 1)/chunk_rows;
+    *nchunk1 = (nr1 + 16 - 1)/16;
+
+    if (*nchunk0 * *nchunk1 < nth*4) {
+        // not enough chunks to balance the work - distribute it evenly across the inner or outer loop
+        // based on which one is larger
+        *nchunk0 = nr0 > nr1 ? nth : 1; // parallelize by src0 rows
+        *nchunk1 = nr0 > nr1 ? 1 : nth; // parallelize by src1 rows
+    }
+}
+
+static void ggml_compute_forward_mul_mat(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
               struct ggml_tensor * dst) {
-    // int64_t t0 = ggml_perf_time_us();
-    // UNUSED(t0);
+    int64_t t0 = ggml_perf_time_us();
+    UNUSED(t0);
+
+    GGML_TENSOR_BINARY_OP_LOCALS
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const enum ggml_type type = src0->type;
+
+    enum ggml_type    const vec_dot_type          = type_traits[type].vec_dot_type;
+    ggml_from_float_t const from_float_to_vec_dot = type_traits[vec_dot_type].from_float;
+
+    GGML_ASSERT(ne0 == ne01);
+    GGML_ASSERT(ne1 == ne11);
+    GGML_ASSERT(ne2 == ne12);
+    GGML_ASSERT(ne3 == ne13);
+
+    // we don't support permuted src0 or src1
+    // src1 is f32, or already converted to vec_dot_type (see ggml_graph_share_src1)
+    GGML_ASSERT(nb00 == ggml_type_size(type));
+    GGML_ASSERT(nb10 == ggml_type_size(src1->type));
+    GGML_ASSERT(src1->type == GGML_TYPE_F32 || src1->type == vec_dot_type);
+
+    // the rows of a repacked src0 are interleaved in contiguous groups
+    GGML_ASSERT(!type_traits[type].vec_dot_tile_1 || (ne01 % type_traits[type].vec_dot_tile_nr == 0 && nb01 == ggml_type_size(type)*ne00/ggml_blck_size(type)));
+
+    // dst cannot be transposed or permuted
+    GGML_ASSERT(nb0 == sizeof(float));
+    GGML_ASSERT(nb0 <= nb1);
+    GGML_ASSERT(nb1 <= nb2);
+    GGML_ASSERT(nb2 <= nb3);
+
+    // nb01 >= nb00 - src0 is not transposed
+    //   compute by src0 rows
+
+#if defined(GGML_USE_CLBLAST)
+    if (ggml_cl_can_mul_mat(src0, src1, dst)) {
+        if (params->ith == 0 && params->type == GGML_TASK_COMPUTE) {
+            ggml_cl_mul_mat(src0, src1, dst, params->wdata, params->wsize);
+        }
+        return;
+    }
+#endif
+
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+    if (ggml_compute_forward_mul_mat_use_blas(src0, src1, dst)) {
+        if (params->ith != 0) {
+            return;
+        }
+
+        // broadcast factors
+        const int64_t r2 = ne12/ne02;
+        const int64_t r3 = ne13/ne03;
+
+        if (params->type == GGML_TASK_INIT) {
+            return;
+        }
+
+        if (params->type == GGML_TASK_FINALIZE) {
+            return;
+        }
+
+        for (int64_t i13 = 0; i13 < ne13; i13++) {
+            for (int64_t i12 = 0; i12 < ne12; i12++) {
+                // broadcast src0 into src1 across 2nd,3rd dimension
+                const int64_t i03 = i13/r3;
+                const int64_t i02 = i12/r2;
+
+                const void  * x = (char *)            src0->data + i02*nb02 + i03*nb03;
+                const float * y = (float *) ((char *) src1->data + i12*nb12 + i13*nb13);
+
+                float * d = (float *) ((char *) dst->data + i12*nb2 + i13*nb3);
+
+                if (type != GGML_TYPE_F32) {
+                            float * const wdata    = params->wdata;
+                    ggml_to_float_t const to_float = type_traits[type].to_float;
+
+                    size_t id = 0;
+                    for (int64_t i01 = 0; i01 < ne01; ++i01) {
+                        to_float((const char *) x + i01*nb01, wdata + id, ne00);
+                        id += ne00;
+                    }
+
+                    assert(id*sizeof(float) <= params->wsize);
+                    x = wdata;
+                }
+
+                cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                        ne11, ne01, ne10,
+                        1.0f,    y, ne10,
+                                 x, ne00,
+                        0.0f,    d, ne01);
+            }
+        }
+
+        //printf("CBLAS = %f ms, %d x %d x %d x %d\n", (ggml_perf_time_us() - t0)/1000.0, ne0, ne1, ne2, ne3);
+
+        return;
+    }
+#endif
+
+    if (params->type == GGML_TASK_INIT) {
+        if (src1->type != vec_dot_type) {
+            char * wdata = params->wdata;
+            const size_t row_size = ne10*ggml_type_size(vec_dot_type)/ggml_blck_size(vec_dot_type);
+
+            assert(params->wsize >= ne11*ne12*ne13*row_size);
+
+            // the src1 rows are converted by all threads (see GGML_OP_HAS_PARALLEL_PASS)
+            for (int64_t i13 = 0; i13 < ne13; ++i13) {
+                for (int64_t i12 = 0; i12 < ne12; ++i12) {
+                    for (int64_t i11 = ith; i11 < ne11; i11 += nth) {
+                        from_float_to_vec_dot((float *)((char *) src1->data + i13*nb13 + i12*nb12 + i11*nb11),
+                                              (void *) (wdata + ((i13*ne12 + i12)*ne11 + i11)*row_size),
+                                              ne10);
+                    }
+                }
+            }
+        }
+
+        return;
+    }
+
+    if (params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    const int64_t nr0 = ne01;           // src0 rows
+    const int64_t nr1 = ne11*ne12*ne13; // src1 rows
+
+    //printf("nr0 = %lld, nr1 = %lld\n", nr0, nr1);
+
+    assert(ne12 % ne02 == 0);
+    assert(ne13 % ne03 == 0);
+
+    // the chunks of a repacked src0 start at a group of interleaved rows
+    const int64_t ng0 = type_traits[type].vec_dot_tile_1 ? type_traits[type].vec_dot_tile_nr : 1;
+
+    const int numa_node = ggml_graph_compute_numa_node(params);
+
+    const struct ggml_context * numa_ctx = numa_node >= 0 ? ggml_numa_find(src0->data) : NULL;
+
+    struct ggml_tensor src0_node;
+
+    if (numa_ctx && numa_ctx->numa_placement == GGML_NUMA_PLACEMENT_REPLICATE) {
+        // read the copy of src0 on the node of the thread
+        src0_node      = *src0;
+        src0_node.data = (char *) numa_ctx->numa_replicas[numa_node] + ((char *) src0->data - (char *) numa_ctx->mem_buffer);
+        src0 = &src0_node;
+    }
+
+    if (numa_ctx && numa_ctx->numa_placement == GGML_NUMA_PLACEMENT_INTERLEAVE && ne02 == 1 && ne03 == 1) {
+        // the threads of a node first multiply the src0 rows placed on their node, then help the other nodes
+        const int n_nodes = ggml_numa_n_nodes();
+
+        for (int i = 0; i < n_nodes; ++i) {
+            const int node = (numa_node + i) % n_nodes;
+
+            int64_t ir0;
+            int64_t ir1;
+            ggml_numa_rows(src0, node, &ir0, &ir1);
+
+            if (ir1 == ir0) {
+                continue;
+            }
+
+            int64_t nchunk0;
+            int64_t nchunk1;
+            ggml_mul_mat_n_chunks(ir1 - ir0, nr1, nb01, (nth + n_nodes - 1)/n_nodes, &nchunk0, &nchunk1);
+
+            const int64_t dr0 = (ir1 - ir0 + ng0*nchunk0 - 1)/(ng0*nchunk0)*ng0;
+            const int64_t dr1 = (nr1 + nchunk1 - 1)/nchunk1;
+
+            int64_t current_chunk;
+
+            while ((current_chunk = ggml_graph_compute_next_numa_chunk(params, node)) < nchunk0*nchunk1) {
+                const int64_t ir0_start = ir0 + dr0*(current_chunk % nchunk0);
+                const int64_t ir0_end   = MIN(ir0_start + dr0, ir1);
+
+                const int64_t ir1_start = dr1*(current_chunk / nchunk0);
+                const int64_t ir1_end   = MIN(ir1_start + dr1, nr1);
+
+                ggml_compute_forward_mul_mat_one_chunk(params, src0, src1, dst, ir0_start, ir0_end, ir1_start, ir1_end);
+            }
+        }
+
+        return;
+    }
+
+    int64_t nchunk0;
+    int64_t nchunk1;
+    ggml_mul_mat_n_chunks(nr0, nr1, nb01, nth, &nchunk0, &nchunk1);
+
+    const int64_t nchunk = nchunk0*nchunk1;
+
+    const int64_t dr0 = (nr0 + ng0*nchunk0 - 1)/(ng0*nchunk0)*ng0;
+    const int64_t dr1 = (nr1 + nchunk1 - 1)/nchunk1;
+
+    // the first chunk of each thread is implied by its index, the next ones are taken from the shared counter
+    int64_t current_chunk = ith;
+
+    while (current_chunk < nchunk) {
+        const int64_t ith0 = current_chunk % nchunk0;
+        const int64_t ith1 = current_chunk / nchunk0;
+
+        const int64_t ir0_start = dr0*ith0;
+        const int64_t ir0_end   = MIN(ir0_start + dr0, nr0);
+
+        const int64_t ir1_start = dr1*ith1;
+        const int64_t ir1_end   = MIN(ir1_start + dr1, nr1);
+
+        ggml_compute_forward_mul_mat_one_chunk(params, src0, src1, dst, ir0_start, ir0_end, ir1_start, ir1_end);
+
+        if (nth >= nchunk) {
+            break;
+        }
+
+        current_chunk = ggml_graph_compute_next_chunk(params);
+    }
+}
+
+// ggml_compute_forward_out_prod
+
+static void ggml_compute_forward_out_prod_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+              struct ggml_tensor * dst) {
+    // int64_t t0 = ggml_perf_time_us();
+    // UNUSED(t0);
 
     GGML_TENSOR_BINARY_OP_LOCALS
 
@@ -10182,6 +11781,33 @@ static void ggml_compute_forward_get_rows_f16(
     }
 }
 
+static void ggml_compute_forward_get_rows_bf16(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+              struct ggml_tensor * dst) {
+    assert(params->ith == 0);
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    const int nc = src0->ne[0];
+    const int nr = ggml_nelements(src1);
+
+    assert( dst->ne[0] == nc);
+    assert( dst->ne[1] == nr);
+    assert(src0->nb[0] == sizeof(ggml_bf16_t));
+
+    for (int i = 0; i < nr; ++i) {
+        const int r = ((int32_t *) src1->data)[i];
+
+        ggml_bf16_to_fp32_row(
+                (const ggml_bf16_t *) ((char *) src0->data + r*src0->nb[1]),
+                     (float *) ((char *)  dst->data + i*dst->nb[1]), nc);
+    }
+}
+
 static void ggml_compute_forward_get_rows_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
@@ -10233,6 +11859,10 @@ static void ggml_compute_forward_get_rows(
             {
                 ggml_compute_forward_get_rows_f16(params, src0, src1, dst);
             } break;
+        case GGML_TYPE_BF16:
+            {
+                ggml_compute_forward_get_rows_bf16(params, src0, src1, dst);
+            } break;
         case GGML_TYPE_F32:
             {
                 ggml_compute_forward_get_rows_f32(params, src0, src1, dst);
@@ -10371,6 +12001,105 @@ static void ggml_compute_forward_get_rows_back(
     //}
 }
 
+// ggml_compute_forward_set_rows
+
+static void ggml_compute_forward_set_rows_f32(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+              struct ggml_tensor * dst) {
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t nc = src0->ne[0];
+    const int64_t nr = src0->ne[1];
+
+    const size_t nb00 = src0->nb[0];
+    const size_t nb01 = src0->nb[1];
+
+    const size_t nb0 = dst->nb[0];
+    const size_t nb1 = dst->nb[1];
+
+    const enum ggml_type type = dst->type;
+
+    assert(dst->ne[0] == nc);
+    assert(ggml_nelements(src1) == nr);
+
+    const int32_t * ids = (const int32_t *) src1->data;
+
+    if (nb00 == sizeof(float) && nb0 == ggml_type_size(type)) {
+        // contiguous rows, split the rows between the threads
+        const int64_t dr  = (nr + nth - 1)/nth;
+        const int64_t ir0 = MIN(dr*ith, nr);
+        const int64_t ir1 = MIN(ir0 + dr, nr);
+
+        for (int64_t i = ir0; i < ir1; ++i) {
+            const int64_t r = ids[i];
+            assert(r >= 0 && r < dst->ne[1]);
+
+            const float * x = (const float *) ((const char *) src0->data + i*nb01);
+                   void * y = (char *) dst->data + r*nb1;
+
+            switch (type) {
+                case GGML_TYPE_F32:  memcpy(y, x, nc*sizeof(float)); break;
+                case GGML_TYPE_F16:  ggml_fp32_to_fp16_row(x, (ggml_fp16_t *) y, nc); break;
+                case GGML_TYPE_BF16: ggml_fp32_to_bf16_row(x, (ggml_bf16_t *) y, nc); break;
+                default: GGML_ASSERT(false);
+            }
+        }
+        return;
+    }
+
+    // strided rows (e.g. the transposed V cache): split the columns between the threads,
+    // so that each thread writes the rows of its own columns, which are next to each other for consecutive ids
+    const int64_t dc  = (nc + nth - 1)/nth;
+    const int64_t ic0 = MIN(dc*ith, nc);
+    const int64_t ic1 = MIN(ic0 + dc, nc);
+
+    for (int64_t k = ic0; k < ic1; ++k) {
+        const char * x = (const char *) src0->data + k*nb00;
+              char * y = (char *) dst->data + k*nb0;
+
+        switch (type) {
+            case GGML_TYPE_F32:
+                for (int64_t i = 0; i < nr; ++i) {
+                    *(float *) (y + ids[i]*nb1) = *(const float *) (x + i*nb01);
+                } break;
+            case GGML_TYPE_F16:
+                for (int64_t i = 0; i < nr; ++i) {
+                    *(ggml_fp16_t *) (y + ids[i]*nb1) = GGML_FP32_TO_FP16(*(const float *) (x + i*nb01));
+                } break;
+            case GGML_TYPE_BF16:
+                for (int64_t i = 0; i < nr; ++i) {
+                    *(ggml_bf16_t *) (y + ids[i]*nb1) = GGML_FP32_TO_BF16(*(const float *) (x + i*nb01));
+                } break;
+            default:
+                GGML_ASSERT(false);
+        }
+    }
+}
+
+static void ggml_compute_forward_set_rows(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
+        struct ggml_tensor * dst) {
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_set_rows_f32(params, src0, src1, dst);
+            } break;
+        default:
+            {
+                GGML_ASSERT(false);
+            } break;
+    }
+}
+
 // ggml_compute_forward_diag
 
 static void ggml_compute_forward_diag_f32(
@@ -10518,6 +12247,7 @@ static void ggml_compute_forward_diag_mask_zero(
 static void ggml_compute_forward_soft_max_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
         struct ggml_tensor * dst) {
     GGML_ASSERT(ggml_is_contiguous(src0));
     GGML_ASSERT(ggml_is_contiguous(dst));
@@ -10527,6 +12257,9 @@ static void ggml_compute_forward_soft_max_f32(
         return;
     }
 
+    float scale = 1.0f;
+    memcpy(&scale, dst->op_params, sizeof(float));
+
     // TODO: handle transposed/permuted matrices
 
     const int ith = params->ith;
@@ -10535,6 +12268,9 @@ static void ggml_compute_forward_soft_max_f32(
     const int nc = src0->ne[0];
     const int nr = ggml_nrows(src0);
 
+    // the mask is broadcast to the rows of each matrix
+    const int ne01 = src0->ne[1];
+
     // rows per thread
     const int dr = (nr + nth - 1)/nth;
 
@@ -10543,34 +12279,39 @@ static void ggml_compute_forward_soft_max_f32(
     const int ir1 = MIN(ir0 + dr, nr);
 
     for (int i1 = ir0; i1 < ir1; i1++) {
-        float *sp = (float *)((char *) src0->data + i1*src0->nb[1]);
-        float *dp = (float *)((char *)  dst->data +  i1*dst->nb[1]);
+        const float * sp = (float *)((char *) src0->data + i1*src0->nb[1]);
+        const float * mp = src1 ? (float *)((char *) src1->data + (i1%ne01)*src1->nb[1]) : NULL;
 
-#ifndef NDEBUG
-        for (int i = 0; i < nc; ++i) {
-            //printf("p[%d] = %f\n", i, p[i]);
-            assert(!isnan(sp[i]));
-        }
-#endif
+        float * dp = (float *)((char *) dst->data + i1*dst->nb[1]);
 
+        // the scale and the mask are applied in the pass that finds the max, dp may alias sp
+        const float * wp = sp;
         float max = -INFINITY;
-        ggml_vec_max_f32(nc, &max, sp);
-
-        ggml_float sum = 0.0;
 
-        uint16_t scvt;
-        for (int i = 0; i < nc; i++) {
-            if (sp[i] == -INFINITY) {
-                dp[i] = 0.0f;
-            } else {
-                // const float val = (sp[i] == -INFINITY) ? 0.0 : exp(sp[i] - max);
-                ggml_fp16_t s = GGML_FP32_TO_FP16(sp[i] - max);
-                memcpy(&scvt, &s, sizeof(scvt));
-                const float val = GGML_FP16_TO_FP32(ggml_table_exp_f16[scvt]);
-                sum += (ggml_float)val;
-                dp[i] = val;
+        if (mp) {
+            for (int i = 0; i < nc; ++i) {
+                dp[i] = sp[i]*scale + mp[i];
+                max = MAX(max, dp[i]);
             }
+            wp = dp;
+        } else if (scale != 1.0f) {
+            for (int i = 0; i < nc; ++i) {
+                dp[i] = sp[i]*scale;
+                max = MAX(max, dp[i]);
+            }
+            wp = dp;
+        } else {
+            ggml_vec_max_f32(nc, &max, sp);
+        }
+
+#ifndef NDEBUG
+        for (int i = 0; i < nc; ++i) {
+            //printf("p[%d] = %f\n", i, p[i]);
+            assert(!isnan(wp[i]));
         }
+#endif
+
+        ggml_float sum = ggml_vec_soft_max_f32(nc, dp, wp, max);
 
         assert(sum > 0.0);
 
@@ -10589,11 +12330,12 @@ static void ggml_compute_forward_soft_max_f32(
 static void ggml_compute_forward_soft_max(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
+        const struct ggml_tensor * src1,
         struct ggml_tensor * dst) {
     switch (src0->type) {
         case GGML_TYPE_F32:
             {
-                ggml_compute_forward_soft_max_f32(params, src0, dst);
+                ggml_compute_forward_soft_max_f32(params, src0, src1, dst);
             } break;
         default:
             {
@@ -10848,6 +12590,10 @@ static void ggml_compute_forward_alibi(
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
+        case GGML_TYPE_Q4_0_X4:
+        case GGML_TYPE_Q8_0_X4:
+        case GGML_TYPE_Q4_K_X4:
+        case GGML_TYPE_BF16:
         case GGML_TYPE_COUNT:
             {
                 GGML_ASSERT(false);
@@ -10922,6 +12668,10 @@ static void ggml_compute_forward_clamp(
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
+        case GGML_TYPE_Q4_0_X4:
+        case GGML_TYPE_Q8_0_X4:
+        case GGML_TYPE_Q4_K_X4:
+        case GGML_TYPE_BF16:
         case GGML_TYPE_COUNT:
             {
                 GGML_ASSERT(false);
@@ -10970,35 +12720,180 @@ void ggml_rope_yarn_corr_dims(
     dims[1] = MIN(n_dims - 1, ceilf(ggml_rope_yarn_corr_dim(n_dims, n_orig_ctx, beta_slow, freq_base)));
 }
 
+// the rotation of the elements of a row at position p: y[i] = x[i]*c[i] + x[j]*s[i], with j the element paired with i
+// c = cache[0, ne0) and s = cache[ne0, 2*ne0), the signs of the sines are included
+static void ggml_rope_cache_init(
+        const int32_t * params, int64_t ne0, float p, float * cache) {
+    float freq_base, freq_scale, ext_factor, attn_factor, beta_fast, beta_slow;
+
+    // these two only relevant for xPos RoPE:
+    float xpos_base;
+    bool  xpos_down;
+
+    const int n_dims     = params[1];
+    const int mode       = params[2];
+    const int n_orig_ctx = params[4];
+
+    memcpy(&freq_base,   params +  5, sizeof(float));
+    memcpy(&freq_scale,  params +  6, sizeof(float));
+    memcpy(&ext_factor,  params +  7, sizeof(float));
+    memcpy(&attn_factor, params +  8, sizeof(float));
+    memcpy(&beta_fast,   params +  9, sizeof(float));
+    memcpy(&beta_slow,   params + 10, sizeof(float));
+    memcpy(&xpos_base,   params + 11, sizeof(float));
+    memcpy(&xpos_down,   params + 12, sizeof(bool));
+
+    const float theta_scale = powf(freq_base, -2.0f/n_dims);
+    const float inv_ndims = -1.f/n_dims;
+    float corr_dims[2];
+    ggml_rope_yarn_corr_dims(n_dims, n_orig_ctx, freq_base, beta_fast, beta_slow, corr_dims);
+
+    const bool is_neox = mode & 2;
+
+    float * c = cache;
+    float * s = cache + ne0;
+
+    float theta_base = p;
+
+    if (!is_neox) {
+        for (int64_t i0 = 0; i0 < ne0; i0 += 2) {
+            float cos_theta, sin_theta;
+            rope_yarn(
+                theta_base, freq_scale, corr_dims, i0, ext_factor, attn_factor, &cos_theta, &sin_theta
+            );
+
+            // zeta scaling for xPos only:
+            float zeta = xpos_base != 0.0f ? powf((i0 + 0.4f * ne0) / (1.4f * ne0), p / xpos_base) : 1.0f;
+            if (xpos_down) zeta = 1.0f / zeta;
+
+            theta_base *= theta_scale;
+
+            c[i0]     =  cos_theta*zeta;
+            c[i0 + 1] =  cos_theta*zeta;
+            s[i0]     = -sin_theta*zeta;
+            s[i0 + 1] =  sin_theta*zeta;
+        }
+    } else {
+        // the elements after the last block of n_dims are not rotated
+        for (int64_t i0 = 0; i0 < ne0; ++i0) {
+            c[i0] = 1.0f;
+            s[i0] = 0.0f;
+        }
+
+        // TODO: this might be wrong for ne0 != n_dims - need double check
+        // ref:  https://github.com/huggingface/transformers/blob/main/src/transformers/models/gpt_neox/modeling_gpt_neox.py#LL251C1-L294C28
+        theta_base *= freq_scale;
+        for (int64_t ib = 0; ib < ne0/n_dims; ++ib) {
+            for (int64_t ic = 0; ic < n_dims; ic += 2) {
+                // simplified from `(ib * n_dims + ic) * inv_ndims`
+                float cur_rot = inv_ndims * ic - ib;
+
+                float cos_theta, sin_theta;
+                rope_yarn(
+                    theta_base, freq_scale, corr_dims, cur_rot, ext_factor, attn_factor,
+                    &cos_theta, &sin_theta
+                );
+
+                theta_base *= theta_scale;
+
+                const int64_t i0 = ib*n_dims + ic/2;
+
+                c[i0]            =  cos_theta;
+                c[i0 + n_dims/2] =  cos_theta;
+                s[i0]            = -sin_theta;
+                s[i0 + n_dims/2] =  sin_theta;
+            }
+        }
+    }
+}
+
+// y = rope(x) with the rotation of ggml_rope_cache_init, y may alias x
+static void ggml_rope_apply_f32(int64_t ne0, int n_dims, bool is_neox, const float * cache, const float * x, float * y) {
+    const float * c = cache;
+    const float * s = cache + ne0;
+
+    if (!is_neox) {
+        // the paired elements are adjacent
+        int64_t i = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+        for (; i + 7 < ne0; i += 8) {
+            const __m256 vx = _mm256_loadu_ps(x + i);
+            const __m256 vp = _mm256_permute_ps(vx, 0xB1);
+            _mm256_storeu_ps(y + i, _mm256_fmadd_ps(vp, _mm256_loadu_ps(s + i), _mm256_mul_ps(vx, _mm256_loadu_ps(c + i))));
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        for (; i + 3 < ne0; i += 4) {
+            const float32x4_t vx = vld1q_f32(x + i);
+            const float32x4_t vp = vrev64q_f32(vx);
+            vst1q_f32(y + i, vfmaq_f32(vmulq_f32(vx, vld1q_f32(c + i)), vp, vld1q_f32(s + i)));
+        }
+#endif
+        for (; i < ne0; i += 2) {
+            const float x0 = x[i];
+            const float x1 = x[i + 1];
+
+            y[i]     = x0*c[i]     + x1*s[i];
+            y[i + 1] = x1*c[i + 1] + x0*s[i + 1];
+        }
+    } else {
+        // the paired elements are n_dims/2 apart in each block of n_dims
+        const int64_t n_half = n_dims/2;
+
+        int64_t i0 = 0;
+        for (; i0 + n_dims <= ne0; i0 += n_dims) {
+            int64_t i = 0;
+#if defined(GGML_SIMD)
+            for (; i + GGML_F32_EPR <= n_half; i += GGML_F32_EPR) {
+                const GGML_F32_VEC x0 = GGML_F32_VEC_LOAD(x + i0 + i);
+                const GGML_F32_VEC x1 = GGML_F32_VEC_LOAD(x + i0 + i + n_half);
+
+                const GGML_F32_VEC y0 = GGML_F32_VEC_FMA(GGML_F32_VEC_MUL(x0, GGML_F32_VEC_LOAD(c + i0 + i)),          x1, GGML_F32_VEC_LOAD(s + i0 + i));
+                const GGML_F32_VEC y1 = GGML_F32_VEC_FMA(GGML_F32_VEC_MUL(x1, GGML_F32_VEC_LOAD(c + i0 + i + n_half)), x0, GGML_F32_VEC_LOAD(s + i0 + i + n_half));
+
+                GGML_F32_VEC_STORE(y + i0 + i,          y0);
+                GGML_F32_VEC_STORE(y + i0 + i + n_half, y1);
+            }
+#endif
+            for (; i < n_half; ++i) {
+                const float x0 = x[i0 + i];
+                const float x1 = x[i0 + i + n_half];
+
+                y[i0 + i]          = x0*c[i0 + i]          + x1*s[i0 + i];
+                y[i0 + i + n_half] = x1*c[i0 + i + n_half] + x0*s[i0 + i + n_half];
+            }
+        }
+
+        if (y != x) {
+            memcpy(y + i0, x + i0, (ne0 - i0)*sizeof(float));
+        }
+    }
+}
+
+// per-thread work buffer: the rotation of the current position, and a row converted to F32
+static size_t ggml_rope_wsize(int64_t ne0) {
+    return sizeof(float)*(3*ne0 + CACHE_LINE_SIZE_F32);
+}
+
+// the rotations of the positions in the cache src2 are read from it
+// the others are computed once per position and thread, and used for all the rows at that position
 static void ggml_compute_forward_rope_f32(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
+        const struct ggml_tensor * src2,
         struct ggml_tensor * dst) {
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
 
-    float freq_base, freq_scale, ext_factor, attn_factor, beta_fast, beta_slow;
-
-    // these two only relevant for xPos RoPE:
-    float xpos_base;
-    bool  xpos_down;
+    float freq_base;
 
     //const int n_past     = ((int32_t *) dst->op_params)[0];
     const int n_dims     = ((int32_t *) dst->op_params)[1];
     const int mode       = ((int32_t *) dst->op_params)[2];
     const int n_ctx      = ((int32_t *) dst->op_params)[3];
-    const int n_orig_ctx = ((int32_t *) dst->op_params)[4];
 
     memcpy(&freq_base,   (int32_t *) dst->op_params +  5, sizeof(float));
-    memcpy(&freq_scale,  (int32_t *) dst->op_params +  6, sizeof(float));
-    memcpy(&ext_factor,  (int32_t *) dst->op_params +  7, sizeof(float));
-    memcpy(&attn_factor, (int32_t *) dst->op_params +  8, sizeof(float));
-    memcpy(&beta_fast,   (int32_t *) dst->op_params +  9, sizeof(float));
-    memcpy(&beta_slow,   (int32_t *) dst->op_params + 10, sizeof(float));
-    memcpy(&xpos_base,   (int32_t *) dst->op_params + 11, sizeof(float));
-    memcpy(&xpos_down,   (int32_t *) dst->op_params + 12, sizeof(bool));
 
     GGML_TENSOR_UNARY_OP_LOCALS
 
@@ -11006,6 +12901,7 @@ static void ggml_compute_forward_rope_f32(
     //printf("n_past = %d, ne2 = %d\n", n_past, ne2);
 
     GGML_ASSERT(nb00 == sizeof(float));
+    GGML_ASSERT(nb0  == sizeof(float));
 
     const int ith = params->ith;
     const int nth = params->nth;
@@ -11026,26 +12922,26 @@ static void ggml_compute_forward_rope_f32(
     int ir = 0;
 
     const float theta_scale = powf(freq_base, -2.0f/n_dims);
-    const float inv_ndims = -1.f/n_dims;
-    float corr_dims[2];
-    ggml_rope_yarn_corr_dims(n_dims, n_orig_ctx, freq_base, beta_fast, beta_slow, corr_dims);
 
     const bool is_neox = mode & 2;
     const bool is_glm  = mode & 4;
 
     const int32_t * pos = (const int32_t *) src1->data;
 
+    float * wcache = (float *) params->wdata + ith*(ggml_rope_wsize(ne0)/sizeof(float));
+
     for (int64_t i3 = 0; i3 < ne3; i3++) {
         for (int64_t i2 = 0; i2 < ne2; i2++) {
             const int64_t p = pos[i2];
+
+            const float * cache = NULL;
+
             for (int64_t i1 = 0; i1 < ne1; i1++) {
                 if (ir++ < ir0) continue;
                 if (ir   > ir1) break;
 
-                float theta_base = (float)p;
-
                 if (is_glm) {
-                    theta_base = MIN(p, n_ctx - 2);
+                    float theta_base = MIN(p, n_ctx - 2);
                     float block_theta = MAX(p - (n_ctx - 2), 0);
                     for (int64_t i0 = 0; i0 < ne0 / 4; i0++) {
                         const float cos_theta = cosf(theta_base);
@@ -11069,58 +12965,21 @@ static void ggml_compute_forward_rope_f32(
                         dst_data[n_dims]     = x2*cos_block_theta - x3*sin_block_theta;
                         dst_data[n_dims/2*3] = x2*sin_block_theta + x3*cos_block_theta;
                     }
-                } else if (!is_neox) {
-                    for (int64_t i0 = 0; i0 < ne0; i0 += 2) {
-                        float cos_theta, sin_theta;
-                        rope_yarn(
-                            theta_base, freq_scale, corr_dims, i0, ext_factor, attn_factor, &cos_theta, &sin_theta
-                        );
-
-                        // zeta scaling for xPos only:
-                        float zeta = xpos_base != 0.0f ? powf((i0 + 0.4f * ne0) / (1.4f * ne0), p / xpos_base) : 1.0f;
-                        if (xpos_down) zeta = 1.0f / zeta;
-
-                        theta_base *= theta_scale;
-
-                        const float * const src = (float *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + i0*nb00);
-                              float * dst_data  = (float *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + i0*nb0);
-
-                        const float x0 = src[0];
-                        const float x1 = src[1];
-
-                        dst_data[0] = x0*cos_theta*zeta - x1*sin_theta*zeta;
-                        dst_data[1] = x0*sin_theta*zeta + x1*cos_theta*zeta;
-                    }
-                } else {
-                    // TODO: this might be wrong for ne0 != n_dims - need double check
-                    // ref:  https://github.com/huggingface/transformers/blob/main/src/transformers/models/gpt_neox/modeling_gpt_neox.py#LL251C1-L294C28
-                    theta_base *= freq_scale;
-                    for (int64_t ib = 0; ib < ne0/n_dims; ++ib) {
-                        for (int64_t ic = 0; ic < n_dims; ic += 2) {
-                            // simplified from `(ib * n_dims + ic) * inv_ndims`
-                            float cur_rot = inv_ndims * ic - ib;
-
-                            float cos_theta, sin_theta;
-                            rope_yarn(
-                                theta_base, freq_scale, corr_dims, cur_rot, ext_factor, attn_factor,
-                                &cos_theta, &sin_theta
-                            );
-
-                            theta_base *= theta_scale;
-
-                            const int64_t i0 = ib*n_dims + ic/2;
-
-                            const float * const src = (float *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + i0*nb00);
-                                  float * dst_data  = (float *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + i0*nb0);
-
-                            const float x0 = src[0];
-                            const float x1 = src[n_dims/2];
+                    continue;
+                }
 
-                            dst_data[0]        = x0*cos_theta - x1*sin_theta;
-                            dst_data[n_dims/2] = x0*sin_theta + x1*cos_theta;
-                        }
+                if (!cache) {
+                    if (src2 && p >= 0 && p < src2->ne[1]) {
+                        cache = (const float *) ((const char *) src2->data + p*src2->nb[1]);
+                    } else {
+                        ggml_rope_cache_init((const int32_t *) dst->op_params, ne0, (float) p, wcache);
+                        cache = wcache;
                     }
                 }
+
+                ggml_rope_apply_f32(ne0, n_dims, is_neox, cache,
+                        (const float *) ((const char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01),
+                        (float *) ((char *) dst->data + i3*nb3 + i2*nb2 + i1*nb1));
             }
         }
     }
@@ -11130,31 +12989,27 @@ static void ggml_compute_forward_rope_f16(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
+        const struct ggml_tensor * src2,
         struct ggml_tensor * dst) {
     if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
         return;
     }
 
-    float freq_base, freq_scale, ext_factor, attn_factor, beta_fast, beta_slow;
+    float freq_base;
 
     //const int n_past     = ((int32_t *) dst->op_params)[0];
     const int n_dims     = ((int32_t *) dst->op_params)[1];
     const int mode       = ((int32_t *) dst->op_params)[2];
     const int n_ctx      = ((int32_t *) dst->op_params)[3];
-    const int n_orig_ctx = ((int32_t *) dst->op_params)[4];
     memcpy(&freq_base,   (int32_t *) dst->op_params +  5, sizeof(float));
-    memcpy(&freq_scale,  (int32_t *) dst->op_params +  6, sizeof(float));
-    memcpy(&ext_factor,  (int32_t *) dst->op_params +  7, sizeof(float));
-    memcpy(&attn_factor, (int32_t *) dst->op_params +  8, sizeof(float));
-    memcpy(&beta_fast,   (int32_t *) dst->op_params +  9, sizeof(float));
-    memcpy(&beta_slow,   (int32_t *) dst->op_params + 10, sizeof(float));
 
     GGML_TENSOR_UNARY_OP_LOCALS
 
     //printf("ne0: %d, ne1: %d, ne2: %d, ne3: %d\n", ne0, ne1, ne2, ne3);
     //printf("n_past = %d, ne2 = %d\n", n_past, ne2);
 
-    GGML_ASSERT(nb0 == sizeof(ggml_fp16_t));
+    GGML_ASSERT(nb00 == sizeof(ggml_fp16_t));
+    GGML_ASSERT(nb0  == sizeof(ggml_fp16_t));
 
     const int ith = params->ith;
     const int nth = params->nth;
@@ -11175,26 +13030,27 @@ static void ggml_compute_forward_rope_f16(
     int ir = 0;
 
     const float theta_scale = powf(freq_base, -2.0f/n_dims);
-    const float inv_ndims = -1.f/n_dims;
-    float corr_dims[2];
-    ggml_rope_yarn_corr_dims(n_dims, n_orig_ctx, freq_base, beta_fast, beta_slow, corr_dims);
 
     const bool is_neox = mode & 2;
     const bool is_glm  = mode & 4;
 
     const int32_t * pos = (const int32_t *) src1->data;
 
+    float * wcache = (float *) params->wdata + ith*(ggml_rope_wsize(ne0)/sizeof(float));
+    float * wrow   = wcache + 2*ne0;
+
     for (int64_t i3 = 0; i3 < ne3; i3++) {
         for (int64_t i2 = 0; i2 < ne2; i2++) {
             const int64_t p = pos[i2];
+
+            const float * cache = NULL;
+
             for (int64_t i1 = 0; i1 < ne1; i1++) {
                 if (ir++ < ir0) continue;
                 if (ir   > ir1) break;
 
-                float theta_base = (float)p;
-
                 if (is_glm) {
-                    theta_base = MIN(p, n_ctx - 2);
+                    float theta_base = MIN(p, n_ctx - 2);
                     float block_theta = MAX(p - (n_ctx - 2), 0);
                     for (int64_t i0 = 0; i0 < ne0 / 4; i0++) {
                         const float cos_theta = cosf(theta_base);
@@ -11218,54 +13074,21 @@ static void ggml_compute_forward_rope_f16(
                         dst_data[n_dims]     = GGML_FP32_TO_FP16(x2*cos_block_theta - x3*sin_block_theta);
                         dst_data[n_dims/2*3] = GGML_FP32_TO_FP16(x2*sin_block_theta + x3*cos_block_theta);
                     }
-                } else if (!is_neox) {
-                    for (int64_t i0 = 0; i0 < ne0; i0 += 2) {
-                        float cos_theta, sin_theta;
-                        rope_yarn(
-                            theta_base, freq_scale, corr_dims, i0, ext_factor, attn_factor, &cos_theta, &sin_theta
-                        );
-
-                        theta_base *= theta_scale;
-
-                        const ggml_fp16_t * const src = (ggml_fp16_t *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + i0*nb00);
-                              ggml_fp16_t * dst_data  = (ggml_fp16_t *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + i0*nb0);
-
-                        const float x0 = GGML_FP16_TO_FP32(src[0]);
-                        const float x1 = GGML_FP16_TO_FP32(src[1]);
-
-                        dst_data[0] = GGML_FP32_TO_FP16(x0*cos_theta - x1*sin_theta);
-                        dst_data[1] = GGML_FP32_TO_FP16(x0*sin_theta + x1*cos_theta);
-                    }
-                } else {
-                    // TODO: this might be wrong for ne0 != n_dims - need double check
-                    // ref:  https://github.com/huggingface/transformers/blob/main/src/transformers/models/gpt_neox/modeling_gpt_neox.py#LL251C1-L294C28
-                    theta_base *= freq_scale;
-                    for (int64_t ib = 0; ib < ne0/n_dims; ++ib) {
-                        for (int64_t ic = 0; ic < n_dims; ic += 2) {
-                            // simplified from `(ib * n_dims + ic) * inv_ndims`
-                            float cur_rot = inv_ndims * ic - ib;
-
-                            float cos_theta, sin_theta;
-                            rope_yarn(
-                                theta_base, freq_scale, corr_dims, cur_rot, ext_factor, attn_factor,
-                                &cos_theta, &sin_theta
-                            );
-
-                            theta_base *= theta_scale;
-
-                            const int64_t i0 = ib*n_dims + ic/2;
-
-                            const ggml_fp16_t * const src = (ggml_fp16_t *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + i0*nb00);
-                                  ggml_fp16_t * dst_data  = (ggml_fp16_t *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + i0*nb0);
-
-                            const float x0 = GGML_FP16_TO_FP32(src[0]);
-                            const float x1 = GGML_FP16_TO_FP32(src[n_dims/2]);
+                    continue;
+                }
 
-                            dst_data[0]        = GGML_FP32_TO_FP16(x0*cos_theta - x1*sin_theta);
-                            dst_data[n_dims/2] = GGML_FP32_TO_FP16(x0*sin_theta + x1*cos_theta);
-                        }
+                if (!cache) {
+                    if (src2 && p >= 0 && p < src2->ne[1]) {
+                        cache = (const float *) ((const char *) src2->data + p*src2->nb[1]);
+                    } else {
+                        ggml_rope_cache_init((const int32_t *) dst->op_params, ne0, (float) p, wcache);
+                        cache = wcache;
                     }
                 }
+
+                ggml_fp16_to_fp32_row((const ggml_fp16_t *) ((const char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01), wrow, ne0);
+                ggml_rope_apply_f32(ne0, n_dims, is_neox, cache, wrow, wrow);
+                ggml_fp32_to_fp16_row(wrow, (ggml_fp16_t *) ((char *) dst->data + i3*nb3 + i2*nb2 + i1*nb1), ne0);
             }
         }
     }
@@ -11275,15 +13098,16 @@ static void ggml_compute_forward_rope(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * src0,
         const struct ggml_tensor * src1,
+        const struct ggml_tensor * src2,
         struct ggml_tensor * dst) {
     switch (src0->type) {
         case GGML_TYPE_F16:
             {
-                ggml_compute_forward_rope_f16(params, src0, src1, dst);
+                ggml_compute_forward_rope_f16(params, src0, src1, src2, dst);
             } break;
         case GGML_TYPE_F32:
             {
-                ggml_compute_forward_rope_f32(params, src0, src1, dst);
+                ggml_compute_forward_rope_f32(params, src0, src1, src2, dst);
             } break;
         default:
             {
@@ -13223,6 +15047,225 @@ static void ggml_compute_forward_flash_attn(
     }
 }
 
+// ggml_compute_forward_flash_attn_ext
+
+// rows of q processed together, so that each row of K and V is loaded once per block
+#define GGML_FLASH_ATTN_EXT_BQ  8
+// KV positions per step of the online softmax, large enough that the segments of the V^T rows
+// read in each step are long sequential streams
+#define GGML_FLASH_ATTN_EXT_BKV 2048
+
+// per-thread work buffer
+static size_t ggml_flash_attn_ext_wsize(int64_t D) {
+    const int64_t BQ  = GGML_FLASH_ATTN_EXT_BQ;
+    const int64_t BKV = GGML_FLASH_ATTN_EXT_BKV;
+
+    return sizeof(float)*(BQ*(2*D + 2*BKV + 2) + CACHE_LINE_SIZE_F32);
+}
+
+static void ggml_compute_forward_flash_attn_ext(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * q,
+        const struct ggml_tensor * k,
+        const struct ggml_tensor * v,
+        const struct ggml_tensor * mask,
+        struct ggml_tensor * dst) {
+    GGML_TENSOR_LOCALS(int64_t, neq, q,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbq, q,   nb)
+    GGML_TENSOR_LOCALS(int64_t, nek, k,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbk, k,   nb)
+    GGML_TENSOR_LOCALS(size_t,  nbv, v,   nb)
+    GGML_TENSOR_LOCALS(size_t,  nb,  dst, nb)
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t D   = neq0;
+    const int64_t N   = neq1;
+    const int64_t nkv = nek1;
+
+    GGML_ASSERT(k->type == GGML_TYPE_F16 || k->type == GGML_TYPE_F32);
+
+    GGML_ASSERT(nbq0 == sizeof(float));
+    GGML_ASSERT(nbk0 == ggml_type_size(k->type));
+    GGML_ASSERT(nbv0 == ggml_type_size(v->type));
+    GGML_ASSERT(nb0  == sizeof(float));
+
+    GGML_ASSERT(neq2 % nek2 == 0);
+    GGML_ASSERT(neq3 % nek3 == 0);
+
+    if (params->type == GGML_TASK_INIT || params->type == GGML_TASK_FINALIZE) {
+        return;
+    }
+
+    float scale;
+    float max_bias;
+    memcpy(&scale,    (float *) dst->op_params + 0, sizeof(float));
+    memcpy(&max_bias, (float *) dst->op_params + 1, sizeof(float));
+
+    // broadcast factors of the KV heads
+    const int64_t rk2 = neq2/nek2;
+    const int64_t rk3 = neq3/nek3;
+
+    // ALiBi slopes, as in ggml_compute_forward_alibi_f32
+    const int n_heads_log2_floor = 1 << (int) floor(log2(neq2));
+
+    const float m0 = powf(2.0f, -(max_bias) / n_heads_log2_floor);
+    const float m1 = powf(2.0f, -(max_bias / 2.0f) / n_heads_log2_floor);
+
+    const bool is_f16 = k->type == GGML_TYPE_F16;
+
+    const int64_t BQ  = GGML_FLASH_ATTN_EXT_BQ;
+    const int64_t BKV = GGML_FLASH_ATTN_EXT_BKV;
+
+    float * wdata = (float *) params->wdata + ith*(ggml_flash_attn_ext_wsize(D)/sizeof(float));
+
+    float * Q = wdata;          // [BQ][D]   rows of q, in the type of K
+    float * O = Q + BQ*D;       // [BQ][D]   unnormalized output
+    float * S = O + BQ*D;       // [BQ][BKV] scores of the current step
+    float * P = S + BQ*BKV;     // [BQ][BKV] probabilities of the current step, in the type of V
+    float * M = P + BQ*BKV;     // [BQ]      running max of the scores
+    float * L = M + BQ;         // [BQ]      running sum of the probabilities
+
+    bool active[GGML_FLASH_ATTN_EXT_BQ];
+
+    // blocks of BQ rows of the same head, interleaved between the threads to balance the causal mask
+    const int64_t nbq = (N + BQ - 1)/BQ;
+    const int64_t nblk = nbq*neq2*neq3;
+
+    for (int64_t ib = ith; ib < nblk; ib += nth) {
+        const int64_t iq3 = ib/(nbq*neq2);
+        const int64_t iq2 = (ib - iq3*nbq*neq2)/nbq;
+        const int64_t iq1 = (ib - iq3*nbq*neq2 - iq2*nbq)*BQ;
+
+        const int64_t nq = MIN(BQ, N - iq1);
+
+        const int64_t ik2 = iq2/rk2;
+        const int64_t ik3 = iq3/rk3;
+
+        float slope = 0.0f;
+        if (max_bias > 0.0f) {
+            slope = iq2 < n_heads_log2_floor ? powf(m0, iq2 + 1) : powf(m1, 2*(iq2 - n_heads_log2_floor) + 1);
+        }
+
+        for (int64_t j = 0; j < nq; ++j) {
+            const float * pq = (const float *) ((const char *) q->data + (iq1 + j)*nbq1 + iq2*nbq2 + iq3*nbq3);
+
+            if (is_f16) {
+                ggml_fp32_to_fp16_row(pq, (ggml_fp16_t *) Q + j*D, D);
+            } else {
+                memcpy(Q + j*D, pq, D*sizeof(float));
+            }
+
+            memset(O + j*D, 0, D*sizeof(float));
+            M[j] = -INFINITY;
+            L[j] = 0.0f;
+        }
+
+        char * k_data = (char *) k->data + ik2*nbk2 + ik3*nbk3;
+        char * v_data = (char *) v->data + ik2*nbv2 + ik3*nbv3;
+
+        for (int64_t ic0 = 0; ic0 < nkv; ic0 += BKV) {
+            const int64_t nc = MIN(BKV, nkv - ic0);
+
+            // S = scale*k*q + alibi + mask, the masked positions are not computed
+            for (int64_t ic = 0; ic < nc; ++ic) {
+                char * pk = k_data + (ic0 + ic)*nbk1;
+
+                for (int64_t j = 0; j < nq; ++j) {
+                    const float mv = mask ? ((const float *) ((const char *) mask->data + (iq1 + j)*mask->nb[1]))[ic0 + ic] : 0.0f;
+
+                    if (mv == -INFINITY) {
+                        S[j*BKV + ic] = -INFINITY;
+                        continue;
+                    }
+
+                    float kq;
+                    if (is_f16) {
+                        ggml_vec_dot_f16(D, &kq, (ggml_fp16_t *) pk, (ggml_fp16_t *) Q + j*D);
+                    } else {
+                        ggml_vec_dot_f32(D, &kq, (const float *) pk, Q + j*D);
+                    }
+
+                    S[j*BKV + ic] = kq*scale + slope*(ic0 + ic) + mv;
+                }
+            }
+
+            // online softmax: rescale the previous steps to the new max
+            bool any_active = false;
+
+            for (int64_t j = 0; j < nq; ++j) {
+                const float * s = S + j*BKV;
+
+                float smax = -INFINITY;
+                ggml_vec_max_f32(nc, &smax, s);
+
+                active[j] = smax != -INFINITY;
+                if (!active[j]) {
+                    continue;
+                }
+                any_active = true;
+
+                const float mnew = MAX(M[j], smax);
+                const float corr = expf(M[j] - mnew);
+
+                ggml_float sum;
+
+                if (is_f16) {
+                    // the scores are not used after this, exp in place and convert to the type of V
+                    sum = ggml_vec_soft_max_f32(nc, S + j*BKV, s, mnew);
+                    ggml_fp32_to_fp16_row(S + j*BKV, (ggml_fp16_t *) P + j*BKV, nc);
+                } else {
+                    sum = ggml_vec_soft_max_f32(nc, P + j*BKV, s, mnew);
+                }
+
+                if (corr != 1.0f) {
+                    ggml_vec_scale_f32(D, O + j*D, corr);
+                }
+
+                L[j] = L[j]*corr + (float) sum;
+                M[j] = mnew;
+            }
+
+            if (!any_active) {
+                continue;
+            }
+
+            // O += P*V, the rows of V^T are contiguous along the KV positions
+            for (int64_t d = 0; d < D; ++d) {
+                char * pv = v_data + d*nbv1 + ic0*nbv0;
+
+                for (int64_t j = 0; j < nq; ++j) {
+                    if (!active[j]) {
+                        continue;
+                    }
+
+                    float kqv;
+                    if (is_f16) {
+                        ggml_vec_dot_f16(nc, &kqv, (ggml_fp16_t *) pv, (ggml_fp16_t *) P + j*BKV);
+                    } else {
+                        ggml_vec_dot_f32(nc, &kqv, (const float *) pv, P + j*BKV);
+                    }
+
+                    O[j*D + d] += kqv;
+                }
+            }
+        }
+
+        // merge the heads: dst[iq3][iq1 + j][iq2]
+        for (int64_t j = 0; j < nq; ++j) {
+            float * pd = (float *) ((char *) dst->data + (iq1 + j)*nb2 + iq2*nb1 + iq3*nb3);
+
+            // rows without any unmasked position are left at zero
+            const float l = L[j] > 0.0f ? 1.0f/L[j] : 0.0f;
+
+            for (int64_t d = 0; d < D; ++d) {
+                pd[d] = O[j*D + d]*l;
+            }
+        }
+    }
+}
+
 // ggml_compute_forward_flash_ff
 
 static void ggml_compute_forward_flash_ff_f16(
@@ -14597,15 +16640,27 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             {
                 ggml_compute_forward_group_norm(params, tensor->src[0], tensor);
             } break;
-        case GGML_OP_MUL_MAT:
+        case GGML_OP_RMS_NORM_MUL:
             {
-                ggml_compute_forward_mul_mat(params, tensor->src[0], tensor->src[1], tensor);
+                ggml_compute_forward_rms_norm_mul(params, tensor->src[0], tensor->src[1], tensor);
             } break;
-        case GGML_OP_OUT_PROD:
+        case GGML_OP_ADD_RMS_NORM:
             {
-                ggml_compute_forward_out_prod(params, tensor->src[0], tensor->src[1], tensor);
+                ggml_compute_forward_add_rms_norm(params, tensor->src[0], tensor->src[1], tensor->src[2], tensor);
             } break;
-        case GGML_OP_SCALE:
+        case GGML_OP_SWIGLU:
+            {
+                ggml_compute_forward_swiglu(params, tensor->src[0], tensor->src[1], tensor);
+            } break;
+        case GGML_OP_MUL_MAT:
+            {
+                ggml_compute_forward_mul_mat(params, tensor->src[0], tensor->src[1], tensor);
+            } break;
+        case GGML_OP_OUT_PROD:
+            {
+                ggml_compute_forward_out_prod(params, tensor->src[0], tensor->src[1], tensor);
+            } break;
+        case GGML_OP_SCALE:
             {
                 ggml_compute_forward_scale(params, tensor->src[0], tensor->src[1], tensor);
             } break;
@@ -14645,6 +16700,10 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             {
                 ggml_compute_forward_get_rows_back(params, tensor->src[0], tensor->src[1], tensor);
             } break;
+        case GGML_OP_SET_ROWS:
+            {
+                ggml_compute_forward_set_rows(params, tensor->src[1], tensor->src[2], tensor);
+            } break;
         case GGML_OP_DIAG:
             {
                 ggml_compute_forward_diag(params, tensor->src[0], tensor);
@@ -14659,7 +16718,7 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             } break;
         case GGML_OP_SOFT_MAX:
             {
-                ggml_compute_forward_soft_max(params, tensor->src[0], tensor);
+                ggml_compute_forward_soft_max(params, tensor->src[0], tensor->src[1], tensor);
             } break;
         case GGML_OP_SOFT_MAX_BACK:
             {
@@ -14667,7 +16726,7 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             } break;
         case GGML_OP_ROPE:
             {
-                ggml_compute_forward_rope(params, tensor->src[0], tensor->src[1], tensor);
+                ggml_compute_forward_rope(params, tensor->src[0], tensor->src[1], tensor->src[2], tensor);
             } break;
         case GGML_OP_ROPE_BACK:
             {
@@ -14732,6 +16791,10 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
                 const bool masked = t != 0;
                 ggml_compute_forward_flash_attn(params, tensor->src[0], tensor->src[1], tensor->src[2], masked, tensor);
             } break;
+        case GGML_OP_FLASH_ATTN_EXT:
+            {
+                ggml_compute_forward_flash_attn_ext(params, tensor->src[0], tensor->src[1], tensor->src[2], tensor->src[3], tensor);
+            } break;
         case GGML_OP_FLASH_FF:
             {
                 ggml_compute_forward_flash_ff(params, tensor->src[0], tensor->src[1], tensor->src[2], tensor->src[3], tensor->src[4], tensor);
@@ -14836,62 +16899,109 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static_assert(GGML_GRAPH_HASHTABLE_SIZE > GGML_MAX_NODES * 2, "GGML_GRAPH_HT_SIZE is too small");
-
-static size_t hash(void * p) {
-    return (size_t)p % GGML_GRAPH_HASHTABLE_SIZE;
+static size_t ggml_hash(const void * p) {
+    return (size_t)p;
 }
 
-static size_t hash_find(void * hash_table[], void * p) {
-    size_t h = hash(p);
+size_t ggml_hash_find(const struct ggml_hash_set hash_set, struct ggml_tensor * key) {
+    size_t h = ggml_hash(key) % hash_set.size;
 
     // linear probing
     size_t i = h;
-    while (hash_table[i] != NULL && hash_table[i] != p) {
-        i = (i + 1) % GGML_GRAPH_HASHTABLE_SIZE;
+    while (hash_set.keys[i] != NULL && hash_set.keys[i] != key) {
+        i = (i + 1) % hash_set.size;
         if (i == h) {
             // visited all hash table entries -> not found
-            return GGML_GRAPH_HASHTABLE_SIZE;
+            return GGML_HASHTABLE_FULL;
         }
     }
     return i;
 }
 
-static bool hash_insert(void * hash_table[], void * p) {
-    size_t i = hash_find(hash_table, p);
+bool ggml_hash_contains(const struct ggml_hash_set hash_set, struct ggml_tensor * key) {
+    size_t i = ggml_hash_find(hash_set, key);
+    return i != GGML_HASHTABLE_FULL && hash_set.keys[i] == key;
+}
 
-    GGML_ASSERT(i < GGML_GRAPH_HASHTABLE_SIZE); // assert that not full
+size_t ggml_hash_insert(struct ggml_hash_set hash_set, struct ggml_tensor * key) {
+    size_t i = ggml_hash_find(hash_set, key);
 
-    if (hash_table[i] == p) {
-        return true;
+    GGML_ASSERT(i != GGML_HASHTABLE_FULL);
+
+    if (hash_set.keys[i] == key) {
+        return GGML_HASHTABLE_ALREADY_EXISTS;
     }
 
     // insert
-    GGML_ASSERT(hash_table[i] == NULL);
-    hash_table[i] = p;
-    return false;
+    GGML_ASSERT(hash_set.keys[i] == NULL);
+    hash_set.keys[i] = key;
+    return i;
+}
+
+size_t ggml_hash_find_or_insert(struct ggml_hash_set hash_set, struct ggml_tensor * key) {
+    size_t i = ggml_hash_find(hash_set, key);
+
+    GGML_ASSERT(i != GGML_HASHTABLE_FULL);
+
+    hash_set.keys[i] = key;
+    return i;
+}
+
+size_t ggml_hash_size(size_t min_sz) {
+    // next primes after powers of two
+    static const size_t primes[] = {
+        2, 3, 5, 11, 17, 37, 67, 131, 257, 521, 1031,
+        2053, 4099, 8209, 16411, 32771, 65537, 131101,
+        262147, 524309, 1048583, 2097169, 4194319, 8388617,
+        16777259, 33554467, 67108879, 134217757, 268435459,
+        536870923, 1073741827, 2147483659
+    };
+    static const size_t n_primes = sizeof(primes)/sizeof(primes[0]);
+
+    // find the smallest prime that is larger or equal to min_sz
+    size_t l = 0;
+    size_t r = n_primes;
+    while (l < r) {
+        size_t m = (l + r)/2;
+        if (primes[m] < min_sz) {
+            l = m + 1;
+        } else {
+            r = m;
+        }
+    }
+    size_t sz = l < n_primes ? primes[l] : min_sz | 1;
+    return sz;
 }
 
-static bool hash_contains(void * hash_table[], void * p) {
-    size_t i = hash_find(hash_table, p);
-    return (i < GGML_GRAPH_HASHTABLE_SIZE) && (hash_table[i] == p);
+static struct ggml_hash_set ggml_hash_set_new(size_t size) {
+    size = ggml_hash_size(size);
+    struct ggml_hash_set result;
+    result.size = size;
+    result.keys = calloc(size, sizeof(struct ggml_tensor *));
+    GGML_ASSERT(result.keys != NULL);
+    return result;
+}
+
+static void ggml_hash_set_free(struct ggml_hash_set hash_set) {
+    free(hash_set.keys);
 }
 
 struct hash_map {
-    void * keys[GGML_GRAPH_HASHTABLE_SIZE];
-    void * vals[GGML_GRAPH_HASHTABLE_SIZE];
+    struct ggml_hash_set set;
+    void ** vals;
 };
 
-static struct hash_map * new_hash_map(void) {
+static struct hash_map * ggml_new_hash_map(size_t size) {
     struct hash_map * result = malloc(sizeof(struct hash_map));
-    for (int i=0; i<GGML_GRAPH_HASHTABLE_SIZE; ++i) {
-        result->keys[i] = NULL;
-        result->vals[i] = NULL;
-    }
+    result->set  = ggml_hash_set_new(size);
+    result->vals = calloc(result->set.size, sizeof(void *));
+    GGML_ASSERT(result->vals != NULL);
     return result;
 }
 
-static void free_hash_map(struct hash_map * map) {
+static void ggml_hash_map_free(struct hash_map * map) {
+    ggml_hash_set_free(map->set);
+    free(map->vals);
     free(map);
 }
 
@@ -14911,7 +17021,7 @@ static struct ggml_tensor * ggml_recompute_graph_node(
         return node;
     }
 
-    if (!hash_contains(graph->visited_hash_table, node)) {
+    if (!ggml_hash_contains(graph->visited_hash_table, node)) {
         return node;
     }
 
@@ -14926,17 +17036,17 @@ static struct ggml_tensor * ggml_recompute_graph_node(
         return node;
     }
 
-    size_t i = hash_find(replacements->keys, node);
-    GGML_ASSERT(i < GGML_GRAPH_HASHTABLE_SIZE); // assert that not full
-    if (replacements->keys[i] == node) {
+    size_t i = ggml_hash_find(replacements->set, node);
+    GGML_ASSERT(i != GGML_HASHTABLE_FULL); // assert that not full
+    if (replacements->set.keys[i] == node) {
         return (struct ggml_tensor *) replacements->vals[i];
     }
 
     struct ggml_tensor * clone = ggml_new_tensor(ctx, node->type, node->n_dims, node->ne);
 
     // insert clone into replacements
-    GGML_ASSERT(replacements->keys[i] == NULL); // assert that we don't overwrite
-    replacements->keys[i] = node;
+    GGML_ASSERT(replacements->set.keys[i] == NULL); // assert that we don't overwrite
+    replacements->set.keys[i] = node;
     replacements->vals[i] = clone;
 
     clone->op       = node->op;
@@ -14973,26 +17083,26 @@ void ggml_build_backward_gradient_checkpointing(
         struct ggml_cgraph    * gb_tmp,
         struct ggml_tensor  * * checkpoints,
         int                     n_checkpoints) {
-    *gb_tmp = *gf;
+    ggml_graph_cpy(gf, gb_tmp);
     ggml_build_backward_expand(ctx, gf, gb_tmp, true);
 
     if (n_checkpoints <= 0) {
-        *gb = *gb_tmp;
+        ggml_graph_cpy(gb_tmp, gb);
         return;
     }
 
-    struct hash_map * replacements = new_hash_map();
+    struct hash_map * replacements = ggml_new_hash_map(gf->n_nodes + gf->n_leafs + n_checkpoints);
 
     // insert checkpoints in replacements
     for (int i = 0; i < n_checkpoints; ++i) {
-        size_t k = hash_find(replacements->keys, checkpoints[i]);
-        GGML_ASSERT(k < GGML_GRAPH_HASHTABLE_SIZE); // assert that not full
-        GGML_ASSERT(replacements->keys[k] == NULL); // assert that we don't overwrite
-        replacements->keys[k] = checkpoints[i];
-        replacements->vals[k] = checkpoints[i];
+        size_t k = ggml_hash_find(replacements->set, checkpoints[i]);
+        GGML_ASSERT(k != GGML_HASHTABLE_FULL); // assert that not full
+        GGML_ASSERT(replacements->set.keys[k] == NULL); // assert that we don't overwrite
+        replacements->set.keys[k] = checkpoints[i];
+        replacements->vals[k]     = checkpoints[i];
     }
 
-    *gb = *gf;
+    ggml_graph_cpy(gf, gb);
     // rewrite gb_tmp->nodes[gf->n_nodes:gb_tmp->n_nodes],
     // replacing references to gb_tmp->nodes[0:gf->n_nodes] ( == gf->nodes[0:gf->n_nodes]),
     // by recomputing them from checkpoints
@@ -15009,21 +17119,21 @@ void ggml_build_backward_gradient_checkpointing(
         ggml_build_forward_expand(gb, node);
     }
 
-    free_hash_map(replacements);
+    ggml_hash_map_free(replacements);
 }
 
 // functions to change gradients considering the case that input a might be initial gradient with zero value
 
-static struct ggml_tensor * ggml_add_or_set(struct ggml_context * ctx, struct ggml_tensor * a, struct ggml_tensor * b, void * zero_table[]) {
-    if (hash_contains(zero_table, a)) {
+static struct ggml_tensor * ggml_add_or_set(struct ggml_context * ctx, struct ggml_tensor * a, struct ggml_tensor * b, struct ggml_hash_set zero_table) {
+    if (ggml_hash_contains(zero_table, a)) {
         return b;
     } else {
         return ggml_add_impl(ctx, a, b, false);
     }
 }
 
-static struct ggml_tensor * ggml_acc_or_set(struct ggml_context * ctx, struct ggml_tensor * a, struct ggml_tensor * b, size_t nb1, size_t nb2, size_t nb3, size_t offset, void * zero_table[]) {
-    if (hash_contains(zero_table, a)) {
+static struct ggml_tensor * ggml_acc_or_set(struct ggml_context * ctx, struct ggml_tensor * a, struct ggml_tensor * b, size_t nb1, size_t nb2, size_t nb3, size_t offset, struct ggml_hash_set zero_table) {
+    if (ggml_hash_contains(zero_table, a)) {
         struct ggml_tensor * a_zero = ggml_scale(ctx, a, ggml_new_f32(ctx, 0));
         return ggml_acc_impl(ctx, a_zero, b, nb1, nb2, nb3, offset, false);
     } else {
@@ -15031,23 +17141,23 @@ static struct ggml_tensor * ggml_acc_or_set(struct ggml_context * ctx, struct gg
     }
 }
 
-static struct ggml_tensor * ggml_add1_or_set(struct ggml_context * ctx, struct ggml_tensor * a, struct ggml_tensor * b, void * zero_table[]) {
-    if (hash_contains(zero_table, a)) {
+static struct ggml_tensor * ggml_add1_or_set(struct ggml_context * ctx, struct ggml_tensor * a, struct ggml_tensor * b, struct ggml_hash_set zero_table) {
+    if (ggml_hash_contains(zero_table, a)) {
         return ggml_repeat(ctx, b, a);
     } else {
         return ggml_add1_impl(ctx, a, b, false);
     }
 }
 
-static struct ggml_tensor * ggml_sub_or_set(struct ggml_context * ctx, struct ggml_tensor * a, struct ggml_tensor * b, void * zero_table[]) {
-    if (hash_contains(zero_table, a)) {
+static struct ggml_tensor * ggml_sub_or_set(struct ggml_context * ctx, struct ggml_tensor * a, struct ggml_tensor * b, struct ggml_hash_set zero_table) {
+    if (ggml_hash_contains(zero_table, a)) {
         return ggml_neg(ctx, b);
     } else {
         return ggml_sub_impl(ctx, a, b, false);
     }
 }
 
-static void ggml_compute_backward(struct ggml_context * ctx, struct ggml_tensor * tensor, void * zero_table[]) {
+static void ggml_compute_backward(struct ggml_context * ctx, struct ggml_tensor * tensor, struct ggml_hash_set zero_table) {
     struct ggml_tensor * src0 = tensor->src[0];
     struct ggml_tensor * src1 = tensor->src[1];
 
@@ -15270,6 +17380,12 @@ static void ggml_compute_backward(struct ggml_context * ctx, struct ggml_tensor
             {
                 GGML_ASSERT(false); // TODO: not implemented
             } break;
+        case GGML_OP_RMS_NORM_MUL:
+        case GGML_OP_ADD_RMS_NORM:
+        case GGML_OP_SWIGLU:
+            {
+                GGML_ASSERT(false); // TODO: not implemented
+            } break;
         case GGML_OP_MUL_MAT:
             {
                 // https://cs231n.github.io/optimization-2/#staged
@@ -15510,6 +17626,7 @@ static void ggml_compute_backward(struct ggml_context * ctx, struct ggml_tensor
                 }
             } break;
         case GGML_OP_GET_ROWS_BACK:
+        case GGML_OP_SET_ROWS:
             {
                 GGML_ASSERT(false); // TODO: not implemented
             } break;
@@ -15607,6 +17724,7 @@ static void ggml_compute_backward(struct ggml_context * ctx, struct ggml_tensor
                             ggml_rope_impl(ctx,
                                 tensor->grad,
                                 src1,
+                                NULL,
                                 n_dims,
                                 mode,
                                 0,
@@ -15729,6 +17847,10 @@ static void ggml_compute_backward(struct ggml_context * ctx, struct ggml_tensor
                             zero_table);
                 }
             } break;
+        case GGML_OP_FLASH_ATTN_EXT:
+            {
+                GGML_ASSERT(false); // TODO: not implemented
+            } break;
         case GGML_OP_FLASH_FF:
             {
                 GGML_ASSERT(false); // not supported
@@ -15869,7 +17991,7 @@ static void ggml_visit_parents(struct ggml_cgraph * cgraph, struct ggml_tensor *
     }
 
     // check if already visited
-    if (hash_insert(cgraph->visited_hash_table, node)) {
+    if (ggml_hash_insert(cgraph->visited_hash_table, node) == GGML_HASHTABLE_ALREADY_EXISTS) {
         return;
     }
 
@@ -15885,7 +18007,7 @@ static void ggml_visit_parents(struct ggml_cgraph * cgraph, struct ggml_tensor *
 
     if (node->op == GGML_OP_NONE && node->grad == NULL) {
         // reached a leaf node, not part of the gradient graph (e.g. a constant)
-        GGML_ASSERT(cgraph->n_leafs < GGML_MAX_NODES);
+        GGML_ASSERT(cgraph->n_leafs < cgraph->size);
 
         if (strlen(node->name) == 0) {
             ggml_format_name(node, "leaf_%d", cgraph->n_leafs);
@@ -15894,22 +18016,23 @@ static void ggml_visit_parents(struct ggml_cgraph * cgraph, struct ggml_tensor *
         cgraph->leafs[cgraph->n_leafs] = node;
         cgraph->n_leafs++;
     } else {
-        GGML_ASSERT(cgraph->n_nodes < GGML_MAX_NODES);
+        GGML_ASSERT(cgraph->n_nodes < cgraph->size);
 
         if (strlen(node->name) == 0) {
             ggml_format_name(node, "node_%d", cgraph->n_nodes);
         }
 
         cgraph->nodes[cgraph->n_nodes] = node;
-        cgraph->grads[cgraph->n_nodes] = node->grad;
+        if (cgraph->grads) {
+            cgraph->grads[cgraph->n_nodes] = node->grad;
+        }
         cgraph->n_nodes++;
     }
 }
 
 static void ggml_build_forward_impl(struct ggml_cgraph * cgraph, struct ggml_tensor * tensor, bool expand) {
     if (!expand) {
-        cgraph->n_nodes = 0;
-        cgraph->n_leafs = 0;
+        ggml_graph_clear(cgraph);
     }
 
     const int n0 = cgraph->n_nodes;
@@ -15930,27 +18053,9 @@ void ggml_build_forward_expand(struct ggml_cgraph * cgraph, struct ggml_tensor *
     ggml_build_forward_impl(cgraph, tensor, true);
 }
 
-struct ggml_cgraph ggml_build_forward(struct ggml_tensor * tensor) {
-    struct ggml_cgraph result = {
-        /*.n_nodes      =*/ 0,
-        /*.n_leafs      =*/ 0,
-        /*.nodes        =*/ { NULL },
-        /*.grads        =*/ { NULL },
-        /*.leafs        =*/ { NULL },
-        /*.hash_table   =*/ { NULL },
-        /*.order        =*/ GGML_CGRAPH_EVAL_ORDER_LEFT_TO_RIGHT,
-        /*.perf_runs    =*/ 0,
-        /*.perf_cycles  =*/ 0,
-        /*.perf_time_us =*/ 0,
-    };
-
-    ggml_build_forward_impl(&result, tensor, false);
-
-    return result;
-}
-
 void ggml_build_backward_expand(struct ggml_context * ctx, struct ggml_cgraph * gf, struct ggml_cgraph * gb, bool keep) {
     GGML_ASSERT(gf->n_nodes > 0);
+    GGML_ASSERT(gf->grads);
 
     // if we are keeping the gradient graph, we have to detach the gradient nodes from the original graph
     if (keep) {
@@ -15965,11 +18070,10 @@ void ggml_build_backward_expand(struct ggml_context * ctx, struct ggml_cgraph *
     }
 
     // remember original gradients which start with zero values
-    void ** zero_table = malloc(sizeof(void *) * GGML_GRAPH_HASHTABLE_SIZE);
-    memset(zero_table, 0, sizeof(void*) * GGML_GRAPH_HASHTABLE_SIZE);
+    struct ggml_hash_set zero_table = ggml_hash_set_new(gf->size);
     for (int i = 0; i < gf->n_nodes; i++) {
         if (gf->grads[i]) {
-            hash_insert(zero_table, gf->grads[i]);
+            ggml_hash_insert(zero_table, gf->grads[i]);
         }
     }
 
@@ -15992,26 +18096,54 @@ void ggml_build_backward_expand(struct ggml_context * ctx, struct ggml_cgraph *
         }
     }
 
-    free(zero_table);
+    ggml_hash_set_free(zero_table);
 }
 
-struct ggml_cgraph ggml_build_backward(struct ggml_context * ctx, struct ggml_cgraph * gf, bool keep) {
-    struct ggml_cgraph result = *gf;
-    ggml_build_backward_expand(ctx, gf, &result, keep);
-    return result;
+static size_t ggml_graph_nbytes(size_t size, bool grads) {
+    size_t nbytes = sizeof(struct ggml_cgraph);
+    nbytes += size * sizeof(struct ggml_tensor *) * 2; // leafs + nodes
+    if (grads) {
+        nbytes += size * sizeof(struct ggml_tensor *); // grads
+    }
+    nbytes += ggml_hash_size(size * 2) * sizeof(struct ggml_tensor *); // hash set
+    return nbytes;
 }
 
-struct ggml_cgraph * ggml_new_graph(struct ggml_context * ctx) {
-    struct ggml_object * obj = ggml_new_object(ctx, GGML_OBJECT_GRAPH, GGML_GRAPH_SIZE);
+size_t ggml_graph_overhead_custom(size_t size, bool grads) {
+    return GGML_OBJECT_SIZE + GGML_PAD(ggml_graph_nbytes(size, grads), GGML_MEM_ALIGN);
+}
+
+size_t ggml_graph_overhead(void) {
+    return ggml_graph_overhead_custom(GGML_DEFAULT_GRAPH_SIZE, false);
+}
+
+struct ggml_cgraph * ggml_new_graph_custom(struct ggml_context * ctx, size_t size, bool grads) {
+    const size_t obj_size = ggml_graph_nbytes(size, grads);
+    struct ggml_object * obj = ggml_new_object(ctx, GGML_OBJECT_GRAPH, obj_size);
     struct ggml_cgraph * cgraph = (struct ggml_cgraph *) ((char *) ctx->mem_buffer + obj->offs);
 
+    struct ggml_tensor ** data_start = (struct ggml_tensor **) (cgraph + 1);
+
+    size_t hash_size = ggml_hash_size(size * 2);
+    struct ggml_tensor ** nodes_ptr = data_start;
+    struct ggml_tensor ** leafs_ptr = nodes_ptr + size;
+    struct ggml_tensor ** hash_keys_ptr = leafs_ptr + size;
+    struct ggml_tensor ** grads_ptr = grads ? hash_keys_ptr + hash_size : NULL;
+
+    // check that we allocated the correct amount of memory
+    assert(obj_size == (size_t) (
+        (grads ? (char *)(grads_ptr + size) : (char *)(hash_keys_ptr + hash_size)) - (char *)cgraph));
+
+    memset(hash_keys_ptr, 0, hash_size * sizeof(struct ggml_tensor *));
+
     *cgraph = (struct ggml_cgraph) {
+        /*.size         =*/ size,
         /*.n_nodes      =*/ 0,
         /*.n_leafs      =*/ 0,
-        /*.nodes        =*/ { NULL },
-        /*.grads        =*/ { NULL },
-        /*.leafs        =*/ { NULL },
-        /*.hash_table   =*/ { NULL },
+        /*.nodes        =*/ nodes_ptr,
+        /*.grads        =*/ grads_ptr,
+        /*.leafs        =*/ leafs_ptr,
+        /*.hash_table   =*/ { hash_size, hash_keys_ptr },
         /*.order        =*/ GGML_CGRAPH_EVAL_ORDER_LEFT_TO_RIGHT,
         /*.perf_runs    =*/ 0,
         /*.perf_cycles  =*/ 0,
@@ -16021,16 +18153,77 @@ struct ggml_cgraph * ggml_new_graph(struct ggml_context * ctx) {
     return cgraph;
 }
 
+struct ggml_cgraph * ggml_new_graph(struct ggml_context * ctx) {
+    return ggml_new_graph_custom(ctx, GGML_DEFAULT_GRAPH_SIZE, false);
+}
+
+struct ggml_cgraph ggml_graph_view(struct ggml_cgraph * cgraph0, int i0, int i1) {
+    struct ggml_cgraph cgraph = {
+        /*.size         =*/ 0,
+        /*.n_nodes      =*/ i1 - i0,
+        /*.n_leafs      =*/ 0,
+        /*.nodes        =*/ cgraph0->nodes + i0,
+        /*.grads        =*/ cgraph0->grads ? cgraph0->grads + i0 : NULL,
+        /*.leafs        =*/ NULL,
+        /*.hash_table   =*/ { 0, NULL },
+        /*.order        =*/ cgraph0->order,
+        /*.perf_runs    =*/ 0,
+        /*.perf_cycles  =*/ 0,
+        /*.perf_time_us =*/ 0,
+    };
+
+    return cgraph;
+}
+
+void ggml_graph_cpy(struct ggml_cgraph * src, struct ggml_cgraph * dst) {
+    GGML_ASSERT(dst->size >= src->n_leafs);
+    GGML_ASSERT(dst->size >= src->n_nodes);
+    GGML_ASSERT(dst->visited_hash_table.size >= src->visited_hash_table.size);
+
+    dst->n_leafs = src->n_leafs;
+    dst->n_nodes = src->n_nodes;
+    dst->order   = src->order;
+
+    for (int i = 0; i < src->n_leafs; ++i) {
+        dst->leafs[i] = src->leafs[i];
+    }
+
+    for (int i = 0; i < src->n_nodes; ++i) {
+        dst->nodes[i] = src->nodes[i];
+    }
+
+    if (src->grads) {
+        GGML_ASSERT(dst->grads != NULL);
+        for (int i = 0; i < src->n_nodes; ++i) {
+            dst->grads[i] = src->grads[i];
+        }
+    }
+
+    for (size_t i = 0; i < src->visited_hash_table.size; ++i) {
+        if (src->visited_hash_table.keys[i]) {
+            ggml_hash_insert(dst->visited_hash_table, src->visited_hash_table.keys[i]);
+        }
+    }
+}
+
+struct ggml_cgraph * ggml_graph_dup(struct ggml_context * ctx, struct ggml_cgraph * cgraph) {
+    struct ggml_cgraph * result = ggml_new_graph_custom(ctx, cgraph->size, cgraph->grads != NULL);
+    ggml_graph_cpy(cgraph, result);
+    return result;
+}
+
+void ggml_graph_clear(struct ggml_cgraph * cgraph) {
+    cgraph->n_leafs = 0;
+    cgraph->n_nodes = 0;
+    memset(cgraph->visited_hash_table.keys, 0, cgraph->visited_hash_table.size * sizeof(struct ggml_tensor *));
+}
+
 struct ggml_cgraph * ggml_build_forward_ctx(struct ggml_context * ctx, struct ggml_tensor * tensor) {
     struct ggml_cgraph * cgraph = ggml_new_graph(ctx);
     ggml_build_forward_impl(cgraph, tensor, false);
     return cgraph;
 }
 
-size_t ggml_graph_overhead(void) {
-    return GGML_OBJECT_SIZE + GGML_PAD(GGML_GRAPH_SIZE, GGML_MEM_ALIGN);
-}
-
 //
 // thread data
 //
@@ -16094,6 +18287,48 @@ typedef pthread_t ggml_thread_t;
 
 #endif
 
+#if defined(_MSC_VER) && defined(_M_AMD64)
+#define ggml_spin_pause() _mm_pause()
+#elif defined(__x86_64__)
+#define ggml_spin_pause() __asm__ __volatile__("pause")
+#elif defined(__aarch64__) && !defined(_MSC_VER)
+#define ggml_spin_pause() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define ggml_spin_pause() ((void) 0)
+#endif
+
+#if defined(_WIN32)
+
+typedef SRWLOCK            ggml_mutex_t;
+typedef CONDITION_VARIABLE ggml_cond_t;
+
+#define ggml_mutex_init(m)     InitializeSRWLock(m)
+#define ggml_mutex_destroy(m)  UNUSED(m)
+#define ggml_mutex_lock(m)     AcquireSRWLockExclusive(m)
+#define ggml_mutex_unlock(m)   ReleaseSRWLockExclusive(m)
+
+#define ggml_cond_init(c)      InitializeConditionVariable(c)
+#define ggml_cond_destroy(c)   UNUSED(c)
+#define ggml_cond_wait(c, m)   SleepConditionVariableSRW(c, m, INFINITE, 0)
+#define ggml_cond_broadcast(c) WakeAllConditionVariable(c)
+
+#else
+
+typedef pthread_mutex_t ggml_mutex_t;
+typedef pthread_cond_t  ggml_cond_t;
+
+#define ggml_mutex_init(m)     pthread_mutex_init(m, NULL)
+#define ggml_mutex_destroy(m)  pthread_mutex_destroy(m)
+#define ggml_mutex_lock(m)     pthread_mutex_lock(m)
+#define ggml_mutex_unlock(m)   pthread_mutex_unlock(m)
+
+#define ggml_cond_init(c)      pthread_cond_init(c, NULL)
+#define ggml_cond_destroy(c)   pthread_cond_destroy(c)
+#define ggml_cond_wait(c, m)   pthread_cond_wait(c, m)
+#define ggml_cond_broadcast(c) pthread_cond_broadcast(c)
+
+#endif
+
 // Android's libc implementation "bionic" does not support setting affinity
 #if defined(__linux__) && !defined(__BIONIC__)
 static void set_numa_thread_affinity(int thread_n, int n_threads) {
@@ -16102,7 +18337,7 @@ static void set_numa_thread_affinity(int thread_n, int n_threads) {
     }
 
     // run thread on node_num thread_n / (threads per node)
-    const int node_num = thread_n / ((n_threads + g_state.numa.n_nodes - 1) / g_state.numa.n_nodes);
+    const int node_num = ggml_numa_node_of_thread(thread_n, n_threads);
     struct ggml_numa_node * node = &g_state.numa.nodes[node_num];
     size_t setsize = CPU_ALLOC_SIZE(g_state.numa.total_cpus);
 
@@ -16149,6 +18384,47 @@ static void set_numa_thread_affinity(int thread_n, int n_threads) { UNUSED(threa
 static void clear_numa_thread_affinity(void) {}
 #endif
 
+// tracing
+
+#define GGML_TRACE_WAIT  -1 // waiting for the other threads
+#define GGML_TRACE_GRAPH -2 // whole ggml_graph_compute() call
+
+struct ggml_trace_event {
+    int32_t node; // index in ggml_trace.nodes, or GGML_TRACE_WAIT/GGML_TRACE_GRAPH
+    int32_t ith;
+    int64_t t0;   // ns
+    int64_t t1;
+};
+
+struct ggml_trace_node {
+    enum ggml_op   op;
+    enum ggml_type type;
+    enum ggml_type src0_type; // GGML_TYPE_COUNT without src0
+    int64_t ne[GGML_MAX_DIMS];
+    char name[GGML_MAX_NAME];
+};
+
+struct ggml_trace {
+    int64_t t_start; // ns, origin of the timestamps
+
+    int n_graphs;
+
+    struct ggml_trace_node * nodes;
+    size_t n_nodes;
+    size_t n_nodes_max;
+
+    struct ggml_trace_event * events;
+    size_t n_events;
+    size_t n_events_max;
+};
+
+// events of a thread during a ggml_graph_compute() call, node is the index of the node in the graph
+struct ggml_trace_thread {
+    struct ggml_trace_event * events;
+    int n_events;
+    int n_events_max;
+};
+
 struct ggml_compute_state_shared {
     const struct ggml_cgraph * cgraph;
     const struct ggml_cplan  * cplan;
@@ -16162,14 +18438,48 @@ struct ggml_compute_state_shared {
     atomic_int n_active; // num active threads
     atomic_int node_n;   // active graph node
 
+    atomic_int n_barrier;        // num threads waiting on the barrier
+    atomic_int n_barrier_passed; // num times the barrier has been passed
+
+    // nodes computed at the same time, see ggml_graph_find_concurrent()
+    // threads [thread_start[i], thread_start[i + 1]) compute node concurrent_nodes[i]
+    int n_concurrent;
+    int concurrent_nodes[GGML_MAX_CONCURRENT];
+    int concurrent_n_tasks[GGML_MAX_CONCURRENT]; // n_tasks of the nodes, see ggml_get_n_tasks()
+    int thread_start[GGML_MAX_CONCURRENT + 1];
+
+    atomic_int current_chunk[GGML_MAX_CONCURRENT]; // next chunk of work of each node, see ggml_graph_compute_next_chunk()
+    atomic_int numa_chunk[GGML_MAX_CONCURRENT][GGML_NUMA_MAX_NODES]; // same, for the rows placed on each NUMA node
+
     bool (*abort_callback)(void * data); // abort ggml_graph_compute when true
     void * abort_callback_data;
+
+    struct ggml_trace_thread * trace_threads; // [n_threads], NULL when not tracing
 };
 
 struct ggml_compute_state {
     ggml_thread_t thrd;
     int ith;
     struct ggml_compute_state_shared * shared;
+    struct ggml_threadpool * threadpool; // NULL for threads created by ggml_graph_compute()
+};
+
+struct ggml_threadpool {
+    struct ggml_compute_state * workers; // [n_threads], workers[0] is the thread calling ggml_graph_compute()
+
+    int n_threads;
+    int n_spin; // number of polling iterations before an idle worker goes to sleep
+
+    struct ggml_compute_state_shared * shared; // state of the graph currently being computed
+
+    ggml_mutex_t mutex;         // protects the sleep/wakeup of idle workers
+    ggml_cond_t  cond;
+    ggml_mutex_t mutex_compute; // serializes graphs submitted from different threads
+
+    atomic_int n_graph;    // incremented for each new graph, workers wait for it to change
+    atomic_int n_done;     // number of workers that finished the current graph
+    atomic_int n_sleeping; // number of workers blocked on cond
+    atomic_int stop;
 };
 
 static void ggml_graph_compute_perf_stats_node(struct ggml_tensor * node, const struct ggml_compute_state_shared * st) {
@@ -16181,595 +18491,1733 @@ static void ggml_graph_compute_perf_stats_node(struct ggml_tensor * node, const
     node->perf_time_us += time_us_cur;
 }
 
-static thread_ret_t ggml_graph_compute_thread(void * data) {
-    struct ggml_compute_state * state = (struct ggml_compute_state *) data;
-
-    const struct ggml_cgraph * cgraph = state->shared->cgraph;
-    const struct ggml_cplan  * cplan  = state->shared->cplan;
+// start of a traced interval, 0 when not tracing
+inline static int64_t ggml_trace_begin(const struct ggml_compute_state_shared * shared) {
+    return shared->trace_threads ? ggml_time_ns() : 0;
+}
 
-    const int * n_tasks_arr = cplan->n_tasks;
-    const int   n_threads   = state->shared->n_threads;
+// end of the interval of thread ith started at t0, spent on node node_n or waiting
+static void ggml_trace_end(const struct ggml_compute_state_shared * shared, int ith, int node_n, int64_t t0) {
+    if (shared->trace_threads == NULL) {
+        return;
+    }
 
-    set_numa_thread_affinity(state->ith, n_threads);
+    struct ggml_trace_thread * thread = &shared->trace_threads[ith];
 
-    int node_n = -1;
+    if (thread->n_events < thread->n_events_max) {
+        struct ggml_trace_event * ev = &thread->events[thread->n_events++];
 
-    while (true) {
-        if (cplan->abort_callback && cplan->abort_callback(cplan->abort_callback_data)) {
-            state->shared->node_n += 1;
-            return (thread_ret_t) GGML_EXIT_ABORTED;
-        }
-        if (atomic_fetch_sub(&state->shared->n_active, 1) == 1) {
-            // all other threads are finished and spinning
-            // do finalize and init here so we don't have synchronize again
-            struct ggml_compute_params params = {
-                /*.type  =*/ GGML_TASK_FINALIZE,
-                /*.ith   =*/ 0,
-                /*.nth   =*/ 0,
-                /*.wsize =*/ cplan->work_size,
-                /*.wdata =*/ cplan->work_data,
-            };
+        ev->node = node_n;
+        ev->ith  = ith;
+        ev->t0   = t0;
+        ev->t1   = ggml_time_ns();
+    }
+}
 
-            if (node_n != -1) {
-                /* FINALIZE */
-                struct ggml_tensor * node = state->shared->cgraph->nodes[node_n];
-                if (GGML_OP_HAS_FINALIZE[node->op]) {
-                    params.nth = n_tasks_arr[node_n];
-                    ggml_compute_forward(&params, node);
-                }
-                ggml_graph_compute_perf_stats_node(node, state->shared);
-            }
+static int ggml_graph_compute_next_chunk(const struct ggml_compute_params * params) {
+    if (params->shared == NULL) {
+        // not called from ggml_graph_compute - no other threads to share the work with
+        return params->ith + params->nth;
+    }
 
-            // distribute new work or execute it direct if 1T
-            while (++node_n < cgraph->n_nodes) {
-                GGML_PRINT_DEBUG_5("%s: %d/%d\n", __func__, node_n, cgraph->n_nodes);
+    return atomic_fetch_add(&params->shared->current_chunk[params->node_i], 1);
+}
 
-                struct ggml_tensor * node = cgraph->nodes[node_n];
-                const int n_tasks = n_tasks_arr[node_n];
+static int ggml_graph_compute_next_numa_chunk(const struct ggml_compute_params * params, int node) {
+    return atomic_fetch_add(&params->shared->numa_chunk[params->node_i][node], 1);
+}
 
-                state->shared->perf_node_start_cycles  = ggml_perf_cycles();
-                state->shared->perf_node_start_time_us = ggml_perf_time_us();
+static int ggml_graph_compute_numa_node(const struct ggml_compute_params * params) {
+    if (params->shared == NULL || g_state.numa.n_placed == 0) {
+        return -1;
+    }
 
-                params.nth = n_tasks;
+    // the threads of the concurrent node node_i start at thread_start[node_i]
+    return ggml_numa_node_of_thread(params->shared->thread_start[params->node_i] + params->ith, params->shared->n_threads);
+}
 
-                /* INIT */
-                if (GGML_OP_HAS_INIT[node->op]) {
-                    params.type = GGML_TASK_INIT;
-                    ggml_compute_forward(&params, node);
-                }
+// the chunks of the NUMA nodes are all taken from the counters, none is implied by the thread index
+static void ggml_graph_compute_reset_numa_chunks(struct ggml_compute_state_shared * shared, int node_i) {
+    if (g_state.numa.n_placed == 0) {
+        return;
+    }
 
-                if (n_tasks == 1) {
-                    // TODO: maybe push node_n to the atomic but if other threads see n_tasks is 1,
-                    // they do something more efficient than spinning (?)
-                    params.type = GGML_TASK_COMPUTE;
-                    ggml_compute_forward(&params, node);
+    for (int k = 0; k < GGML_NUMA_MAX_NODES; ++k) {
+        atomic_store(&shared->numa_chunk[node_i][k], 0);
+    }
+}
 
-                    if (GGML_OP_HAS_FINALIZE[node->op]) {
-                        params.type = GGML_TASK_FINALIZE;
-                        ggml_compute_forward(&params, node);
-                    }
+// wait until all n_threads threads of the graph reach the barrier
+static void ggml_barrier(struct ggml_compute_state_shared * shared) {
+    const int n_threads = shared->n_threads;
 
-                    ggml_graph_compute_perf_stats_node(node, state->shared);
-                } else {
-                    break;
-                }
+    if (n_threads == 1) {
+        return;
+    }
 
-                if (cplan->abort_callback && cplan->abort_callback(cplan->abort_callback_data)) {
-                    break;
-                }
-            }
+    const int n_passed = atomic_load(&shared->n_barrier_passed);
 
-            atomic_store(&state->shared->n_active, n_threads);
-            atomic_store(&state->shared->node_n,   node_n);
-        } else {
-            // wait for other threads to finish
-            const int last = node_n;
-            while (true) {
-                // TODO: this sched_yield can have significant impact on the performance - either positive or negative
-                //       depending on the workload and the operating system.
-                //       since it is not clear what is the best approach, it should potentially become user-configurable
-                //       ref: https://github.com/ggerganov/ggml/issues/291
+    if (atomic_fetch_add(&shared->n_barrier, 1) == n_threads - 1) {
+        // last thread to arrive releases the others
+        atomic_store(&shared->n_barrier, 0);
+        atomic_fetch_add(&shared->n_barrier_passed, 1);
+    } else {
+        while (atomic_load(&shared->n_barrier_passed) == n_passed) {
 #if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
-                sched_yield();
+            sched_yield();
+#else
+            ggml_spin_pause();
 #endif
-
-                node_n = atomic_load(&state->shared->node_n);
-                if (node_n != last) break;
-            };
         }
+    }
+}
 
-        // check if we should stop
-        if (node_n >= cgraph->n_nodes) break;
+static bool ggml_op_is_noop(enum ggml_op op) {
+    return op == GGML_OP_NONE || op == GGML_OP_VIEW || op == GGML_OP_RESHAPE || op == GGML_OP_PERMUTE || op == GGML_OP_TRANSPOSE;
+}
 
-        /* COMPUTE */
-        struct ggml_tensor * node = cgraph->nodes[node_n];
-        const int n_tasks = n_tasks_arr[node_n];
+static bool ggml_tensors_overlap(const struct ggml_tensor * a, const struct ggml_tensor * b) {
+    const char * a0 = (const char *) a->data;
+    const char * b0 = (const char *) b->data;
 
-        struct ggml_compute_params params = {
-            /*.type  =*/ GGML_TASK_COMPUTE,
-            /*.ith   =*/ state->ith,
-            /*.nth   =*/ n_tasks,
-            /*.wsize =*/ cplan->work_size,
-            /*.wdata =*/ cplan->work_data,
-        };
+    return a0 < b0 + ggml_nbytes(b) && b0 < a0 + ggml_nbytes(a);
+}
 
-        if (state->ith < n_tasks) {
-            ggml_compute_forward(&params, node);
+// a and b do not read the memory written by the other and do not write to the same memory
+static bool ggml_nodes_independent(const struct ggml_tensor * a, const struct ggml_tensor * b) {
+    if (ggml_tensors_overlap(a, b)) {
+        return false;
+    }
+
+    for (int i = 0; i < GGML_MAX_SRC; ++i) {
+        if (a->src[i] && ggml_tensors_overlap(a->src[i], b)) {
+            return false;
+        }
+        if (b->src[i] && ggml_tensors_overlap(b->src[i], a)) {
+            return false;
         }
     }
 
-    return GGML_EXIT_SUCCESS;
+    return true;
 }
 
-struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
-    if (n_threads <= 0) {
-        n_threads = GGML_DEFAULT_N_THREADS;
+static bool ggml_node_can_concurrent(const struct ggml_tensor * node, int n_tasks) {
+    if (n_tasks <= 1 || !GGML_OP_CAN_CONCURRENT[node->op] || node->data == NULL || node->backend != GGML_BACKEND_CPU) {
+        return false;
     }
 
-    size_t work_size = 0;
+    for (int i = 0; i < GGML_MAX_SRC; ++i) {
+        if (node->src[i] && (node->src[i]->data == NULL || node->src[i]->backend != GGML_BACKEND_CPU)) {
+            return false;
+        }
+    }
 
-    struct ggml_cplan cplan;
-    memset(&cplan, 0, sizeof(struct ggml_cplan));
+    return true;
+}
 
-    // thread scheduling for the different operations + work buffer size estimation
-    for (int i = 0; i < cgraph->n_nodes; i++) {
-        int n_tasks = 1;
+// estimate of the work of a node, used to split the threads between concurrent nodes
+static double ggml_node_cost(const struct ggml_tensor * node) {
+    if (node->op == GGML_OP_MUL_MAT) {
+        return (double) ggml_nelements(node)*node->src[0]->ne[0];
+    }
+
+    return (double) ggml_nelements(node);
+}
+
+// split n_threads between the n nodes proportionally to their cost, returns the resulting time relative to the ideal split
+static double ggml_graph_split_threads(const struct ggml_cgraph * cgraph, const int * nodes, int n, int n_threads, int * thread_start) {
+    double cost[GGML_MAX_CONCURRENT];
+    int    nth [GGML_MAX_CONCURRENT];
+
+    double cost_total = 0.0;
+    for (int i = 0; i < n; ++i) {
+        cost[i] = ggml_node_cost(cgraph->nodes[nodes[i]]);
+        nth [i] = 1;
+        cost_total += cost[i];
+    }
+
+    // give the remaining threads one by one to the node that would take the longest
+    for (int t = n; t < n_threads; ++t) {
+        int imax = 0;
+        for (int i = 1; i < n; ++i) {
+            if (cost[i]/nth[i] > cost[imax]/nth[imax]) {
+                imax = i;
+            }
+        }
+        nth[imax]++;
+    }
+
+    double time_max = 0.0;
+    thread_start[0] = 0;
+    for (int i = 0; i < n; ++i) {
+        thread_start[i + 1] = thread_start[i] + nth[i];
+        time_max = MAX(time_max, cost[i]/nth[i]);
+    }
+
+    return cost_total > 0.0 ? time_max/(cost_total/n_threads) : 1.0;
+}
+
+static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads);
+
+// find the independent nodes that can be computed together with node node_n, starting from node_n
+// the nodes must be of the same op and can only be separated by no-op nodes (views)
+// returns the number of nodes, and the threads assigned to each of them in thread_start
+static int ggml_graph_find_concurrent(
+        const struct ggml_cgraph * cgraph,
+        int node_n,
+        int n_threads,
+        int n_max,
+        int * nodes,
+        int * thread_start) {
+    int n = 1;
+    nodes[0] = node_n;
+
+    const struct ggml_tensor * node = cgraph->nodes[node_n];
+
+    if (ggml_node_can_concurrent(node, ggml_get_n_tasks(cgraph->nodes[node_n], n_threads))) {
+        for (int j = node_n + 1; j < cgraph->n_nodes && n < MIN(n_max, MIN(n_threads, GGML_MAX_CONCURRENT)); ++j) {
+            const struct ggml_tensor * cand = cgraph->nodes[j];
+
+            if (ggml_op_is_noop(cand->op)) {
+                continue;
+            }
+
+            if (cand->op != node->op || !ggml_node_can_concurrent(cand, ggml_get_n_tasks(cgraph->nodes[j], n_threads))) {
+                break;
+            }
+
+            bool independent = true;
+            for (int i = 0; i < n && independent; ++i) {
+                independent = ggml_nodes_independent(cgraph->nodes[nodes[i]], cand);
+            }
+            if (!independent) {
+                break;
+            }
+
+            // only worth it if the threads can be split without leaving too many of them idle
+            nodes[n] = j;
+            if (ggml_graph_split_threads(cgraph, nodes, n + 1, n_threads, thread_start) > 1.25) {
+                break;
+            }
+
+            n++;
+        }
+    }
+
+    if (n == 1) {
+        thread_start[0] = 0;
+        thread_start[1] = n_threads;
+    } else {
+        ggml_graph_split_threads(cgraph, nodes, n, n_threads, thread_start);
+    }
+
+    return n;
+}
+
+// max number of nodes that can be computed concurrently with the work buffer of the plan
+static int ggml_cplan_max_concurrent(const struct ggml_cplan * cplan) {
+    if (cplan->work_size == 0) {
+        return GGML_MAX_CONCURRENT;
+    }
+
+    if (cplan->work_slot_size == 0) {
+        return 1;
+    }
+
+    return (int) MIN(GGML_MAX_CONCURRENT, cplan->work_size/cplan->work_slot_size);
+}
+
+static void ggml_graph_compute_prepare_concurrent(struct ggml_compute_state_shared * shared, int node_n) {
+    const struct ggml_cgraph * cgraph = shared->cgraph;
+    const struct ggml_cplan  * cplan  = shared->cplan;
+
+    const int n = ggml_graph_find_concurrent(cgraph, node_n, shared->n_threads, ggml_cplan_max_concurrent(cplan),
+            shared->concurrent_nodes, shared->thread_start);
+
+    for (int i = 1; i < n; ++i) {
+        shared->concurrent_n_tasks[i] = ggml_get_n_tasks(cgraph->nodes[shared->concurrent_nodes[i]], shared->n_threads);
+    }
+
+    for (int i = 0; i < n; ++i) {
+        const int nth = MIN(shared->concurrent_n_tasks[i], shared->thread_start[i + 1] - shared->thread_start[i]);
+
+        // the first nth chunks are implicitly taken by the threads, one each
+        atomic_store(&shared->current_chunk[i], nth);
+        ggml_graph_compute_reset_numa_chunks(shared, i);
+    }
+
+    shared->n_concurrent = n;
+}
+
+static thread_ret_t ggml_graph_compute_thread(void * data) {
+    struct ggml_compute_state * state = (struct ggml_compute_state *) data;
+
+    const struct ggml_cgraph * cgraph = state->shared->cgraph;
+    const struct ggml_cplan  * cplan  = state->shared->cplan;
+
+    const int n_threads = state->shared->n_threads;
+
+    set_numa_thread_affinity(state->ith, n_threads);
+
+    int node_n = -1;
+
+    while (true) {
+        if (cplan->abort_callback && cplan->abort_callback(cplan->abort_callback_data)) {
+            state->shared->node_n += 1;
+            return (thread_ret_t) GGML_EXIT_ABORTED;
+        }
+        if (atomic_fetch_sub(&state->shared->n_active, 1) == 1) {
+            // all other threads are finished and spinning
+            // do finalize and init here so we don't have synchronize again
+            struct ggml_compute_params params = {
+                /*.type  =*/ GGML_TASK_FINALIZE,
+                /*.ith   =*/ 0,
+                /*.nth   =*/ 0,
+                /*.wsize =*/ cplan->work_size,
+                /*.wdata =*/ cplan->work_data,
+                /*.shared=*/ state->shared,
+                /*.node_i=*/ 0,
+            };
+
+            if (node_n != -1) {
+                /* FINALIZE */
+                for (int i = 0; i < state->shared->n_concurrent; ++i) {
+                    struct ggml_tensor * node = cgraph->nodes[state->shared->concurrent_nodes[i]];
+                    if (GGML_OP_HAS_FINALIZE[node->op] && !GGML_OP_HAS_PARALLEL_PASS[node->op]) {
+                        const int64_t t0 = ggml_trace_begin(state->shared);
+                        params.nth = state->shared->concurrent_n_tasks[i];
+                        ggml_compute_forward(&params, node);
+                        ggml_trace_end(state->shared, state->ith, state->shared->concurrent_nodes[i], t0);
+                    }
+                    ggml_graph_compute_perf_stats_node(node, state->shared);
+                }
+
+                // skip the nodes computed concurrently (and the no-op nodes between them)
+                node_n = state->shared->concurrent_nodes[state->shared->n_concurrent - 1];
+            }
+
+            state->shared->n_concurrent        = 1;
+            state->shared->concurrent_nodes[0] = node_n;
+            state->shared->thread_start[0]     = 0;
+            state->shared->thread_start[1]     = n_threads;
+
+            // distribute new work or execute it direct if 1T
+            while (++node_n < cgraph->n_nodes) {
+                GGML_PRINT_DEBUG_5("%s: %d/%d\n", __func__, node_n, cgraph->n_nodes);
+
+                struct ggml_tensor * node = cgraph->nodes[node_n];
+                const int n_tasks = ggml_get_n_tasks(node, n_threads);
+
+                state->shared->perf_node_start_cycles  = ggml_perf_cycles();
+                state->shared->perf_node_start_time_us = ggml_perf_time_us();
+
+                // the INIT pass and the single-threaded nodes are computed by this thread alone
+                const int64_t t0 = ggml_trace_begin(state->shared);
+
+                params.nth = n_tasks;
+
+                // the first n_tasks chunks are implicitly taken by the threads, one each
+                atomic_store(&state->shared->current_chunk[0], n_tasks);
+                ggml_graph_compute_reset_numa_chunks(state->shared, 0);
+                state->shared->concurrent_nodes[0]   = node_n;
+                state->shared->concurrent_n_tasks[0] = n_tasks;
+
+                /* INIT */
+                // parallel INIT passes of multi-threaded nodes are done by all threads below
+                if (GGML_OP_HAS_INIT[node->op] && (n_tasks == 1 || !GGML_OP_HAS_PARALLEL_PASS[node->op])) {
+                    params.type = GGML_TASK_INIT;
+                    ggml_compute_forward(&params, node);
+                }
+
+                if (n_tasks == 1) {
+                    // TODO: maybe push node_n to the atomic but if other threads see n_tasks is 1,
+                    // they do something more efficient than spinning (?)
+                    params.type = GGML_TASK_COMPUTE;
+                    ggml_compute_forward(&params, node);
+
+                    if (GGML_OP_HAS_FINALIZE[node->op]) {
+                        params.type = GGML_TASK_FINALIZE;
+                        ggml_compute_forward(&params, node);
+                    }
+
+                    ggml_graph_compute_perf_stats_node(node, state->shared);
+
+                    if (!ggml_op_is_noop(node->op)) {
+                        ggml_trace_end(state->shared, state->ith, node_n, t0);
+                    }
+                } else {
+                    if (GGML_OP_HAS_INIT[node->op] && !GGML_OP_HAS_PARALLEL_PASS[node->op]) {
+                        ggml_trace_end(state->shared, state->ith, node_n, t0);
+                    }
+
+                    // look for independent nodes that can be computed at the same time by other threads
+                    ggml_graph_compute_prepare_concurrent(state->shared, node_n);
+                    break;
+                }
+
+                if (cplan->abort_callback && cplan->abort_callback(cplan->abort_callback_data)) {
+                    break;
+                }
+            }
+
+            atomic_store(&state->shared->n_active, n_threads);
+            atomic_store(&state->shared->node_n,   node_n);
+        } else {
+            // wait for other threads to finish
+            const int64_t t0 = ggml_trace_begin(state->shared);
+            const int last = node_n;
+            while (true) {
+                // TODO: this sched_yield can have significant impact on the performance - either positive or negative
+                //       depending on the workload and the operating system.
+                //       since it is not clear what is the best approach, it should potentially become user-configurable
+                //       ref: https://github.com/ggerganov/ggml/issues/291
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+                sched_yield();
+#endif
+
+                node_n = atomic_load(&state->shared->node_n);
+                if (node_n != last) break;
+            };
+
+            ggml_trace_end(state->shared, state->ith, GGML_TRACE_WAIT, t0);
+        }
+
+        // check if we should stop
+        if (node_n >= cgraph->n_nodes) break;
+
+        /* COMPUTE */
+        const int n_concurrent = state->shared->n_concurrent;
+
+        // find the node computed by this thread
+        int node_i = 0;
+        while (node_i < n_concurrent - 1 && state->ith >= state->shared->thread_start[node_i + 1]) {
+            node_i++;
+        }
+
+        const int thread_start = state->shared->thread_start[node_i];
+        const int thread_end   = state->shared->thread_start[node_i + 1];
+
+        struct ggml_tensor * node = cgraph->nodes[state->shared->concurrent_nodes[node_i]];
+        const int n_tasks = MIN(state->shared->concurrent_n_tasks[node_i], thread_end - thread_start);
+        const int ith     = state->ith - thread_start;
+
+        // each of the concurrent nodes uses a separate part of the work buffer
+        struct ggml_compute_params params = {
+            /*.type  =*/ GGML_TASK_COMPUTE,
+            /*.ith   =*/ ith,
+            /*.nth   =*/ n_tasks,
+            /*.wsize =*/ n_concurrent > 1 ? cplan->work_slot_size : cplan->work_size,
+            /*.wdata =*/ cplan->work_data ? (char *) cplan->work_data + node_i*cplan->work_slot_size : NULL,
+            /*.shared=*/ state->shared,
+            /*.node_i=*/ node_i,
+        };
+
+        // the concurrent nodes have the same op
+        const bool parallel_pass = GGML_OP_HAS_PARALLEL_PASS[node->op];
+
+        // the threads without work in this node only record the time they wait for the others
+        const bool traced = ith < n_tasks;
+
+        int64_t t0 = ggml_trace_begin(state->shared);
+
+        if (parallel_pass && GGML_OP_HAS_INIT[node->op]) {
+            params.type = GGML_TASK_INIT;
+            if (ith < n_tasks) {
+                ggml_compute_forward(&params, node);
+            }
+            if (traced) {
+                ggml_trace_end(state->shared, state->ith, state->shared->concurrent_nodes[node_i], t0);
+            }
+
+            t0 = ggml_trace_begin(state->shared);
+            ggml_barrier(state->shared);
+            ggml_trace_end(state->shared, state->ith, GGML_TRACE_WAIT, t0);
+
+            t0 = ggml_trace_begin(state->shared);
+            params.type = GGML_TASK_COMPUTE;
+        }
+
+        if (ith < n_tasks) {
+            ggml_compute_forward(&params, node);
+        }
+
+        if (parallel_pass && GGML_OP_HAS_FINALIZE[node->op]) {
+            if (traced) {
+                ggml_trace_end(state->shared, state->ith, state->shared->concurrent_nodes[node_i], t0);
+            }
+
+            t0 = ggml_trace_begin(state->shared);
+            ggml_barrier(state->shared);
+            ggml_trace_end(state->shared, state->ith, GGML_TRACE_WAIT, t0);
+
+            t0 = ggml_trace_begin(state->shared);
+            params.type = GGML_TASK_FINALIZE;
+            if (ith < n_tasks) {
+                ggml_compute_forward(&params, node);
+            }
+        }
+
+        if (traced) {
+            ggml_trace_end(state->shared, state->ith, state->shared->concurrent_nodes[node_i], t0);
+        }
+    }
+
+    return GGML_EXIT_SUCCESS;
+}
+
+static thread_ret_t ggml_threadpool_worker(void * data) {
+    struct ggml_compute_state * state = (struct ggml_compute_state *) data;
+    struct ggml_threadpool * threadpool = state->threadpool;
+
+    int n_graph_last = 0;
+
+    while (true) {
+        // wait for a new graph: spin for a while to keep the core hot between graphs, then sleep
+        int n_graph = atomic_load(&threadpool->n_graph);
+        for (int i = 0; n_graph == n_graph_last && i < threadpool->n_spin; ++i) {
+            ggml_spin_pause();
+            n_graph = atomic_load(&threadpool->n_graph);
+        }
+
+        if (n_graph == n_graph_last) {
+            ggml_mutex_lock(&threadpool->mutex);
+            atomic_fetch_add(&threadpool->n_sleeping, 1);
+            while ((n_graph = atomic_load(&threadpool->n_graph)) == n_graph_last) {
+                ggml_cond_wait(&threadpool->cond, &threadpool->mutex);
+            }
+            atomic_fetch_sub(&threadpool->n_sleeping, 1);
+            ggml_mutex_unlock(&threadpool->mutex);
+        }
+
+        n_graph_last = n_graph;
+
+        if (atomic_load(&threadpool->stop)) {
+            break;
+        }
+
+        // graphs may use less threads than the pool has
+        if (state->ith < threadpool->shared->n_threads) {
+            state->shared = threadpool->shared;
+            ggml_graph_compute_thread(state);
+        }
+
+        atomic_fetch_add(&threadpool->n_done, 1);
+    }
+
+    return 0;
+}
+
+// wake up the workers of the pool and compute the graph with the calling thread as thread 0
+static int ggml_threadpool_compute(struct ggml_threadpool * threadpool, struct ggml_compute_state_shared * shared) {
+    ggml_mutex_lock(&threadpool->mutex_compute);
+
+    threadpool->shared = shared;
+    atomic_store(&threadpool->n_done, 0);
+
+    ggml_mutex_lock(&threadpool->mutex);
+    atomic_fetch_add(&threadpool->n_graph, 1);
+    if (atomic_load(&threadpool->n_sleeping) > 0) {
+        ggml_cond_broadcast(&threadpool->cond);
+    }
+    ggml_mutex_unlock(&threadpool->mutex);
+
+    struct ggml_compute_state * state = &threadpool->workers[0];
+    state->shared = shared;
+
+    const int compute_status = (size_t) ggml_graph_compute_thread(state);
+
+    // the workers may still be reading the shared state of this graph
+    while (atomic_load(&threadpool->n_done) < threadpool->n_threads - 1) {
+        ggml_spin_pause();
+    }
+
+    ggml_mutex_unlock(&threadpool->mutex_compute);
+
+    return compute_status;
+}
+
+struct ggml_threadpool * ggml_threadpool_new(int n_threads, int n_spin) {
+    if (n_threads <= 0) {
+        n_threads = GGML_DEFAULT_N_THREADS;
+    }
+
+    struct ggml_threadpool * threadpool = malloc(sizeof(struct ggml_threadpool));
+    GGML_ASSERT(threadpool);
+
+    threadpool->workers   = malloc(sizeof(struct ggml_compute_state)*n_threads);
+    threadpool->n_threads = n_threads;
+    threadpool->n_spin    = MAX(0, n_spin);
+    threadpool->shared    = NULL;
+    GGML_ASSERT(threadpool->workers);
+
+    ggml_mutex_init(&threadpool->mutex);
+    ggml_cond_init(&threadpool->cond);
+    ggml_mutex_init(&threadpool->mutex_compute);
+
+    atomic_store(&threadpool->n_graph,    0);
+    atomic_store(&threadpool->n_done,     0);
+    atomic_store(&threadpool->n_sleeping, 0);
+    atomic_store(&threadpool->stop,       0);
+
+    for (int j = 0; j < n_threads; ++j) {
+        threadpool->workers[j] = (struct ggml_compute_state) {
+            .thrd       = 0,
+            .ith        = j,
+            .shared     = NULL,
+            .threadpool = threadpool,
+        };
+
+        if (j > 0) {
+            const int rc = ggml_thread_create(&threadpool->workers[j].thrd, NULL, ggml_threadpool_worker, &threadpool->workers[j]);
+            GGML_ASSERT(rc == 0);
+            UNUSED(rc);
+        }
+    }
+
+    return threadpool;
+}
+
+void ggml_threadpool_free(struct ggml_threadpool * threadpool) {
+    if (threadpool == NULL) {
+        return;
+    }
+
+    ggml_mutex_lock(&threadpool->mutex);
+    atomic_store(&threadpool->stop, 1);
+    atomic_fetch_add(&threadpool->n_graph, 1);
+    ggml_cond_broadcast(&threadpool->cond);
+    ggml_mutex_unlock(&threadpool->mutex);
+
+    for (int j = 1; j < threadpool->n_threads; ++j) {
+        const int rc = ggml_thread_join(threadpool->workers[j].thrd, NULL);
+        GGML_ASSERT(rc == 0);
+        UNUSED(rc);
+    }
+
+    ggml_mutex_destroy(&threadpool->mutex);
+    ggml_cond_destroy(&threadpool->cond);
+    ggml_mutex_destroy(&threadpool->mutex_compute);
+
+    free(threadpool->workers);
+    free(threadpool);
+}
+
+int ggml_threadpool_get_n_threads(const struct ggml_threadpool * threadpool) {
+    return threadpool->n_threads;
+}
+
+// tracing
+
+// the most events a thread can record per node: the INIT, COMPUTE and FINALIZE passes, the single-threaded passes and the waits between them
+#define GGML_TRACE_MAX_EVENTS_PER_NODE 8
+
+static struct ggml_trace_thread * ggml_trace_threads_new(int n_threads, int n_nodes) {
+    struct ggml_trace_thread * threads = malloc(n_threads*sizeof(struct ggml_trace_thread));
+    GGML_ASSERT(threads);
+
+    for (int i = 0; i < n_threads; ++i) {
+        threads[i].n_events     = 0;
+        threads[i].n_events_max = GGML_TRACE_MAX_EVENTS_PER_NODE*(n_nodes + 1);
+        threads[i].events       = malloc(threads[i].n_events_max*sizeof(struct ggml_trace_event));
+        GGML_ASSERT(threads[i].events);
+    }
+
+    return threads;
+}
+
+static void ggml_trace_threads_free(struct ggml_trace_thread * threads, int n_threads) {
+    for (int i = 0; i < n_threads; ++i) {
+        free(threads[i].events);
+    }
+    free(threads);
+}
+
+// grow the array p of *n_max elements of the given size, so that it can hold n elements
+static void * ggml_trace_reserve(void * p, size_t * n_max, size_t n, size_t size) {
+    if (n > *n_max) {
+        *n_max = MAX(2*(*n_max), n);
+        p = realloc(p, (*n_max)*size);
+        GGML_ASSERT(p);
+    }
+    return p;
+}
+
+// append the nodes of the graph and the events of the threads that computed it, t_start is the start of ggml_graph_compute()
+static void ggml_trace_add_graph(
+        struct ggml_trace * trace,
+        const struct ggml_cgraph * cgraph,
+        const struct ggml_trace_thread * threads,
+        int n_threads,
+        int64_t t_start) {
+    const int64_t t_end = ggml_time_ns();
+
+    const size_t node_offs = trace->n_nodes;
+
+    trace->nodes = ggml_trace_reserve(trace->nodes, &trace->n_nodes_max, node_offs + cgraph->n_nodes, sizeof(struct ggml_trace_node));
+
+    for (int i = 0; i < cgraph->n_nodes; ++i) {
+        const struct ggml_tensor * node = cgraph->nodes[i];
+        struct ggml_trace_node * tn = &trace->nodes[node_offs + i];
+
+        tn->op        = node->op;
+        tn->type      = node->type;
+        tn->src0_type = node->src[0] ? node->src[0]->type : GGML_TYPE_COUNT;
+        memcpy(tn->ne,   node->ne,   sizeof(tn->ne));
+        memcpy(tn->name, node->name, sizeof(tn->name));
+    }
+    trace->n_nodes += cgraph->n_nodes;
+
+    size_t n_events = 1;
+    for (int i = 0; i < n_threads; ++i) {
+        n_events += threads[i].n_events;
+    }
+
+    trace->events = ggml_trace_reserve(trace->events, &trace->n_events_max, trace->n_events + n_events, sizeof(struct ggml_trace_event));
+
+    struct ggml_trace_event * ev = &trace->events[trace->n_events];
+
+    ev->node = GGML_TRACE_GRAPH;
+    ev->ith  = 0;
+    ev->t0   = t_start;
+    ev->t1   = t_end;
+    ev++;
+
+    for (int i = 0; i < n_threads; ++i) {
+        for (int j = 0; j < threads[i].n_events; ++j) {
+            *ev = threads[i].events[j];
+            if (ev->node >= 0) {
+                ev->node += (int32_t) node_offs;
+            }
+            ev++;
+        }
+    }
+
+    trace->n_events += n_events;
+    trace->n_graphs++;
+}
+
+struct ggml_trace * ggml_trace_new(void) {
+    struct ggml_trace * trace = calloc(1, sizeof(struct ggml_trace));
+    GGML_ASSERT(trace);
+
+    trace->t_start = ggml_time_ns();
+
+    return trace;
+}
+
+void ggml_trace_free(struct ggml_trace * trace) {
+    if (trace == NULL) {
+        return;
+    }
+
+    free(trace->nodes);
+    free(trace->events);
+    free(trace);
+}
+
+void ggml_trace_reset(struct ggml_trace * trace) {
+    trace->t_start  = ggml_time_ns();
+    trace->n_graphs = 0;
+    trace->n_nodes  = 0;
+    trace->n_events = 0;
+}
+
+int ggml_trace_n_graphs(const struct ggml_trace * trace) {
+    return trace->n_graphs;
+}
+
+static void ggml_trace_fprint_str(FILE * fout, const char * s) {
+    fputc('"', fout);
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', fout);
+            fputc(*s, fout);
+        } else if ((unsigned char) *s < 0x20) {
+            fprintf(fout, "\\u%04x", (unsigned char) *s);
+        } else {
+            fputc(*s, fout);
+        }
+    }
+    fputc('"', fout);
+}
+
+bool ggml_trace_write_json(const struct ggml_trace * trace, const char * fname) {
+    FILE * fout = fopen(fname, "w");
+    if (!fout) {
+        return false;
+    }
+
+    fprintf(fout, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+
+    for (size_t i = 0; i < trace->n_events; ++i) {
+        const struct ggml_trace_event * ev = &trace->events[i];
+
+        // the timestamps are in us
+        const double ts  = (ev->t0 - trace->t_start)/1000.0;
+        const double dur = (ev->t1 - ev->t0)/1000.0;
+
+        fprintf(fout, "{\"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, ", ev->ith, ts, dur);
+
+        if (ev->node == GGML_TRACE_GRAPH) {
+            fprintf(fout, "\"name\": \"graph\", \"cat\": \"graph\"}");
+        } else if (ev->node == GGML_TRACE_WAIT) {
+            fprintf(fout, "\"name\": \"wait\", \"cat\": \"wait\"}");
+        } else {
+            const struct ggml_trace_node * tn = &trace->nodes[ev->node];
+
+            fprintf(fout, "\"name\": ");
+            ggml_trace_fprint_str(fout, tn->name[0] ? tn->name : ggml_op_name(tn->op));
+            fprintf(fout, ", \"cat\": \"%s\", \"args\": {\"op\": \"%s\", \"name\": ", ggml_op_name(tn->op), ggml_op_name(tn->op));
+            ggml_trace_fprint_str(fout, tn->name);
+            fprintf(fout, ", \"type\": \"%s\"", ggml_type_name(tn->type));
+            if (tn->src0_type != GGML_TYPE_COUNT) {
+                fprintf(fout, ", \"src0_type\": \"%s\"", ggml_type_name(tn->src0_type));
+            }
+            fprintf(fout, ", \"ne\": [%" PRId64 ", %" PRId64 ", %" PRId64 ", %" PRId64 "]}}",
+                    tn->ne[0], tn->ne[1], tn->ne[2], tn->ne[3]);
+        }
+
+        fprintf(fout, "%s\n", i + 1 < trace->n_events ? "," : "");
+    }
+
+    fprintf(fout, "]}\n");
+
+    const bool ok = ferror(fout) == 0;
+
+    fclose(fout);
+
+    return ok;
+}
+
+static struct ggml_tensor * ggml_base_tensor(struct ggml_tensor * t) {
+    return t->view_src ? t->view_src : t;
+}
+
+static int ggml_graph_find_node(const struct ggml_cgraph * cgraph, const struct ggml_tensor * t, int start, int end) {
+    for (int i = start; i < end; ++i) {
+        if (cgraph->nodes[i] == t) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// a and b do not read the tensors written by the other and do not write to the same tensor
+// this is checked on the base tensors, since the nodes are not allocated yet
+static bool ggml_nodes_independent_unallocated(struct ggml_tensor * a, struct ggml_tensor * b) {
+    if (ggml_base_tensor(a) == ggml_base_tensor(b)) {
+        return false;
+    }
+
+    for (int i = 0; i < GGML_MAX_SRC; ++i) {
+        if (a->src[i] && ggml_base_tensor(a->src[i]) == ggml_base_tensor(b)) {
+            return false;
+        }
+        if (b->src[i] && ggml_base_tensor(b->src[i]) == ggml_base_tensor(a)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// collect in moved the nodes in [start, end) that have to be moved together with node
+// these are the no-op nodes (views) that it depends on, returns false if it depends on a node that computes something
+static bool ggml_graph_collect_deps(
+        const struct ggml_cgraph * cgraph,
+        const struct ggml_tensor * node,
+        int   first,
+        int   start,
+        int   end,
+        int * moved,
+        int * n_moved) {
+    for (int i = 0; i < GGML_MAX_SRC; ++i) {
+        const struct ggml_tensor * src = node->src[i];
+        if (src == NULL) {
+            continue;
+        }
+
+        const int j = ggml_graph_find_node(cgraph, src, first, end);
+        if (j < 0) {
+            continue;
+        }
+
+        if (!ggml_op_is_noop(src->op)) {
+            return false;
+        }
+
+        if (!ggml_graph_collect_deps(cgraph, src, first, start, end, moved, n_moved)) {
+            return false;
+        }
+
+        if (j >= start) {
+            bool found = false;
+            for (int k = 0; k < *n_moved; ++k) {
+                found = found || moved[k] == j;
+            }
+            if (!found) {
+                if (*n_moved == GGML_CONCURRENT_LOOKAHEAD) {
+                    return false;
+                }
+                moved[(*n_moved)++] = j;
+            }
+        }
+    }
+
+    return true;
+}
+
+void ggml_graph_reorder_concurrent(struct ggml_cgraph * cgraph) {
+    struct ggml_tensor * nodes[GGML_CONCURRENT_LOOKAHEAD + 1];
+    struct ggml_tensor * grads[GGML_CONCURRENT_LOOKAHEAD + 1];
+
+    int moved[GGML_CONCURRENT_LOOKAHEAD];
+
+    for (int i = 0; i < cgraph->n_nodes; ++i) {
+        struct ggml_tensor * node = cgraph->nodes[i];
+
+        if (!GGML_OP_CAN_CONCURRENT[node->op]) {
+            continue;
+        }
+
+        // the nodes of the group are in [i, end), together with the views that they use
+        int end = i + 1;
+        int n   = 1;
+
+        for (int j = end; j < MIN(cgraph->n_nodes, i + GGML_CONCURRENT_LOOKAHEAD) && n < GGML_MAX_CONCURRENT; ++j) {
+            struct ggml_tensor * cand = cgraph->nodes[j];
+
+            if (cand->op != node->op) {
+                continue;
+            }
+
+            int n_moved = 0;
+            if (!ggml_graph_collect_deps(cgraph, cand, i, end, j, moved, &n_moved)) {
+                continue;
+            }
+
+            // cand must be independent of the group and of the nodes it is moved in front of
+            bool independent = true;
+            for (int k = i; k < j && independent; ++k) {
+                if (!ggml_op_is_noop(cgraph->nodes[k]->op)) {
+                    independent = ggml_nodes_independent_unallocated(cgraph->nodes[k], cand);
+                }
+            }
+            if (!independent) {
+                continue;
+            }
+
+            moved[n_moved++] = j;
+
+            // keep the moved nodes in their original order, so that the views stay after their sources
+            for (int k = 1; k < n_moved; ++k) {
+                for (int m = k; m > 0 && moved[m - 1] > moved[m]; --m) {
+                    const int tmp = moved[m]; moved[m] = moved[m - 1]; moved[m - 1] = tmp;
+                }
+            }
+
+            // move the nodes to end, keeping the order of the other nodes
+            int n_keep = 0;
+            for (int k = end, m = 0; k <= j; ++k) {
+                if (m < n_moved && moved[m] == k) {
+                    nodes[m] = cgraph->nodes[k];
+                    grads[m] = cgraph->grads ? cgraph->grads[k] : NULL;
+                    m++;
+                } else {
+                    nodes[n_moved + n_keep] = cgraph->nodes[k];
+                    grads[n_moved + n_keep] = cgraph->grads ? cgraph->grads[k] : NULL;
+                    n_keep++;
+                }
+            }
+            for (int k = 0; k < n_moved + n_keep; ++k) {
+                cgraph->nodes[end + k] = nodes[k];
+                if (cgraph->grads) {
+                    cgraph->grads[end + k] = grads[k];
+                }
+            }
+
+            end += n_moved;
+            n++;
+        }
+
+        i = end - 1;
+    }
+}
+
+// rows of f32 on the CPU, as expected by the fused ops
+static bool ggml_fuse_can_use(const struct ggml_tensor * t) {
+    return t->type == GGML_TYPE_F32 && t->backend == GGML_BACKEND_CPU && t->grad == NULL && t->nb[0] == sizeof(float);
+}
+
+static int ggml_fuse_n_uses(struct hash_map * uses, struct ggml_tensor * t) {
+    const size_t i = ggml_hash_find(uses->set, t);
+    return i != GGML_HASHTABLE_FULL && uses->set.keys[i] == t ? (int) (intptr_t) uses->vals[i] : 0;
+}
+
+// the result of node is only used by the next node of a fused op, so that it can be removed from the graph
+static bool ggml_fuse_can_remove(struct hash_map * uses, struct ggml_tensor * node) {
+    return node->view_src == NULL && ggml_fuse_can_use(node) && ggml_fuse_n_uses(uses, node) == 1;
+}
+
+// turn t into a view of the tensor src at offset offs, keeping its shape and its uses
+static void ggml_fuse_make_view(struct ggml_tensor * t, struct ggml_tensor * src, size_t offs) {
+    memset(t->src, 0, sizeof(t->src));
+    ggml_set_op_params(t, &offs, sizeof(offs));
+
+    t->op        = GGML_OP_VIEW;
+    t->src[0]    = src;
+    t->view_src  = src;
+    t->view_offs = offs;
+    t->data      = src->data ? (char *) src->data + offs : NULL;
+}
+
+void ggml_graph_fuse(struct ggml_context * ctx, struct ggml_cgraph * cgraph) {
+    // number of nodes that use each tensor
+    struct hash_map * uses = ggml_new_hash_map(cgraph->n_nodes + cgraph->n_leafs);
+
+    for (int i = 0; i < cgraph->n_nodes; ++i) {
+        for (int j = 0; j < GGML_MAX_SRC; ++j) {
+            struct ggml_tensor * src = cgraph->nodes[i]->src[j];
+            if (src == NULL) {
+                continue;
+            }
+
+            const size_t k = ggml_hash_find_or_insert(uses->set, src);
+
+            uses->vals[k] = (void *) ((intptr_t) uses->vals[k] + 1);
+        }
+    }
 
+    // the removed nodes are set to NULL
+    int n_added = 0;
+
+    for (int i = 0; i < cgraph->n_nodes; ++i) {
         struct ggml_tensor * node = cgraph->nodes[i];
 
-        switch (node->op) {
-            case GGML_OP_CPY:
-            case GGML_OP_DUP:
-                {
-                    n_tasks = n_threads;
+        if (node == NULL || node->op != GGML_OP_MUL || node->view_src != NULL || !ggml_is_contiguous(node) ||
+            !ggml_fuse_can_use(node) || !ggml_fuse_can_use(node->src[1])) {
+            continue;
+        }
 
-                    size_t cur = 0;
-                    if (ggml_is_quantized(node->type)) {
-                        cur = ggml_type_size(GGML_TYPE_F32) * node->ne[0] * n_tasks;
-                    }
+        struct ggml_tensor * a = node->src[0];
+        struct ggml_tensor * b = node->src[1];
 
-                    work_size = MAX(work_size, cur);
-                } break;
-            case GGML_OP_ADD:
-            case GGML_OP_ADD1:
-                {
-                    n_tasks = n_threads;
+        if (!ggml_fuse_can_remove(uses, a) || !ggml_fuse_can_use(a->src[0])) {
+            continue;
+        }
 
-                    size_t cur = 0;
+        // rms_norm(x)*w -> rms_norm_mul(x, w)
+        if (a->op == GGML_OP_RMS_NORM) {
+            float eps;
+            memcpy(&eps, a->op_params, sizeof(float));
 
-                    if (ggml_is_quantized(node->src[0]->type)) {
-                        cur = ggml_type_size(GGML_TYPE_F32) * node->src[0]->ne[0] * n_tasks;
-                    }
+            ggml_set_op_params(node, &eps, sizeof(eps));
 
-                    work_size = MAX(work_size, cur);
-                } break;
-            case GGML_OP_ACC:
-                {
-                    n_tasks = n_threads;
+            node->op     = GGML_OP_RMS_NORM_MUL;
+            node->src[0] = a->src[0];
+            node->src[1] = b;
+
+            cgraph->nodes[ggml_graph_find_node(cgraph, a, 0, i)] = NULL;
+
+            // x = s0 + s1 before the norm -> add_rms_norm(s0, s1, w), with x and the result as views of its two halves
+            struct ggml_tensor * x = node->src[0];
+
+            if (x->op == GGML_OP_ADD && x->view_src == NULL && ggml_is_contiguous(x) && x->ne[3] == 1 &&
+                ggml_fuse_can_use(x->src[0]) && ggml_fuse_can_use(x->src[1]) && ggml_are_same_shape(x->src[0], x->src[1])) {
+                struct ggml_tensor * f = ggml_add_rms_norm(ctx, x->src[0], x->src[1], b, eps);
+                ggml_format_name(f, "%s + %s", x->name, node->name);
+
+                ggml_fuse_make_view(x,    f, 0);
+                ggml_fuse_make_view(node, f, f->nb[3]);
+
+                n_added++;
+            }
+            continue;
+        }
+
+        // silu(g)*u -> swiglu(g, u)
+        if (a->op == GGML_OP_UNARY && ggml_get_unary_op(a) == GGML_UNARY_OP_SILU && ggml_are_same_shape(a->src[0], b)) {
+            node->op     = GGML_OP_SWIGLU;
+            node->src[0] = a->src[0];
+            node->src[1] = b;
+
+            cgraph->nodes[ggml_graph_find_node(cgraph, a, 0, i)] = NULL;
+            continue;
+        }
+    }
+
+    ggml_hash_map_free(uses);
+
+    // compact the nodes, and insert the new add_rms_norm nodes in front of the views of their first half
+    struct ggml_tensor ** nodes = malloc(2*cgraph->n_nodes*sizeof(struct ggml_tensor *));
+    struct ggml_tensor ** grads = nodes + cgraph->n_nodes;
+
+    memcpy(nodes, cgraph->nodes, cgraph->n_nodes*sizeof(struct ggml_tensor *));
+    if (cgraph->grads) {
+        memcpy(grads, cgraph->grads, cgraph->n_nodes*sizeof(struct ggml_tensor *));
+    }
+
+    int n_nodes = 0;
+
+    for (int i = 0; i < cgraph->n_nodes; ++i) {
+        struct ggml_tensor * node = nodes[i];
+        if (node == NULL) {
+            continue;
+        }
+
+        if (node->op == GGML_OP_VIEW && node->src[0]->op == GGML_OP_ADD_RMS_NORM &&
+            ggml_hash_insert(cgraph->visited_hash_table, node->src[0]) != GGML_HASHTABLE_ALREADY_EXISTS) {
+            GGML_ASSERT(n_nodes < cgraph->size);
+            cgraph->nodes[n_nodes] = node->src[0];
+            if (cgraph->grads) {
+                cgraph->grads[n_nodes] = NULL;
+            }
+            n_nodes++;
+        }
+
+        GGML_ASSERT(n_nodes < cgraph->size);
+        cgraph->nodes[n_nodes] = node;
+        if (cgraph->grads) {
+            cgraph->grads[n_nodes] = grads[i];
+        }
+        n_nodes++;
+    }
+
+    free(nodes);
+
+    GGML_ASSERT(n_nodes <= cgraph->n_nodes + n_added);
+
+    cgraph->n_nodes = n_nodes;
+}
+
+// the mul_mat nodes that convert src1 to the vec_dot_type of src0 in their INIT pass on the CPU
+static bool ggml_mul_mat_converts_src1(const struct ggml_tensor * node) {
+    if (node->op != GGML_OP_MUL_MAT || node->backend != GGML_BACKEND_CPU || node->grad != NULL) {
+        return false;
+    }
+
+    const struct ggml_tensor * src0 = node->src[0];
+    const struct ggml_tensor * src1 = node->src[1];
+
+    const enum ggml_type vec_dot_type = type_traits[src0->type].vec_dot_type;
+
+    if (src1->type != GGML_TYPE_F32 || vec_dot_type == GGML_TYPE_F32 || src1->backend != GGML_BACKEND_CPU ||
+        !ggml_is_contiguous(src1) || src1->ne[0] % ggml_blck_size(vec_dot_type) != 0) {
+        return false;
+    }
+
+#if defined(GGML_USE_CUBLAS)
+    if (ggml_cuda_can_mul_mat(src0, src1, node)) {
+        return false;
+    }
+#elif defined(GGML_USE_CLBLAST)
+    if (ggml_cl_can_mul_mat(src0, src1, node)) {
+        return false;
+    }
+#endif
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+    if (ggml_compute_forward_mul_mat_use_blas(src0, src1, (struct ggml_tensor *) node)) {
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+void ggml_graph_share_src1(struct ggml_context * ctx, struct ggml_cgraph * cgraph) {
+    // the copy of src1 is inserted before the first of its users, and the src[1] of all its users points to the copy
+    // the other nodes keep their order
+    struct ggml_tensor ** nodes = malloc(2*cgraph->n_nodes*sizeof(struct ggml_tensor *));
+    struct ggml_tensor ** grads = malloc(2*cgraph->n_nodes*sizeof(struct ggml_tensor *));
+
+    int n_nodes = 0;
+
+    for (int i = 0; i < cgraph->n_nodes; ++i) {
+        struct ggml_tensor * node = cgraph->nodes[i];
 
-                    size_t cur = 0;
+        if (ggml_mul_mat_converts_src1(node)) {
+            struct ggml_tensor * src1 = node->src[1];
 
-                    if (ggml_is_quantized(node->src[0]->type)) {
-                        cur = ggml_type_size(GGML_TYPE_F32) * node->src[1]->ne[0] * n_tasks;
+            const enum ggml_type vec_dot_type = type_traits[node->src[0]->type].vec_dot_type;
+
+            int n_users = 1;
+            for (int j = i + 1; j < cgraph->n_nodes; ++j) {
+                const struct ggml_tensor * other = cgraph->nodes[j];
+                if (other->src[1] == src1 && ggml_mul_mat_converts_src1(other) && type_traits[other->src[0]->type].vec_dot_type == vec_dot_type) {
+                    n_users++;
+                }
+            }
+
+            if (n_users > 1) {
+                struct ggml_tensor * src1_q = ggml_cpy(ctx, src1, ggml_new_tensor(ctx, vec_dot_type, 4, src1->ne));
+                ggml_format_name(src1_q, "%s (%s)", src1->name, ggml_type_name(vec_dot_type));
+
+                nodes[n_nodes] = src1_q;
+                grads[n_nodes] = NULL;
+                n_nodes++;
+
+                for (int j = i; j < cgraph->n_nodes; ++j) {
+                    struct ggml_tensor * other = cgraph->nodes[j];
+                    if (other->src[1] == src1 && ggml_mul_mat_converts_src1(other) && type_traits[other->src[0]->type].vec_dot_type == vec_dot_type) {
+                        other->src[1] = src1_q;
                     }
+                }
+            }
+        }
 
-                    work_size = MAX(work_size, cur);
-                } break;
-            case GGML_OP_SUB:
-            case GGML_OP_DIV:
-            case GGML_OP_SQR:
-            case GGML_OP_SQRT:
-            case GGML_OP_LOG:
-            case GGML_OP_SUM:
-            case GGML_OP_SUM_ROWS:
-            case GGML_OP_MEAN:
-            case GGML_OP_ARGMAX:
-            case GGML_OP_REPEAT:
-            case GGML_OP_REPEAT_BACK:
-            {
-                    n_tasks = 1;
-                } break;
+        nodes[n_nodes] = node;
+        grads[n_nodes] = cgraph->grads ? cgraph->grads[i] : NULL;
+        n_nodes++;
+    }
 
-            case GGML_OP_UNARY:
-                {
-                    switch (ggml_get_unary_op(node)) {
-                        case GGML_UNARY_OP_ABS:
-                        case GGML_UNARY_OP_SGN:
-                        case GGML_UNARY_OP_NEG:
-                        case GGML_UNARY_OP_STEP:
-                        case GGML_UNARY_OP_TANH:
-                        case GGML_UNARY_OP_ELU:
-                        case GGML_UNARY_OP_RELU:
-                            {
-                                n_tasks = 1;
-                            } break;
+    GGML_ASSERT(n_nodes <= cgraph->size);
 
-                        case GGML_UNARY_OP_GELU:
-                        case GGML_UNARY_OP_GELU_QUICK:
-                        case GGML_UNARY_OP_SILU:
-                            {
-                                n_tasks = n_threads;
-                            } break;
+    memcpy(cgraph->nodes, nodes, n_nodes*sizeof(struct ggml_tensor *));
+    if (cgraph->grads) {
+        memcpy(cgraph->grads, grads, n_nodes*sizeof(struct ggml_tensor *));
+    }
+
+    cgraph->n_nodes = n_nodes;
+
+    free(nodes);
+    free(grads);
+}
+
+// small nodes of cheap element-wise ops are computed by a single thread
+// this is faster than splitting them, because the other threads do not have to synchronize with it
+static int ggml_get_n_tasks_elementwise(const struct ggml_tensor * node, int n_threads) {
+    return ggml_nelements(node) <= GGML_SMALL_NODE_NELEMENTS ? 1 : n_threads;
+}
+
+// number of threads that compute node, and the size of the work buffer that it needs in work_size
+static int ggml_get_n_tasks_wsize(struct ggml_tensor * node, int n_threads, size_t * wsize) {
+    int n_tasks = 1;
+
+    size_t work_size = 0;
+
+    switch (node->op) {
+        case GGML_OP_CPY:
+        case GGML_OP_DUP:
+            {
+                n_tasks = ggml_get_n_tasks_elementwise(node, n_threads);
+
+                // the rows are converted to f32 before they are converted to another type, except if they are f32 already
+                size_t cur = 0;
+                if (node->type != GGML_TYPE_F32 && node->type != node->src[0]->type && node->src[0]->type != GGML_TYPE_F32) {
+                    cur = ggml_type_size(GGML_TYPE_F32) * node->ne[0] * n_tasks;
+                }
+
+                work_size = MAX(work_size, cur);
+            } break;
+        case GGML_OP_ADD:
+        case GGML_OP_ADD1:
+            {
+                n_tasks = ggml_get_n_tasks_elementwise(node, n_threads);
+
+                size_t cur = 0;
+
+                if (ggml_is_quantized(node->src[0]->type)) {
+                    cur = ggml_type_size(GGML_TYPE_F32) * node->src[0]->ne[0] * n_tasks;
+                }
+
+                work_size = MAX(work_size, cur);
+            } break;
+        case GGML_OP_ACC:
+            {
+                n_tasks = n_threads;
+
+                size_t cur = 0;
+
+                if (ggml_is_quantized(node->src[0]->type)) {
+                    cur = ggml_type_size(GGML_TYPE_F32) * node->src[1]->ne[0] * n_tasks;
+                }
+
+                work_size = MAX(work_size, cur);
+            } break;
+        case GGML_OP_SUB:
+        case GGML_OP_DIV:
+        case GGML_OP_SQR:
+        case GGML_OP_SQRT:
+        case GGML_OP_LOG:
+        case GGML_OP_SUM:
+        case GGML_OP_SUM_ROWS:
+        case GGML_OP_MEAN:
+        case GGML_OP_ARGMAX:
+        case GGML_OP_REPEAT:
+        case GGML_OP_REPEAT_BACK:
+        {
+                n_tasks = 1;
+            } break;
+
+        case GGML_OP_UNARY:
+            {
+                switch (ggml_get_unary_op(node)) {
+                    case GGML_UNARY_OP_ABS:
+                    case GGML_UNARY_OP_SGN:
+                    case GGML_UNARY_OP_NEG:
+                    case GGML_UNARY_OP_STEP:
+                    case GGML_UNARY_OP_TANH:
+                    case GGML_UNARY_OP_ELU:
+                    case GGML_UNARY_OP_RELU:
+                        {
+                            n_tasks = 1;
+                        } break;
+
+                    case GGML_UNARY_OP_GELU:
+                    case GGML_UNARY_OP_GELU_QUICK:
+                    case GGML_UNARY_OP_SILU:
+                        {
+                            n_tasks = ggml_get_n_tasks_elementwise(node, n_threads);
+                        } break;
+                }
+            } break;
+        case GGML_OP_MUL:
+        case GGML_OP_NORM:
+        case GGML_OP_RMS_NORM:
+        case GGML_OP_RMS_NORM_MUL:
+        case GGML_OP_ADD_RMS_NORM:
+        case GGML_OP_SWIGLU:
+            {
+                n_tasks = ggml_get_n_tasks_elementwise(node, n_threads);
+            } break;
+        case GGML_OP_SILU_BACK:
+        case GGML_OP_RMS_NORM_BACK:
+        case GGML_OP_GROUP_NORM:
+        case GGML_OP_SET_ROWS:
+            {
+                n_tasks = n_threads;
+            } break;
+        case GGML_OP_CONCAT:
+        case GGML_OP_MUL_MAT:
+            {
+                n_tasks = n_threads;
+
+                // TODO: use different scheduling for different matrix sizes
+                //const int nr0 = ggml_nrows(node->src[0]);
+                //const int nr1 = ggml_nrows(node->src[1]);
+
+                //n_tasks = MIN(n_threads, MAX(1, nr0/128));
+                //printf("nr0 = %8d, nr1 = %8d, nr0*nr1 = %8d, n_tasks%d\n", nr0, nr1, nr0*nr1, n_tasks);
+
+                size_t cur = 0;
+                const enum ggml_type vec_dot_type = type_traits[node->src[0]->type].vec_dot_type;
+
+#if defined(GGML_USE_CUBLAS)
+                if (ggml_cuda_can_mul_mat(node->src[0], node->src[1], node)) {
+                    n_tasks = 1; // TODO: this actually is doing nothing
+                                 //       the threads are still spinning
+                } else
+#elif defined(GGML_USE_CLBLAST)
+                if (ggml_cl_can_mul_mat(node->src[0], node->src[1], node)) {
+                    n_tasks = 1; // TODO: this actually is doing nothing
+                                 //       the threads are still spinning
+                    cur = ggml_cl_mul_mat_get_wsize(node->src[0], node->src[1], node);
+                } else
+#endif
+#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
+                if (ggml_compute_forward_mul_mat_use_blas(node->src[0], node->src[1], node)) {
+                    n_tasks = 1; // TODO: this actually is doing nothing
+                                 //       the threads are still spinning
+                    if (node->src[0]->type != GGML_TYPE_F32) {
+                        // here we need memory just for single 2D matrix from src0
+                        cur = ggml_type_size(GGML_TYPE_F32)*(node->src[0]->ne[0]*node->src[0]->ne[1]);
                     }
-                } break;
-            case GGML_OP_SILU_BACK:
-            case GGML_OP_MUL:
-            case GGML_OP_NORM:
-            case GGML_OP_RMS_NORM:
-            case GGML_OP_RMS_NORM_BACK:
-            case GGML_OP_GROUP_NORM:
-                {
-                    n_tasks = n_threads;
-                } break;
-            case GGML_OP_CONCAT:
-            case GGML_OP_MUL_MAT:
-                {
-                    n_tasks = n_threads;
+                } else
+#endif
+                if (node->src[1]->type != vec_dot_type) {
+                    cur = ggml_type_size(vec_dot_type)*ggml_nelements(node->src[1])/ggml_blck_size(vec_dot_type);
+                } else {
+                    cur = 0;
+                }
+
+                work_size = MAX(work_size, cur);
+            } break;
+        case GGML_OP_OUT_PROD:
+            {
+                n_tasks = n_threads;
+
+                size_t cur = 0;
+
+                if (ggml_is_quantized(node->src[0]->type)) {
+                    cur = ggml_type_size(GGML_TYPE_F32) * node->src[0]->ne[0] * n_tasks;
+                }
+
+                work_size = MAX(work_size, cur);
+            } break;
+        case GGML_OP_SCALE:
+            {
+                n_tasks = 1;
+            } break;
+        case GGML_OP_SET:
+        case GGML_OP_CONT:
+        case GGML_OP_RESHAPE:
+        case GGML_OP_VIEW:
+        case GGML_OP_PERMUTE:
+        case GGML_OP_TRANSPOSE:
+        case GGML_OP_GET_ROWS:
+        case GGML_OP_GET_ROWS_BACK:
+        case GGML_OP_DIAG:
+            {
+                n_tasks = 1;
+            } break;
+        case GGML_OP_DIAG_MASK_ZERO:
+        case GGML_OP_DIAG_MASK_INF:
+        case GGML_OP_SOFT_MAX:
+        case GGML_OP_SOFT_MAX_BACK:
+        case GGML_OP_ROPE_BACK:
+        case GGML_OP_ADD_REL_POS:
+            {
+                n_tasks = n_threads;
+            } break;
+        case GGML_OP_ROPE:
+            {
+                n_tasks = n_threads;
+
+                const size_t cur = ggml_rope_wsize(node->src[0]->ne[0])*n_tasks;
+
+                work_size = MAX(work_size, cur);
+            } break;
+        case GGML_OP_ALIBI:
+            {
+                n_tasks = 1; //TODO
+            } break;
+        case GGML_OP_CLAMP:
+            {
+                n_tasks = 1; //TODO
+            } break;
+        case GGML_OP_CONV_1D:
+            {
+                n_tasks = n_threads;
+
+                GGML_ASSERT(node->src[0]->ne[3] == 1);
+                GGML_ASSERT(node->src[1]->ne[2] == 1);
+                GGML_ASSERT(node->src[1]->ne[3] == 1);
+
+                const int64_t ne00 = node->src[0]->ne[0];
+                const int64_t ne01 = node->src[0]->ne[1];
+                const int64_t ne02 = node->src[0]->ne[2];
+
+                const int64_t ne10 = node->src[1]->ne[0];
+                const int64_t ne11 = node->src[1]->ne[1];
+
+                const int64_t ne0 = node->ne[0];
+                const int64_t ne1 = node->ne[1];
+                const int64_t nk  = ne00;
+                const int64_t ew0 = nk * ne01;
+
+                UNUSED(ne02);
+                UNUSED(ne10);
+                UNUSED(ne11);
+
+                size_t cur = 0;
+
+                if (node->src[0]->type == GGML_TYPE_F16 &&
+                    node->src[1]->type == GGML_TYPE_F32) {
+                    cur = sizeof(ggml_fp16_t)*(ne0*ne1*ew0);
+                } else if (node->src[0]->type == GGML_TYPE_F32 &&
+                           node->src[1]->type == GGML_TYPE_F32) {
+                    cur = sizeof(float)*(ne0*ne1*ew0);
+                } else {
+                    GGML_ASSERT(false);
+                }
+
+                work_size = MAX(work_size, cur);
+            } break;
+        case GGML_OP_CONV_1D_STAGE_0:
+            {
+                n_tasks = n_threads;
+            } break;
+        case GGML_OP_CONV_1D_STAGE_1:
+            {
+                n_tasks = n_threads;
+            } break;
+        case GGML_OP_CONV_TRANSPOSE_1D:
+            {
+                n_tasks = n_threads;
+
+                GGML_ASSERT(node->src[0]->ne[3] == 1);
+                GGML_ASSERT(node->src[1]->ne[2] == 1);
+                GGML_ASSERT(node->src[1]->ne[3] == 1);
+
+                const int64_t ne00 = node->src[0]->ne[0];  // K
+                const int64_t ne01 = node->src[0]->ne[1];  // Cout
+                const int64_t ne02 = node->src[0]->ne[2];  // Cin
+
+                const int64_t ne10 = node->src[1]->ne[0];  // L
+                const int64_t ne11 = node->src[1]->ne[1];  // Cin
+
+                size_t cur = 0;
+                if (node->src[0]->type == GGML_TYPE_F16 &&
+                    node->src[1]->type == GGML_TYPE_F32) {
+                    cur += sizeof(ggml_fp16_t)*ne00*ne01*ne02;
+                    cur += sizeof(ggml_fp16_t)*ne10*ne11;
+                } else if (node->src[0]->type == GGML_TYPE_F32 &&
+                           node->src[1]->type == GGML_TYPE_F32) {
+                    cur += sizeof(float)*ne00*ne01*ne02;
+                    cur += sizeof(float)*ne10*ne11;
+                } else {
+                    GGML_ASSERT(false);
+                }
+
+                work_size = MAX(work_size, cur);
+            } break;
+        case GGML_OP_CONV_2D:
+            {
+                n_tasks = n_threads;
 
-                    // TODO: use different scheduling for different matrix sizes
-                    //const int nr0 = ggml_nrows(node->src[0]);
-                    //const int nr1 = ggml_nrows(node->src[1]);
+                const int64_t ne00 = node->src[0]->ne[0]; // W
+                const int64_t ne01 = node->src[0]->ne[1]; // H
+                const int64_t ne02 = node->src[0]->ne[2]; // C
+                const int64_t ne03 = node->src[0]->ne[3]; // N
 
-                    //n_tasks = MIN(n_threads, MAX(1, nr0/128));
-                    //printf("nr0 = %8d, nr1 = %8d, nr0*nr1 = %8d, n_tasks%d\n", nr0, nr1, nr0*nr1, n_tasks);
+                const int64_t ne10 = node->src[1]->ne[0]; // W
+                const int64_t ne11 = node->src[1]->ne[1]; // H
+                const int64_t ne12 = node->src[1]->ne[2]; // C
 
-                    size_t cur = 0;
-                    const enum ggml_type vec_dot_type = type_traits[node->src[0]->type].vec_dot_type;
+                const int64_t ne0 = node->ne[0];
+                const int64_t ne1 = node->ne[1];
+                const int64_t ne2 = node->ne[2];
+                const int64_t ne3 = node->ne[3];
+                const int64_t nk = ne00*ne01;
+                const int64_t ew0 = nk * ne02;
 
-#if defined(GGML_USE_CUBLAS)
-                    if (ggml_cuda_can_mul_mat(node->src[0], node->src[1], node)) {
-                        n_tasks = 1; // TODO: this actually is doing nothing
-                                     //       the threads are still spinning
-                    } else
-#elif defined(GGML_USE_CLBLAST)
-                    if (ggml_cl_can_mul_mat(node->src[0], node->src[1], node)) {
-                        n_tasks = 1; // TODO: this actually is doing nothing
-                                     //       the threads are still spinning
-                        cur = ggml_cl_mul_mat_get_wsize(node->src[0], node->src[1], node);
-                    } else
-#endif
-#if defined(GGML_USE_ACCELERATE) || defined(GGML_USE_OPENBLAS)
-                    if (ggml_compute_forward_mul_mat_use_blas(node->src[0], node->src[1], node)) {
-                        n_tasks = 1; // TODO: this actually is doing nothing
-                                     //       the threads are still spinning
-                        if (node->src[0]->type != GGML_TYPE_F32) {
-                            // here we need memory just for single 2D matrix from src0
-                            cur = ggml_type_size(GGML_TYPE_F32)*(node->src[0]->ne[0]*node->src[0]->ne[1]);
-                        }
-                    } else
-#endif
-                    if (node->src[1]->type != vec_dot_type) {
-                        cur = ggml_type_size(vec_dot_type)*ggml_nelements(node->src[1])/ggml_blck_size(vec_dot_type);
-                    } else {
-                        cur = 0;
-                    }
+                UNUSED(ne03);
+                UNUSED(ne2);
 
-                    work_size = MAX(work_size, cur);
-                } break;
-            case GGML_OP_OUT_PROD:
-                {
-                    n_tasks = n_threads;
+                size_t cur = 0;
 
-                    size_t cur = 0;
+                if (node->src[0]->type == GGML_TYPE_F16 &&
+                    node->src[1]->type == GGML_TYPE_F32) {
+                    // im2col: [N*OH*OW, IC*KH*KW]
+                    cur = sizeof(ggml_fp16_t)*(ne3*ne0*ne1*ew0);
+                } else if (node->src[0]->type == GGML_TYPE_F32 &&
+                           node->src[1]->type == GGML_TYPE_F32) {
+                    cur = sizeof(float)*      (ne10*ne11*ne12);
+                } else {
+                    GGML_ASSERT(false);
+                }
 
-                    if (ggml_is_quantized(node->src[0]->type)) {
-                        cur = ggml_type_size(GGML_TYPE_F32) * node->src[0]->ne[0] * n_tasks;
-                    }
+                work_size = MAX(work_size, cur);
+            } break;
+        case GGML_OP_CONV_2D_STAGE_0:
+            {
+                n_tasks = n_threads;
+            } break;
+        case GGML_OP_CONV_2D_STAGE_1:
+            {
+                n_tasks = n_threads;
+            } break;
+        case GGML_OP_CONV_TRANSPOSE_2D:
+            {
+                n_tasks = n_threads;
 
-                    work_size = MAX(work_size, cur);
-                } break;
-            case GGML_OP_SCALE:
-                {
-                    n_tasks = 1;
-                } break;
-            case GGML_OP_SET:
-            case GGML_OP_CONT:
-            case GGML_OP_RESHAPE:
-            case GGML_OP_VIEW:
-            case GGML_OP_PERMUTE:
-            case GGML_OP_TRANSPOSE:
-            case GGML_OP_GET_ROWS:
-            case GGML_OP_GET_ROWS_BACK:
-            case GGML_OP_DIAG:
-                {
-                    n_tasks = 1;
-                } break;
-            case GGML_OP_DIAG_MASK_ZERO:
-            case GGML_OP_DIAG_MASK_INF:
-            case GGML_OP_SOFT_MAX:
-            case GGML_OP_SOFT_MAX_BACK:
-            case GGML_OP_ROPE:
-            case GGML_OP_ROPE_BACK:
-            case GGML_OP_ADD_REL_POS:
-                {
-                    n_tasks = n_threads;
-                } break;
-            case GGML_OP_ALIBI:
-                {
-                    n_tasks = 1; //TODO
-                } break;
-            case GGML_OP_CLAMP:
-                {
-                    n_tasks = 1; //TODO
-                } break;
-            case GGML_OP_CONV_1D:
-                {
-                    n_tasks = n_threads;
+                const int64_t ne00 = node->src[0]->ne[0]; // W
+                const int64_t ne01 = node->src[0]->ne[1]; // H
+                const int64_t ne02 = node->src[0]->ne[2]; // Channels Out
+                const int64_t ne03 = node->src[0]->ne[3]; // Channels In
 
-                    GGML_ASSERT(node->src[0]->ne[3] == 1);
-                    GGML_ASSERT(node->src[1]->ne[2] == 1);
-                    GGML_ASSERT(node->src[1]->ne[3] == 1);
+                const int64_t ne10 = node->src[1]->ne[0]; // W
+                const int64_t ne11 = node->src[1]->ne[1]; // H
+                const int64_t ne12 = node->src[1]->ne[2]; // Channels In
 
-                    const int64_t ne00 = node->src[0]->ne[0];
-                    const int64_t ne01 = node->src[0]->ne[1];
-                    const int64_t ne02 = node->src[0]->ne[2];
+                size_t cur = 0;
+                cur += sizeof(ggml_fp16_t)*ne00*ne01*ne02*ne03;
+                cur += sizeof(ggml_fp16_t)*ne10*ne11*ne12;
 
-                    const int64_t ne10 = node->src[1]->ne[0];
-                    const int64_t ne11 = node->src[1]->ne[1];
+                work_size = MAX(work_size, cur);
+            } break;
+        case GGML_OP_POOL_1D:
+        case GGML_OP_POOL_2D:
+            {
+                n_tasks = 1;
+            } break;
+        case GGML_OP_UPSCALE:
+            {
+                n_tasks = n_threads;
+            } break;
+        case GGML_OP_FLASH_ATTN:
+            {
+                n_tasks = n_threads;
 
-                    const int64_t ne0 = node->ne[0];
-                    const int64_t ne1 = node->ne[1];
-                    const int64_t nk  = ne00;
-                    const int64_t ew0 = nk * ne01;
+                size_t cur = 0;
 
-                    UNUSED(ne02);
-                    UNUSED(ne10);
-                    UNUSED(ne11);
+                const int64_t ne11 = ggml_up(node->src[1]->ne[1], GGML_SOFT_MAX_UNROLL);
 
-                    size_t cur = 0;
+                if (node->src[1]->type == GGML_TYPE_F32) {
+                    cur  = sizeof(float)*ne11*n_tasks; // TODO: this can become (n_tasks-1)
+                    cur += sizeof(float)*ne11*n_tasks; // this is overestimated by x2
+                }
 
-                    if (node->src[0]->type == GGML_TYPE_F16 &&
-                        node->src[1]->type == GGML_TYPE_F32) {
-                        cur = sizeof(ggml_fp16_t)*(ne0*ne1*ew0);
-                    } else if (node->src[0]->type == GGML_TYPE_F32 &&
-                               node->src[1]->type == GGML_TYPE_F32) {
-                        cur = sizeof(float)*(ne0*ne1*ew0);
-                    } else {
-                        GGML_ASSERT(false);
-                    }
+                if (node->src[1]->type == GGML_TYPE_F16) {
+                    cur  = sizeof(float)*ne11*n_tasks; // TODO: this can become (n_tasks-1)
+                    cur += sizeof(float)*ne11*n_tasks; // this is overestimated by x2
+                }
 
-                    work_size = MAX(work_size, cur);
-                } break;
-            case GGML_OP_CONV_1D_STAGE_0:
-                {
-                    n_tasks = n_threads;
-                } break;
-            case GGML_OP_CONV_1D_STAGE_1:
-                {
-                    n_tasks = n_threads;
-                } break;
-            case GGML_OP_CONV_TRANSPOSE_1D:
-                {
-                    n_tasks = n_threads;
+                work_size = MAX(work_size, cur);
+            } break;
+        case GGML_OP_FLASH_ATTN_EXT:
+            {
+                n_tasks = n_threads;
 
-                    GGML_ASSERT(node->src[0]->ne[3] == 1);
-                    GGML_ASSERT(node->src[1]->ne[2] == 1);
-                    GGML_ASSERT(node->src[1]->ne[3] == 1);
-
-                    const int64_t ne00 = node->src[0]->ne[0];  // K
-                    const int64_t ne01 = node->src[0]->ne[1];  // Cout
-                    const int64_t ne02 = node->src[0]->ne[2];  // Cin
-
-                    const int64_t ne10 = node->src[1]->ne[0];  // L
-                    const int64_t ne11 = node->src[1]->ne[1];  // Cin
-
-                    size_t cur = 0;
-                    if (node->src[0]->type == GGML_TYPE_F16 &&
-                        node->src[1]->type == GGML_TYPE_F32) {
-                        cur += sizeof(ggml_fp16_t)*ne00*ne01*ne02;
-                        cur += sizeof(ggml_fp16_t)*ne10*ne11;
-                    } else if (node->src[0]->type == GGML_TYPE_F32 &&
-                               node->src[1]->type == GGML_TYPE_F32) {
-                        cur += sizeof(float)*ne00*ne01*ne02;
-                        cur += sizeof(float)*ne10*ne11;
-                    } else {
-                        GGML_ASSERT(false);
-                    }
+                const size_t cur = ggml_flash_attn_ext_wsize(node->src[0]->ne[0])*n_tasks;
 
-                    work_size = MAX(work_size, cur);
-                } break;
-            case GGML_OP_CONV_2D:
-                {
-                    n_tasks = n_threads;
+                work_size = MAX(work_size, cur);
+            } break;
+        case GGML_OP_FLASH_FF:
+            {
+                n_tasks = n_threads;
 
-                    const int64_t ne00 = node->src[0]->ne[0]; // W
-                    const int64_t ne01 = node->src[0]->ne[1]; // H
-                    const int64_t ne02 = node->src[0]->ne[2]; // C
-                    const int64_t ne03 = node->src[0]->ne[3]; // N
-
-                    const int64_t ne10 = node->src[1]->ne[0]; // W
-                    const int64_t ne11 = node->src[1]->ne[1]; // H
-                    const int64_t ne12 = node->src[1]->ne[2]; // C
-
-                    const int64_t ne0 = node->ne[0];
-                    const int64_t ne1 = node->ne[1];
-                    const int64_t ne2 = node->ne[2];
-                    const int64_t ne3 = node->ne[3];
-                    const int64_t nk = ne00*ne01;
-                    const int64_t ew0 = nk * ne02;
-
-                    UNUSED(ne03);
-                    UNUSED(ne2);
-
-                    size_t cur = 0;
-
-                    if (node->src[0]->type == GGML_TYPE_F16 &&
-                        node->src[1]->type == GGML_TYPE_F32) {
-                        // im2col: [N*OH*OW, IC*KH*KW]
-                        cur = sizeof(ggml_fp16_t)*(ne3*ne0*ne1*ew0);
-                    } else if (node->src[0]->type == GGML_TYPE_F32 &&
-                               node->src[1]->type == GGML_TYPE_F32) {
-                        cur = sizeof(float)*      (ne10*ne11*ne12);
-                    } else {
-                        GGML_ASSERT(false);
-                    }
+                size_t cur = 0;
 
-                    work_size = MAX(work_size, cur);
-                } break;
-            case GGML_OP_CONV_2D_STAGE_0:
-                {
-                    n_tasks = n_threads;
-                } break;
-            case GGML_OP_CONV_2D_STAGE_1:
-                {
-                    n_tasks = n_threads;
-                } break;
-            case GGML_OP_CONV_TRANSPOSE_2D:
-                {
-                    n_tasks = n_threads;
+                if (node->src[1]->type == GGML_TYPE_F32) {
+                    cur  = sizeof(float)*node->src[1]->ne[1]*n_tasks; // TODO: this can become (n_tasks-1)
+                    cur += sizeof(float)*node->src[1]->ne[1]*n_tasks; // this is overestimated by x2
+                }
 
-                    const int64_t ne00 = node->src[0]->ne[0]; // W
-                    const int64_t ne01 = node->src[0]->ne[1]; // H
-                    const int64_t ne02 = node->src[0]->ne[2]; // Channels Out
-                    const int64_t ne03 = node->src[0]->ne[3]; // Channels In
+                if (node->src[1]->type == GGML_TYPE_F16) {
+                    cur  = sizeof(float)*node->src[1]->ne[1]*n_tasks; // TODO: this can become (n_tasks-1)
+                    cur += sizeof(float)*node->src[1]->ne[1]*n_tasks; // this is overestimated by x2
+                }
 
-                    const int64_t ne10 = node->src[1]->ne[0]; // W
-                    const int64_t ne11 = node->src[1]->ne[1]; // H
-                    const int64_t ne12 = node->src[1]->ne[2]; // Channels In
+                work_size = MAX(work_size, cur);
+            } break;
+        case GGML_OP_FLASH_ATTN_BACK:
+            {
+                n_tasks = n_threads;
 
-                    size_t cur = 0;
-                    cur += sizeof(ggml_fp16_t)*ne00*ne01*ne02*ne03;
-                    cur += sizeof(ggml_fp16_t)*ne10*ne11*ne12;
+                size_t cur = 0;
 
-                    work_size = MAX(work_size, cur);
-                } break;
-            case GGML_OP_POOL_1D:
-            case GGML_OP_POOL_2D:
-                {
-                    n_tasks = 1;
-                } break;
-            case GGML_OP_UPSCALE:
-                {
+                const int64_t    D = node->src[0]->ne[0];
+                const int64_t ne11 = ggml_up(node->src[1]->ne[1], GGML_SOFT_MAX_UNROLL);
+                const int64_t mxDn = MAX(D, ne11) * 2; // *2 because of S and SM in ggml_compute_forward_flash_attn_back
+                if (node->src[1]->type == GGML_TYPE_F32) {
+                    cur  = sizeof(float)*mxDn*n_tasks; // TODO: this can become (n_tasks-1)
+                    cur += sizeof(float)*mxDn*n_tasks; // this is overestimated by x2
+                }
+
+                if (node->src[1]->type == GGML_TYPE_F16) {
+                    cur  = sizeof(float)*mxDn*n_tasks; // TODO: this can become (n_tasks-1)
+                    cur += sizeof(float)*mxDn*n_tasks; // this is overestimated by x2
+                }
+
+                work_size = MAX(work_size, cur);
+            } break;
+        case GGML_OP_WIN_PART:
+        case GGML_OP_WIN_UNPART:
+        case GGML_OP_GET_REL_POS:
+        case GGML_OP_MAP_UNARY:
+        case GGML_OP_MAP_BINARY:
+        case GGML_OP_MAP_CUSTOM1_F32:
+        case GGML_OP_MAP_CUSTOM2_F32:
+        case GGML_OP_MAP_CUSTOM3_F32:
+            {
+                n_tasks = 1;
+            } break;
+        case GGML_OP_MAP_CUSTOM1:
+            {
+                struct ggml_map_custom1_op_params * p = (struct ggml_map_custom1_op_params *) node->op_params;
+                if (p->n_tasks == GGML_N_TASKS_MAX) {
                     n_tasks = n_threads;
-                } break;
-            case GGML_OP_FLASH_ATTN:
-                {
+                } else {
+                    n_tasks = MIN(p->n_tasks, n_threads);
+                }
+            } break;
+        case GGML_OP_MAP_CUSTOM2:
+            {
+                struct ggml_map_custom2_op_params * p = (struct ggml_map_custom2_op_params *) node->op_params;
+                if (p->n_tasks == GGML_N_TASKS_MAX) {
+                    n_tasks = n_threads;
+                } else {
+                    n_tasks = MIN(p->n_tasks, n_threads);
+                }
+            } break;
+        case GGML_OP_MAP_CUSTOM3:
+            {
+                struct ggml_map_custom3_op_params * p = (struct ggml_map_custom3_op_params *) node->op_params;
+                if (p->n_tasks == GGML_N_TASKS_MAX) {
                     n_tasks = n_threads;
+                } else {
+                    n_tasks = MIN(p->n_tasks, n_threads);
+                }
+            } break;
+        case GGML_OP_CROSS_ENTROPY_LOSS:
+            {
+                n_tasks = n_threads;
 
-                    size_t cur = 0;
+                size_t cur = ggml_type_size(node->type)*(n_tasks + node->src[0]->ne[0]*n_tasks);
 
-                    const int64_t ne11 = ggml_up(node->src[1]->ne[1], GGML_SOFT_MAX_UNROLL);
+                work_size = MAX(work_size, cur);
+            } break;
+        case GGML_OP_CROSS_ENTROPY_LOSS_BACK:
+            {
+                n_tasks = n_threads;
+            } break;
+        case GGML_OP_NONE:
+            {
+                n_tasks = 1;
+            } break;
+        case GGML_OP_COUNT:
+            {
+                GGML_ASSERT(false);
+            } break;
+    }
 
-                    if (node->src[1]->type == GGML_TYPE_F32) {
-                        cur  = sizeof(float)*ne11*n_tasks; // TODO: this can become (n_tasks-1)
-                        cur += sizeof(float)*ne11*n_tasks; // this is overestimated by x2
-                    }
+    *wsize = work_size;
 
-                    if (node->src[1]->type == GGML_TYPE_F16) {
-                        cur  = sizeof(float)*ne11*n_tasks; // TODO: this can become (n_tasks-1)
-                        cur += sizeof(float)*ne11*n_tasks; // this is overestimated by x2
-                    }
+    return n_tasks;
+}
 
-                    work_size = MAX(work_size, cur);
-                } break;
-            case GGML_OP_FLASH_FF:
-                {
-                    n_tasks = n_threads;
+static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
+    size_t wsize;
+    return ggml_get_n_tasks_wsize(node, n_threads, &wsize);
+}
 
-                    size_t cur = 0;
+struct ggml_cplan ggml_graph_plan(struct ggml_cgraph * cgraph, int n_threads) {
+    if (n_threads <= 0) {
+        n_threads = GGML_DEFAULT_N_THREADS;
+    }
 
-                    if (node->src[1]->type == GGML_TYPE_F32) {
-                        cur  = sizeof(float)*node->src[1]->ne[1]*n_tasks; // TODO: this can become (n_tasks-1)
-                        cur += sizeof(float)*node->src[1]->ne[1]*n_tasks; // this is overestimated by x2
-                    }
+    size_t work_size = 0;
 
-                    if (node->src[1]->type == GGML_TYPE_F16) {
-                        cur  = sizeof(float)*node->src[1]->ne[1]*n_tasks; // TODO: this can become (n_tasks-1)
-                        cur += sizeof(float)*node->src[1]->ne[1]*n_tasks; // this is overestimated by x2
-                    }
+    struct ggml_cplan cplan;
+    memset(&cplan, 0, sizeof(struct ggml_cplan));
 
-                    work_size = MAX(work_size, cur);
-                } break;
-            case GGML_OP_FLASH_ATTN_BACK:
-                {
-                    n_tasks = n_threads;
+    // thread scheduling for the different operations + work buffer size estimation
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        size_t cur = 0;
+        ggml_get_n_tasks_wsize(cgraph->nodes[i], n_threads, &cur);
 
-                    size_t cur = 0;
+        work_size = MAX(work_size, cur);
+    }
 
-                    const int64_t    D = node->src[0]->ne[0];
-                    const int64_t ne11 = ggml_up(node->src[1]->ne[1], GGML_SOFT_MAX_UNROLL);
-                    const int64_t mxDn = MAX(D, ne11) * 2; // *2 because of S and SM in ggml_compute_forward_flash_attn_back
-                    if (node->src[1]->type == GGML_TYPE_F32) {
-                        cur  = sizeof(float)*mxDn*n_tasks; // TODO: this can become (n_tasks-1)
-                        cur += sizeof(float)*mxDn*n_tasks; // this is overestimated by x2
-                    }
+    size_t work_slot_size = 0;
 
-                    if (node->src[1]->type == GGML_TYPE_F16) {
-                        cur  = sizeof(float)*mxDn*n_tasks; // TODO: this can become (n_tasks-1)
-                        cur += sizeof(float)*mxDn*n_tasks; // this is overestimated by x2
-                    }
+    if (work_size > 0) {
+        work_size += CACHE_LINE_SIZE*(n_threads - 1);
 
-                    work_size = MAX(work_size, cur);
-                } break;
-            case GGML_OP_WIN_PART:
-            case GGML_OP_WIN_UNPART:
-            case GGML_OP_GET_REL_POS:
-            case GGML_OP_MAP_UNARY:
-            case GGML_OP_MAP_BINARY:
-            case GGML_OP_MAP_CUSTOM1_F32:
-            case GGML_OP_MAP_CUSTOM2_F32:
-            case GGML_OP_MAP_CUSTOM3_F32:
-                {
-                    n_tasks = 1;
-                } break;
-            case GGML_OP_MAP_CUSTOM1:
-                {
-                    struct ggml_map_custom1_op_params * p = (struct ggml_map_custom1_op_params *) node->op_params;
-                    if (p->n_tasks == GGML_N_TASKS_MAX) {
-                        n_tasks = n_threads;
-                    } else {
-                        n_tasks = MIN(p->n_tasks, n_threads);
-                    }
-                } break;
-            case GGML_OP_MAP_CUSTOM2:
-                {
-                    struct ggml_map_custom2_op_params * p = (struct ggml_map_custom2_op_params *) node->op_params;
-                    if (p->n_tasks == GGML_N_TASKS_MAX) {
-                        n_tasks = n_threads;
-                    } else {
-                        n_tasks = MIN(p->n_tasks, n_threads);
-                    }
-                } break;
-            case GGML_OP_MAP_CUSTOM3:
-                {
-                    struct ggml_map_custom3_op_params * p = (struct ggml_map_custom3_op_params *) node->op_params;
-                    if (p->n_tasks == GGML_N_TASKS_MAX) {
-                        n_tasks = n_threads;
-                    } else {
-                        n_tasks = MIN(p->n_tasks, n_threads);
-                    }
-                } break;
-            case GGML_OP_CROSS_ENTROPY_LOSS:
-                {
-                    n_tasks = n_threads;
+        // each of the nodes that are computed concurrently needs its own part of the work buffer
+        // the groups are formed in the same way as in ggml_graph_compute_thread()
+        int nodes[GGML_MAX_CONCURRENT];
+        int thread_start[GGML_MAX_CONCURRENT + 1];
 
-                    size_t cur = ggml_type_size(node->type)*(n_tasks + node->src[0]->ne[0]*n_tasks);
+        int n_slots = 1;
+        for (int i = 0; i < cgraph->n_nodes; i++) {
+            if (ggml_get_n_tasks(cgraph->nodes[i], n_threads) > 1) {
+                const int n = ggml_graph_find_concurrent(cgraph, i, n_threads, GGML_MAX_CONCURRENT, nodes, thread_start);
 
-                    work_size = MAX(work_size, cur);
-                } break;
-            case GGML_OP_CROSS_ENTROPY_LOSS_BACK:
-                {
-                    n_tasks = n_threads;
-                } break;
-            case GGML_OP_NONE:
-                {
-                    n_tasks = 1;
-                } break;
-            case GGML_OP_COUNT:
-                {
-                    GGML_ASSERT(false);
-                } break;
+                n_slots = MAX(n_slots, n);
+                i = nodes[n - 1];
+            }
         }
 
-        cplan.n_tasks[i] = n_tasks;
-    }
-
-    if (work_size > 0) {
-        work_size += CACHE_LINE_SIZE*(n_threads - 1);
+        work_slot_size = GGML_PAD(work_size, CACHE_LINE_SIZE);
+        work_size      = work_slot_size*n_slots;
     }
 
-    cplan.n_threads = n_threads;
-    cplan.work_size = work_size;
+    cplan.n_threads      = n_threads;
+    cplan.work_size      = work_size;
+    cplan.work_slot_size = work_slot_size;
     cplan.work_data = NULL;
 
     return cplan;
@@ -16783,16 +20231,15 @@ int ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
         if (cplan->work_size > 0) {
             GGML_ASSERT(cplan->work_data);
         }
-
-        for (int i = 0; i < cgraph->n_nodes; ++i) {
-            if (cgraph->nodes[i]->op != GGML_OP_NONE) {
-                GGML_ASSERT(cplan->n_tasks[i] > 0);
-            }
-        }
     }
 
     const int n_threads = cplan->n_threads;
 
+    struct ggml_threadpool * threadpool = cplan->threadpool;
+    if (threadpool) {
+        GGML_ASSERT(n_threads <= threadpool->n_threads);
+    }
+
     struct ggml_compute_state_shared state_shared = {
         /*.cgraph                  =*/ cgraph,
         /*.cgraph_plan             =*/ cplan,
@@ -16801,46 +20248,75 @@ int ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
         /*.n_threads               =*/ n_threads,
         /*.n_active                =*/ n_threads,
         /*.node_n                  =*/ -1,
+        /*.n_barrier               =*/ 0,
+        /*.n_barrier_passed        =*/ 0,
+        /*.n_concurrent            =*/ 1,
+        /*.concurrent_nodes        =*/ { 0 },
+        /*.concurrent_n_tasks      =*/ { 0 },
+        /*.thread_start            =*/ { 0 },
+        /*.current_chunk           =*/ { 0 },
+        /*.numa_chunk              =*/ { { 0 } },
         /*.abort_callback          =*/ NULL,
         /*.abort_callback_data     =*/ NULL,
+        /*.trace_threads           =*/ NULL,
     };
-    struct ggml_compute_state * workers = alloca(sizeof(struct ggml_compute_state)*n_threads);
+    struct ggml_compute_state * workers = NULL;
+
+    if (cplan->trace) {
+        state_shared.trace_threads = ggml_trace_threads_new(n_threads, cgraph->n_nodes);
+    }
+    const int64_t trace_start = ggml_trace_begin(&state_shared);
 
     // create thread pool
-    if (n_threads > 1) {
+    if (threadpool == NULL) {
+        workers = alloca(sizeof(struct ggml_compute_state)*n_threads);
+
         for (int j = 1; j < n_threads; ++j) {
             workers[j] = (struct ggml_compute_state) {
-                .thrd   = 0,
-                .ith = j,
-                .shared = &state_shared,
+                .thrd       = 0,
+                .ith        = j,
+                .shared     = &state_shared,
+                .threadpool = NULL,
             };
 
             const int rc = ggml_thread_create(&workers[j].thrd, NULL, ggml_graph_compute_thread, &workers[j]);
             GGML_ASSERT(rc == 0);
             UNUSED(rc);
         }
-    }
 
-    workers[0].ith = 0;
-    workers[0].shared = &state_shared;
+        workers[0].ith        = 0;
+        workers[0].shared     = &state_shared;
+        workers[0].threadpool = NULL;
+    }
 
     const int64_t perf_start_cycles  = ggml_perf_cycles();
     const int64_t perf_start_time_us = ggml_perf_time_us();
 
-    // this is a work thread too
-    int compute_status = (size_t) ggml_graph_compute_thread(&workers[0]);
+    int compute_status;
+
+    if (threadpool) {
+        compute_status = ggml_threadpool_compute(threadpool, &state_shared);
+    } else {
+        // this is a work thread too
+        compute_status = (size_t) ggml_graph_compute_thread(&workers[0]);
+    }
 
     // don't leave affinity set on the main thread
     clear_numa_thread_affinity();
 
     // join or kill thread pool
-    if (n_threads > 1) {
+    if (threadpool == NULL) {
         for (int j = 1; j < n_threads; j++) {
             const int rc = ggml_thread_join(workers[j].thrd, NULL);
             GGML_ASSERT(rc == 0);
         }
     }
 
+    if (cplan->trace) {
+        ggml_trace_add_graph(cplan->trace, cgraph, state_shared.trace_threads, n_threads, trace_start);
+        ggml_trace_threads_free(state_shared.trace_threads, n_threads);
+    }
+
     // performance stats (graph)
     {
         int64_t perf_cycles_cur  = ggml_perf_cycles()  - perf_start_cycles;
@@ -16862,6 +20338,8 @@ int ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
 }
 
 void ggml_graph_reset(struct ggml_cgraph * cgraph) {
+    GGML_ASSERT(cgraph->grads != NULL);
+
     for (int i = 0; i < cgraph->n_nodes; i++) {
         struct ggml_tensor * grad = cgraph->grads[i];
 
@@ -16930,7 +20408,12 @@ static void ggml_graph_export_node(const struct ggml_tensor * tensor, const char
             tensor->name);
 }
 
+// in the exported graphs, the arguments that are nodes are stored as GGML_GRAPH_EXPORT_NODES + the index of the node
+#define GGML_GRAPH_EXPORT_NODES 16384
+
 void ggml_graph_export(const struct ggml_cgraph * cgraph, const char * fname) {
+    GGML_ASSERT(cgraph->n_leafs <= GGML_GRAPH_EXPORT_NODES);
+
     uint64_t size_eval = 0;
 
     // compute size of intermediate results
@@ -17090,7 +20573,7 @@ void ggml_graph_export(const struct ggml_cgraph * cgraph, const char * fname) {
                             if (idx == -1) {
                                 for (int k = 0; k < cgraph->n_nodes; ++k) {
                                     if (args[j] == cgraph->nodes[k]) {
-                                        idx = GGML_MAX_NODES + k;
+                                        idx = GGML_GRAPH_EXPORT_NODES + k;
                                         break;
                                     }
                                 }
@@ -17117,11 +20600,11 @@ void ggml_graph_export(const struct ggml_cgraph * cgraph, const char * fname) {
     }
 }
 
-struct ggml_cgraph ggml_graph_import(const char * fname, struct ggml_context ** ctx_data, struct ggml_context ** ctx_eval) {
+struct ggml_cgraph * ggml_graph_import(const char * fname, struct ggml_context ** ctx_data, struct ggml_context ** ctx_eval) {
     assert(*ctx_data == NULL);
     assert(*ctx_eval == NULL);
 
-    struct ggml_cgraph result = { 0 };
+    struct ggml_cgraph * result = NULL;
 
     struct ggml_tensor * data = NULL;
 
@@ -17194,12 +20677,11 @@ struct ggml_cgraph ggml_graph_import(const char * fname, struct ggml_context **
         const uint32_t n_nodes   = *(const uint32_t *) ptr; ptr += sizeof(n_nodes);
         const uint64_t size_eval = *(const uint64_t *) ptr; ptr += sizeof(size_eval);
 
-        result.n_leafs = n_leafs;
-        result.n_nodes = n_nodes;
+        const int graph_size = MAX(n_leafs, n_nodes);
 
         // create the data context
         {
-            const size_t overhead = (n_leafs + n_nodes)*ggml_tensor_overhead();
+            const size_t overhead = (n_leafs + n_nodes)*ggml_tensor_overhead() + ggml_graph_overhead_custom(graph_size, false);
 
             struct ggml_init_params params = {
                 .mem_size   = size_eval + overhead,
@@ -17215,6 +20697,11 @@ struct ggml_cgraph ggml_graph_import(const char * fname, struct ggml_context **
             }
         }
 
+        result = ggml_new_graph_custom(*ctx_eval, graph_size, false);
+
+        result->n_leafs = n_leafs;
+        result->n_nodes = n_nodes;
+
         // leafs
         {
             uint32_t type;
@@ -17253,7 +20740,7 @@ struct ggml_cgraph ggml_graph_import(const char * fname, struct ggml_context **
                     tensor->nb[j] = nb[j];
                 }
 
-                result.leafs[i] = tensor;
+                result->leafs[i] = tensor;
 
                 ptr += ggml_nbytes(tensor);
 
@@ -17305,10 +20792,10 @@ struct ggml_cgraph ggml_graph_import(const char * fname, struct ggml_context **
                         continue;
                     }
 
-                    if (arg_idx < GGML_MAX_NODES) {
-                        args[j] = result.leafs[arg_idx];
+                    if (arg_idx < GGML_GRAPH_EXPORT_NODES) {
+                        args[j] = result->leafs[arg_idx];
                     } else {
-                        args[j] = result.nodes[arg_idx - GGML_MAX_NODES];
+                        args[j] = result->nodes[arg_idx - GGML_GRAPH_EXPORT_NODES];
                     }
                 }
 
@@ -17360,7 +20847,7 @@ struct ggml_cgraph ggml_graph_import(const char * fname, struct ggml_context **
                     tensor->src[j] = args[j];
                 }
 
-                result.nodes[i] = tensor;
+                result->nodes[i] = tensor;
 
                 fprintf(stderr, "%s: loaded node %d: '%16s', %3d dims, %9zu bytes\n", __func__, i, tensor->name, n_dims, ggml_nbytes(tensor));
             }
@@ -18265,10 +21752,11 @@ struct ggml_opt_params ggml_opt_default_params(enum ggml_opt_type type) {
         case GGML_OPT_ADAM:
             {
                 result = (struct ggml_opt_params) {
-                    .type      = GGML_OPT_ADAM,
-                    .n_threads = 1,
-                    .past      = 0,
-                    .delta     = 1e-5f,
+                    .type       = GGML_OPT_ADAM,
+                    .graph_size = GGML_DEFAULT_GRAPH_SIZE,
+                    .n_threads  = 1,
+                    .past       = 0,
+                    .delta      = 1e-5f,
 
                     .max_no_improvement = 100,
 
@@ -18295,10 +21783,11 @@ struct ggml_opt_params ggml_opt_default_params(enum ggml_opt_type type) {
         case GGML_OPT_LBFGS:
             {
                 result = (struct ggml_opt_params) {
-                    .type      = GGML_OPT_LBFGS,
-                    .n_threads = 1,
-                    .past      = 0,
-                    .delta     = 1e-5f,
+                    .type       = GGML_OPT_LBFGS,
+                    .graph_size = GGML_DEFAULT_GRAPH_SIZE,
+                    .n_threads  = 1,
+                    .past       = 0,
+                    .delta      = 1e-5f,
 
                     .max_no_improvement = 0,
 
@@ -18440,14 +21929,11 @@ enum ggml_opt_result ggml_opt_resume(
         struct ggml_tensor * f) {
 
     // build forward + backward compute graphs
-    struct ggml_tensor * gfbuf = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, sizeof(struct ggml_cgraph) / ggml_type_size(GGML_TYPE_I32)+ (sizeof(struct ggml_cgraph) % ggml_type_size(GGML_TYPE_I32) ? 1 : 0));
-    struct ggml_tensor * gbbuf = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, sizeof(struct ggml_cgraph) / ggml_type_size(GGML_TYPE_I32)+ (sizeof(struct ggml_cgraph) % ggml_type_size(GGML_TYPE_I32) ? 1 : 0));
+    struct ggml_cgraph * gf = ggml_new_graph_custom(ctx, opt->params.graph_size, true);
+    ggml_build_forward_expand(gf, f);
 
-    struct ggml_cgraph * gf = (struct ggml_cgraph *) gfbuf->data;
-    struct ggml_cgraph * gb = (struct ggml_cgraph *) gbbuf->data;
-
-    *gf = ggml_build_forward (f);
-    *gb = ggml_build_backward(ctx, gf, true);
+    struct ggml_cgraph * gb = ggml_graph_dup(ctx, gf);
+    ggml_build_backward_expand(ctx, gf, gb, true);
 
     return ggml_opt_resume_g(ctx, opt, f, gf, gb, NULL, NULL);
 }
@@ -18686,6 +22172,12 @@ size_t ggml_quantize_chunk(enum ggml_type type, const float * src, void * dst, i
                 ggml_fp32_to_fp16_row(src + start, (ggml_fp16_t *)dst + start, n);
                 result = n * elemsize;
             } break;
+        case GGML_TYPE_BF16:
+            {
+                int elemsize = sizeof(ggml_bf16_t);
+                ggml_fp32_to_bf16_row(src + start, (ggml_bf16_t *)dst + start, n);
+                result = n * elemsize;
+            } break;
         case GGML_TYPE_F32:
             {
                 int elemsize = sizeof(float);
@@ -18698,6 +22190,41 @@ size_t ggml_quantize_chunk(enum ggml_type type, const float * src, void * dst, i
     return result;
 }
 
+enum ggml_type ggml_repack_type(enum ggml_type type) {
+    switch (type) {
+        case GGML_TYPE_Q4_0: return GGML_TYPE_Q4_0_X4;
+        case GGML_TYPE_Q8_0: return GGML_TYPE_Q8_0_X4;
+        case GGML_TYPE_Q4_K: return GGML_TYPE_Q4_K_X4;
+        default:             return GGML_TYPE_COUNT;
+    }
+}
+
+void ggml_repack(enum ggml_type type, const void * src, void * dst, int64_t n_per_row, int64_t nrows) {
+    GGML_ASSERT(ggml_repack_type(type) != GGML_TYPE_COUNT);
+    GGML_ASSERT(n_per_row % ggml_blck_size(type) == 0);
+    GGML_ASSERT(nrows % QK_TILE_NR == 0);
+
+    const size_t  bs = ggml_type_size(type);
+    const int64_t nb = n_per_row/ggml_blck_size(type);
+
+    const size_t row_size = nb*bs;
+
+    GGML_ASSERT((const char *) src + nrows*row_size <= (char *) dst || (char *) dst + nrows*row_size <= (const char *) src);
+
+    // the groups keep their place, only the blocks of their rows are reordered
+    for (int64_t ig = 0; ig < nrows; ig += QK_TILE_NR) {
+        const char * g = (const char *) src + ig*row_size;
+              char * d = (char *)       dst + ig*row_size;
+
+        for (int64_t i = 0; i < nb; ++i) {
+            for (int r = 0; r < QK_TILE_NR; ++r) {
+                memcpy(d, g + r*row_size + i*bs, bs);
+                d += bs;
+            }
+        }
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 struct gguf_str {
@@ -19034,6 +22561,15 @@ struct gguf_context * gguf_init_from_file(const char * fname, struct gguf_init_p
                 (int64_t) info->ne[2] *
                 (int64_t) info->ne[3];
 
+            // some ids are unused (e.g. between the repacked types and BF16), they have no type traits
+            if ((int) info->type < 0 || info->type >= GGML_TYPE_COUNT || ggml_blck_size(info->type) == 0) {
+                fprintf(stderr, "%s: tensor '%s' has unknown type %d\n",
+                        __func__, info->name.data, (int) info->type);
+                fclose(file);
+                gguf_free(ctx);
+                return NULL;
+            }
+
             if (ne % ggml_blck_size(info->type) != 0) {
                 fprintf(stderr, "%s: tensor '%s' number of elements (%" PRId64 ") is not a multiple of block size (%d)\n",
                         __func__, info->name.data, ne, ggml_blck_size(info->type));
@@ -19782,7 +23318,7 @@ int ggml_cpu_has_avx(void) {
 #if defined(__AVX__)
     return 1;
 #else
-    return 0;
+    return ggml_cpu_kernels_have(GGML_CPU_FEATURE_AVX);
 #endif
 }
 
@@ -19790,7 +23326,7 @@ int ggml_cpu_has_avx2(void) {
 #if defined(__AVX2__)
     return 1;
 #else
-    return 0;
+    return ggml_cpu_kernels_have(GGML_CPU_FEATURE_AVX2);
 #endif
 }
 
@@ -19798,7 +23334,7 @@ int ggml_cpu_has_avx512(void) {
 #if defined(__AVX512F__)
     return 1;
 #else
-    return 0;
+    return ggml_cpu_kernels_have(GGML_CPU_FEATURE_AVX512);
 #endif
 }
 
@@ -19814,7 +23350,15 @@ int ggml_cpu_has_avx512_vnni(void) {
 #if defined(__AVX512VNNI__)
     return 1;
 #else
-    return 0;
+    return ggml_cpu_kernels_have(GGML_CPU_FEATURE_AVX512_VNNI);
+#endif
+}
+
+int ggml_cpu_has_avx512_bf16(void) {
+#if defined(__AVX512BF16__)
+    return 1;
+#else
+    return ggml_cpu_kernels_have(GGML_CPU_FEATURE_AVX512_BF16);
 #endif
 }
 
@@ -19822,7 +23366,7 @@ int ggml_cpu_has_fma(void) {
 #if defined(__FMA__)
     return 1;
 #else
-    return 0;
+    return ggml_cpu_kernels_have(GGML_CPU_FEATURE_FMA);
 #endif
 }
 
@@ -19854,7 +23398,7 @@ int ggml_cpu_has_f16c(void) {
 #if defined(__F16C__)
     return 1;
 #else
-    return 0;
+    return ggml_cpu_kernels_have(GGML_CPU_FEATURE_F16C);
 #endif
 }
 
@@ -58,14 +58,15 @@
 //   {
 //       ...
 //
-//       struct ggml_cgraph gf = ggml_build_forward(f);
+//       struct ggml_cgraph * gf = ggml_new_graph(ctx);
+//       ggml_build_forward_expand(gf, f);
 //
 //       // set the input variable and parameter values
 //       ggml_set_f32(x, 2.0f);
 //       ggml_set_f32(a, 3.0f);
 //       ggml_set_f32(b, 4.0f);
 //
-//       ggml_graph_compute_with_ctx(ctx, &gf, n_threads);
+//       ggml_graph_compute_with_ctx(ctx, gf, n_threads);
 //
 //       printf("f = %f\n", ggml_get_f32_1d(f, 0));
 //
@@ -214,13 +215,14 @@
 #define GGML_QNT_VERSION_FACTOR 1000 // do not change this
 
 #define GGML_MAX_DIMS          4
-#define GGML_MAX_NODES         16384
 #define GGML_MAX_PARAMS        1024
 #define GGML_MAX_CONTEXTS      64
 #define GGML_MAX_SRC           6
 #define GGML_MAX_NAME          64
 #define GGML_MAX_OP_PARAMS     64
 #define GGML_DEFAULT_N_THREADS 4
+#define GGML_DEFAULT_N_SPIN    100000
+#define GGML_DEFAULT_GRAPH_SIZE 2048
 
 #if UINTPTR_MAX == 0xFFFFFFFF
     #define GGML_MEM_ALIGN 4
@@ -300,6 +302,16 @@ extern "C" {
     GGML_API void ggml_fp16_to_fp32_row(const ggml_fp16_t * x, float * y, int n);
     GGML_API void ggml_fp32_to_fp16_row(const float * x, ggml_fp16_t * y, int n);
 
+    // bfloat16: the upper 16 bits of an FP32, same range with an 8-bit mantissa
+    typedef struct { uint16_t bits; } ggml_bf16_t;
+
+    // convert BF16 <-> FP32, rounding to nearest even
+    GGML_API float       ggml_bf16_to_fp32(ggml_bf16_t x);
+    GGML_API ggml_bf16_t ggml_fp32_to_bf16(float x);
+
+    GGML_API void ggml_bf16_to_fp32_row(const ggml_bf16_t * x, float * y, int n);
+    GGML_API void ggml_fp32_to_bf16_row(const float * x, ggml_bf16_t * y, int n);
+
     struct ggml_object;
     struct ggml_context;
 
@@ -324,6 +336,13 @@ extern "C" {
         GGML_TYPE_I8,
         GGML_TYPE_I16,
         GGML_TYPE_I32,
+        // the rows of a weight interleaved in groups of 4 for the CPU mul_mat, see ggml_repack
+        // these are only created at load time and are never stored in a file
+        GGML_TYPE_Q4_0_X4,
+        GGML_TYPE_Q8_0_X4,
+        GGML_TYPE_Q4_K_X4,
+        // 22-29 are unused, BF16 has the same id as in the GGUF files of other writers
+        GGML_TYPE_BF16 = 30,
         GGML_TYPE_COUNT,
     };
 
@@ -349,6 +368,14 @@ extern "C" {
         GGML_FTYPE_MOSTLY_Q4_K = 12, // except 1d tensors
         GGML_FTYPE_MOSTLY_Q5_K = 13, // except 1d tensors
         GGML_FTYPE_MOSTLY_Q6_K = 14, // except 1d tensors
+        GGML_FTYPE_MOSTLY_BF16 = 24, // except 1d tensors
+    };
+
+    // placement of the weights on the NUMA nodes, see ggml_numa_place()
+    enum ggml_numa_placement {
+        GGML_NUMA_PLACEMENT_NONE       = 0, // the pages are on the node that touched them first
+        GGML_NUMA_PLACEMENT_INTERLEAVE = 1, // the rows of each matrix are split across the nodes, the threads of a node multiply its rows
+        GGML_NUMA_PLACEMENT_REPLICATE  = 2, // each node has a copy of the data, the threads of a node read its copy
     };
 
     // available tensor operations:
@@ -377,6 +404,9 @@ extern "C" {
         GGML_OP_RMS_NORM,
         GGML_OP_RMS_NORM_BACK,
         GGML_OP_GROUP_NORM,
+        GGML_OP_RMS_NORM_MUL,
+        GGML_OP_ADD_RMS_NORM,
+        GGML_OP_SWIGLU,
 
         GGML_OP_MUL_MAT,
         GGML_OP_OUT_PROD,
@@ -391,6 +421,7 @@ extern "C" {
         GGML_OP_TRANSPOSE,
         GGML_OP_GET_ROWS,
         GGML_OP_GET_ROWS_BACK,
+        GGML_OP_SET_ROWS,
         GGML_OP_DIAG,
         GGML_OP_DIAG_MASK_INF,
         GGML_OP_DIAG_MASK_ZERO,
@@ -414,6 +445,7 @@ extern "C" {
         GGML_OP_UPSCALE, // nearest interpolate
 
         GGML_OP_FLASH_ATTN,
+        GGML_OP_FLASH_ATTN_EXT,
         GGML_OP_FLASH_FF,
         GGML_OP_FLASH_ATTN_BACK,
         GGML_OP_WIN_PART,
@@ -523,28 +555,33 @@ extern "C" {
 
     static const size_t GGML_TENSOR_SIZE = sizeof(struct ggml_tensor);
 
+    // persistent pool of compute threads, see ggml_threadpool_new()
+    struct ggml_threadpool;
+
+    // per-node timings recorded by ggml_graph_compute(), see ggml_trace_new()
+    struct ggml_trace;
+
     // the compute plan that needs to be prepared for ggml_graph_compute()
     // since https://github.com/ggerganov/ggml/issues/287
     struct ggml_cplan {
         size_t    work_size; // size of work buffer, calculated by `ggml_graph_plan()`
         uint8_t * work_data; // work buffer, to be allocated by caller before calling to `ggml_graph_compute()`
 
-        int n_threads;
+        size_t work_slot_size; // part of the work buffer used by each of the nodes that are computed concurrently
 
-        // the `n_tasks` of nodes, 1:1 mapping to cgraph nodes
-        int n_tasks[GGML_MAX_NODES];
+        int n_threads;
 
         // abort ggml_graph_compute when true
         bool (*abort_callback)(void * data);
         void * abort_callback_data;
-    };
 
-    // next prime after GGML_MAX_NODES
-    // #define GGML_GRAPH_HASHTABLE_SIZE 4099
-    // next prime after GGML_MAX_NODES * 2 (nodes + leafs)
-    // #define GGML_GRAPH_HASHTABLE_SIZE 8273
-    // #define GGML_GRAPH_HASHTABLE_SIZE 16411
-    #define GGML_GRAPH_HASHTABLE_SIZE 32771
+        // optional: run the graph on the threads of this pool instead of spawning new ones
+        // the pool must have at least n_threads threads
+        struct ggml_threadpool * threadpool;
+
+        // optional: record the time spent by each thread on each node of the graph
+        struct ggml_trace * trace;
+    };
 
     enum ggml_cgraph_eval_order {
         GGML_CGRAPH_EVAL_ORDER_LEFT_TO_RIGHT = 0,
@@ -552,16 +589,24 @@ extern "C" {
         GGML_CGRAPH_EVAL_ORDER_COUNT
     };
 
+    // open addressing hash set of tensor pointers, used to find the tensors that are already in a graph
+    struct ggml_hash_set {
+        size_t size;
+        struct ggml_tensor ** keys;
+    };
+
     // computation graph
+    // the arrays are allocated together with the graph in a context, with room for size nodes and size leafs
     struct ggml_cgraph {
+        int size;
         int n_nodes;
         int n_leafs;
 
-        struct ggml_tensor * nodes[GGML_MAX_NODES];
-        struct ggml_tensor * grads[GGML_MAX_NODES];
-        struct ggml_tensor * leafs[GGML_MAX_NODES];
+        struct ggml_tensor ** nodes;
+        struct ggml_tensor ** grads; // NULL when the graph has no gradients
+        struct ggml_tensor ** leafs;
 
-        void * visited_hash_table[GGML_GRAPH_HASHTABLE_SIZE];
+        struct ggml_hash_set visited_hash_table;
 
         enum ggml_cgraph_eval_order order;
 
@@ -571,8 +616,6 @@ extern "C" {
         int64_t perf_time_us;
     };
 
-    static const size_t GGML_GRAPH_SIZE = sizeof(struct ggml_cgraph);
-
     // scratch buffer
     struct ggml_scratch {
         size_t offs;
@@ -598,6 +641,8 @@ extern "C" {
         GGML_TASK_FINALIZE,
     };
 
+    struct ggml_compute_state_shared;
+
     struct ggml_compute_params {
         enum ggml_task_type type;
 
@@ -607,6 +652,12 @@ extern "C" {
         // work buffer for all threads
         size_t wsize;
         void * wdata;
+
+        // state shared by the threads computing the graph, used for dynamic distribution of the work of a node
+        struct ggml_compute_state_shared * shared;
+
+        // index of the node among the nodes that are computed concurrently
+        int node_i;
     };
 
     // misc
@@ -614,11 +665,18 @@ extern "C" {
     GGML_API void    ggml_time_init(void); // call this once at the beginning of the program
     GGML_API int64_t ggml_time_ms(void);
     GGML_API int64_t ggml_time_us(void);
+    GGML_API int64_t ggml_time_ns(void);
     GGML_API int64_t ggml_cycles(void);
     GGML_API int64_t ggml_cycles_per_ms(void);
 
     GGML_API void    ggml_numa_init(void); // call once for better performance on NUMA systems
     GGML_API bool    ggml_is_numa(void); // true if init detected that system has >1 NUMA node
+    GGML_API int     ggml_numa_n_nodes(void);
+
+    // place the data of the tensors of a context on the NUMA nodes (Linux only, after ggml_numa_init)
+    // the data must be in the memory buffer of the context, outside of a file mapping, and not be modified afterwards
+    // returns false if the system has a single node, the placement is released by ggml_free
+    GGML_API bool    ggml_numa_place(struct ggml_context * ctx, enum ggml_numa_placement placement);
 
     GGML_API void    ggml_print_object (const struct ggml_object * obj);
     GGML_API void    ggml_print_objects(const struct ggml_context * ctx);
@@ -1021,6 +1079,32 @@ extern "C" {
             struct ggml_tensor  * b,
             float                 eps);
 
+    // fused element-wise ops, computed in a single pass over the rows
+    // the results are the same as those of the separate ops
+    // see ggml_graph_fuse()
+
+    // ggml_mul(ggml_rms_norm(a, eps), b)
+    GGML_API struct ggml_tensor * ggml_rms_norm_mul(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * b,
+            float                 eps);
+
+    // s = ggml_add(a, b) and ggml_mul(ggml_rms_norm(s, eps), c)
+    // a and b are at most 3D, the result has ne[3] == 2: [:, :, :, 0] is s and [:, :, :, 1] is the normalized s
+    GGML_API struct ggml_tensor * ggml_add_rms_norm(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * b,
+            struct ggml_tensor  * c,
+            float                 eps);
+
+    // ggml_mul(ggml_silu(a), b)
+    GGML_API struct ggml_tensor * ggml_swiglu(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * b);
+
     // A: k columns, n rows => [ne03, ne02, n, k]
     // B: k columns, m rows  (i.e. we transpose it internally) => [ne03 * x, ne02 * y, m, k]
     // result is n columns, m rows => [ne03 * x, ne02 * y, m, n]
@@ -1247,6 +1331,15 @@ extern "C" {
             struct ggml_tensor  * b,
             struct ggml_tensor  * c);
 
+    // a[c[i]] = b[i] for the rows of b, converted from F32 to the type of a (F32, F16 or BF16)
+    // the rows of a can be strided, e.g. a transposed view
+    // returns a view of a
+    GGML_API struct ggml_tensor * ggml_set_rows(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * b,
+            struct ggml_tensor  * c);
+
     GGML_API struct ggml_tensor * ggml_diag(
         struct ggml_context     * ctx,
         struct ggml_tensor      * a);
@@ -1284,6 +1377,14 @@ extern "C" {
             struct ggml_context * ctx,
             struct ggml_tensor  * a);
 
+    // fused soft_max(a*scale + mask)
+    // mask is optional, it has the shape of the first rows of a and is broadcast to the other dimensions
+    GGML_API struct ggml_tensor * ggml_soft_max_ext(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * mask,
+            float                 scale);
+
     GGML_API struct ggml_tensor * ggml_soft_max_back(
             struct ggml_context * ctx,
             struct ggml_tensor  * a,
@@ -1350,6 +1451,41 @@ extern "C" {
             float                 beta_fast,
             float                 beta_slow);
 
+    // the sin, cos of the rotations of ggml_rope_custom for rows of ne0 elements at the positions [0, n_pos)
+    // computed on the CPU when it is called, ctx must allocate the data
+    GGML_API struct ggml_tensor * ggml_rope_cache(
+            struct ggml_context * ctx,
+            int64_t               ne0,
+            int                   n_pos,
+            int                   n_dims,
+            int                   mode,
+            int                   n_ctx,
+            int                   n_orig_ctx,
+            float                 freq_base,
+            float                 freq_scale,
+            float                 ext_factor,
+            float                 attn_factor,
+            float                 beta_fast,
+            float                 beta_slow);
+
+    // ggml_rope_custom reading the rotations from c, a result of ggml_rope_cache with the same parameters
+    // the positions outside of c are computed as usual
+    GGML_API struct ggml_tensor * ggml_rope_custom_cached(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * b,
+            struct ggml_tensor  * c,
+            int                   n_dims,
+            int                   mode,
+            int                   n_ctx,
+            int                   n_orig_ctx,
+            float                 freq_base,
+            float                 freq_scale,
+            float                 ext_factor,
+            float                 attn_factor,
+            float                 beta_fast,
+            float                 beta_slow);
+
     // compute correction dims for YaRN RoPE scaling
     void ggml_rope_yarn_corr_dims(
         int n_dims, int n_orig_ctx, float freq_base, float beta_fast, float beta_slow, float dims[2]);
@@ -1502,6 +1638,22 @@ extern "C" {
             struct ggml_tensor  * v,
             bool                  masked);
 
+    // fused attention: softmax(scale*k*q + alibi + mask) * v, with the heads of the result merged
+    // q:    [n_embd_head, n_tokens, n_head]
+    // k:    [n_embd_head, n_kv, n_head_kv]
+    // v:    [n_kv, n_embd_head, n_head_kv] (transposed, as stored in the KV cache)
+    // mask: [n_kv, n_tokens] or NULL
+    // res:  [n_embd_head, n_head, n_tokens]
+    // n_head must be a multiple of n_head_kv, ALiBi is applied when max_bias > 0.0f
+    GGML_API struct ggml_tensor * ggml_flash_attn_ext(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * q,
+            struct ggml_tensor  * k,
+            struct ggml_tensor  * v,
+            struct ggml_tensor  * mask,
+            float                 scale,
+            float                 max_bias);
+
     GGML_API struct ggml_tensor * ggml_flash_attn_back(
            struct ggml_context * ctx,
            struct ggml_tensor  * q,
@@ -1727,13 +1879,33 @@ extern "C" {
     GGML_API void ggml_build_forward_expand (struct ggml_cgraph * cgraph, struct ggml_tensor * tensor);
     GGML_API void ggml_build_backward_expand(struct ggml_context * ctx, struct ggml_cgraph * gf, struct ggml_cgraph * gb, bool keep);
 
-    GGML_API struct ggml_cgraph ggml_build_forward (struct ggml_tensor * tensor);
-    GGML_API struct ggml_cgraph ggml_build_backward(struct ggml_context * ctx, struct ggml_cgraph * gf, bool keep);
-
     // graph allocation in a context
-    GGML_API struct ggml_cgraph * ggml_new_graph        (struct ggml_context * ctx);
-    GGML_API struct ggml_cgraph * ggml_build_forward_ctx(struct ggml_context * ctx, struct ggml_tensor * tensor);
+    // the graph has room for size nodes and size leafs, and for their gradients when grads is true
+    // ggml_new_graph() creates a graph of GGML_DEFAULT_GRAPH_SIZE without gradients
+    GGML_API struct ggml_cgraph * ggml_new_graph         (struct ggml_context * ctx);
+    GGML_API struct ggml_cgraph * ggml_new_graph_custom  (struct ggml_context * ctx, size_t size, bool grads);
+    GGML_API struct ggml_cgraph * ggml_graph_dup         (struct ggml_context * ctx, struct ggml_cgraph * cgraph);
+    GGML_API struct ggml_cgraph   ggml_graph_view        (struct ggml_cgraph * cgraph, int i0, int i1); // nodes [i0, i1), no leafs or hash set
+    GGML_API void                 ggml_graph_cpy         (struct ggml_cgraph * src, struct ggml_cgraph * dst);
+    GGML_API void                 ggml_graph_clear       (struct ggml_cgraph * cgraph); // removes all the nodes and leafs
+    GGML_API struct ggml_cgraph * ggml_build_forward_ctx (struct ggml_context * ctx, struct ggml_tensor * tensor);
     GGML_API size_t ggml_graph_overhead(void);
+    GGML_API size_t ggml_graph_overhead_custom(size_t size, bool grads);
+
+    // move independent nodes of the same op next to each other, so that ggml_graph_compute() can compute them
+    // concurrently on separate subsets of the threads (e.g. the Q, K and V projections of an attention layer)
+    // should be called before the graph is allocated, since the order of the nodes determines the memory reuse
+    GGML_API void ggml_graph_reorder_concurrent(struct ggml_cgraph * cgraph);
+
+    // replace the sequences of element-wise ops that have a fused op (e.g. ggml_rms_norm followed by ggml_mul) by the fused op
+    // only nodes computed on the CPU are fused, and the intermediate results that are removed must not be used outside of the graph
+    // new tensors are created in ctx, so this has to be called before the graph is allocated
+    GGML_API void ggml_graph_fuse(struct ggml_context * ctx, struct ggml_cgraph * cgraph);
+
+    // convert the src1 that is shared by several ggml_mul_mat nodes (e.g. the input of the Q, K and V projections) to their
+    // vec_dot_type once, in a new node, instead of in the INIT pass of each of them
+    // new tensors are created in ctx, so this has to be called before the graph is allocated
+    GGML_API void ggml_graph_share_src1(struct ggml_context * ctx, struct ggml_cgraph * cgraph);
 
     // ggml_graph_plan() has to be called before ggml_graph_compute()
     // when plan.work_size > 0, caller must allocate memory for plan.work_data
@@ -1741,14 +1913,34 @@ extern "C" {
     GGML_API               int ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cplan * cplan);
     GGML_API              void ggml_graph_reset  (struct ggml_cgraph * cgraph);
 
+    // persistent thread pool that can be reused by multiple ggml_graph_compute() calls via cplan.threadpool
+    // the calling thread acts as thread 0, so n_threads - 1 worker threads are created
+    // between graphs, idle workers busy-wait for n_spin iterations before going to sleep
+    GGML_API struct ggml_threadpool * ggml_threadpool_new          (int n_threads, int n_spin /*= GGML_DEFAULT_N_SPIN*/);
+    GGML_API                    void  ggml_threadpool_free         (struct ggml_threadpool * threadpool);
+    GGML_API                     int  ggml_threadpool_get_n_threads(const struct ggml_threadpool * threadpool);
+
+    // runtime profiling of ggml_graph_compute(), enabled by setting cplan.trace
+    // for each node, records its op, name, shape and type, and the intervals in which each thread computed it or waited for
+    // the other threads to finish it
+    // the graphs computed with the same trace must not run at the same time
+    GGML_API struct ggml_trace * ggml_trace_new       (void);
+    GGML_API              void   ggml_trace_free      (struct ggml_trace * trace);
+    GGML_API              void   ggml_trace_reset     (struct ggml_trace * trace);
+    GGML_API               int   ggml_trace_n_graphs  (const struct ggml_trace * trace);
+
+    // write the recorded intervals as Chrome trace events (viewable in chrome://tracing or https://ui.perfetto.dev)
+    // returns false if the file cannot be written
+    GGML_API              bool   ggml_trace_write_json(const struct ggml_trace * trace, const char * fname);
+
     // same as ggml_graph_compute() but the work data is allocated as a part of the context
     // note: the drawback of this API is that you must have ensured that the context has enough memory for the work data
     GGML_API void ggml_graph_compute_with_ctx(struct ggml_context * ctx, struct ggml_cgraph * cgraph, int n_threads);
 
     GGML_API struct ggml_tensor * ggml_graph_get_tensor(struct ggml_cgraph * cgraph, const char * name);
 
-    GGML_API void               ggml_graph_export(const struct ggml_cgraph * cgraph, const char * fname);
-    GGML_API struct ggml_cgraph ggml_graph_import(const char * fname, struct ggml_context ** ctx_data, struct ggml_context ** ctx_eval);
+    GGML_API void                 ggml_graph_export(const struct ggml_cgraph * cgraph, const char * fname);
+    GGML_API struct ggml_cgraph * ggml_graph_import(const char * fname, struct ggml_context ** ctx_data, struct ggml_context ** ctx_eval);
 
     // print info and performance information for the graph
     GGML_API void ggml_graph_print(const struct ggml_cgraph * cgraph);
@@ -1811,6 +2003,8 @@ extern "C" {
     struct ggml_opt_params {
         enum ggml_opt_type type;
 
+        size_t graph_size; // capacity of the forward and backward graphs built by ggml_opt()
+
         int n_threads;
 
         // delta-based convergence test
@@ -1959,6 +2153,15 @@ extern "C" {
 
     GGML_API size_t ggml_quantize_chunk(enum ggml_type type, const float * src, void * dst, int start, int n, int64_t * hist);
 
+    // the type with the rows of type interleaved in groups of 4, or GGML_TYPE_COUNT if type cannot be repacked
+    // block i of the 4 rows of a group is stored next to each other, so that the CPU mul_mat computes 4 rows at once
+    // from a single stream of memory
+    // repacked tensors can only be used as src0 of ggml_mul_mat and must have a multiple of 4 rows
+    GGML_API enum ggml_type ggml_repack_type(enum ggml_type type);
+
+    // interleave the nrows rows of src (of type type) into dst (of type ggml_repack_type(type)), src and dst must not overlap
+    GGML_API void ggml_repack(enum ggml_type type, const void * src, void * dst, int64_t n_per_row, int64_t nrows);
+
     //
     // gguf
     //
@@ -2084,11 +2287,13 @@ extern "C" {
     // system info
     //
 
+    // with GGML_USE_CPU_DISPATCH, the x86 flags also report the instruction sets of the kernels selected at runtime
     GGML_API int ggml_cpu_has_avx        (void);
     GGML_API int ggml_cpu_has_avx2       (void);
     GGML_API int ggml_cpu_has_avx512     (void);
     GGML_API int ggml_cpu_has_avx512_vbmi(void);
     GGML_API int ggml_cpu_has_avx512_vnni(void);
+    GGML_API int ggml_cpu_has_avx512_bf16(void);
     GGML_API int ggml_cpu_has_fma        (void);
     GGML_API int ggml_cpu_has_neon       (void);
     GGML_API int ggml_cpu_has_arm_fma    (void);
@@ -2104,6 +2309,9 @@ extern "C" {
     GGML_API int ggml_cpu_has_ssse3      (void);
     GGML_API int ggml_cpu_has_vsx        (void);
 
+    // name of the quantized kernels selected at runtime with GGML_USE_CPU_DISPATCH ("base" for the built-in ones)
+    GGML_API const char * ggml_cpu_kernels_name(void);
+
     //
     // Internal types and functions exposed for tests and benchmarks
     //
@@ -2117,17 +2325,23 @@ extern "C" {
     typedef void (*ggml_to_float_t)  (const void  * GGML_RESTRICT x, float * GGML_RESTRICT y, int k);
     typedef void (*ggml_from_float_t)(const float * GGML_RESTRICT x, void  * GGML_RESTRICT y, int k);
     typedef void (*ggml_vec_dot_t)   (const int n, float * GGML_RESTRICT s, const void * GGML_RESTRICT x, const void * GGML_RESTRICT y);
+    typedef void (*ggml_vec_dot_tile_t)(const int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT x, size_t bx,
+                                        const void * GGML_RESTRICT y, size_t by);
 
     typedef struct {
-        const char      * type_name;
-        int               blck_size;
-        size_t            type_size;
-        bool              is_quantized;
-        ggml_to_float_t   to_float;
-        ggml_from_float_t from_float;
-        ggml_from_float_t from_float_reference;
-        ggml_vec_dot_t    vec_dot;
-        enum ggml_type    vec_dot_type;
+        const char          * type_name;
+        int                   blck_size;
+        size_t                type_size;
+        bool                  is_quantized;
+        ggml_to_float_t       to_float;
+        ggml_from_float_t     from_float;
+        ggml_from_float_t     from_float_reference;
+        ggml_vec_dot_t        vec_dot;
+        enum ggml_type        vec_dot_type;
+        ggml_vec_dot_tile_t   vec_dot_tile;    // optional, vec_dot of vec_dot_tile_nr rows with vec_dot_tile_nc columns at once
+        ggml_vec_dot_tile_t   vec_dot_tile_1;  // the repacked types: vec_dot_tile with a single column, they have no vec_dot
+        int                   vec_dot_tile_nr;
+        int                   vec_dot_tile_nc;
     } ggml_type_traits_t;
 
     GGML_API ggml_type_traits_t ggml_internal_get_type_traits(enum ggml_type type);
@@ -605,6 +605,7 @@ class GGMLQuantizationType(IntEnum):
     Q5_K = 13
     Q6_K = 14
     Q8_K = 15
+    BF16 = 30
 
 class GGUFEndian(IntEnum):
     LITTLE = 0
@@ -51,6 +51,7 @@
 
 #include <algorithm>
 #include <array>
+#include <bitset>
 #include <cassert>
 #include <cinttypes>
 #include <climits>
@@ -581,8 +582,10 @@ static int8_t llama_rope_scaling_type_from_string(const std::string & name) {
 // ggml helpers
 //
 
-static void ggml_graph_compute_helper(std::vector<uint8_t> & buf, ggml_cgraph * graph, int n_threads) {
+static void ggml_graph_compute_helper(std::vector<uint8_t> & buf, ggml_cgraph * graph, int n_threads, ggml_threadpool * threadpool = nullptr, ggml_trace * trace = nullptr) {
     struct ggml_cplan plan = ggml_graph_plan(graph, n_threads);
+    plan.threadpool = threadpool;
+    plan.trace      = trace;
 
     if (plan.work_size > 0) {
         buf.resize(plan.work_size);
@@ -624,6 +627,125 @@ static std::string llama_format_win_err(DWORD err) {
 }
 #endif
 
+#if defined(__linux__) && defined(_POSIX_MAPPED_FILES)
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+#endif
+
+static const char * llama_hugepages_name(enum llama_hugepages hp) {
+    switch (hp) {
+        case LLAMA_HUGEPAGES_NONE: return "none";
+        case LLAMA_HUGEPAGES_THP:  return "THP";
+        case LLAMA_HUGEPAGES_2M:   return "2M";
+        case LLAMA_HUGEPAGES_1G:   return "1G";
+    }
+    return "unknown";
+}
+
+// anonymous mapping of at least n bytes backed by huge pages
+// the 2M and 1G pages come from the pool reserved in /proc/sys/vm/nr_hugepages and, if it is
+// too small, the mapping falls back to transparent huge pages
+// returns NULL if no mapping could be made, the caller then uses malloc
+static void * llama_hugepages_alloc(size_t n, enum llama_hugepages hp, size_t * mapped_size, enum llama_hugepages * obtained) {
+#if defined(__linux__) && defined(_POSIX_MAPPED_FILES)
+    if (hp == LLAMA_HUGEPAGES_2M || hp == LLAMA_HUGEPAGES_1G) {
+        const size_t page = hp == LLAMA_HUGEPAGES_1G ? (size_t) 1 << 30 : (size_t) 1 << 21;
+        const size_t size = (n + page - 1)/page*page;
+
+        void * addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (hp == LLAMA_HUGEPAGES_1G ? MAP_HUGE_1GB : MAP_HUGE_2MB), -1, 0);
+        if (addr != MAP_FAILED) {
+            *mapped_size = size;
+            *obtained = hp;
+            return addr;
+        }
+
+        LLAMA_LOG_WARN("%s: could not map %.2f MB of %s huge pages (%s), falling back to transparent huge pages\n",
+                __func__, size/1024.0/1024.0, llama_hugepages_name(hp), strerror(errno));
+    }
+
+    // map 2M more than needed and trim the ends so that the mapping is aligned to the huge page size
+    const size_t page = (size_t) 1 << 21;
+    const size_t size = (n + page - 1)/page*page;
+
+    void * addr = mmap(NULL, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        return NULL;
+    }
+
+    char * base = (char *) GGML_PAD((uintptr_t) addr, page);
+    if (base > (char *) addr) {
+        munmap(addr, base - (char *) addr);
+    }
+    if ((char *) addr + size + page > base + size) {
+        munmap(base + size, (char *) addr + size + page - (base + size));
+    }
+
+    *mapped_size = size;
+    *obtained = LLAMA_HUGEPAGES_NONE;
+
+#ifdef MADV_HUGEPAGE
+    if (madvise(base, size, MADV_HUGEPAGE) == 0) {
+        *obtained = LLAMA_HUGEPAGES_THP;
+    } else {
+        LLAMA_LOG_WARN("%s: madvise(MADV_HUGEPAGE) failed: %s\n", __func__, strerror(errno));
+    }
+#endif
+
+    // fault the pages in now, so that the kernel can be asked how many of them are huge pages
+    for (size_t i = 0; i < size; i += page) {
+        base[i] = 0;
+    }
+
+    return base;
+#else
+    GGML_UNUSED(n);
+    GGML_UNUSED(hp);
+    GGML_UNUSED(mapped_size);
+    GGML_UNUSED(obtained);
+    return NULL;
+#endif
+}
+
+// bytes of the mapping at addr that the kernel backs with transparent huge pages, from /proc/self/smaps
+static size_t llama_hugepages_thp_size(const void * addr, size_t size) {
+#if defined(__linux__)
+    std::ifstream smaps("/proc/self/smaps");
+
+    bool in_vma = false;
+    size_t total = 0;
+
+    std::string line;
+    while (std::getline(smaps, line)) {
+        unsigned long long start;
+        unsigned long long end;
+        if (sscanf(line.c_str(), "%llx-%llx ", &start, &end) == 2 && line.find(':') > line.find(' ')) {
+            // the mapping may have been split or merged with its neighbours, sum all the VMAs that overlap it
+            in_vma = start < (uintptr_t) addr + size && end > (uintptr_t) addr;
+            continue;
+        }
+
+        unsigned long long kb;
+        if (in_vma && sscanf(line.c_str(), "AnonHugePages: %llu kB", &kb) == 1) {
+            total += kb*1024;
+        }
+    }
+
+    return std::min(total, size);
+#else
+    GGML_UNUSED(addr);
+    GGML_UNUSED(size);
+    return 0;
+#endif
+}
+
 struct llama_buffer {
     void * data = NULL;
     size_t size = 0;
@@ -632,8 +754,22 @@ struct llama_buffer {
     // useful in cases where CUDA can try to allocate PINNED memory
     bool fallback = false;
 
-    void resize(size_t n) {
-        llama_host_free(data);
+    // the buffer is an anonymous mapping of mapped_size bytes, with the huge pages actually obtained
+    size_t mapped_size = 0;
+    enum llama_hugepages hugepages = LLAMA_HUGEPAGES_NONE;
+
+    void resize(size_t n, enum llama_hugepages hp = LLAMA_HUGEPAGES_NONE) {
+        free_data();
+
+        if (hp != LLAMA_HUGEPAGES_NONE) {
+            data = llama_hugepages_alloc(n, hp, &mapped_size, &hugepages);
+            if (data) {
+                size = n;
+                return;
+            }
+            mapped_size = 0;
+            hugepages = LLAMA_HUGEPAGES_NONE;
+        }
 
         data = llama_host_malloc(n);
         if (!data) {
@@ -647,9 +783,37 @@ struct llama_buffer {
         size = n;
     }
 
-    ~llama_buffer() {
+    // log whether the buffer got the huge pages that were asked for
+    void log_hugepages(const char * func, const char * name) const {
+        if (!data) {
+            return;
+        }
+
+        const double mb = size/1024.0/1024.0;
+
+        switch (hugepages) {
+            case LLAMA_HUGEPAGES_2M:
+            case LLAMA_HUGEPAGES_1G:
+                LLAMA_LOG_INFO("%s: %-7s buffer = %8.2f MB, %.2f MB mapped in %s huge pages\n", func, name, mb,
+                        mapped_size/1024.0/1024.0, llama_hugepages_name(hugepages));
+                break;
+            case LLAMA_HUGEPAGES_THP:
+                LLAMA_LOG_INFO("%s: %-7s buffer = %8.2f MB, %.2f MB of the %.2f MB mapped in transparent huge pages\n", func, name, mb,
+                        llama_hugepages_thp_size(data, mapped_size)/1024.0/1024.0, mapped_size/1024.0/1024.0);
+                break;
+            case LLAMA_HUGEPAGES_NONE:
+                LLAMA_LOG_INFO("%s: %-7s buffer = %8.2f MB, no huge pages\n", func, name, mb);
+                break;
+        }
+    }
+
+    void free_data() {
         if (data) {
-            if (fallback) { // NOLINT
+            if (mapped_size) {
+#if defined(_POSIX_MAPPED_FILES)
+                munmap(data, mapped_size);
+#endif
+            } else if (fallback) { // NOLINT
                 free(data);
             } else {
                 llama_host_free(data);
@@ -657,6 +821,13 @@ struct llama_buffer {
         }
 
         data = NULL;
+        size = 0;
+        mapped_size = 0;
+        hugepages = LLAMA_HUGEPAGES_NONE;
+    }
+
+    ~llama_buffer() {
+        free_data();
     }
 };
 
@@ -1122,7 +1293,14 @@ struct llama_cparams {
     float yarn_beta_fast;
     float yarn_beta_slow;
 
+    float defrag_thold;
+
     bool mul_mat_q;
+    bool flash_attn;  // use the fused attention op, see llm_build_kqv
+    bool fused_ops;   // replace the element-wise ops by the fused ops, see ggml_graph_fuse
+    bool reuse_graph; // reuse the graph of the previous decode call when possible, see llama_graph_can_reuse
+    bool rope_cache;  // precompute the RoPE rotations of the context positions, see llama_rope_cache_init
+    bool kv_paged;    // store the new K and V in any free cells of the cache, see llama_kv_cache_find_slot
 };
 
 struct llama_layer {
@@ -1155,38 +1333,99 @@ struct llama_layer {
     struct ggml_tensor * ffn_gate; // w1
     struct ggml_tensor * ffn_down; // w2
     struct ggml_tensor * ffn_up;   // w3
+    struct ggml_tensor * ffn_gate_up; // w1 and w3 in one matrix, see llm_fuse_weights
 
     // ff bias
     struct ggml_tensor * ffn_down_b; // b2
     struct ggml_tensor * ffn_up_b;   // b3
 };
 
+struct llama_kv_prefix_node;
+
 struct llama_kv_cell {
     llama_pos pos   = -1;
     llama_pos delta = 0;
 
-    std::set<llama_seq_id> seq_id;
+    // one bit for each sequence of the cell
+    std::bitset<LLAMA_MAX_SEQ> seq_id;
+
+    // the node of the prefix cache that holds the cell, it keeps the cell used when it has no sequence
+    llama_kv_prefix_node * node = nullptr;
 
     bool has_seq_id(const llama_seq_id & id) const {
-        return seq_id.find(id) != seq_id.end();
+        return seq_id.test(id);
     }
 };
 
-// ring-buffer of cached KV data
+// prefix cache: a radix tree of the token sequences that start at position 0, each node holds a run of tokens and their cells
+// the cells stay in the cache when their sequences are removed, so that a new sequence can take them over, see
+// llama_kv_cache_seq_attach, until the least recently used leaves are evicted to make room
+struct llama_kv_prefix_node {
+    llama_pos pos = 0; // the position of the first token
+
+    std::vector<llama_token> tokens;
+    std::vector<uint32_t>    cells;
+
+    llama_kv_prefix_node * parent = nullptr;
+
+    std::map<llama_token, std::unique_ptr<llama_kv_prefix_node>> children; // by first token
+
+    uint64_t t_used = 0;
+};
+
+// the tokens of a sequence in the prefix cache: the path to node and the first n tokens of node
+// node is NULL when the sequence does not match a path of the tree
+struct llama_kv_prefix_cursor {
+    llama_kv_prefix_node * node = nullptr;
+    uint32_t               n    = 0;
+};
+
+// the cells are handed out to the sequences in blocks of LLAMA_KV_BLOCK_SIZE cells, the padding of n
+#define LLAMA_KV_BLOCK_SIZE 32
+
+// cached KV data
+// paged: the new K and V of a batch are stored in any free cells, each sequence appending to the last block of its
+//        block table and taking a new block from the free list when it is full, see llama_kv_cache_find_slot
+// otherwise: ring-buffer, the new K and V are stored in n_tokens contiguous cells starting at head
 struct llama_kv_cache {
     bool has_shift = false;
+    bool paged     = false;
 
     // Note: The value of head isn't only used to optimize searching
     // for a free KV slot. llama_decode_internal also uses it, so it
     // cannot be freely changed after a slot has been allocated.
     uint32_t head = 0;
     uint32_t size = 0;
+    uint32_t used = 0; // number of cells with a position
 
     // computed before each graph build
     uint32_t n = 0;
 
     std::vector<llama_kv_cell> cells;
 
+    // the cells of each sequence by position, so that the sequence operations only visit the cells they change
+    std::multimap<llama_pos, uint32_t> seq_cells[LLAMA_MAX_SEQ];
+
+    // the cells of the tokens of the last batch given to llama_kv_cache_find_slot
+    std::vector<int32_t> slot;
+
+    // blocks of LLAMA_KV_BLOCK_SIZE cells
+    std::vector<uint32_t>     block_used;  // number of used cells in each block
+    std::vector<llama_seq_id> block_owner; // the sequence that took the block from the free list, -1 if none
+    std::set<uint32_t>        free_blocks; // the blocks without used cells, the lowest first to keep n small
+    std::set<uint32_t>        open_blocks; // the blocks with used and free cells
+    std::set<uint32_t>        used_blocks; // the blocks with used cells, the last one bounds n
+
+    // block table of each sequence, in the order they were taken
+    std::vector<uint32_t> seq_blocks[LLAMA_MAX_SEQ];
+
+    // prefix cache, only with the paged cache
+    bool prefix = false;
+
+    llama_kv_prefix_node   prefix_root;
+    llama_kv_prefix_cursor prefix_cur[LLAMA_MAX_SEQ];
+    uint64_t               prefix_t = 0; // clock of the LRU eviction
+
     struct ggml_tensor * k = NULL;
     struct ggml_tensor * v = NULL;
 
@@ -1283,6 +1522,17 @@ struct llama_model {
     // the model memory buffer
     llama_buffer buf;
 
+    // the fused weights, see llm_fuse_weights
+    struct ggml_context * ctx_fused = NULL;
+    llama_buffer buf_fused;
+
+    // the repacked copies of the weights of the file mapping, see llm_repack_weights
+    llama_buffer buf_repack;
+    bool repacked = false;
+
+    // placement of the weights on the NUMA nodes, see llm_numa_place
+    enum ggml_numa_placement numa_placement = GGML_NUMA_PLACEMENT_NONE;
+
     // model memory mapped file
     std::unique_ptr<llama_mmap> mapping;
 
@@ -1300,6 +1550,9 @@ struct llama_model {
         if (ctx) {
             ggml_free(ctx);
         }
+        if (ctx_fused) {
+            ggml_free(ctx_fused);
+        }
 
 #ifdef GGML_USE_CUBLAS
         for (size_t i = 0; i < tensors_by_name.size(); ++i) {
@@ -1314,6 +1567,32 @@ struct llama_model {
     }
 };
 
+// the graph of the last decode call and its inputs
+// the graph is kept in buf_compute until the next call of llama_build_graph, so that a batch with the same shape can
+// compute it again after setting the inputs and moving the views that store the new K and V to the new head of the cache
+struct llama_graph_cache {
+    struct ggml_cgraph * gf = NULL;
+
+    // the shape of the batch and of the KV cache the graph was built for
+    int32_t n_tokens = 0;
+    int32_t n_kv     = 0;
+    int32_t kv_head  = 0;
+    bool    embd     = false;
+    bool    k_shift  = false;
+
+    // input tensors, set by llama_set_inputs before each compute
+    struct ggml_tensor * inp_tokens = NULL;
+    struct ggml_tensor * inp_embd   = NULL;
+    struct ggml_tensor * inp_pos    = NULL;
+    struct ggml_tensor * KQ_scale   = NULL;
+    struct ggml_tensor * KQ_mask    = NULL;
+    struct ggml_tensor * K_shift    = NULL;
+    struct ggml_tensor * kv_slot    = NULL;
+
+    // views of the KV cache at kv_head and the size in bytes of one cell in them
+    std::vector<std::pair<struct ggml_tensor *, size_t>> kv_store;
+};
+
 struct llama_context {
     llama_context(const llama_model & model) : model(model), t_start_us(model.t_start_us), t_load_us(model.t_load_us) {}
     ~llama_context() {
@@ -1325,6 +1604,13 @@ struct llama_context {
         if (alloc) {
             ggml_allocr_free(alloc);
         }
+        if (threadpool_owned) {
+            ggml_threadpool_free(threadpool);
+        }
+        ggml_trace_free(trace);
+        if (ctx_rope) {
+            ggml_free(ctx_rope);
+        }
     }
 
     llama_cparams cparams;
@@ -1358,6 +1644,23 @@ struct llama_context {
     // reusable buffer for `struct ggml_graph_plan.work_data`
     std::vector<uint8_t> work_buffer;
 
+    // reusable buffer for the positions of the cells of a sequence, see llama_set_inputs
+    std::vector<llama_pos> buf_seq_pos;
+
+    // persistent compute threads, reused across decode calls
+    ggml_threadpool * threadpool = NULL;
+    bool threadpool_owned = false;
+
+    // per-node timings of the computed graphs, see llama_trace_start()
+    ggml_trace * trace = NULL;
+
+    llama_graph_cache graph;
+
+    // sin, cos of the RoPE rotations for the positions of the context
+    struct ggml_tensor  * rope_cache = NULL;
+    struct ggml_context * ctx_rope   = NULL;
+    llama_buffer buf_rope;
+
     // memory buffers used to evaluate the model
     llama_buffer buf_compute;
 
@@ -1373,16 +1676,476 @@ struct llama_context {
 #endif
 };
 
+// returns the pool to compute a graph with n_threads threads, creating the context's own pool if needed
+static ggml_threadpool * llama_get_threadpool(llama_context & lctx, int n_threads) {
+    if (n_threads <= 1) {
+        return nullptr;
+    }
+
+    if (lctx.threadpool && ggml_threadpool_get_n_threads(lctx.threadpool) >= n_threads) {
+        return lctx.threadpool;
+    }
+
+    if (lctx.threadpool && !lctx.threadpool_owned) {
+        // the user provided pool is too small - fallback to spawning threads for this graph
+        return nullptr;
+    }
+
+    ggml_threadpool_free(lctx.threadpool);
+
+    const int n_pool = std::max(n_threads, (int) std::max(lctx.cparams.n_threads, lctx.cparams.n_threads_batch));
+
+    lctx.threadpool       = ggml_threadpool_new(n_pool, GGML_DEFAULT_N_SPIN);
+    lctx.threadpool_owned = true;
+
+    return lctx.threadpool;
+}
+
 //
 // kv cache helpers
 //
 
+// the number of cells of block b, the last block can be smaller
+static uint32_t llama_kv_cache_block_cells(const struct llama_kv_cache & cache, uint32_t b) {
+    return std::min(cache.size - b*LLAMA_KV_BLOCK_SIZE, (uint32_t) LLAMA_KV_BLOCK_SIZE);
+}
+
+// put block b in the free, open and used sets that match its number of used cells
+static void llama_kv_cache_block_update(struct llama_kv_cache & cache, uint32_t b) {
+    const uint32_t n_used = cache.block_used[b];
+
+    if (n_used == 0) {
+        cache.free_blocks.insert(b);
+        cache.used_blocks.erase(b);
+    } else {
+        cache.free_blocks.erase(b);
+        cache.used_blocks.insert(b);
+    }
+
+    if (n_used > 0 && n_used < llama_kv_cache_block_cells(cache, b)) {
+        cache.open_blocks.insert(b);
+    } else {
+        cache.open_blocks.erase(b);
+    }
+}
+
+// recompute the number of used cells, the blocks and the cells of the sequences from the cells
+// the blocks are not owned by any sequence
+static void llama_kv_cache_recount(struct llama_kv_cache & cache) {
+    const uint32_t n_blocks = (cache.size + LLAMA_KV_BLOCK_SIZE - 1)/LLAMA_KV_BLOCK_SIZE;
+
+    cache.used = 0;
+    cache.block_used.assign(n_blocks, 0);
+    cache.block_owner.assign(n_blocks, -1);
+    cache.free_blocks.clear();
+    cache.open_blocks.clear();
+    cache.used_blocks.clear();
+
+    for (llama_seq_id s = 0; s < LLAMA_MAX_SEQ; ++s) {
+        cache.seq_cells[s].clear();
+        cache.seq_blocks[s].clear();
+    }
+
+    for (uint32_t i = 0; i < cache.size; ++i) {
+        const auto & cell = cache.cells[i];
+        if (cell.pos < 0) {
+            continue;
+        }
+
+        cache.used++;
+        cache.block_used[i/LLAMA_KV_BLOCK_SIZE]++;
+
+        for (llama_seq_id s = 0; s < LLAMA_MAX_SEQ && cell.seq_id.any(); ++s) {
+            if (cell.has_seq_id(s)) {
+                cache.seq_cells[s].emplace(cell.pos, i);
+            }
+        }
+    }
+
+    for (uint32_t b = 0; b < n_blocks; ++b) {
+        llama_kv_cache_block_update(cache, b);
+    }
+}
+
+// the free cell i gets a position
+static void llama_kv_cache_cell_use(struct llama_kv_cache & cache, uint32_t i, llama_pos pos) {
+    GGML_ASSERT(cache.cells[i].pos < 0);
+
+    cache.cells[i].pos = pos;
+    cache.used++;
+
+    const uint32_t b = i/LLAMA_KV_BLOCK_SIZE;
+    const uint32_t n_used = ++cache.block_used[b];
+    if (n_used == 1 || n_used == llama_kv_cache_block_cells(cache, b)) {
+        llama_kv_cache_block_update(cache, b);
+    }
+}
+
+static void llama_kv_cache_seq_cells_erase(struct llama_kv_cache & cache, llama_seq_id seq_id, llama_pos pos, uint32_t i) {
+    auto & seq_cells = cache.seq_cells[seq_id];
+
+    const auto range = seq_cells.equal_range(pos);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == i) {
+            seq_cells.erase(it);
+            return;
+        }
+    }
+}
+
+// the used cell i loses its position and its sequences, its block goes back to the free list when it was the last one
+// Note: the sequences are indexed by the position of the cell, which must not have changed yet
+static void llama_kv_cache_cell_free(struct llama_kv_cache & cache, uint32_t i) {
+    auto & cell = cache.cells[i];
+
+    GGML_ASSERT(cell.node == nullptr);
+
+    for (llama_seq_id s = 0; s < LLAMA_MAX_SEQ && cell.seq_id.any(); ++s) {
+        if (cell.has_seq_id(s)) {
+            llama_kv_cache_seq_cells_erase(cache, s, cell.pos, i);
+            cell.seq_id.reset(s);
+        }
+    }
+
+    cell.pos = -1;
+    cache.used--;
+
+    const uint32_t b = i/LLAMA_KV_BLOCK_SIZE;
+    const uint32_t n_used = cache.block_used[b]--;
+    if (n_used == 1 || n_used == llama_kv_cache_block_cells(cache, b)) {
+        llama_kv_cache_block_update(cache, b);
+    }
+
+    if (n_used > 1) {
+        return;
+    }
+
+    const llama_seq_id owner = cache.block_owner[b];
+    if (owner >= 0) {
+        auto & blocks = cache.seq_blocks[owner];
+        blocks.erase(std::find(blocks.begin(), blocks.end(), b));
+    }
+
+    cache.block_owner[b] = -1;
+}
+
+static void llama_kv_cache_cell_add_seq(struct llama_kv_cache & cache, uint32_t i, llama_seq_id seq_id) {
+    auto & cell = cache.cells[i];
+
+    if (!cell.has_seq_id(seq_id)) {
+        cell.seq_id.set(seq_id);
+        cache.seq_cells[seq_id].emplace(cell.pos, i);
+    }
+}
+
+// the cell is freed when it was the last sequence of the cell, unless it is in the prefix cache
+static void llama_kv_cache_cell_rm_seq(struct llama_kv_cache & cache, uint32_t i, llama_seq_id seq_id) {
+    auto & cell = cache.cells[i];
+
+    if (cell.seq_id.count() == 1 && !cell.node) {
+        llama_kv_cache_cell_free(cache, i);
+    } else {
+        llama_kv_cache_seq_cells_erase(cache, seq_id, cell.pos, i);
+        cell.seq_id.reset(seq_id);
+    }
+}
+
+// the cells of seq_id with positions in [p0, p1)
+static std::vector<uint32_t> llama_kv_cache_seq_cells(const struct llama_kv_cache & cache, llama_seq_id seq_id, llama_pos p0, llama_pos p1) {
+    std::vector<uint32_t> res;
+
+    const auto & seq_cells = cache.seq_cells[seq_id];
+    for (auto it = seq_cells.lower_bound(p0); it != seq_cells.end() && it->first < p1; ++it) {
+        res.push_back(it->second);
+    }
+
+    return res;
+}
+
+// a free cell for the next token of seq_id: in the last block of its table, else in a block taken from the free list,
+// else in any block with free cells, so that it only fails if all the cells are used
+static int32_t llama_kv_cache_find_cell(struct llama_kv_cache & cache, llama_seq_id seq_id) {
+    uint32_t b;
+
+    if (seq_id >= 0 && !cache.seq_blocks[seq_id].empty() &&
+        cache.block_used[cache.seq_blocks[seq_id].back()] < llama_kv_cache_block_cells(cache, cache.seq_blocks[seq_id].back())) {
+        b = cache.seq_blocks[seq_id].back();
+    } else if (!cache.free_blocks.empty()) {
+        b = *cache.free_blocks.begin();
+        if (seq_id >= 0) {
+            cache.block_owner[b] = seq_id;
+            cache.seq_blocks[seq_id].push_back(b);
+        }
+        return b*LLAMA_KV_BLOCK_SIZE;
+    } else if (!cache.open_blocks.empty()) {
+        b = *cache.open_blocks.begin();
+    } else {
+        return -1;
+    }
+
+    for (uint32_t i = b*LLAMA_KV_BLOCK_SIZE; i < b*LLAMA_KV_BLOCK_SIZE + llama_kv_cache_block_cells(cache, b); ++i) {
+        if (cache.cells[i].pos < 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+//
+// prefix cache helpers
+//
+
+// the position of the next token of the sequence of cur
+static llama_pos llama_kv_prefix_cursor_pos(const llama_kv_prefix_cursor & cur) {
+    return cur.node->pos + cur.n;
+}
+
+// move cur back to the first p tokens of its path
+static void llama_kv_prefix_cursor_rewind(llama_kv_prefix_cursor & cur, llama_pos p) {
+    while (cur.node->parent && cur.node->pos >= p) {
+        cur.node = cur.node->parent;
+    }
+
+    cur.n = p - cur.node->pos;
+}
+
+// remove the tokens [i0, end) of node and the descendants of node from the tree, without unlinking node
+// their cells without sequences are freed and the cursors past i0 no longer match the tree
+static void llama_kv_cache_prefix_release(struct llama_kv_cache & cache, llama_kv_prefix_node * node, uint32_t i0) {
+    for (auto & it : node->children) {
+        llama_kv_cache_prefix_release(cache, it.second.get(), 0);
+    }
+    node->children.clear();
+
+    for (uint32_t j = i0; j < node->cells.size(); ++j) {
+        const uint32_t i = node->cells[j];
+
+        cache.cells[i].node = nullptr;
+        if (cache.cells[i].pos >= 0 && cache.cells[i].seq_id.none()) {
+            llama_kv_cache_cell_free(cache, i);
+        }
+    }
+
+    node->tokens.resize(i0);
+    node->cells.resize(i0);
+
+    for (auto & cur : cache.prefix_cur) {
+        if (cur.node == node && cur.n > i0) {
+            cur.node = nullptr;
+        }
+    }
+}
+
+// remove the tokens [i0, end) of node and its descendants from the tree, and node itself when none of its tokens is left
+static void llama_kv_cache_prefix_prune(struct llama_kv_cache & cache, llama_kv_prefix_node * node, uint32_t i0) {
+    const llama_token token = node->tokens.empty() ? -1 : node->tokens[0];
+
+    llama_kv_cache_prefix_release(cache, node, i0);
+
+    if (i0 == 0 && node->parent) {
+        node->parent->children.erase(token); // destroys node
+    }
+}
+
+// remove the tokens at positions p and after from the descendants of node
+static void llama_kv_cache_prefix_truncate(struct llama_kv_cache & cache, llama_kv_prefix_node * node, llama_pos p) {
+    for (auto it = node->children.begin(); it != node->children.end(); ) {
+        llama_kv_prefix_node * child = it->second.get();
+
+        if (child->pos >= p) {
+            llama_kv_cache_prefix_release(cache, child, 0);
+            it = node->children.erase(it);
+            continue;
+        }
+
+        if (child->pos + (llama_pos) child->tokens.size() > p) {
+            llama_kv_cache_prefix_release(cache, child, p - child->pos);
+        } else {
+            llama_kv_cache_prefix_truncate(cache, child, p);
+        }
+        ++it;
+    }
+}
+
+// empty the prefix cache, the cursors of the empty sequences start again from the root
+static void llama_kv_cache_prefix_clear(struct llama_kv_cache & cache) {
+    llama_kv_cache_prefix_release(cache, &cache.prefix_root, 0);
+
+    for (llama_seq_id s = 0; s < LLAMA_MAX_SEQ; ++s) {
+        cache.prefix_cur[s].node = cache.seq_cells[s].empty() ? &cache.prefix_root : nullptr;
+        cache.prefix_cur[s].n    = 0;
+    }
+}
+
+// split node before its token k, the tokens from k on go to a new child that takes over the children of node
+static void llama_kv_cache_prefix_split(struct llama_kv_cache & cache, llama_kv_prefix_node * node, uint32_t k) {
+    std::unique_ptr<llama_kv_prefix_node> tail(new llama_kv_prefix_node);
+
+    tail->pos      = node->pos + k;
+    tail->tokens.assign(node->tokens.begin() + k, node->tokens.end());
+    tail->cells .assign(node->cells .begin() + k, node->cells .end());
+    tail->parent   = node;
+    tail->children = std::move(node->children);
+    tail->t_used   = node->t_used;
+
+    for (auto & it : tail->children) {
+        it.second->parent = tail.get();
+    }
+
+    for (const uint32_t i : tail->cells) {
+        cache.cells[i].node = tail.get();
+    }
+
+    for (auto & cur : cache.prefix_cur) {
+        if (cur.node == node && cur.n > k) {
+            cur.node  = tail.get();
+            cur.n    -= k;
+        }
+    }
+
+    node->tokens.resize(k);
+    node->cells.resize(k);
+    node->children.clear();
+
+    const llama_token token = tail->tokens[0];
+    node->children[token] = std::move(tail);
+}
+
+// the token stored in cell is the next token of the sequence of cur
+// it is added to the tree, unless the tree already has it, in which case cur only moves over it
+static void llama_kv_cache_prefix_push(struct llama_kv_cache & cache, llama_kv_prefix_cursor & cur, llama_token token, uint32_t cell) {
+    llama_kv_prefix_node * node = cur.node;
+
+    if (cur.n < node->tokens.size()) {
+        if (node->tokens[cur.n] == token) {
+            cur.n++;
+            node->t_used = ++cache.prefix_t;
+            return;
+        }
+
+        llama_kv_cache_prefix_split(cache, node, cur.n);
+    }
+
+    auto it = node->children.find(token);
+    if (it != node->children.end()) {
+        cur.node = it->second.get();
+        cur.n    = 1;
+        cur.node->t_used = ++cache.prefix_t;
+        return;
+    }
+
+    // a cell shared by sequences on different paths stays on the first one
+    if (cache.cells[cell].node) {
+        cur.node = nullptr;
+        return;
+    }
+
+    // a leaf grows, otherwise the token starts a new branch
+    if (node == &cache.prefix_root || !node->children.empty()) {
+        llama_kv_prefix_node * child = new llama_kv_prefix_node;
+
+        child->pos    = llama_kv_prefix_cursor_pos(cur);
+        child->parent = node;
+
+        node->children[token].reset(child);
+        node = child;
+    }
+
+    node->tokens.push_back(token);
+    node->cells.push_back(cell);
+    node->t_used = ++cache.prefix_t;
+
+    cache.cells[cell].node = node;
+
+    cur.node = node;
+    cur.n    = node->tokens.size();
+}
+
+// remove the least recently used leaves from the tree until n_free cells are free or the tree is empty
+// the leaves where a sequence ends are removed last
+static void llama_kv_cache_prefix_evict(struct llama_kv_cache & cache, uint32_t n_free) {
+    std::vector<llama_kv_prefix_node *> stack;
+
+    while (cache.size - cache.used < n_free) {
+        llama_kv_prefix_node * lru = nullptr;
+        bool lru_has_cur = false;
+
+        stack.assign(1, &cache.prefix_root);
+        while (!stack.empty()) {
+            llama_kv_prefix_node * node = stack.back();
+            stack.pop_back();
+
+            if (!node->children.empty()) {
+                for (auto & it : node->children) {
+                    stack.push_back(it.second.get());
+                }
+                continue;
+            }
+
+            if (node == &cache.prefix_root) {
+                continue;
+            }
+
+            bool has_cur = false;
+            for (const auto & cur : cache.prefix_cur) {
+                has_cur = has_cur || cur.node == node;
+            }
+
+            if (!lru || (lru_has_cur && !has_cur) || (lru_has_cur == has_cur && node->t_used < lru->t_used)) {
+                lru         = node;
+                lru_has_cur = has_cur;
+            }
+        }
+
+        if (!lru) {
+            break;
+        }
+
+        llama_kv_cache_prefix_prune(cache, lru, 0);
+    }
+}
+
+// add to seq_id the cells of the tokens that follow it on its path, the number of tokens it holds then, -1 if it has no path
+static int32_t llama_kv_cache_prefix_attach(struct llama_kv_cache & cache, llama_seq_id seq_id, const llama_token * tokens, int32_t n_tokens) {
+    auto & cur = cache.prefix_cur[seq_id];
+
+    if (!cache.prefix || !cur.node) {
+        return -1;
+    }
+
+    int32_t i = llama_kv_prefix_cursor_pos(cur);
+
+    for (; i < n_tokens; ++i) {
+        if (cur.n == cur.node->tokens.size()) {
+            auto it = cur.node->children.find(tokens[i]);
+            if (it == cur.node->children.end()) {
+                break;
+            }
+
+            cur.node = it->second.get();
+            cur.n    = 0;
+        } else if (cur.node->tokens[cur.n] != tokens[i]) {
+            break;
+        }
+
+        llama_kv_cache_cell_add_seq(cache, cur.node->cells[cur.n], seq_id);
+
+        cur.n++;
+        cur.node->t_used = ++cache.prefix_t;
+    }
+
+    return i;
+}
+
 static bool llama_kv_cache_init(
         const struct llama_hparams & hparams,
              struct llama_kv_cache & cache,
                          ggml_type   wtype,
                           uint32_t   n_ctx,
-                               int   n_gpu_layers) {
+                               int   n_gpu_layers,
+                              bool   paged,
+              enum llama_hugepages   hugepages) {
     const uint32_t n_embd  = hparams.n_embd_gqa();
     const uint32_t n_layer = hparams.n_layer;
 
@@ -1390,6 +2153,7 @@ static bool llama_kv_cache_init(
     const int64_t n_elements = n_embd*n_mem;
 
     cache.has_shift = false;
+    cache.paged     = paged;
 
     cache.head = 0;
     cache.size = n_ctx;
@@ -1397,7 +2161,10 @@ static bool llama_kv_cache_init(
     cache.cells.clear();
     cache.cells.resize(n_ctx);
 
-    cache.buf.resize(2u*n_elements*ggml_type_size(wtype) + 2u*ggml_tensor_overhead());
+    llama_kv_cache_recount(cache);
+    llama_kv_cache_prefix_clear(cache);
+
+    cache.buf.resize(2u*n_elements*ggml_type_size(wtype) + 2u*ggml_tensor_overhead(), hugepages);
     memset(cache.buf.data, 0, cache.buf.size);
 
     struct ggml_init_params params;
@@ -1439,8 +2206,38 @@ static bool llama_kv_cache_init(
     return true;
 }
 
-// find an empty slot of size "n_tokens" in the cache
-// updates the cache head
+// precompute the RoPE rotations of the positions [0, n_ctx), with the parameters used by the graph of the model
+// only the LLAMA graph uses them, see build_llama
+static void llama_rope_cache_init(llama_context & lctx) {
+    const auto & hparams = lctx.model.hparams;
+    const auto & cparams = lctx.cparams;
+
+    if (lctx.model.arch != LLM_ARCH_LLAMA) {
+        return;
+    }
+
+    const int64_t n_embd_head = hparams.n_embd_head();
+
+    lctx.buf_rope.resize(ggml_tensor_overhead() + 2*n_embd_head*cparams.n_ctx*sizeof(float) + GGML_MEM_ALIGN);
+
+    struct ggml_init_params params;
+    params.mem_size   = lctx.buf_rope.size;
+    params.mem_buffer = lctx.buf_rope.data;
+    params.no_alloc   = false;
+
+    lctx.ctx_rope = ggml_init(params);
+
+    lctx.rope_cache = ggml_rope_cache(lctx.ctx_rope, n_embd_head, cparams.n_ctx,
+            n_embd_head, 0, 0, cparams.n_yarn_orig_ctx, cparams.rope_freq_base, cparams.rope_freq_scale,
+            cparams.yarn_ext_factor, cparams.yarn_attn_factor, cparams.yarn_beta_fast, cparams.yarn_beta_slow);
+    ggml_set_name(lctx.rope_cache, "rope_cache");
+
+    LLAMA_LOG_INFO("%s: rope cache size = %7.2f MB\n", __func__, ggml_nbytes(lctx.rope_cache) / 1024.0 / 1024.0);
+}
+
+// find an empty slot of size "n_tokens" in the cache, the cells of the tokens are stored in cache.slot
+// paged: any free cells, it only fails if there are less than n_tokens free cells
+// otherwise: contiguous cells, updates the cache head
 // Note: On success, it's important that cache.head points
 // to the first cell of the slot.
 static bool llama_kv_cache_find_slot(
@@ -1454,6 +2251,48 @@ static bool llama_kv_cache_find_slot(
         return false;
     }
 
+    cache.slot.resize(n_tokens);
+
+    if (cache.paged) {
+        if (n_tokens > n_ctx - cache.used && cache.prefix) {
+            llama_kv_cache_prefix_evict(cache, n_tokens);
+        }
+
+        if (n_tokens > n_ctx - cache.used) {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < n_tokens; i++) {
+            const int32_t cell = llama_kv_cache_find_cell(cache, batch.n_seq_id[i] > 0 ? batch.seq_id[i][0] : -1);
+            GGML_ASSERT(cell >= 0);
+
+            llama_kv_cache_cell_use(cache, cell, batch.pos[i]);
+
+            for (int32_t j = 0; j < batch.n_seq_id[i]; j++) {
+                llama_kv_cache_cell_add_seq(cache, cell, batch.seq_id[i][j]);
+            }
+
+            cache.slot[i] = cell;
+        }
+
+        // the tokens that continue the path of their sequences extend the prefix cache
+        if (cache.prefix) {
+            for (uint32_t i = 0; i < n_tokens; i++) {
+                for (int32_t j = 0; j < batch.n_seq_id[i]; j++) {
+                    auto & cur = cache.prefix_cur[batch.seq_id[i][j]];
+
+                    if (cur.node && batch.token && batch.pos[i] == llama_kv_prefix_cursor_pos(cur)) {
+                        llama_kv_cache_prefix_push(cache, cur, batch.token[i], cache.slot[i]);
+                    } else {
+                        cur.node = nullptr;
+                    }
+                }
+            }
+        }
+
+        return true;
+    }
+
     uint32_t n_tested = 0;
 
     while (true) {
@@ -1484,11 +2323,13 @@ static bool llama_kv_cache_find_slot(
     }
 
     for (uint32_t i = 0; i < n_tokens; i++) {
-        cache.cells[cache.head + i].pos = batch.pos[i];
+        llama_kv_cache_cell_use(cache, cache.head + i, batch.pos[i]);
 
         for (int32_t j = 0; j < batch.n_seq_id[i]; j++) {
-            cache.cells[cache.head + i].seq_id.insert(batch.seq_id[i][j]);
+            llama_kv_cache_cell_add_seq(cache, cache.head + i, batch.seq_id[i][j]);
         }
+
+        cache.slot[i] = cache.head + i;
     }
 
     return true;
@@ -1496,9 +2337,12 @@ static bool llama_kv_cache_find_slot(
 
 // find how many cells are currently in use
 static int32_t llama_kv_cache_cell_max(const struct llama_kv_cache & cache) {
-    for (uint32_t i = cache.size - 1; i > 0; --i) {
-        if (cache.cells[i].pos >= 0 && !cache.cells[i].seq_id.empty()) {
-            return i + 1;
+    for (auto it = cache.used_blocks.rbegin(); it != cache.used_blocks.rend(); ++it) {
+        const uint32_t b = *it;
+        for (uint32_t i = b*LLAMA_KV_BLOCK_SIZE + llama_kv_cache_block_cells(cache, b); i > b*LLAMA_KV_BLOCK_SIZE; --i) {
+            if (cache.cells[i - 1].pos >= 0 && cache.cells[i - 1].seq_id.any()) {
+                return i;
+            }
         }
     }
 
@@ -1508,9 +2352,12 @@ static int32_t llama_kv_cache_cell_max(const struct llama_kv_cache & cache) {
 static void llama_kv_cache_clear(struct llama_kv_cache & cache) {
     for (int32_t i = 0; i < (int32_t) cache.size; ++i) {
         cache.cells[i].pos = -1;
-        cache.cells[i].seq_id.clear();
+        cache.cells[i].seq_id.reset();
     }
     cache.head = 0;
+
+    llama_kv_cache_recount(cache);
+    llama_kv_cache_prefix_clear(cache);
 }
 
 static void llama_kv_cache_seq_rm(
@@ -1523,22 +2370,37 @@ static void llama_kv_cache_seq_rm(
     if (p0 < 0) p0 = 0;
     if (p1 < 0) p1 = std::numeric_limits<llama_pos>::max();
 
-    for (uint32_t i = 0; i < cache.size; ++i) {
-        if (cache.cells[i].pos >= p0 && cache.cells[i].pos < p1) {
-            if (seq_id < 0) {
-                cache.cells[i].seq_id.clear();
-            } else if (cache.cells[i].has_seq_id(seq_id)) {
-                cache.cells[i].seq_id.erase(seq_id);
-            } else {
-                continue;
+    for (llama_seq_id s = 0; s < LLAMA_MAX_SEQ; ++s) {
+        if (seq_id >= 0 && s != seq_id) {
+            continue;
+        }
+
+        for (const uint32_t i : llama_kv_cache_seq_cells(cache, s, p0, p1)) {
+            llama_kv_cache_cell_rm_seq(cache, i, s);
+            if (cache.cells[i].pos < 0) {
+                new_head = std::min(new_head, i);
             }
-            if (cache.cells[i].seq_id.empty()) {
-                cache.cells[i].pos = -1;
-                if (new_head == cache.size) new_head = i;
+        }
+
+        // the sequence keeps its path when its end is removed
+        auto & cur = cache.prefix_cur[s];
+        if (cache.seq_cells[s].empty()) {
+            cur.node = &cache.prefix_root;
+            cur.n    = 0;
+        } else if (cur.node && p0 < llama_kv_prefix_cursor_pos(cur)) {
+            if (p1 >= llama_kv_prefix_cursor_pos(cur)) {
+                llama_kv_prefix_cursor_rewind(cur, p0);
+            } else {
+                cur.node = nullptr;
             }
         }
     }
 
+    // the tokens from p0 on are also removed from the prefix cache, the cells that no sequence holds are freed
+    if (seq_id < 0 && cache.prefix) {
+        llama_kv_cache_prefix_truncate(cache, &cache.prefix_root, p0);
+    }
+
     // If we freed up a slot, set head to it so searching can start there.
     if (new_head != cache.size) cache.head = new_head;
 }
@@ -1549,30 +2411,52 @@ static void llama_kv_cache_seq_cp(
                  llama_seq_id   seq_id_dst,
                     llama_pos   p0,
                     llama_pos   p1) {
+    if (seq_id_src == seq_id_dst) {
+        return;
+    }
+
     if (p0 < 0) p0 = 0;
     if (p1 < 0) p1 = std::numeric_limits<llama_pos>::max();
 
     cache.head = 0;
 
-    for (uint32_t i = 0; i < cache.size; ++i) {
-        if (cache.cells[i].has_seq_id(seq_id_src) && cache.cells[i].pos >= p0 && cache.cells[i].pos < p1) {
-            cache.cells[i].seq_id.insert(seq_id_dst);
+    const bool dst_empty = cache.seq_cells[seq_id_dst].empty();
+
+    const std::vector<uint32_t> cells = llama_kv_cache_seq_cells(cache, seq_id_src, p0, p1);
+    for (const uint32_t i : cells) {
+        llama_kv_cache_cell_add_seq(cache, i, seq_id_dst);
+    }
+
+    // an empty sequence that gets the start of another one also gets its path
+    const auto & cur_src = cache.prefix_cur[seq_id_src];
+    auto       & cur_dst = cache.prefix_cur[seq_id_dst];
+    if (dst_empty && cur_src.node && p0 == 0) {
+        cur_dst = cur_src;
+        if (p1 < llama_kv_prefix_cursor_pos(cur_dst)) {
+            llama_kv_prefix_cursor_rewind(cur_dst, p1);
         }
+    } else if (!cells.empty()) {
+        cur_dst.node = nullptr;
     }
 }
 
 static void llama_kv_cache_seq_keep(struct llama_kv_cache & cache, llama_seq_id seq_id) {
     uint32_t new_head = cache.size;
 
-    for (uint32_t i = 0; i < cache.size; ++i) {
-        if (!cache.cells[i].has_seq_id(seq_id)) {
-            cache.cells[i].pos = -1;
-            cache.cells[i].seq_id.clear();
-            if (new_head == cache.size) new_head = i;
-        } else {
-            cache.cells[i].seq_id.clear();
-            cache.cells[i].seq_id.insert(seq_id);
+    for (llama_seq_id s = 0; s < LLAMA_MAX_SEQ; ++s) {
+        if (s == seq_id) {
+            continue;
         }
+
+        for (const uint32_t i : llama_kv_cache_seq_cells(cache, s, 0, std::numeric_limits<llama_pos>::max())) {
+            llama_kv_cache_cell_rm_seq(cache, i, s);
+            if (cache.cells[i].pos < 0) {
+                new_head = std::min(new_head, i);
+            }
+        }
+
+        cache.prefix_cur[s].node = &cache.prefix_root;
+        cache.prefix_cur[s].n    = 0;
     }
 
     // If we freed up a slot, set head to it so searching can start there.
@@ -1590,18 +2474,43 @@ static void llama_kv_cache_seq_shift(
     if (p0 < 0) p0 = 0;
     if (p1 < 0) p1 = std::numeric_limits<llama_pos>::max();
 
-    for (uint32_t i = 0; i < cache.size; ++i) {
-        if (cache.cells[i].has_seq_id(seq_id) && cache.cells[i].pos >= p0 && cache.cells[i].pos < p1) {
-            cache.has_shift = true;
-            cache.cells[i].pos   += delta;
-            cache.cells[i].delta += delta;
+    const std::vector<uint32_t> cells = llama_kv_cache_seq_cells(cache, seq_id, p0, p1);
 
-            if (cache.cells[i].pos < 0) {
-                cache.cells[i].pos = -1;
-                cache.cells[i].seq_id.clear();
-                if (new_head == cache.size) new_head = i;
+    // the tokens of the prefix cache are at their position from the start of the sequence, the moved ones leave it
+    for (const uint32_t i : cells) {
+        llama_kv_prefix_node * node = cache.cells[i].node;
+        if (node) {
+            llama_kv_cache_prefix_prune(cache, node, cache.cells[i].pos - node->pos);
+        }
+    }
+
+    for (const uint32_t i : cells) {
+        auto & cell = cache.cells[i];
+
+        for (llama_seq_id s = 0; s < LLAMA_MAX_SEQ && cell.seq_id.any(); ++s) {
+            if (cell.has_seq_id(s)) {
+                cache.prefix_cur[s].node = nullptr;
+            }
+        }
+
+        cache.has_shift = true;
+        cell.delta += delta;
+
+        if (cell.pos + delta < 0) {
+            llama_kv_cache_cell_free(cache, i);
+            new_head = std::min(new_head, i);
+            continue;
+        }
+
+        // the cell moves in the index of each of its sequences
+        for (llama_seq_id s = 0; s < LLAMA_MAX_SEQ; ++s) {
+            if (cell.has_seq_id(s)) {
+                llama_kv_cache_seq_cells_erase(cache, s, cell.pos, i);
+                cache.seq_cells[s].emplace(cell.pos + delta, i);
             }
         }
+
+        cell.pos += delta;
     }
 
     // If we freed up a slot, set head to it so searching can start there.
@@ -1717,6 +2626,7 @@ struct llama_model_loader {
             switch (type_max) {
                 case GGML_TYPE_F32:  ftype = LLAMA_FTYPE_ALL_F32;       break;
                 case GGML_TYPE_F16:  ftype = LLAMA_FTYPE_MOSTLY_F16;    break;
+                case GGML_TYPE_BF16: ftype = LLAMA_FTYPE_MOSTLY_BF16;   break;
                 case GGML_TYPE_Q4_0: ftype = LLAMA_FTYPE_MOSTLY_Q4_0;   break;
                 case GGML_TYPE_Q4_1: ftype = LLAMA_FTYPE_MOSTLY_Q4_1;   break;
                 case GGML_TYPE_Q5_0: ftype = LLAMA_FTYPE_MOSTLY_Q5_0;   break;
@@ -1882,8 +2792,11 @@ struct llama_model_loader {
     void load_data_for(struct ggml_tensor * cur) const {
         const size_t offs = file_offset(ggml_get_name(cur));
 
-        if (use_mmap) {
+        if (use_mmap && cur->data == NULL) {
             cur->data = (uint8_t *) mapping->addr + offs;
+        } else if (use_mmap) {
+            // the tensor has its own memory, see llm_fuse_weights
+            memcpy(cur->data, (uint8_t *) mapping->addr + offs, ggml_nbytes(cur));
         } else {
             file.seek(offs, SEEK_SET);
             file.read_raw(cur->data, ggml_nbytes(cur));
@@ -1987,6 +2900,7 @@ static std::string llama_model_ftype_name(llama_ftype ftype) {
     switch (ftype) {
         case LLAMA_FTYPE_ALL_F32:     return "all F32";
         case LLAMA_FTYPE_MOSTLY_F16:  return "mostly F16";
+        case LLAMA_FTYPE_MOSTLY_BF16: return "mostly BF16";
         case LLAMA_FTYPE_MOSTLY_Q4_0: return "mostly Q4_0";
         case LLAMA_FTYPE_MOSTLY_Q4_1: return "mostly Q4_1";
         case LLAMA_FTYPE_MOSTLY_Q4_1_SOME_F16:
@@ -2477,6 +3391,257 @@ static void llm_load_print_meta(llama_model_loader & ml, llama_model & model) {
     if (vocab.linefeed_id    != -1) { LLAMA_LOG_INFO( "%s: LF token  = %d '%s'\n", __func__, vocab.linefeed_id,    vocab.id_to_token[vocab.linefeed_id].text.c_str() );    }
 }
 
+// allocate the projections that use the same input (Q, K, V and gate, up) next to each other in one tensor per layer,
+// so that the graph can compute them with a single mul_mat
+// the original tensors point into the fused tensor, so that the loader reads their data into it
+static void llm_fuse_weights(llama_model & model, enum llama_hugepages hugepages) {
+    if (model.arch != LLM_ARCH_LLAMA) {
+        LLAMA_LOG_WARN("%s: fused weights are not supported for this architecture\n", __func__);
+        return;
+    }
+
+#if defined(GGML_USE_CUBLAS) || defined(GGML_USE_CLBLAST) || defined(GGML_USE_METAL)
+    if (model.n_gpu_layers > 0) {
+        LLAMA_LOG_WARN("%s: fused weights are only supported on the CPU\n", __func__);
+        return;
+    }
+#endif
+
+    struct llm_fused_tensor {
+        struct ggml_tensor ** dst;
+        std::vector<struct ggml_tensor *> srcs;
+        const char * name;
+        int il;
+    };
+
+    std::vector<llm_fused_tensor> fused;
+
+    // the rows of the tensors are concatenated, so they must have the same type and number of columns
+    auto can_fuse = [](const std::vector<struct ggml_tensor *> & srcs) {
+        for (const auto * t : srcs) {
+            if (t->type != srcs[0]->type || t->ne[0] != srcs[0]->ne[0] || t->ne[2] != 1 || t->ne[3] != 1 ||
+                t->backend != GGML_BACKEND_CPU || !ggml_is_contiguous(t)) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    for (int il = 0; il < (int) model.layers.size(); ++il) {
+        auto & layer = model.layers[il];
+
+        if (can_fuse({ layer.wq, layer.wk, layer.wv })) {
+            fused.push_back({ &layer.wqkv, { layer.wq, layer.wk, layer.wv }, "blk.%d.attn_qkv.weight", il });
+        }
+        if (can_fuse({ layer.ffn_gate, layer.ffn_up })) {
+            fused.push_back({ &layer.ffn_gate_up, { layer.ffn_gate, layer.ffn_up }, "blk.%d.ffn_gate_up.weight", il });
+        }
+    }
+
+    if (fused.empty()) {
+        return;
+    }
+
+    size_t size = 0;
+    for (const auto & f : fused) {
+        size += ggml_tensor_overhead() + GGML_MEM_ALIGN;
+        for (const auto * t : f.srcs) {
+            size += ggml_nbytes(t);
+        }
+    }
+
+    model.buf_fused.resize(size, hugepages);
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ model.buf_fused.size,
+        /*.mem_buffer =*/ model.buf_fused.data,
+        /*.no_alloc   =*/ false,
+    };
+
+    model.ctx_fused = ggml_init(params);
+    if (!model.ctx_fused) {
+        throw std::runtime_error(format("ggml_init() failed"));
+    }
+
+    for (const auto & f : fused) {
+        int64_t ne1 = 0;
+        for (const auto * t : f.srcs) {
+            ne1 += t->ne[1];
+        }
+
+        struct ggml_tensor * cur = ggml_new_tensor_2d(model.ctx_fused, f.srcs[0]->type, f.srcs[0]->ne[0], ne1);
+        ggml_format_name(cur, f.name, f.il);
+
+        size_t offs = 0;
+        for (auto * t : f.srcs) {
+            t->data = (char *) cur->data + offs;
+            offs += ggml_nbytes(t);
+        }
+
+        *f.dst = cur;
+    }
+
+    LLAMA_LOG_INFO("%s: fused %d tensors (%7.2f MB)\n", __func__, (int) fused.size(), size/1024.0/1024.0);
+}
+
+// interleave the rows of the mul_mat weights in groups of 4 for the faster CPU kernels (see ggml_repack)
+// the weights in the file mapping are copied to a buffer of the model, the others are repacked in place
+// the tensors that point into a fused weight (see llm_fuse_weights) are repacked with it
+static void llm_repack_weights(const llama_model_loader & ml, llama_model & model) {
+#if defined(GGML_USE_CUBLAS) || defined(GGML_USE_CLBLAST) || defined(GGML_USE_METAL)
+    if (model.n_gpu_layers > 0) {
+        LLAMA_LOG_WARN("%s: repacked weights are only supported on the CPU\n", __func__);
+        return;
+    }
+#endif
+
+    struct llm_repack_tensor {
+        struct ggml_tensor * cur;
+        std::vector<struct ggml_tensor *> views;
+    };
+
+    std::vector<llm_repack_tensor> repack;
+
+    auto can_repack = [](const struct ggml_tensor * t) {
+        return ggml_repack_type(t->type) != GGML_TYPE_COUNT && t->backend == GGML_BACKEND_CPU &&
+            t->ne[1] % 4 == 0 && t->ne[2] == 1 && t->ne[3] == 1 && ggml_is_contiguous(t);
+    };
+
+    // the weights that are only used as src0 of a mul_mat
+    auto add = [&](struct ggml_tensor * t, std::vector<struct ggml_tensor *> views) {
+        if (t == NULL || !can_repack(t)) {
+            return;
+        }
+        for (const auto * v : views) {
+            if (v->ne[1] % 4 != 0) {
+                return;
+            }
+        }
+        repack.push_back({ t, views });
+    };
+
+    for (auto & layer : model.layers) {
+        if (layer.wqkv) {
+            std::vector<struct ggml_tensor *> views;
+            for (auto * t : { layer.wq, layer.wk, layer.wv }) {
+                if (t) {
+                    views.push_back(t);
+                }
+            }
+            add(layer.wqkv, views);
+        } else {
+            add(layer.wq, {});
+            add(layer.wk, {});
+            add(layer.wv, {});
+        }
+        add(layer.wo, {});
+
+        if (layer.ffn_gate_up) {
+            add(layer.ffn_gate_up, { layer.ffn_gate, layer.ffn_up });
+        } else {
+            add(layer.ffn_gate, {});
+            add(layer.ffn_up,   {});
+        }
+        add(layer.ffn_down, {});
+    }
+
+    if (model.output != model.tok_embd) {
+        add(model.output, {});
+    }
+
+    if (repack.empty()) {
+        return;
+    }
+
+    auto in_mapping = [&](const struct ggml_tensor * t) {
+        return ml.mapping && (const char *) t->data >= (const char *) ml.mapping->addr &&
+            (const char *) t->data < (const char *) ml.mapping->addr + ml.mapping->size;
+    };
+
+    size_t size_copy = 0;
+    size_t size      = 0;
+    for (const auto & r : repack) {
+        if (in_mapping(r.cur)) {
+            size_copy += ggml_nbytes(r.cur);
+        }
+        size += ggml_nbytes(r.cur);
+    }
+
+    if (size_copy > 0) {
+        model.buf_repack.resize(size_copy);
+    }
+
+    std::vector<uint8_t> tmp;
+
+    size_t offs = 0;
+    for (const auto & r : repack) {
+        struct ggml_tensor * cur = r.cur;
+
+        const void * src = cur->data;
+
+        if (in_mapping(cur)) {
+            cur->data = (char *) model.buf_repack.data + offs;
+            offs += ggml_nbytes(cur);
+        } else {
+            tmp.resize(ggml_nbytes(cur));
+            memcpy(tmp.data(), cur->data, tmp.size());
+            src = tmp.data();
+        }
+
+        ggml_repack(cur->type, src, cur->data, cur->ne[0], cur->ne[1]);
+
+        cur->type = ggml_repack_type(cur->type);
+
+        // the rows of the views start at a group of 4 rows of cur
+        for (auto * v : r.views) {
+            v->type = cur->type;
+        }
+    }
+
+    model.repacked = true;
+
+    LLAMA_LOG_INFO("%s: repacked %d tensors (%7.2f MB, %7.2f MB copied from the mapping)\n", __func__,
+            (int) repack.size(), size/1024.0/1024.0, size_copy/1024.0/1024.0);
+}
+
+// the weights are read by the threads of each node from the memory of the node, see ggml_numa_place
+static void llm_numa_place(llama_model & model, enum ggml_numa_placement placement) {
+#if defined(GGML_USE_CUBLAS) || defined(GGML_USE_CLBLAST) || defined(GGML_USE_METAL)
+    if (model.n_gpu_layers > 0) {
+        LLAMA_LOG_WARN("%s: the NUMA placement of the weights is only supported on the CPU\n", __func__);
+        return;
+    }
+#endif
+
+    if (!ggml_is_numa()) {
+        LLAMA_LOG_WARN("%s: the system has a single NUMA node, or NUMA optimizations are not enabled (llama_backend_init)\n", __func__);
+        return;
+    }
+
+    if (model.mapping) {
+        LLAMA_LOG_WARN("%s: the weights in a file mapping cannot be placed on the NUMA nodes\n", __func__);
+        return;
+    }
+
+    const int n_nodes = ggml_numa_n_nodes();
+
+    size_t size = 0;
+    for (struct ggml_context * ctx : { model.ctx, model.ctx_fused }) {
+        if (ctx && ggml_numa_place(ctx, placement)) {
+            size += ggml_used_mem(ctx);
+        }
+    }
+
+    model.numa_placement = placement;
+
+    if (placement == GGML_NUMA_PLACEMENT_REPLICATE) {
+        LLAMA_LOG_INFO("%s: weights replicated on %d NUMA nodes (%7.2f MB per node)\n", __func__, n_nodes, size/1024.0/1024.0);
+    } else {
+        LLAMA_LOG_INFO("%s: weights interleaved by rows across %d NUMA nodes\n", __func__, n_nodes);
+    }
+}
+
+
 static void llm_load_tensors(
         llama_model_loader & ml,
         llama_model & model,
@@ -2484,6 +3649,10 @@ static void llm_load_tensors(
         int main_gpu,
         const float * tensor_split,
         bool use_mlock,
+        bool fuse_weights,
+        bool repack_weights,
+        enum llama_hugepages hugepages,
+        enum ggml_numa_placement numa_placement,
         llama_progress_callback progress_callback,
         void * progress_callback_user_data) {
     model.t_start_us = ggml_time_us();
@@ -2502,7 +3671,7 @@ static void llm_load_tensors(
 
     // create the ggml context
     {
-        model.buf.resize(ctx_size);
+        model.buf.resize(ctx_size, hugepages);
         if (use_mlock) {
             model.mlock_buf.init   (model.buf.data);
             model.mlock_buf.grow_to(model.buf.size);
@@ -3054,6 +4223,10 @@ static void llm_load_tensors(
 
     ml.done_getting_tensors();
 
+    if (fuse_weights) {
+        llm_fuse_weights(model, hugepages);
+    }
+
     // print memory requirements
     {
         // this is the total memory required to run the inference
@@ -3101,10 +4274,23 @@ static void llm_load_tensors(
 
     ml.load_all_data(ctx, progress_callback, progress_callback_user_data, use_mlock ? &model.mlock_mmap : NULL);
 
+    if (repack_weights) {
+        llm_repack_weights(ml, model);
+    }
+
+    if (numa_placement != GGML_NUMA_PLACEMENT_NONE) {
+        llm_numa_place(model, numa_placement);
+    }
+
     if (progress_callback) {
         progress_callback(1.0f, progress_callback_user_data);
     }
 
+    if (hugepages != LLAMA_HUGEPAGES_NONE) {
+        model.buf.log_hugepages(__func__, "weights");
+        model.buf_fused.log_hugepages(__func__, "fused");
+    }
+
     model.mapping = std::move(ml.mapping);
 
     // loading time will be recalculate after the first eval, so
@@ -3112,9 +4298,25 @@ static void llm_load_tensors(
     model.t_load_us = ggml_time_us() - model.t_start_us;
 }
 
-static bool llama_model_load(const std::string & fname, llama_model & model, const llama_model_params & params) {
-    try {
-        llama_model_loader ml(fname, params.use_mmap);
+static bool llama_model_load(const std::string & fname, llama_model & model, const llama_model_params & params) {
+    try {
+        const enum llama_hugepages hugepages = (enum llama_hugepages) params.hugepages;
+
+        // the weights are copied into the huge pages, a file mapping cannot get them
+        if (params.use_mmap && hugepages != LLAMA_HUGEPAGES_NONE) {
+            LLAMA_LOG_INFO("%s: %s huge pages requested, the weights are read into memory instead of mmap-ed\n", __func__, llama_hugepages_name(hugepages));
+        }
+
+        const enum ggml_numa_placement numa_placement = (enum ggml_numa_placement) params.numa_placement;
+
+        // the pages of a file mapping are shared with the page cache, they cannot be moved to the nodes
+        if (params.use_mmap && numa_placement != GGML_NUMA_PLACEMENT_NONE && ggml_is_numa()) {
+            LLAMA_LOG_INFO("%s: NUMA placement requested, the weights are read into memory instead of mmap-ed\n", __func__);
+        }
+
+        const bool use_mmap = params.use_mmap && hugepages == LLAMA_HUGEPAGES_NONE && (numa_placement == GGML_NUMA_PLACEMENT_NONE || !ggml_is_numa());
+
+        llama_model_loader ml(fname, use_mmap);
 
         model.hparams.vocab_only = params.vocab_only;
 
@@ -3134,7 +4336,7 @@ static bool llama_model_load(const std::string & fname, llama_model & model, con
         }
 
         llm_load_tensors(
-            ml, model, params.n_gpu_layers, params.main_gpu, params.tensor_split, params.use_mlock,
+            ml, model, params.n_gpu_layers, params.main_gpu, params.tensor_split, params.use_mlock, params.fuse_weights, params.repack_weights, hugepages, numa_placement,
             params.progress_callback, params.progress_callback_user_data
         );
     } catch (const std::exception & err) {
@@ -3174,6 +4376,11 @@ enum llm_norm_type {
     LLM_NORM_RMS,
 };
 
+// the scale of KQ: the value of the "KQ_scale" input and the scale given to the fused attention ops
+static float llm_kq_scale(const llama_hparams & hparams) {
+    return 1.0f/sqrtf(float(hparams.n_embd_head()));
+}
+
 static struct ggml_tensor * llm_build_inp_embd(
         struct ggml_context * ctx,
         const llama_hparams & hparams,
@@ -3263,12 +4470,36 @@ static void llm_build_kv_store(
                     int64_t   n_ctx,
                     int32_t   n_tokens,
                     int32_t   kv_head,
+         struct ggml_tensor * kv_slot,
          const llm_build_cb & cb,
                     int64_t   il) {
     const int64_t n_embd_gqa = hparams.n_embd_gqa();
 
+    // v_cur can also be a view of the rows of a fused QKV result, which is already 2D
+    struct ggml_tensor * v_cur_2d = ggml_is_contiguous(v_cur) ? ggml_reshape_2d(ctx, v_cur, n_embd_gqa, n_tokens) : v_cur;
+
+    if (kv_slot) {
+        // paged cache: the token i goes to the cell kv_slot[i], a row of K and a column of V
+        struct ggml_tensor * k_cache_rows = ggml_view_2d(ctx, kv.k, n_embd_gqa, n_ctx,
+                ggml_element_size(kv.k)*n_embd_gqa,
+                ggml_element_size(kv.k)*n_embd_gqa*n_ctx*il);
+        cb(k_cache_rows, "k_cache_rows", il);
+
+        struct ggml_tensor * v_cache_rows = ggml_transpose(ctx, ggml_view_2d(ctx, kv.v, n_ctx, n_embd_gqa,
+                ggml_element_size(kv.v)*n_ctx,
+                ggml_element_size(kv.v)*n_ctx*n_embd_gqa*il));
+        cb(v_cache_rows, "v_cache_rows", il);
+
+        struct ggml_tensor * k_cur_2d = ggml_is_contiguous(k_cur) ? ggml_reshape_2d(ctx, k_cur, n_embd_gqa, n_tokens) : k_cur;
+
+        // important: storing RoPE-ed version of K in the KV cache!
+        ggml_build_forward_expand(graph, ggml_set_rows(ctx, k_cache_rows, k_cur_2d, kv_slot));
+        ggml_build_forward_expand(graph, ggml_set_rows(ctx, v_cache_rows, v_cur_2d, kv_slot));
+        return;
+    }
+
     // compute the transposed [n_tokens, n_embd] V matrix
-    struct ggml_tensor * v_cur_t = ggml_transpose(ctx, ggml_reshape_2d(ctx, v_cur, n_embd_gqa, n_tokens));
+    struct ggml_tensor * v_cur_t = ggml_transpose(ctx, v_cur_2d);
     //struct ggml_tensor * v_cur_t = ggml_transpose(ctx, v_cur); // TODO: reshape above is likely not needed
     cb(v_cur_t, "v_cur_t", il);
 
@@ -3404,10 +4635,38 @@ static struct ggml_tensor * llm_build_ffn(
     return cur;
 }
 
+// gate and up in one matrix, computed with a single mul_mat and split with views (see llm_fuse_weights)
+static struct ggml_tensor * llm_build_ffn_gate_up(
+        struct ggml_context * ctx,
+         struct ggml_tensor * cur,
+         struct ggml_tensor * gate_up,
+         struct ggml_tensor * down,
+         const llm_build_cb & cb,
+                        int   il) {
+    cur = ggml_mul_mat(ctx, gate_up, cur);
+    cb(cur, "ffn_gate_up", il);
+
+    const int64_t n_ff = cur->ne[0]/2;
+
+    struct ggml_tensor * gate = ggml_view_2d(ctx, cur, n_ff, cur->ne[1], cur->nb[1], 0);
+    struct ggml_tensor * up   = ggml_view_2d(ctx, cur, n_ff, cur->ne[1], cur->nb[1], ggml_element_size(cur)*n_ff);
+
+    cur = ggml_silu(ctx, gate);
+    cb(cur, "ffn_silu", il);
+
+    cur = ggml_mul(ctx, cur, up);
+    cb(cur, "ffn_gate_par", il);
+
+    cur = ggml_mul_mat(ctx, down, cur);
+
+    return cur;
+}
+
 // if max_alibi_bias > 0 then apply ALiBi
 static struct ggml_tensor * llm_build_kqv(
         struct ggml_context * ctx,
         const llama_hparams & hparams,
+        const llama_cparams & cparams,
        const llama_kv_cache & kv,
          struct ggml_tensor * wo,
          struct ggml_tensor * wo_b,
@@ -3437,26 +4696,6 @@ static struct ggml_tensor * llm_build_kqv(
                 ggml_element_size(kv.k)*n_embd_gqa*n_ctx*il);
     cb(k, "k", il);
 
-    struct ggml_tensor * kq = ggml_mul_mat(ctx, k, q);
-    cb(kq, "kq", il);
-
-    kq = ggml_scale(ctx, kq, kq_scale);
-    cb(kq, "kq_scaled", il);
-
-    if (max_alibi_bias > 0.0f) {
-        // TODO: n_head or n_head_kv
-        // TODO: K-shift is likely not working
-        // TODO: change to ggml_add
-        kq = ggml_alibi(ctx, kq, /*n_past*/ 0, n_head, max_alibi_bias);
-        cb(kq, "kq_scaled_alibi", il);
-    }
-
-    kq = ggml_add(ctx, kq, kq_mask);
-    cb(kq, "kq_masked", il);
-
-    kq = ggml_soft_max(ctx, kq);
-    cb(kq, "kq_soft_max", il);
-
     // split cached v into n_head heads
     struct ggml_tensor * v =
         ggml_view_3d(ctx, kv.v,
@@ -3466,14 +4705,51 @@ static struct ggml_tensor * llm_build_kqv(
                 ggml_element_size(kv.v)*n_ctx*n_embd_gqa*il);
     cb(v, "v", il);
 
-    struct ggml_tensor * kqv = ggml_mul_mat(ctx, v, kq);
-    cb(kqv, "kqv", il);
+    struct ggml_tensor * cur;
+
+    if (cparams.flash_attn) {
+        // scale, ALiBi, mask, soft_max and the product with v in one op, without materializing kq
+        cur = ggml_flash_attn_ext(ctx, q, k, v, kq_mask, llm_kq_scale(hparams), max_alibi_bias);
+        cb(cur, "kqv_flash", il);
+
+        cur = ggml_reshape_2d(ctx, cur, n_embd, n_tokens);
+        cb(cur, "kqv_merged_cont", il);
+    } else {
+        struct ggml_tensor * kq = ggml_mul_mat(ctx, k, q);
+        cb(kq, "kq", il);
+
+        if (cparams.fused_ops && max_alibi_bias <= 0.0f) {
+            // scale, mask and soft_max in one pass over kq
+            kq = ggml_soft_max_ext(ctx, kq, kq_mask, llm_kq_scale(hparams));
+            cb(kq, "kq_soft_max", il);
+        } else {
+            kq = ggml_scale(ctx, kq, kq_scale);
+            cb(kq, "kq_scaled", il);
+
+            if (max_alibi_bias > 0.0f) {
+                // TODO: n_head or n_head_kv
+                // TODO: K-shift is likely not working
+                // TODO: change to ggml_add
+                kq = ggml_alibi(ctx, kq, /*n_past*/ 0, n_head, max_alibi_bias);
+                cb(kq, "kq_scaled_alibi", il);
+            }
+
+            kq = ggml_add(ctx, kq, kq_mask);
+            cb(kq, "kq_masked", il);
+
+            kq = ggml_soft_max(ctx, kq);
+            cb(kq, "kq_soft_max", il);
+        }
+
+        struct ggml_tensor * kqv = ggml_mul_mat(ctx, v, kq);
+        cb(kqv, "kqv", il);
 
-    struct ggml_tensor * kqv_merged = ggml_permute(ctx, kqv, 0, 2, 1, 3);
-    cb(kqv_merged, "kqv_merged", il);
+        struct ggml_tensor * kqv_merged = ggml_permute(ctx, kqv, 0, 2, 1, 3);
+        cb(kqv_merged, "kqv_merged", il);
 
-    struct ggml_tensor * cur = ggml_cont_2d(ctx, kqv_merged, n_embd, n_tokens);
-    cb(cur, "kqv_merged_cont", il);
+        cur = ggml_cont_2d(ctx, kqv_merged, n_embd, n_tokens);
+        cb(cur, "kqv_merged_cont", il);
+    }
 
     cur = ggml_mul_mat(ctx, wo, cur);
     if (wo_b) {
@@ -3487,6 +4763,14 @@ static struct ggml_tensor * llm_build_kqv(
     return cur;
 }
 
+// capacity of the decode graphs, for both the nodes and the leafs
+// the layers of the largest architectures have less than LLAMA_GRAPH_NODES_PER_LAYER nodes and leafs each
+#define LLAMA_GRAPH_NODES_PER_LAYER 128
+
+static size_t llama_graph_size(const llama_model & model) {
+    return std::max<size_t>(GGML_DEFAULT_GRAPH_SIZE, LLAMA_GRAPH_NODES_PER_LAYER*model.hparams.n_layer + 256);
+}
+
 struct llm_build_context {
     const llama_model    & model;
     const llama_hparams  & hparams;
@@ -3518,6 +4802,11 @@ struct llm_build_context {
 
     const bool do_rope_shift;
 
+    struct ggml_tensor * rope_cache;
+
+    // the cells where we store new KV data in a paged cache, see llm_build_kv_store
+    struct ggml_tensor * inp_kv_slot = nullptr;
+
     const llm_build_cb & cb;
 
     llama_buffer & buf_compute;
@@ -3555,6 +4844,7 @@ struct llm_build_context {
         kv_head       (worst_case ? n_ctx - n_tokens : kv_self.head),
         n_orig_ctx    (cparams.n_yarn_orig_ctx),
         do_rope_shift (worst_case || kv_self.has_shift),
+        rope_cache    (lctx.rope_cache),
         cb            (cb),
         buf_compute   (lctx.buf_compute) {
             GGML_ASSERT(!!kv_self.ctx);
@@ -3570,6 +4860,11 @@ struct llm_build_context {
         };
 
         ctx0 = ggml_init(params);
+
+        if (kv_self.paged) {
+            inp_kv_slot = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+            cb(inp_kv_slot, "kv_slot", -1);
+        }
     }
 
     void free() {
@@ -3580,7 +4875,7 @@ struct llm_build_context {
     }
 
     struct ggml_cgraph * build_llama() {
-        struct ggml_cgraph * gf = ggml_new_graph(ctx0);
+        struct ggml_cgraph * gf = ggml_new_graph_custom(ctx0, llama_graph_size(model), false);
 
         GGML_ASSERT(n_embd_head == hparams.n_rot);
 
@@ -3619,32 +4914,51 @@ struct llm_build_context {
             // self-attention
             {
                 // compute Q and K and RoPE them
-                struct ggml_tensor * Qcur = ggml_mul_mat(ctx0, model.layers[il].wq, cur);
-                cb(Qcur, "Qcur", il);
+                struct ggml_tensor * Qcur;
+                struct ggml_tensor * Kcur;
+                struct ggml_tensor * Vcur;
+
+                if (model.layers[il].wqkv) {
+                    // the projections were fused at load time, see llm_fuse_weights
+                    cur = ggml_mul_mat(ctx0, model.layers[il].wqkv, cur);
+                    cb(cur, "wqkv", il);
+
+                    Qcur = ggml_view_3d(ctx0, cur, n_embd_head, n_head,    n_tokens, ggml_element_size(cur)*n_embd_head, cur->nb[1], 0);
+                    Kcur = ggml_view_3d(ctx0, cur, n_embd_head, n_head_kv, n_tokens, ggml_element_size(cur)*n_embd_head, cur->nb[1], ggml_element_size(cur)*n_embd);
+                    Vcur = ggml_view_2d(ctx0, cur, n_embd_gqa, n_tokens, cur->nb[1], ggml_element_size(cur)*(n_embd + n_embd_gqa));
+                    cb(Vcur, "Vcur", il);
+                } else {
+                    Qcur = ggml_mul_mat(ctx0, model.layers[il].wq, cur);
+                    cb(Qcur, "Qcur", il);
 
-                struct ggml_tensor * Kcur = ggml_mul_mat(ctx0, model.layers[il].wk, cur);
-                cb(Kcur, "Kcur", il);
+                    Kcur = ggml_mul_mat(ctx0, model.layers[il].wk, cur);
+                    cb(Kcur, "Kcur", il);
 
-                struct ggml_tensor * Vcur = ggml_mul_mat(ctx0, model.layers[il].wv, cur);
-                cb(Vcur, "Vcur", il);
+                    Vcur = ggml_mul_mat(ctx0, model.layers[il].wv, cur);
+                    cb(Vcur, "Vcur", il);
 
-                Qcur = ggml_rope_custom(
-                    ctx0, ggml_reshape_3d(ctx0, Qcur, n_embd_head, n_head,    n_tokens), inp_pos,
+                    Qcur = ggml_reshape_3d(ctx0, Qcur, n_embd_head, n_head,    n_tokens);
+                    Kcur = ggml_reshape_3d(ctx0, Kcur, n_embd_head, n_head_kv, n_tokens);
+                }
+
+                // rope_cache is NULL or was made with these parameters, see llama_rope_cache_init
+                Qcur = ggml_rope_custom_cached(
+                    ctx0, Qcur, inp_pos, rope_cache,
                     n_embd_head, 0, 0, n_orig_ctx, freq_base, freq_scale,
                     ext_factor, attn_factor, beta_fast, beta_slow
                 );
                 cb(Qcur, "Qcur", il);
 
-                Kcur = ggml_rope_custom(
-                    ctx0, ggml_reshape_3d(ctx0, Kcur, n_embd_head, n_head_kv, n_tokens), inp_pos,
+                Kcur = ggml_rope_custom_cached(
+                    ctx0, Kcur, inp_pos, rope_cache,
                     n_embd_head, 0, 0, n_orig_ctx, freq_base, freq_scale,
                     ext_factor, attn_factor, beta_fast, beta_slow
                 );
                 cb(Kcur, "Kcur", il);
 
-                llm_build_kv_store(ctx0, hparams, kv_self, gf, Kcur, Vcur, n_ctx, n_tokens, kv_head, cb, il);
+                llm_build_kv_store(ctx0, hparams, kv_self, gf, Kcur, Vcur, n_ctx, n_tokens, kv_head, inp_kv_slot, cb, il);
 
-                cur = llm_build_kqv(ctx0, hparams, kv_self,
+                cur = llm_build_kqv(ctx0, hparams, cparams, kv_self,
                         model.layers[il].wo, NULL,
                         Qcur, KQ_scale, KQ_mask, n_ctx, n_tokens, n_kv, -1.0f, cb, il);
                 cb(cur, "kqv_out", il);
@@ -3660,11 +4974,18 @@ struct llm_build_context {
                         LLM_NORM_RMS, cb, il);
                 cb(cur, "ffn_norm", il);
 
-                cur = llm_build_ffn(ctx0, cur,
-                        model.layers[il].ffn_up,   NULL,
-                        model.layers[il].ffn_gate, NULL,
-                        model.layers[il].ffn_down, NULL,
-                        LLM_FFN_SILU, LLM_FFN_PAR, cb, il);
+                if (model.layers[il].ffn_gate_up) {
+                    cur = llm_build_ffn_gate_up(ctx0, cur,
+                            model.layers[il].ffn_gate_up,
+                            model.layers[il].ffn_down,
+                            cb, il);
+                } else {
+                    cur = llm_build_ffn(ctx0, cur,
+                            model.layers[il].ffn_up,   NULL,
+                            model.layers[il].ffn_gate, NULL,
+                            model.layers[il].ffn_down, NULL,
+                            LLM_FFN_SILU, LLM_FFN_PAR, cb, il);
+                }
                 cb(cur, "ffn_out", il);
             }
 
@@ -3692,7 +5013,7 @@ struct llm_build_context {
     }
 
     struct ggml_cgraph * build_baichuan() {
-        struct ggml_cgraph * gf = ggml_new_graph(ctx0);
+        struct ggml_cgraph * gf = ggml_new_graph_custom(ctx0, llama_graph_size(model), false);
 
         struct ggml_tensor * cur;
         struct ggml_tensor * inpL;
@@ -3759,12 +5080,12 @@ struct llm_build_context {
                 cb(Qcur, "Qcur", il);
                 cb(Kcur, "Kcur", il);
 
-                llm_build_kv_store(ctx0, hparams, kv_self, gf, Kcur, Vcur, n_ctx, n_tokens, kv_head, cb, il);
+                llm_build_kv_store(ctx0, hparams, kv_self, gf, Kcur, Vcur, n_ctx, n_tokens, kv_head, inp_kv_slot, cb, il);
 
                 // apply ALiBi for 13B model
                 const float max_alibi_bias = model.type == MODEL_13B ? 8.0f : -1.0f;
 
-                cur = llm_build_kqv(ctx0, hparams, kv_self,
+                cur = llm_build_kqv(ctx0, hparams, cparams, kv_self,
                         model.layers[il].wo, NULL,
                         Qcur, KQ_scale, KQ_mask, n_ctx, n_tokens, n_kv, max_alibi_bias, cb, il);
                 cb(cur, "kqv_out", il);
@@ -3812,7 +5133,7 @@ struct llm_build_context {
     }
 
     struct ggml_cgraph * build_falcon() {
-        struct ggml_cgraph * gf = ggml_new_graph(ctx0);
+        struct ggml_cgraph * gf = ggml_new_graph_custom(ctx0, llama_graph_size(model), false);
 
         struct ggml_tensor * cur;
         struct ggml_tensor * inpL;
@@ -3886,9 +5207,9 @@ struct llm_build_context {
                 );
                 cb(Kcur, "Kcur", il);
 
-                llm_build_kv_store(ctx0, hparams, kv_self, gf, Kcur, Vcur, n_ctx, n_tokens, kv_head, cb, il);
+                llm_build_kv_store(ctx0, hparams, kv_self, gf, Kcur, Vcur, n_ctx, n_tokens, kv_head, inp_kv_slot, cb, il);
 
-                cur = llm_build_kqv(ctx0, hparams, kv_self,
+                cur = llm_build_kqv(ctx0, hparams, cparams, kv_self,
                         model.layers[il].wo, NULL,
                         Qcur, KQ_scale, KQ_mask, n_ctx, n_tokens, n_kv, -1.0f, cb, il);
                 cb(cur, "kqv_out", il);
@@ -3934,7 +5255,7 @@ struct llm_build_context {
     }
 
     struct ggml_cgraph * build_starcoder() {
-        struct ggml_cgraph * gf = ggml_new_graph(ctx0);
+        struct ggml_cgraph * gf = ggml_new_graph_custom(ctx0, llama_graph_size(model), false);
 
         struct ggml_tensor * cur;
         struct ggml_tensor * pos;
@@ -3986,9 +5307,9 @@ struct llm_build_context {
 
                 Qcur = ggml_reshape_3d(ctx0, Qcur, n_embd_head, n_head, n_tokens);
 
-                llm_build_kv_store(ctx0, hparams, kv_self, gf, Kcur, Vcur, n_ctx, n_tokens, kv_head, cb, il);
+                llm_build_kv_store(ctx0, hparams, kv_self, gf, Kcur, Vcur, n_ctx, n_tokens, kv_head, inp_kv_slot, cb, il);
 
-                cur = llm_build_kqv(ctx0, hparams, kv_self,
+                cur = llm_build_kqv(ctx0, hparams, cparams, kv_self,
                         model.layers[il].wo, model.layers[il].bo,
                         Qcur, KQ_scale, KQ_mask, n_ctx, n_tokens, n_kv, -1.0f, cb, il);
                 cb(cur, "kqv_out", il);
@@ -4033,7 +5354,7 @@ struct llm_build_context {
     }
 
     struct ggml_cgraph * build_persimmon() {
-        struct ggml_cgraph * gf = ggml_new_graph(ctx0);
+        struct ggml_cgraph * gf = ggml_new_graph_custom(ctx0, llama_graph_size(model), false);
 
         const int64_t n_rot = n_embd_head / 2;
 
@@ -4192,10 +5513,10 @@ struct llm_build_context {
                         );
                 cb(Vcur, "Vcur", il);
 
-                llm_build_kv_store(ctx0, hparams, kv_self, gf, Kcur, Vcur, n_ctx, n_tokens, kv_head, cb, il);
+                llm_build_kv_store(ctx0, hparams, kv_self, gf, Kcur, Vcur, n_ctx, n_tokens, kv_head, inp_kv_slot, cb, il);
 
                 // TODO: not tested, could be broken
-                cur = llm_build_kqv(ctx0, hparams, kv_self,
+                cur = llm_build_kqv(ctx0, hparams, cparams, kv_self,
                         model.layers[il].wo, model.layers[il].bo,
                         Q, KQ_scale, KQ_mask, n_ctx, n_tokens, n_kv, -1.0f, cb, il);
                 cb(cur, "kqv_out", il);
@@ -4243,7 +5564,7 @@ struct llm_build_context {
     }
 
     struct ggml_cgraph * build_refact() {
-        struct ggml_cgraph * gf = ggml_new_graph(ctx0);
+        struct ggml_cgraph * gf = ggml_new_graph_custom(ctx0, llama_graph_size(model), false);
 
         struct ggml_tensor * cur;
         struct ggml_tensor * inpL;
@@ -4284,9 +5605,9 @@ struct llm_build_context {
                 Qcur = ggml_reshape_3d(ctx0, Qcur, n_embd_head, n_head,    n_tokens);
                 cb(Qcur, "Qcur", il);
 
-                llm_build_kv_store(ctx0, hparams, kv_self, gf, Kcur, Vcur, n_ctx, n_tokens, kv_head, cb, il);
+                llm_build_kv_store(ctx0, hparams, kv_self, gf, Kcur, Vcur, n_ctx, n_tokens, kv_head, inp_kv_slot, cb, il);
 
-                cur = llm_build_kqv(ctx0, hparams, kv_self,
+                cur = llm_build_kqv(ctx0, hparams, cparams, kv_self,
                         model.layers[il].wo, NULL,
                         Qcur, KQ_scale, KQ_mask, n_ctx, n_tokens, n_kv, 8.0f, cb, il);
                 cb(cur, "kqv_out", il);
@@ -4334,7 +5655,7 @@ struct llm_build_context {
     }
 
     struct ggml_cgraph * build_bloom() {
-        struct ggml_cgraph * gf = ggml_new_graph(ctx0);
+        struct ggml_cgraph * gf = ggml_new_graph_custom(ctx0, llama_graph_size(model), false);
 
         struct ggml_tensor * cur;
         struct ggml_tensor * inpL;
@@ -4381,9 +5702,9 @@ struct llm_build_context {
 
                 Qcur = ggml_reshape_3d(ctx0, Qcur, n_embd_head, n_head, n_tokens);
 
-                llm_build_kv_store(ctx0, hparams, kv_self, gf, Kcur, Vcur, n_ctx, n_tokens, kv_head, cb, il);
+                llm_build_kv_store(ctx0, hparams, kv_self, gf, Kcur, Vcur, n_ctx, n_tokens, kv_head, inp_kv_slot, cb, il);
 
-                cur = llm_build_kqv(ctx0, hparams, kv_self,
+                cur = llm_build_kqv(ctx0, hparams, cparams, kv_self,
                         model.layers[il].wo, model.layers[il].bo,
                         Qcur, KQ_scale, KQ_mask, n_ctx, n_tokens, n_kv, 8.0f, cb, il);
                 cb(cur, "kqv_out", il);
@@ -4428,7 +5749,7 @@ struct llm_build_context {
     }
 
     struct ggml_cgraph * build_mpt() {
-        struct ggml_cgraph * gf = ggml_new_graph(ctx0);
+        struct ggml_cgraph * gf = ggml_new_graph_custom(ctx0, llama_graph_size(model), false);
 
         struct ggml_tensor * cur;
         struct ggml_tensor * inpL;
@@ -4475,9 +5796,9 @@ struct llm_build_context {
 
                 Qcur = ggml_reshape_3d(ctx0, Qcur, n_embd_head, n_head, n_tokens);
 
-                llm_build_kv_store(ctx0, hparams, kv_self, gf, Kcur, Vcur, n_ctx, n_tokens, kv_head, cb, il);
+                llm_build_kv_store(ctx0, hparams, kv_self, gf, Kcur, Vcur, n_ctx, n_tokens, kv_head, inp_kv_slot, cb, il);
 
-                cur = llm_build_kqv(ctx0, hparams, kv_self,
+                cur = llm_build_kqv(ctx0, hparams, cparams, kv_self,
                         model.layers[il].wo, NULL,
                         Qcur, KQ_scale, KQ_mask, n_ctx, n_tokens, n_kv, hparams.f_max_alibi_bias, cb, il);
                 cb(cur, "kqv_out", il);
@@ -4678,6 +5999,7 @@ static const std::unordered_map<const char *, llm_offload_func_e> k_offload_map
     { "ffn_up_b",                   OFFLOAD_FUNC     },
     { "ffn_gate",                   OFFLOAD_FUNC     },
     { "ffn_gate_b",                 OFFLOAD_FUNC     },
+    { "ffn_gate_up",                OFFLOAD_FUNC     },
     { "ffn_gate_par",               OFFLOAD_FUNC     },
     { "ffn_down",                   OFFLOAD_FUNC     },
     { "ffn_down_b",                 OFFLOAD_FUNC     },
@@ -4704,6 +6026,10 @@ static struct ggml_cgraph * llama_build_graph(
     // check if we should build the worst-case graph (for memory measurement)
     const bool worst_case = ggml_allocr_is_measure(lctx.alloc);
 
+    // the previous graph is overwritten by this one
+    auto & graph = lctx.graph;
+    graph = llama_graph_cache();
+
     // keep track of the input that has already been allocated
     bool alloc_inp_tokens   = false;
     bool alloc_inp_embd     = false;
@@ -4711,6 +6037,7 @@ static struct ggml_cgraph * llama_build_graph(
     bool alloc_inp_KQ_scale = false;
     bool alloc_inp_KQ_mask  = false;
     bool alloc_inp_K_shift  = false;
+    bool alloc_inp_kv_slot  = false;
 
 #ifdef GGML_USE_CUBLAS
     const bool do_offload = true;
@@ -4730,103 +6057,59 @@ static struct ggml_cgraph * llama_build_graph(
         }
 
         //
-        // allocate input tensors and set input data
+        // allocate input tensors, their data is set by llama_set_inputs
         //
         // TODO: will be removed with backend v2
 
         if (!alloc_inp_tokens && strcmp(name, "inp_tokens") == 0) {
             ggml_allocr_alloc(lctx.alloc, cur);
-
-            if (!ggml_allocr_is_measure(lctx.alloc) && batch.token) {
-                const int64_t n_tokens = cur->ne[0];
-
-                memcpy(cur->data, batch.token, n_tokens*ggml_element_size(cur));
-            }
-
+            graph.inp_tokens = cur;
             alloc_inp_tokens = true;
         }
 
         if (!alloc_inp_embd && strcmp(name, "inp_embd") == 0) {
             ggml_allocr_alloc(lctx.alloc, cur);
-
-            if (!ggml_allocr_is_measure(lctx.alloc) && batch.embd) {
-                const int64_t n_embd   = cur->ne[0];
-                const int64_t n_tokens = cur->ne[1];
-
-                memcpy(cur->data, batch.embd, n_tokens*n_embd*ggml_element_size(cur));
-            }
-
+            graph.inp_embd = cur;
             alloc_inp_embd = true;
         }
 
         if (!alloc_inp_pos && strcmp(name, "inp_pos") == 0) {
             ggml_allocr_alloc(lctx.alloc, cur);
-
-            if (!ggml_allocr_is_measure(lctx.alloc) && batch.pos) {
-                const int64_t n_tokens = cur->ne[0];
-
-                int32_t * data = (int32_t *) cur->data;
-
-                for (int i = 0; i < n_tokens; ++i) {
-                    data[i] = batch.pos[i];
-                }
-            }
-
+            graph.inp_pos = cur;
             alloc_inp_pos = true;
         }
 
         if (!alloc_inp_KQ_scale && strcmp(name, "KQ_scale") == 0) {
             ggml_allocr_alloc(lctx.alloc, cur);
-
-            if (!ggml_allocr_is_measure(lctx.alloc)) {
-                const int64_t n_embd_head = model.hparams.n_embd_head();
-                ggml_set_f32(cur, 1.0f/sqrtf(float(n_embd_head)));
-            }
-
+            graph.KQ_scale = cur;
             alloc_inp_KQ_scale = true;
         }
 
         if (!alloc_inp_KQ_mask && strcmp(name, "KQ_mask") == 0) {
             ggml_allocr_alloc(lctx.alloc, cur);
-
-            if (!ggml_allocr_is_measure(lctx.alloc)) {
-                const int64_t n_kv     = cur->ne[0];
-                const int64_t n_tokens = cur->ne[1];
-
-                float * data = (float *) cur->data;
-                memset(data, 0, ggml_nbytes(cur));
-
-                for (int h = 0; h < 1; ++h) {
-                    for (int j = 0; j < n_tokens; ++j) {
-                        const llama_pos    pos    = batch.pos[j];
-                        const llama_seq_id seq_id = batch.seq_id[j][0];
-
-                        for (int i = 0; i < n_kv; ++i) {
-                            if (!lctx.kv_self.cells[i].has_seq_id(seq_id) || lctx.kv_self.cells[i].pos > pos) {
-                                data[h*(n_kv*n_tokens) + j*n_kv + i] = -INFINITY;
-                            }
-                        }
-                    }
-                }
-            }
-
+            graph.KQ_mask = cur;
             alloc_inp_KQ_mask = true;
         }
 
         if (!alloc_inp_K_shift && strcmp(name, "K_shift") == 0) {
             ggml_allocr_alloc(lctx.alloc, cur);
+            graph.K_shift = cur;
+            alloc_inp_K_shift = true;
+        }
 
-            if (!ggml_allocr_is_measure(lctx.alloc)) {
-                const int64_t n_ctx = cur->ne[0];
-
-                int32_t * data = (int32_t *) cur->data;
+        if (!alloc_inp_kv_slot && strcmp(name, "kv_slot") == 0) {
+            ggml_allocr_alloc(lctx.alloc, cur);
+            graph.kv_slot = cur;
+            alloc_inp_kv_slot = true;
+        }
 
-                for (int i = 0; i < n_ctx; ++i) {
-                    data[i] = lctx.kv_self.cells[i].delta;
-                }
-            }
+        // the views that store the new K and V move with the head of the cache when the graph is reused
+        if (strcmp(name, "k_cache_view") == 0) {
+            graph.kv_store.emplace_back(cur, ggml_element_size(lctx.kv_self.k)*model.hparams.n_embd_gqa());
+        }
 
-            alloc_inp_K_shift = true;
+        if (strcmp(name, "v_cache_view") == 0) {
+            graph.kv_store.emplace_back(cur, ggml_element_size(lctx.kv_self.v));
         }
 
         // view tensors are not processed further
@@ -4945,83 +6228,349 @@ static struct ggml_cgraph * llama_build_graph(
             default: GGML_ASSERT(false);
         }
 
-        // apply offload function to the tensor
-        func(cur);
+        // apply offload function to the tensor
+        func(cur);
+
+#ifdef LLAMA_OFFLOAD_DEBUG
+        if (worst_case) {
+            LLAMA_LOG_INFO("%s: %32s: %s\n", __func__, cur->name, k_offload_func_name.at(func_e).c_str());
+        }
+#endif
+    };
+
+    struct ggml_cgraph * result = NULL;
+
+    struct llm_build_context llm(lctx, batch, cb, worst_case);
+
+    llm.init();
+
+    switch (model.arch) {
+        case LLM_ARCH_LLAMA:
+            {
+                result = llm.build_llama();
+            } break;
+        case LLM_ARCH_BAICHUAN:
+            {
+                result = llm.build_baichuan();
+            } break;
+        case LLM_ARCH_FALCON:
+            {
+                result = llm.build_falcon();
+            } break;
+        case LLM_ARCH_STARCODER:
+            {
+                result = llm.build_starcoder();
+            } break;
+        case LLM_ARCH_PERSIMMON:
+            {
+                result = llm.build_persimmon();
+            } break;
+        case LLM_ARCH_REFACT:
+            {
+                result = llm.build_refact();
+            } break;
+        case LLM_ARCH_BLOOM:
+            {
+                result = llm.build_bloom();
+            } break;
+        case LLM_ARCH_MPT:
+            {
+                result = llm.build_mpt();
+            } break;
+        default:
+            GGML_ASSERT(false);
+    }
+
+    if (worst_case) {
+        int n_non_view_total = 0;
+
+        for (int i = 0; i < result->n_nodes; ++i) {
+            if (result->nodes[i]->view_src == nullptr) {
+                n_non_view_total++;
+            }
+        }
+
+        LLAMA_LOG_INFO("%s: non-view tensors processed: %d/%d\n", __func__, n_non_view, n_non_view_total);
+
+        if (n_non_view != n_non_view_total) {
+            LLAMA_LOG_WARN("%s: ****************************************************************\n", __func__);
+            LLAMA_LOG_WARN("%s: not all non-view tensors have been processed with a callback\n",     __func__);
+            LLAMA_LOG_WARN("%s: this can indicate an inefficiency in the graph implementation\n",    __func__);
+            LLAMA_LOG_WARN("%s: build with LLAMA_OFFLOAD_DEBUG for more info\n",                     __func__);
+            LLAMA_LOG_WARN("%s: ref: https://github.com/ggerganov/llama.cpp/pull/3837\n",            __func__);
+            LLAMA_LOG_WARN("%s: ****************************************************************\n", __func__);
+        }
+    }
+
+    // use the fused ops for the norms, the SwiGLU and the residual adds of all architectures
+    // and convert the inputs of the projections that share them (Q, K, V and gate, up) to the vec_dot_type once
+    if (lctx.cparams.fused_ops) {
+        ggml_graph_fuse(llm.ctx0, result);
+        ggml_graph_share_src1(llm.ctx0, result);
+    }
+
+    llm.free();
+
+    // group independent nodes (e.g. the Q, K and V projections) so that the CPU backend can compute them concurrently
+    ggml_graph_reorder_concurrent(result);
+
+    if (!worst_case) {
+        // the copies into the cache are views of the same cells as their destination
+        const size_t n_kv_store = graph.kv_store.size();
+        for (int i = 0; i < result->n_nodes; ++i) {
+            struct ggml_tensor * node = result->nodes[i];
+            if (node->op != GGML_OP_CPY) {
+                continue;
+            }
+            for (size_t j = 0; j < n_kv_store; ++j) {
+                if (node->src[1] == graph.kv_store[j].first) {
+                    graph.kv_store.emplace_back(node, graph.kv_store[j].second);
+                    break;
+                }
+            }
+        }
+
+        graph.gf       = result;
+        graph.n_tokens = batch.n_tokens;
+        graph.n_kv     = lctx.kv_self.n;
+        graph.kv_head  = lctx.kv_self.head;
+        graph.embd     = batch.embd != nullptr;
+        graph.k_shift  = lctx.kv_self.has_shift;
+    }
+
+    return result;
+}
+
+// check if the graph of the previous decode call can compute the batch
+static bool llama_graph_can_reuse(const llama_context & lctx, const llama_batch & batch) {
+    const auto & graph = lctx.graph;
+
+    return lctx.cparams.reuse_graph &&
+        graph.gf != NULL &&
+        graph.n_tokens == batch.n_tokens &&
+        graph.n_kv     == (int32_t) lctx.kv_self.n &&
+        graph.embd     == (batch.embd != nullptr) &&
+        graph.k_shift  == lctx.kv_self.has_shift;
+}
+
+// move the views that store the new K and V to the current head of the cache
+static void llama_graph_set_kv_head(llama_context & lctx) {
+    auto & graph = lctx.graph;
+
+    const int32_t kv_head = lctx.kv_self.head;
+    if (graph.kv_head == kv_head) {
+        return;
+    }
+
+    for (auto & it : graph.kv_store) {
+        struct ggml_tensor * t = it.first;
+
+        t->view_offs = t->view_offs + (kv_head - graph.kv_head)*it.second;
+        t->data      = (char *) t->view_src->data + t->view_offs;
+    }
+
+    graph.kv_head = kv_head;
+}
+
+// set the data of the input tensors of the graph for the batch
+static void llama_set_inputs(llama_context & lctx, const llama_batch & batch) {
+    const auto & hparams = lctx.model.hparams;
+    const auto & graph   = lctx.graph;
+
+    if (graph.inp_tokens && batch.token) {
+        const int64_t n_tokens = graph.inp_tokens->ne[0];
+
+        memcpy(graph.inp_tokens->data, batch.token, n_tokens*ggml_element_size(graph.inp_tokens));
+    }
+
+    if (graph.inp_embd && batch.embd) {
+        const int64_t n_embd   = graph.inp_embd->ne[0];
+        const int64_t n_tokens = graph.inp_embd->ne[1];
+
+        memcpy(graph.inp_embd->data, batch.embd, n_tokens*n_embd*ggml_element_size(graph.inp_embd));
+    }
+
+    if (graph.inp_pos && batch.pos) {
+        const int64_t n_tokens = graph.inp_pos->ne[0];
+
+        int32_t * data = (int32_t *) graph.inp_pos->data;
+
+        for (int i = 0; i < n_tokens; ++i) {
+            data[i] = batch.pos[i];
+        }
+    }
+
+    if (graph.KQ_scale) {
+        ggml_set_f32(graph.KQ_scale, llm_kq_scale(hparams));
+    }
+
+    if (graph.KQ_mask) {
+        const int64_t n_kv     = graph.KQ_mask->ne[0];
+        const int64_t n_tokens = graph.KQ_mask->ne[1];
+
+        float * data = (float *) graph.KQ_mask->data;
+
+        // the positions of the cells of the sequence of the tokens, the other cells are never visible
+        // they are gathered once for each run of tokens of the same sequence
+        std::vector<llama_pos> & seq_pos = lctx.buf_seq_pos;
+        seq_pos.resize(n_kv);
+
+        llama_seq_id seq_id_cur = -1;
+
+        for (int h = 0; h < 1; ++h) {
+            for (int j = 0; j < n_tokens; ++j) {
+                const llama_pos    pos    = batch.pos[j];
+                const llama_seq_id seq_id = batch.seq_id[j][0];
+
+                if (seq_id != seq_id_cur) {
+                    for (int i = 0; i < n_kv; ++i) {
+                        const auto & cell = lctx.kv_self.cells[i];
+                        seq_pos[i] = cell.has_seq_id(seq_id) ? cell.pos : std::numeric_limits<llama_pos>::max();
+                    }
+                    seq_id_cur = seq_id;
+                }
+
+                float * row = data + h*(n_kv*n_tokens) + j*n_kv;
+                for (int i = 0; i < n_kv; ++i) {
+                    row[i] = seq_pos[i] <= pos ? 0.0f : -INFINITY;
+                }
+            }
+        }
+    }
+
+    if (graph.kv_slot) {
+        memcpy(graph.kv_slot->data, lctx.kv_self.slot.data(), ggml_nbytes(graph.kv_slot));
+    }
+
+    if (graph.K_shift) {
+        const int64_t n_ctx = graph.K_shift->ne[0];
+
+        int32_t * data = (int32_t *) graph.K_shift->data;
+
+        for (int i = 0; i < n_ctx; ++i) {
+            data[i] = lctx.kv_self.cells[i].delta;
+        }
+    }
+}
+
+// the K and V of the cache are in host memory, so that the CPU can move and copy their cells
+static bool llama_kv_cache_is_host(const struct llama_kv_cache & cache) {
+    return cache.k->backend == GGML_BACKEND_CPU && cache.v->backend == GGML_BACKEND_CPU;
+}
+
+// a run of consecutive cells moved by the defragmentation
+struct llama_kv_move {
+    uint32_t src;
+    uint32_t dst;
+    uint32_t len;
+};
+
+struct llama_kv_defrag_data {
+    const llama_kv_cache * kv;
+    const std::vector<llama_kv_move> * moves;
+    int64_t n_layer;
+    int64_t n_embd_gqa;
+};
+
+// custom op of the defragmentation: copy the moved cells of the layers [ith*n_layer/nth, (ith + 1)*n_layer/nth)
+// a cell is a row of K and a column of V
+static void llama_kv_cache_defrag_copy(struct ggml_tensor * dst, const struct ggml_tensor * a, int ith, int nth, void * userdata) {
+    GGML_UNUSED(dst);
+    GGML_UNUSED(a);
+
+    const auto & data    = *(const llama_kv_defrag_data *) userdata;
+    const auto & kv_self = *data.kv;
+
+    const int64_t n_embd_gqa = data.n_embd_gqa;
+    const int64_t n_ctx      = kv_self.size;
 
-#ifdef LLAMA_OFFLOAD_DEBUG
-        if (worst_case) {
-            LLAMA_LOG_INFO("%s: %32s: %s\n", __func__, cur->name, k_offload_func_name.at(func_e).c_str());
-        }
-#endif
-    };
+    const size_t k_row  = ggml_element_size(kv_self.k)*n_embd_gqa;
+    const size_t v_elem = ggml_element_size(kv_self.v);
 
-    struct ggml_cgraph * result = NULL;
+    const int64_t il0 = ith*data.n_layer/nth;
+    const int64_t il1 = (ith + 1)*data.n_layer/nth;
 
-    struct llm_build_context llm(lctx, batch, cb, worst_case);
+    for (int64_t il = il0; il < il1; ++il) {
+        char * k = (char *) kv_self.k->data + il*n_ctx*k_row;
+        char * v = (char *) kv_self.v->data + il*n_ctx*n_embd_gqa*v_elem;
 
-    llm.init();
+        for (const auto & m : *data.moves) {
+            memcpy(k + m.dst*k_row, k + m.src*k_row, m.len*k_row);
 
-    switch (model.arch) {
-        case LLM_ARCH_LLAMA:
-            {
-                result = llm.build_llama();
-            } break;
-        case LLM_ARCH_BAICHUAN:
-            {
-                result = llm.build_baichuan();
-            } break;
-        case LLM_ARCH_FALCON:
-            {
-                result = llm.build_falcon();
-            } break;
-        case LLM_ARCH_STARCODER:
-            {
-                result = llm.build_starcoder();
-            } break;
-        case LLM_ARCH_PERSIMMON:
-            {
-                result = llm.build_persimmon();
-            } break;
-        case LLM_ARCH_REFACT:
-            {
-                result = llm.build_refact();
-            } break;
-        case LLM_ARCH_BLOOM:
-            {
-                result = llm.build_bloom();
-            } break;
-        case LLM_ARCH_MPT:
-            {
-                result = llm.build_mpt();
-            } break;
-        default:
-            GGML_ASSERT(false);
+            for (int64_t i = 0; i < n_embd_gqa; ++i) {
+                memcpy(v + (i*n_ctx + m.dst)*v_elem, v + (i*n_ctx + m.src)*v_elem, m.len*v_elem);
+            }
+        }
     }
+}
 
-    llm.free();
+// move the used cells to the free cells at the front of the cache, as runs of consecutive cells
+// the K and V of each layer are copied in place, the layers are split between the threads of the context pool
+static void llama_kv_cache_defrag_internal(struct llama_context & lctx) {
+    auto & kv_self = lctx.kv_self;
 
-    if (worst_case) {
-        int n_non_view_total = 0;
+    std::vector<llama_kv_move> moves;
 
-        for (int i = 0; i < result->n_nodes; ++i) {
-            if (result->nodes[i]->view_src == nullptr) {
-                n_non_view_total++;
-            }
+    // the cells after the first kv_self.used ones go to the free cells among them
+    uint32_t dst = 0;
+    for (uint32_t src = kv_self.used; src < kv_self.size; ++src) {
+        if (kv_self.cells[src].pos < 0) {
+            continue;
         }
 
-        LLAMA_LOG_INFO("%s: non-view tensors processed: %d/%d\n", __func__, n_non_view, n_non_view_total);
+        while (kv_self.cells[dst].pos >= 0) {
+            dst++;
+        }
 
-        if (n_non_view != n_non_view_total) {
-            LLAMA_LOG_WARN("%s: ****************************************************************\n", __func__);
-            LLAMA_LOG_WARN("%s: not all non-view tensors have been processed with a callback\n",     __func__);
-            LLAMA_LOG_WARN("%s: this can indicate an inefficiency in the graph implementation\n",    __func__);
-            LLAMA_LOG_WARN("%s: build with LLAMA_OFFLOAD_DEBUG for more info\n",                     __func__);
-            LLAMA_LOG_WARN("%s: ref: https://github.com/ggerganov/llama.cpp/pull/3837\n",            __func__);
-            LLAMA_LOG_WARN("%s: ****************************************************************\n", __func__);
+        if (!moves.empty() && moves.back().src + moves.back().len == src && moves.back().dst + moves.back().len == dst) {
+            moves.back().len++;
+        } else {
+            moves.push_back({ src, dst, 1 });
         }
+
+        kv_self.cells[dst] = kv_self.cells[src];
+        kv_self.cells[src] = llama_kv_cell();
     }
 
-    return result;
+    if (moves.empty()) {
+        return;
+    }
+
+    // the nodes of the prefix cache follow their cells
+    for (const auto & m : moves) {
+        for (uint32_t i = m.dst; i < m.dst + m.len; ++i) {
+            const auto & cell = kv_self.cells[i];
+            if (cell.node) {
+                cell.node->cells[cell.pos - cell.node->pos] = i;
+            }
+        }
+    }
+
+    const int64_t n_layer = lctx.model.hparams.n_layer;
+
+    llama_kv_defrag_data data = { &kv_self, &moves, n_layer, (int64_t) lctx.model.hparams.n_embd_gqa() };
+
+    // a graph with a single custom op, so that the copies run on the same threads as the decode
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ ggml_tensor_overhead() + ggml_graph_overhead(),
+        /*.mem_buffer =*/ NULL,
+        /*.no_alloc   =*/ true,
+    };
+
+    ggml_context * ctx0 = ggml_init(params);
+    ggml_cgraph  * gf   = ggml_new_graph(ctx0);
+
+    const int n_threads = std::max(1, (int) std::min<int64_t>(lctx.cparams.n_threads_batch, n_layer));
+
+    ggml_build_forward_expand(gf, ggml_map_custom1_inplace(ctx0, kv_self.k, llama_kv_cache_defrag_copy, n_threads, &data));
+
+    ggml_graph_compute_helper(lctx.work_buffer, gf, n_threads, llama_get_threadpool(lctx, n_threads));
+
+    ggml_free(ctx0);
+
+    llama_kv_cache_recount(kv_self);
+
+    kv_self.head = kv_self.used < kv_self.size ? kv_self.used : 0;
 }
 
 // decode a batch of tokens by evaluating the transformer
@@ -5103,23 +6652,50 @@ static int llama_decode_internal(
         batch.seq_id = seq_id_arr.data();
     }
 
+    for (uint32_t i = 0; i < n_tokens; i++) {
+        for (int32_t j = 0; j < batch.n_seq_id[i]; j++) {
+            if (batch.seq_id[i][j] < 0 || batch.seq_id[i][j] >= LLAMA_MAX_SEQ) {
+                LLAMA_LOG_ERROR("%s: invalid seq_id[%d][%d] = %d >= %d\n", __func__, i, j, batch.seq_id[i][j], LLAMA_MAX_SEQ);
+                return -1;
+            }
+        }
+    }
+
+    // defragment the cache when too many of the cells below the last used one are free
+    if (cparams.defrag_thold >= 0.0f && llama_kv_cache_is_host(kv_self)) {
+        const int32_t cell_max = llama_kv_cache_cell_max(kv_self);
+
+        if (cell_max >= 4*LLAMA_KV_BLOCK_SIZE && 1.0f - float(kv_self.used)/cell_max > cparams.defrag_thold) {
+            llama_kv_cache_defrag_internal(lctx);
+        }
+    }
+
     if (!llama_kv_cache_find_slot(kv_self, batch)) {
         return 1;
     }
 
     // a heuristic, to avoid attending the full cache if it is not yet utilized
-    // after enough generations, the benefit from this heuristic disappears
-    // if we start defragmenting the cache, the benefit from this will be more important
-    //kv_self.n = std::max(32, GGML_PAD(llama_kv_cache_cell_max(kv_self), 32));   // TODO: this might be better for CUDA?
-    kv_self.n = std::min((int32_t) cparams.n_ctx, std::max(32, llama_kv_cache_cell_max(kv_self)));
+    // after enough generations, the used cells are spread over the cache, unless it is defragmented
+    // n is padded so that the same graph can be reused for the next generated tokens
+    kv_self.n = std::min((int32_t) cparams.n_ctx, std::max(32, GGML_PAD(llama_kv_cache_cell_max(kv_self), 32)));
 
     //printf("kv_self.n = %d\n", kv_self.n);
 
-    ggml_allocr_reset(lctx.alloc);
+    ggml_cgraph * gf = NULL;
+
+    if (llama_graph_can_reuse(lctx, batch)) {
+        gf = lctx.graph.gf;
+
+        llama_graph_set_kv_head(lctx);
+    } else {
+        ggml_allocr_reset(lctx.alloc);
+
+        gf = llama_build_graph(lctx, batch);
 
-    ggml_cgraph * gf = llama_build_graph(lctx, batch);
+        ggml_allocr_alloc_graph(lctx.alloc, gf);
+    }
 
-    ggml_allocr_alloc_graph(lctx.alloc, gf);
+    llama_set_inputs(lctx, batch);
 
     struct ggml_tensor * res        = gf->nodes[gf->n_nodes - 1];
     struct ggml_tensor * embeddings = gf->nodes[gf->n_nodes - 2];
@@ -5185,17 +6761,17 @@ static int llama_decode_internal(
         ggml_metal_set_n_cb     (lctx.ctx_metal, n_threads);
         ggml_metal_graph_compute(lctx.ctx_metal, gf);
     } else {
-        ggml_graph_compute_helper(lctx.work_buffer, gf, n_threads);
+        ggml_graph_compute_helper(lctx.work_buffer, gf, n_threads, llama_get_threadpool(lctx, n_threads), lctx.trace);
     }
 #else
-    ggml_graph_compute_helper(lctx.work_buffer, gf, n_threads);
+    ggml_graph_compute_helper(lctx.work_buffer, gf, n_threads, llama_get_threadpool(lctx, n_threads), lctx.trace);
 #endif
 
 #if GGML_USE_MPI
     ggml_mpi_graph_compute_post(lctx.ctx_mpi, gf, n_layer);
 #endif
 
-    // update the kv ring buffer
+    // update the kv cache
     {
         if (kv_self.has_shift) {
             kv_self.has_shift = false;
@@ -5204,11 +6780,13 @@ static int llama_decode_internal(
             }
         }
 
-        kv_self.head += n_tokens;
+        if (!kv_self.paged) {
+            kv_self.head += n_tokens;
 
-        // Ensure kv cache head points to a valid index.
-        if (kv_self.head >= kv_self.size) {
-            kv_self.head = 0;
+            // Ensure kv cache head points to a valid index.
+            if (kv_self.head >= kv_self.size) {
+                kv_self.head = 0;
+            }
         }
     }
 
@@ -7235,7 +8813,7 @@ static void llama_convert_tensor_internal(
     float * f32_output = (float *) output.data();
 
     ggml_type_traits_t qtype;
-    if (ggml_is_quantized(tensor->type)) {
+    if (ggml_is_quantized(tensor->type) || tensor->type == GGML_TYPE_BF16) {
         qtype = ggml_internal_get_type_traits(tensor->type);
         if (qtype.to_float == NULL) {
             throw std::runtime_error(format("type %s unsupported for integer quantization: no dequantization available", ggml_type_name(tensor->type)));
@@ -7247,7 +8825,7 @@ static void llama_convert_tensor_internal(
     if (nthread < 2) {
         if (tensor->type == GGML_TYPE_F16) {
             ggml_fp16_to_fp32_row((ggml_fp16_t *)tensor->data, f32_output, nelements);
-        } else if (ggml_is_quantized(tensor->type)) {
+        } else if (ggml_is_quantized(tensor->type) || tensor->type == GGML_TYPE_BF16) {
             qtype.to_float(tensor->data, f32_output, nelements);
         } else {
             GGML_ASSERT(false); // unreachable
@@ -7406,6 +8984,7 @@ static void llama_model_quantize_internal(const std::string & fname_inp, const s
         case LLAMA_FTYPE_MOSTLY_Q5_1: quantized_type = GGML_TYPE_Q5_1; break;
         case LLAMA_FTYPE_MOSTLY_Q8_0: quantized_type = GGML_TYPE_Q8_0; break;
         case LLAMA_FTYPE_MOSTLY_F16:  quantized_type = GGML_TYPE_F16;  break;
+        case LLAMA_FTYPE_MOSTLY_BF16: quantized_type = GGML_TYPE_BF16; break;
         case LLAMA_FTYPE_ALL_F32:     quantized_type = GGML_TYPE_F32;  break;
 
         // K-quants
@@ -7682,6 +9261,16 @@ static int llama_apply_lora_from_file_internal(
 
     const int64_t t_start_lora_us = ggml_time_us();
 
+    if (model.repacked) {
+        LLAMA_LOG_ERROR("%s: a lora adapter cannot be applied to repacked weights, load the model without repack_weights\n", __func__);
+        return 1;
+    }
+
+    if (model.numa_placement == GGML_NUMA_PLACEMENT_REPLICATE) {
+        LLAMA_LOG_ERROR("%s: a lora adapter cannot be applied to replicated weights, load the model without numa_placement\n", __func__);
+        return 1;
+    }
+
     auto fin = std::ifstream(path_lora, std::ios::binary);
     if (!fin) {
         LLAMA_LOG_ERROR("%s: failed to open '%s'\n", __func__, path_lora);
@@ -7960,9 +9549,13 @@ struct llama_model_params llama_model_default_params() {
         /*.tensor_split                =*/ nullptr,
         /*.progress_callback           =*/ nullptr,
         /*.progress_callback_user_data =*/ nullptr,
+        /*.hugepages                   =*/ LLAMA_HUGEPAGES_NONE,
+        /*.numa_placement              =*/ GGML_NUMA_PLACEMENT_NONE,
         /*.vocab_only                  =*/ false,
         /*.use_mmap                    =*/ true,
         /*.use_mlock                   =*/ false,
+        /*.fuse_weights                =*/ false,
+        /*.repack_weights              =*/ false,
     };
 
 #ifdef GGML_USE_METAL
@@ -7980,6 +9573,7 @@ struct llama_context_params llama_context_default_params() {
         /*.n_threads                   =*/ GGML_DEFAULT_N_THREADS, // TODO: better default
         /*.n_threads_batch             =*/ GGML_DEFAULT_N_THREADS,
         /*.rope_scaling_type           =*/ LLAMA_ROPE_SCALING_UNSPECIFIED,
+        /*.hugepages                   =*/ LLAMA_HUGEPAGES_NONE,
         /*.rope_freq_base              =*/ 0.0f,
         /*.rope_freq_scale             =*/ 0.0f,
         /*.yarn_ext_factor             =*/ NAN,
@@ -7987,10 +9581,17 @@ struct llama_context_params llama_context_default_params() {
         /*.yarn_beta_fast              =*/ 32.0f,
         /*.yarn_beta_slow              =*/ 1.0f,
         /*.yarn_orig_ctx               =*/ 0,
+        /*.defrag_thold                =*/ -1.0f,
         /*.mul_mat_q                   =*/ true,
         /*.f16_kv                      =*/ true,
         /*.logits_all                  =*/ false,
         /*.embedding                   =*/ false,
+        /*.prefix_cache                =*/ false,
+        /*.flash_attn                  =*/ true,
+        /*.fused_ops                   =*/ true,
+        /*.reuse_graph                 =*/ true,
+        /*.rope_cache                  =*/ true,
+        /*.kv_paged                    =*/ true,
     };
 
     return result;
@@ -8107,6 +9708,25 @@ struct llama_context * llama_new_context_with_model(
     cparams.yarn_beta_fast   = params.yarn_beta_fast;
     cparams.yarn_beta_slow   = params.yarn_beta_slow;
     cparams.mul_mat_q        = params.mul_mat_q;
+    cparams.defrag_thold     = params.defrag_thold;
+
+    cparams.flash_attn       = params.flash_attn;
+    cparams.fused_ops        = params.fused_ops;
+    cparams.reuse_graph      = params.reuse_graph;
+    cparams.rope_cache       = params.rope_cache;
+    cparams.kv_paged         = params.kv_paged;
+
+#if defined(GGML_USE_CUBLAS) || defined(GGML_USE_METAL)
+    // ggml_flash_attn_ext, ggml_set_rows and the fused element-wise ops are only implemented on the CPU
+    // the offloaded graphs assign their GPU buffers after each build, so they are not reused
+    if (model->n_gpu_layers > 0) {
+        cparams.flash_attn   = false;
+        cparams.fused_ops    = false;
+        cparams.reuse_graph  = false;
+        cparams.rope_cache   = false;
+        cparams.kv_paged     = false;
+    }
+#endif
 
     cparams.n_ctx            = params.n_ctx           == 0    ? hparams.n_ctx_train           : params.n_ctx;
     cparams.rope_freq_base   = params.rope_freq_base  == 0.0f ? hparams.rope_freq_base_train  : params.rope_freq_base;
@@ -8142,19 +9762,30 @@ struct llama_context * llama_new_context_with_model(
 
     ggml_type memory_type = params.f16_kv ? GGML_TYPE_F16 : GGML_TYPE_F32;
 
+    const enum llama_hugepages hugepages = (enum llama_hugepages) params.hugepages;
+
     // reserve memory for context buffers
     if (!hparams.vocab_only) {
-        if (!llama_kv_cache_init(ctx->model.hparams, ctx->kv_self, memory_type, cparams.n_ctx, model->n_gpu_layers)) {
+        if (!llama_kv_cache_init(ctx->model.hparams, ctx->kv_self, memory_type, cparams.n_ctx, model->n_gpu_layers, cparams.kv_paged, hugepages)) {
             LLAMA_LOG_ERROR("%s: llama_kv_cache_init() failed for self-attention cache\n", __func__);
             llama_free(ctx);
             return nullptr;
         }
 
+        ctx->kv_self.prefix = params.prefix_cache && cparams.kv_paged;
+        if (params.prefix_cache && !cparams.kv_paged) {
+            LLAMA_LOG_WARN("%s: the prefix cache needs the paged KV cache, it is disabled\n", __func__);
+        }
+
         {
             const size_t memory_size = ggml_nbytes(ctx->kv_self.k) + ggml_nbytes(ctx->kv_self.v);
             LLAMA_LOG_INFO("%s: kv self size  = %7.2f MB\n", __func__, memory_size / 1024.0 / 1024.0);
         }
 
+        if (cparams.rope_cache) {
+            llama_rope_cache_init(*ctx);
+        }
+
         // resized during inference
         if (params.logits_all) {
             ctx->logits.reserve(cparams.n_ctx*hparams.n_vocab);
@@ -8169,7 +9800,7 @@ struct llama_context * llama_new_context_with_model(
         {
             static const size_t tensor_alignment = 32;
             // the compute buffer is used to store the tensor and graph structs, while the allocator buffer is used for the tensor data
-            ctx->buf_compute.resize(ggml_tensor_overhead()*GGML_MAX_NODES + ggml_graph_overhead());
+            ctx->buf_compute.resize(ggml_tensor_overhead()*llama_graph_size(ctx->model) + ggml_graph_overhead_custom(llama_graph_size(ctx->model), false), hugepages);
 
             // create measure allocator
             ctx->alloc = ggml_allocr_new_measure(tensor_alignment);
@@ -8202,8 +9833,14 @@ struct llama_context * llama_new_context_with_model(
             // recreate allocator with exact memory requirements
             ggml_allocr_free(ctx->alloc);
 
-            ctx->buf_alloc.resize(alloc_size);
+            ctx->buf_alloc.resize(alloc_size, hugepages);
             ctx->alloc = ggml_allocr_new(ctx->buf_alloc.data, ctx->buf_alloc.size, tensor_alignment);
+
+            if (hugepages != LLAMA_HUGEPAGES_NONE) {
+                ctx->kv_self.buf.log_hugepages(__func__, "kv self");
+                ctx->buf_compute.log_hugepages(__func__, "compute");
+                ctx->buf_alloc.log_hugepages(__func__, "alloc");
+            }
 #ifdef GGML_USE_METAL
             if (ctx->ctx_metal) {
                 //ggml_allocr_set_parse_seq(ctx->alloc, ggml_metal_get_concur_list(ctx->ctx_metal), ggml_metal_if_optimized(ctx->ctx_metal));
@@ -8387,25 +10024,58 @@ void llama_kv_cache_clear(struct llama_context * ctx) {
     llama_kv_cache_clear(ctx->kv_self);
 }
 
+// the sequence operations log an error and do nothing for the ids outside of [0, LLAMA_MAX_SEQ)
+static bool llama_seq_id_check(const char * func, llama_seq_id seq_id) {
+    if (seq_id < 0 || seq_id >= LLAMA_MAX_SEQ) {
+        LLAMA_LOG_ERROR("%s: invalid seq_id = %d, the sequence ids are in [0, %d)\n", func, seq_id, LLAMA_MAX_SEQ);
+        return false;
+    }
+    return true;
+}
+
 void llama_kv_cache_seq_rm(struct llama_context * ctx, llama_seq_id seq_id, llama_pos p0, llama_pos p1) {
+    if (seq_id >= 0 && !llama_seq_id_check(__func__, seq_id)) {
+        return;
+    }
     llama_kv_cache_seq_rm(ctx->kv_self, seq_id, p0, p1);
 }
 
 void llama_kv_cache_seq_cp(struct llama_context * ctx, llama_seq_id seq_id_src, llama_seq_id seq_id_dst, llama_pos p0, llama_pos p1) {
-    if (seq_id_src == seq_id_dst) {
+    if (!llama_seq_id_check(__func__, seq_id_src) || !llama_seq_id_check(__func__, seq_id_dst)) {
         return;
     }
     llama_kv_cache_seq_cp(ctx->kv_self, seq_id_src, seq_id_dst, p0, p1);
 }
 
 void llama_kv_cache_seq_keep(struct llama_context * ctx, llama_seq_id seq_id) {
+    if (!llama_seq_id_check(__func__, seq_id)) {
+        return;
+    }
     llama_kv_cache_seq_keep(ctx->kv_self, seq_id);
 }
 
 void llama_kv_cache_seq_shift(struct llama_context * ctx, llama_seq_id seq_id, llama_pos p0, llama_pos p1, llama_pos delta) {
+    if (!llama_seq_id_check(__func__, seq_id)) {
+        return;
+    }
     llama_kv_cache_seq_shift(ctx->kv_self, seq_id, p0, p1, delta);
 }
 
+int32_t llama_kv_cache_seq_attach(struct llama_context * ctx, llama_seq_id seq_id, const llama_token * tokens, int32_t n_tokens) {
+    if (!llama_seq_id_check(__func__, seq_id)) {
+        return -1;
+    }
+    return llama_kv_cache_prefix_attach(ctx->kv_self, seq_id, tokens, n_tokens);
+}
+
+void llama_kv_cache_defrag(struct llama_context * ctx) {
+    if (!llama_kv_cache_is_host(ctx->kv_self)) {
+        LLAMA_LOG_WARN("%s: the KV cache is offloaded, it is not defragmented\n", __func__);
+        return;
+    }
+    llama_kv_cache_defrag_internal(*ctx);
+}
+
 // Returns the *maximum* size of the state
 size_t llama_get_state_size(const struct llama_context * ctx) {
     // we don't know size of rng until we actually serialize it. so reserve more than enough memory for its serialized state.
@@ -8547,8 +10217,9 @@ static void llama_copy_state_data_internal(struct llama_context * ctx, llama_dat
         const auto   n_embd  = hparams.n_embd_gqa();
         const auto   n_ctx   = cparams.n_ctx;
 
+        // the used cells of a paged cache are not all before head, the cells up to the last used one are written
         const size_t   kv_buf_size = kv_self.buf.size;
-        const uint32_t kv_head     = kv_self.head;
+        const uint32_t kv_head     = kv_self.paged ? llama_kv_cache_cell_max(kv_self) : kv_self.head;
         const uint32_t kv_size     = kv_self.size;
 
         data_ctx->write(&kv_buf_size, sizeof(kv_buf_size));
@@ -8558,8 +10229,8 @@ static void llama_copy_state_data_internal(struct llama_context * ctx, llama_dat
         if (kv_buf_size) {
             const size_t elt_size = ggml_element_size(kv_self.k);
 
-            ggml_context * cpy_ctx = ggml_init({ 4096, NULL, /* no_alloc */ true });
-            ggml_cgraph gf{};
+            ggml_context * cpy_ctx = ggml_init({ 6*ggml_tensor_overhead() + ggml_graph_overhead(), NULL, /* no_alloc */ true });
+            ggml_cgraph * gf = ggml_new_graph(cpy_ctx);
 
             ggml_tensor * kout3d = ggml_new_tensor_3d(cpy_ctx, kv_self.k->type, n_embd, kv_head, n_layer);
             std::vector<uint8_t> kout3d_data(ggml_nbytes(kout3d), 0);
@@ -8577,9 +10248,9 @@ static void llama_copy_state_data_internal(struct llama_context * ctx, llama_dat
                 kv_head, n_embd, n_layer,
                 elt_size*n_ctx, elt_size*n_ctx*n_embd, 0);
 
-            ggml_build_forward_expand(&gf, ggml_cpy(cpy_ctx, k3d, kout3d));
-            ggml_build_forward_expand(&gf, ggml_cpy(cpy_ctx, v3d, vout3d));
-            ggml_graph_compute_helper(ctx->work_buffer, &gf, /*n_threads*/ 1);
+            ggml_build_forward_expand(gf, ggml_cpy(cpy_ctx, k3d, kout3d));
+            ggml_build_forward_expand(gf, ggml_cpy(cpy_ctx, v3d, vout3d));
+            ggml_graph_compute_helper(ctx->work_buffer, gf, /*n_threads*/ 1);
 
             ggml_free(cpy_ctx);
 
@@ -8593,13 +10264,15 @@ static void llama_copy_state_data_internal(struct llama_context * ctx, llama_dat
             const auto & cell = kv_self.cells[i];
 
             const llama_pos pos         = cell.pos;
-            const size_t    seq_id_size = cell.seq_id.size();
+            const size_t    seq_id_size = cell.seq_id.count();
 
             data_ctx->write(&pos,         sizeof(pos));
             data_ctx->write(&seq_id_size, sizeof(seq_id_size));
 
-            for (auto seq_id : cell.seq_id) {
-                data_ctx->write(&seq_id, sizeof(seq_id));
+            for (llama_seq_id seq_id = 0; seq_id < LLAMA_MAX_SEQ; ++seq_id) {
+                if (cell.has_seq_id(seq_id)) {
+                    data_ctx->write(&seq_id, sizeof(seq_id));
+                }
             }
         }
     }
@@ -8686,8 +10359,8 @@ size_t llama_set_state_data(struct llama_context * ctx, uint8_t * src) {
 
             const size_t elt_size = ggml_element_size(kv_self.k);
 
-            ggml_context * cpy_ctx = ggml_init({ 4096, NULL, /* no_alloc */ true });
-            ggml_cgraph gf{};
+            ggml_context * cpy_ctx = ggml_init({ 6*ggml_tensor_overhead() + ggml_graph_overhead(), NULL, /* no_alloc */ true });
+            ggml_cgraph * gf = ggml_new_graph(cpy_ctx);
 
             ggml_tensor * kin3d = ggml_new_tensor_3d(cpy_ctx, kv_self.k->type, n_embd, kv_head, n_layer);
             kin3d->data = (void *) inp;
@@ -8705,9 +10378,9 @@ size_t llama_set_state_data(struct llama_context * ctx, uint8_t * src) {
                 kv_head, n_embd, n_layer,
                 elt_size*n_ctx, elt_size*n_ctx*n_embd, 0);
 
-            ggml_build_forward_expand(&gf, ggml_cpy(cpy_ctx, kin3d, k3d));
-            ggml_build_forward_expand(&gf, ggml_cpy(cpy_ctx, vin3d, v3d));
-            ggml_graph_compute_helper(ctx->work_buffer, &gf, /*n_threads*/ 1);
+            ggml_build_forward_expand(gf, ggml_cpy(cpy_ctx, kin3d, k3d));
+            ggml_build_forward_expand(gf, ggml_cpy(cpy_ctx, vin3d, v3d));
+            ggml_graph_compute_helper(ctx->work_buffer, gf, /*n_threads*/ 1);
 
             ggml_free(cpy_ctx);
         }
@@ -8724,15 +10397,21 @@ size_t llama_set_state_data(struct llama_context * ctx, uint8_t * src) {
             memcpy(&pos,         inp, sizeof(pos));         inp += sizeof(pos);
             memcpy(&seq_id_size, inp, sizeof(seq_id_size)); inp += sizeof(seq_id_size);
 
-            ctx->kv_self.cells[i].pos = pos;
+            // the cells of the prefix cache that no sequence holds are not restored
+            ctx->kv_self.cells[i].pos = seq_id_size > 0 ? pos : -1;
+            ctx->kv_self.cells[i].seq_id.reset();
 
             llama_seq_id seq_id;
 
             for (size_t j = 0; j < seq_id_size; ++j) {
                 memcpy(&seq_id, inp, sizeof(seq_id)); inp += sizeof(seq_id);
-                ctx->kv_self.cells[i].seq_id.insert(seq_id);
+                GGML_ASSERT(seq_id >= 0 && seq_id < LLAMA_MAX_SEQ);
+                ctx->kv_self.cells[i].seq_id.set(seq_id);
             }
         }
+
+        llama_kv_cache_recount(ctx->kv_self);
+        llama_kv_cache_prefix_clear(ctx->kv_self);
     }
 
     const size_t nread    = inp - src;
@@ -8825,6 +10504,224 @@ bool llama_save_session_file(struct llama_context * ctx, const char * path_sessi
     return true;
 }
 
+// the state of a sequence: its cells, by position, with their K and V
+//
+//   uint32_t  n_cells, n_layer, n_embd_gqa, type of K, type of V
+//   llama_pos pos[n_cells], delta[n_cells]
+//   K: for each layer, the rows of the cells
+//   V: for each layer, for each of the n_embd_gqa rows of V, the elements of the cells
+//
+// the pending shift of the cells (delta) is applied by the next decode of the context they are restored into
+
+// the cells as runs of consecutive cells
+static std::vector<std::pair<uint32_t, uint32_t>> llama_kv_cache_cell_runs(const std::vector<uint32_t> & cells) {
+    std::vector<std::pair<uint32_t, uint32_t>> runs;
+
+    for (const uint32_t i : cells) {
+        if (!runs.empty() && runs.back().first + runs.back().second == i) {
+            runs.back().second++;
+        } else {
+            runs.emplace_back(i, 1);
+        }
+    }
+
+    return runs;
+}
+
+size_t llama_seq_state_get_size(const struct llama_context * ctx, llama_seq_id seq_id) {
+    if (!llama_seq_id_check(__func__, seq_id)) {
+        return 0;
+    }
+
+    const auto & kv_self = ctx->kv_self;
+    const auto & hparams = ctx->model.hparams;
+
+    const size_t n_cells    = kv_self.seq_cells[seq_id].size();
+    const size_t n_layer    = hparams.n_layer;
+    const size_t n_embd_gqa = hparams.n_embd_gqa();
+
+    const size_t s_header = 5*sizeof(uint32_t);
+    const size_t s_cells  = n_cells*2*sizeof(llama_pos);
+    const size_t s_kv     = n_layer*n_cells*n_embd_gqa*(ggml_element_size(kv_self.k) + ggml_element_size(kv_self.v));
+
+    return s_header + s_cells + s_kv;
+}
+
+static bool llama_seq_state_copy_internal(struct llama_context * ctx, llama_seq_id seq_id, llama_data_context * data_ctx) {
+    const auto & kv_self = ctx->kv_self;
+    const auto & hparams = ctx->model.hparams;
+
+    if (!llama_kv_cache_is_host(kv_self)) {
+        LLAMA_LOG_ERROR("%s: the KV cache is offloaded\n", __func__);
+        return false;
+    }
+
+    const std::vector<uint32_t> cells = llama_kv_cache_seq_cells(kv_self, seq_id, 0, std::numeric_limits<llama_pos>::max());
+
+    const uint32_t n_cells    = cells.size();
+    const uint32_t n_layer    = hparams.n_layer;
+    const uint32_t n_embd_gqa = hparams.n_embd_gqa();
+    const uint32_t k_type     = kv_self.k->type;
+    const uint32_t v_type     = kv_self.v->type;
+
+    data_ctx->write(&n_cells,    sizeof(n_cells));
+    data_ctx->write(&n_layer,    sizeof(n_layer));
+    data_ctx->write(&n_embd_gqa, sizeof(n_embd_gqa));
+    data_ctx->write(&k_type,     sizeof(k_type));
+    data_ctx->write(&v_type,     sizeof(v_type));
+
+    for (const uint32_t i : cells) {
+        data_ctx->write(&kv_self.cells[i].pos, sizeof(llama_pos));
+    }
+    for (const uint32_t i : cells) {
+        data_ctx->write(&kv_self.cells[i].delta, sizeof(llama_pos));
+    }
+
+    const auto runs = llama_kv_cache_cell_runs(cells);
+
+    const size_t n_ctx  = kv_self.size;
+    const size_t k_row  = ggml_element_size(kv_self.k)*n_embd_gqa;
+    const size_t v_elem = ggml_element_size(kv_self.v);
+
+    for (uint32_t il = 0; il < n_layer; ++il) {
+        const char * k = (const char *) kv_self.k->data + il*n_ctx*k_row;
+        for (const auto & r : runs) {
+            data_ctx->write(k + r.first*k_row, r.second*k_row);
+        }
+    }
+
+    for (uint32_t il = 0; il < n_layer; ++il) {
+        const char * v = (const char *) kv_self.v->data + il*n_ctx*n_embd_gqa*v_elem;
+        for (uint32_t j = 0; j < n_embd_gqa; ++j) {
+            for (const auto & r : runs) {
+                data_ctx->write(v + (j*n_ctx + r.first)*v_elem, r.second*v_elem);
+            }
+        }
+    }
+
+    return true;
+}
+
+size_t llama_seq_state_copy(struct llama_context * ctx, llama_seq_id seq_id, uint8_t * dst, size_t size) {
+    if (!llama_seq_id_check(__func__, seq_id)) {
+        return 0;
+    }
+
+    if (size < llama_seq_state_get_size(ctx, seq_id)) {
+        LLAMA_LOG_ERROR("%s: the destination of %zu bytes is too small for the state of sequence %d\n", __func__, size, seq_id);
+        return 0;
+    }
+
+    llama_data_buffer_context data_ctx(dst);
+    if (!llama_seq_state_copy_internal(ctx, seq_id, &data_ctx)) {
+        return 0;
+    }
+
+    return data_ctx.get_size_written();
+}
+
+size_t llama_seq_state_set(struct llama_context * ctx, llama_seq_id seq_id, const uint8_t * src, size_t size) {
+    if (!llama_seq_id_check(__func__, seq_id)) {
+        return 0;
+    }
+
+    auto & kv_self = ctx->kv_self;
+    const auto & hparams = ctx->model.hparams;
+
+    const uint8_t * inp = src;
+
+    const size_t s_header = 5*sizeof(uint32_t);
+
+    if (size < s_header) {
+        LLAMA_LOG_ERROR("%s: the state of %zu bytes is too small\n", __func__, size);
+        return 0;
+    }
+
+    uint32_t n_cells;
+    uint32_t n_layer;
+    uint32_t n_embd_gqa;
+    uint32_t k_type;
+    uint32_t v_type;
+
+    memcpy(&n_cells,    inp, sizeof(n_cells));    inp += sizeof(n_cells);
+    memcpy(&n_layer,    inp, sizeof(n_layer));    inp += sizeof(n_layer);
+    memcpy(&n_embd_gqa, inp, sizeof(n_embd_gqa)); inp += sizeof(n_embd_gqa);
+    memcpy(&k_type,     inp, sizeof(k_type));     inp += sizeof(k_type);
+    memcpy(&v_type,     inp, sizeof(v_type));     inp += sizeof(v_type);
+
+    if (n_layer != hparams.n_layer || n_embd_gqa != hparams.n_embd_gqa() || k_type != kv_self.k->type || v_type != kv_self.v->type) {
+        LLAMA_LOG_ERROR("%s: the state was saved with a different model or KV cache type\n", __func__);
+        return 0;
+    }
+
+    if (!llama_kv_cache_is_host(kv_self)) {
+        LLAMA_LOG_ERROR("%s: the KV cache is offloaded\n", __func__);
+        return 0;
+    }
+
+    const size_t s_cells = (size_t) n_cells*2*sizeof(llama_pos);
+    const size_t s_kv    = (size_t) n_layer*n_cells*n_embd_gqa*(ggml_element_size(kv_self.k) + ggml_element_size(kv_self.v));
+
+    if (size < s_header + s_cells + s_kv) {
+        LLAMA_LOG_ERROR("%s: the state of %zu bytes is too small for its %u cells\n", __func__, size, n_cells);
+        return 0;
+    }
+
+    std::vector<llama_pos> pos(n_cells);
+    std::vector<llama_pos> delta(n_cells);
+
+    memcpy(pos.data(),   inp, n_cells*sizeof(llama_pos)); inp += n_cells*sizeof(llama_pos);
+    memcpy(delta.data(), inp, n_cells*sizeof(llama_pos)); inp += n_cells*sizeof(llama_pos);
+
+    llama_kv_cache_seq_rm(kv_self, seq_id, -1, -1);
+
+    if (n_cells == 0) {
+        return inp - src;
+    }
+
+    // the cells are placed like the tokens of a batch of the sequence
+    std::vector<int32_t>        n_seq_id(n_cells, 1);
+    std::vector<llama_seq_id *> seq_ids (n_cells, &seq_id);
+
+    llama_batch batch = { (int32_t) n_cells, nullptr, nullptr, pos.data(), n_seq_id.data(), seq_ids.data(), nullptr, 0, 0, 0, };
+
+    if (!llama_kv_cache_find_slot(kv_self, batch)) {
+        LLAMA_LOG_ERROR("%s: no room for the %u cells of the sequence\n", __func__, n_cells);
+        return 0;
+    }
+
+    const std::vector<uint32_t> cells(kv_self.slot.begin(), kv_self.slot.end());
+
+    for (uint32_t c = 0; c < n_cells; ++c) {
+        kv_self.cells[cells[c]].delta = delta[c];
+        kv_self.has_shift = kv_self.has_shift || delta[c] != 0;
+    }
+
+    const auto runs = llama_kv_cache_cell_runs(cells);
+
+    const size_t n_ctx  = kv_self.size;
+    const size_t k_row  = ggml_element_size(kv_self.k)*n_embd_gqa;
+    const size_t v_elem = ggml_element_size(kv_self.v);
+
+    for (uint32_t il = 0; il < n_layer; ++il) {
+        char * k = (char *) kv_self.k->data + il*n_ctx*k_row;
+        for (const auto & r : runs) {
+            memcpy(k + r.first*k_row, inp, r.second*k_row); inp += r.second*k_row;
+        }
+    }
+
+    for (uint32_t il = 0; il < n_layer; ++il) {
+        char * v = (char *) kv_self.v->data + il*n_ctx*n_embd_gqa*v_elem;
+        for (uint32_t j = 0; j < n_embd_gqa; ++j) {
+            for (const auto & r : runs) {
+                memcpy(v + (j*n_ctx + r.first)*v_elem, inp, r.second*v_elem); inp += r.second*v_elem;
+            }
+        }
+    }
+
+    return inp - src;
+}
+
 int llama_eval(
         struct llama_context * ctx,
                  llama_token * tokens,
@@ -8862,6 +10759,15 @@ void llama_set_n_threads(struct llama_context * ctx, uint32_t n_threads, uint32_
     ctx->cparams.n_threads_batch = n_threads_batch;
 }
 
+void llama_set_threadpool(struct llama_context * ctx, struct ggml_threadpool * threadpool) {
+    if (ctx->threadpool_owned) {
+        ggml_threadpool_free(ctx->threadpool);
+    }
+
+    ctx->threadpool       = threadpool;
+    ctx->threadpool_owned = false;
+}
+
 struct llama_batch llama_batch_get_one(
              llama_token * tokens,
                  int32_t   n_tokens,
@@ -9107,6 +11013,32 @@ void llama_reset_timings(struct llama_context * ctx) {
     ctx->t_p_eval_us = ctx->n_p_eval = 0;
 }
 
+void llama_trace_start(struct llama_context * ctx) {
+    if (ctx->trace) {
+        ggml_trace_reset(ctx->trace);
+    } else {
+        ctx->trace = ggml_trace_new();
+    }
+}
+
+bool llama_trace_stop(struct llama_context * ctx, const char * fname) {
+    if (!ctx->trace) {
+        return false;
+    }
+
+    const bool ok = ggml_trace_write_json(ctx->trace, fname);
+    if (ok) {
+        LLAMA_LOG_INFO("%s: wrote %d graphs to %s\n", __func__, ggml_trace_n_graphs(ctx->trace), fname);
+    } else {
+        LLAMA_LOG_ERROR("%s: failed to write %s\n", __func__, fname);
+    }
+
+    ggml_trace_free(ctx->trace);
+    ctx->trace = NULL;
+
+    return ok;
+}
+
 const char * llama_print_system_info(void) {
     static std::string s;
 
@@ -9116,6 +11048,7 @@ const char * llama_print_system_info(void) {
     s += "AVX512 = "      + std::to_string(ggml_cpu_has_avx512())      + " | ";
     s += "AVX512_VBMI = " + std::to_string(ggml_cpu_has_avx512_vbmi()) + " | ";
     s += "AVX512_VNNI = " + std::to_string(ggml_cpu_has_avx512_vnni()) + " | ";
+    s += "AVX512_BF16 = " + std::to_string(ggml_cpu_has_avx512_bf16()) + " | ";
     s += "FMA = "         + std::to_string(ggml_cpu_has_fma())         + " | ";
     s += "NEON = "        + std::to_string(ggml_cpu_has_neon())        + " | ";
     s += "ARM_FMA = "     + std::to_string(ggml_cpu_has_arm_fma())     + " | ";
@@ -9126,6 +11059,7 @@ const char * llama_print_system_info(void) {
     s += "SSE3 = "        + std::to_string(ggml_cpu_has_sse3())        + " | ";
     s += "SSSE3 = "       + std::to_string(ggml_cpu_has_ssse3())       + " | ";
     s += "VSX = "         + std::to_string(ggml_cpu_has_vsx())         + " | ";
+    s += "KERNELS = "     + std::string(ggml_cpu_kernels_name())       + " | ";
 
     return s.c_str();
 }
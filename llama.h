@@ -39,6 +39,10 @@
 
 #define LLAMA_MAX_RNG_STATE (64*1024)
 
+// the sequence ids of the tokens and of the KV cache operations are in [0, LLAMA_MAX_SEQ)
+// llama_decode returns -1 for a batch with other ids, the sequence operations log an error and do nothing
+#define LLAMA_MAX_SEQ 64
+
 #define LLAMA_FILE_MAGIC_GGSN 0x6767736eu // 'ggsn'
 
 #define LLAMA_SESSION_MAGIC   LLAMA_FILE_MAGIC_GGSN
@@ -102,6 +106,7 @@ extern "C" {
         LLAMA_FTYPE_MOSTLY_Q5_K_S        = 16, // except 1d tensors
         LLAMA_FTYPE_MOSTLY_Q5_K_M        = 17, // except 1d tensors
         LLAMA_FTYPE_MOSTLY_Q6_K          = 18, // except 1d tensors
+        LLAMA_FTYPE_MOSTLY_BF16          = 32, // except 1d tensors
 
         LLAMA_FTYPE_GUESSED = 1024, // not specified in the model file
     };
@@ -114,6 +119,14 @@ extern "C" {
         LLAMA_ROPE_SCALING_MAX_VALUE   = LLAMA_ROPE_SCALING_YARN,
     };
 
+    // backing of the large buffers with huge pages (Linux only, ignored elsewhere)
+    enum llama_hugepages {
+        LLAMA_HUGEPAGES_NONE = 0, // regular pages
+        LLAMA_HUGEPAGES_THP  = 1, // transparent huge pages (madvise)
+        LLAMA_HUGEPAGES_2M   = 2, // hugetlbfs 2M pages, THP if none are reserved
+        LLAMA_HUGEPAGES_1G   = 3, // hugetlbfs 1G pages, THP if none are reserved
+    };
+
     typedef struct llama_token_data {
         llama_token id; // token id
         float logit;    // log-odds of the token
@@ -168,10 +181,15 @@ extern "C" {
         // context pointer passed to the progress callback
         void * progress_callback_user_data;
 
+        int8_t hugepages; // huge pages for the weights, from `enum llama_hugepages` - the weights are read into memory instead of mmap-ed
+        int8_t numa_placement; // placement of the weights on the NUMA nodes, from `enum ggml_numa_placement` - needs llama_backend_init(true)
+
         // Keep the booleans together to avoid misalignment during copy-by-value.
         bool vocab_only; // only load the vocabulary, no weights
         bool use_mmap;   // use mmap if possible
         bool use_mlock;  // force system to keep model in RAM
+        bool fuse_weights; // load the Q, K, V and the gate, up projections of each layer as one matrix each (CPU only)
+        bool repack_weights; // interleave the rows of the q4_0, q8_0 and q4_K weights for the faster mul_mat kernels (CPU only)
     };
 
     struct llama_context_params {
@@ -181,6 +199,7 @@ extern "C" {
         uint32_t n_threads;       // number of threads to use for generation
         uint32_t n_threads_batch; // number of threads to use for batch processing
         int8_t   rope_scaling_type; // RoPE scaling type, from `enum llama_rope_scaling_type`
+        int8_t   hugepages;         // huge pages for the KV cache and the compute buffers, from `enum llama_hugepages`
 
         // ref: https://github.com/ggerganov/llama.cpp/pull/2054
         float    rope_freq_base;   // RoPE base frequency, 0 = from model
@@ -190,12 +209,19 @@ extern "C" {
         float    yarn_beta_fast;   // YaRN low correction dim
         float    yarn_beta_slow;   // YaRN high correction dim
         uint32_t yarn_orig_ctx;    // YaRN original context size
+        float    defrag_thold;     // defragment the KV cache when more than this fraction of the cells below the last used one are free, < 0 = disabled
 
         // Keep the booleans together to avoid misalignment during copy-by-value.
         bool mul_mat_q;  // if true, use experimental mul_mat_q kernels (DEPRECATED - always true)
         bool f16_kv;     // use fp16 for KV cache, fp32 otherwise
         bool logits_all; // the llama_eval() call computes all logits, not just the last one
         bool embedding;  // embedding mode only
+        bool prefix_cache; // keep the KV cells of the sequences that start at position 0 for llama_kv_cache_seq_attach, needs kv_paged
+        bool flash_attn;   // compute the attention with one fused op instead of KQ, soft_max and KQV (CPU only)
+        bool fused_ops;    // replace the element-wise ops of the norms, the SwiGLU and the residual adds by fused ops (CPU only)
+        bool reuse_graph;  // reuse the graph of the previous llama_decode call when the batch has the same shape (CPU only)
+        bool rope_cache;   // precompute the RoPE rotations of the context positions once (CPU only)
+        bool kv_paged;     // store the new K and V in any free cells of the KV cache instead of a contiguous slot (CPU only)
     };
 
     // model quantization parameters
@@ -353,7 +379,7 @@ extern "C" {
             struct llama_context * ctx);
 
     // Removes all tokens that belong to the specified sequence and have positions in [p0, p1)
-    // seq_id < 0 : match any sequence
+    // seq_id < 0 : match any sequence, and remove the tokens from p0 on from the prefix cache
     // p0 < 0     : [0,  p1]
     // p1 < 0     : [p0, inf)
     LLAMA_API void llama_kv_cache_seq_rm(
@@ -389,6 +415,24 @@ extern "C" {
                        llama_pos   p1,
                        llama_pos   delta);
 
+    // Adds to the sequence the cells of the prefix cache that hold the next tokens of "tokens", without decoding them
+    // "tokens" are the tokens of the sequence from position 0, it must already hold the first ones (none for a new sequence)
+    // The prefix cache has the tokens decoded since the context creation, unless they were shifted or evicted to make room
+    // Returns the number of tokens of the sequence, i.e. the position of the next token to decode
+    // Returns -1 if the prefix cache is disabled, or if the sequence was not built only by decoding its tokens in order
+    // and removing its end, as then it is not in the prefix cache
+    LLAMA_API int32_t llama_kv_cache_seq_attach(
+            struct llama_context * ctx,
+                    llama_seq_id   seq_id,
+               const llama_token * tokens,
+                         int32_t   n_tokens);
+
+    // Moves the used cells to the front of the KV cache, so that the next decode calls attend over fewer cells
+    // This is done automatically by llama_decode when defrag_thold >= 0
+    // The KV cache must be in host memory, it is not defragmented when it is offloaded
+    LLAMA_API void llama_kv_cache_defrag(
+            struct llama_context * ctx);
+
     //
     // State / sessions
     //
@@ -424,6 +468,29 @@ extern "C" {
                const llama_token * tokens,
                           size_t   n_token_count);
 
+    // Returns the size in bytes of the state of the sequence: the positions, K and V of its cells
+    LLAMA_API size_t llama_seq_state_get_size(
+      const struct llama_context * ctx,
+                    llama_seq_id   seq_id);
+
+    // Copies the state of the sequence to the specified destination address, of size bytes
+    // Returns the number of bytes copied, 0 if size is less than llama_seq_state_get_size() or the KV cache is offloaded
+    LLAMA_API size_t llama_seq_state_copy(
+            struct llama_context * ctx,
+                    llama_seq_id   seq_id,
+                         uint8_t * dst,
+                          size_t   size);
+
+    // Replaces the cells of the sequence by the state read from the specified address, of size bytes, in free cells of the KV cache
+    // The state can come from another sequence and another context of the same model and KV cache type
+    // Returns the number of bytes read, 0 on failure, in which case the sequence is left empty if the KV cache had no room
+    // A state that does not fit in size bytes is rejected, the sequence is then left unchanged
+    LLAMA_API size_t llama_seq_state_set(
+            struct llama_context * ctx,
+                    llama_seq_id   seq_id,
+                   const uint8_t * src,
+                          size_t   size);
+
     //
     // Decoding
     //
@@ -487,6 +554,11 @@ extern "C" {
     // n_threads_batch is the number of threads used for prompt and batch processing (multiple tokens)
     LLAMA_API void llama_set_n_threads(struct llama_context * ctx, uint32_t n_threads, uint32_t n_threads_batch);
 
+    // Set the thread pool used to compute the graphs of this context (see ggml_threadpool_new())
+    // The pool is not owned by the context, it can be shared between contexts and must outlive them
+    // By default (or when NULL is passed), the context creates its own pool on first use
+    LLAMA_API void llama_set_threadpool(struct llama_context * ctx, struct ggml_threadpool * threadpool);
+
     // Token logits obtained from the last call to llama_eval()
     // The logits for the last token are stored in the last row
     // Logits for which llama_batch.logits[i] == 0 are undefined
@@ -743,6 +815,13 @@ extern "C" {
     LLAMA_API void llama_print_timings(struct llama_context * ctx);
     LLAMA_API void llama_reset_timings(struct llama_context * ctx);
 
+    // Record the time spent by each thread on each node of the graphs computed on the CPU, until llama_trace_stop()
+    LLAMA_API void llama_trace_start(struct llama_context * ctx);
+
+    // Stop recording and write the recorded nodes to fname as Chrome trace events (chrome://tracing or https://ui.perfetto.dev)
+    // Returns false if the recording was not started or the file cannot be written
+    LLAMA_API bool llama_trace_stop(struct llama_context * ctx, const char * fname);
+
     // Print system information
     LLAMA_API const char * llama_print_system_info(void);
 
@@ -0,0 +1,183 @@
+#include "ggml.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4244 4267) // possible loss of data
+#endif
+
+static float frand(void) {
+    return (float)rand()/(float)RAND_MAX;
+}
+
+static uint32_t f32_bits(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+static float f32_from_bits(uint32_t u) {
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static void ggml_graph_compute_helper(std::vector<uint8_t> & buf, ggml_cgraph * graph, int n_threads) {
+    struct ggml_cplan plan = ggml_graph_plan(graph, n_threads);
+
+    if (plan.work_size > 0) {
+        buf.resize(plan.work_size);
+        plan.work_data = buf.data();
+    }
+
+    ggml_graph_compute(graph, &plan);
+}
+
+// the conversions round to nearest even and keep NaNs, the row versions give the same bits as the scalar ones
+static bool test_convert(void) {
+    bool ok = true;
+
+    // 1 + 2^-8 is halfway between two BF16 and goes to the even one, 1 + 3*2^-8 goes up
+    ok = ok && ggml_fp32_to_bf16(1.0f).bits                          == 0x3f80;
+    ok = ok && ggml_fp32_to_bf16(f32_from_bits(0x3f808000)).bits     == 0x3f80;
+    ok = ok && ggml_fp32_to_bf16(f32_from_bits(0x3f818000)).bits     == 0x3f82;
+    ok = ok && ggml_fp32_to_bf16(f32_from_bits(0x3f808001)).bits     == 0x3f81;
+    ok = ok && ggml_fp32_to_bf16(-2.5f).bits                         == 0xc020;
+    ok = ok && ggml_fp32_to_bf16(INFINITY).bits                      == 0x7f80;
+    ok = ok && ggml_fp32_to_bf16(f32_from_bits(0x7f7fffff)).bits     == 0x7f80; // the largest float rounds to infinity
+    ok = ok && std::isnan(ggml_bf16_to_fp32(ggml_fp32_to_bf16(NAN)));
+    ok = ok && std::isnan(ggml_bf16_to_fp32(ggml_fp32_to_bf16(f32_from_bits(0x7f800001)))); // not rounded to infinity
+
+    // every BF16 is an FP32, and converts back to itself
+    for (uint32_t h = 0; h < 0x10000 && ok; ++h) {
+        ggml_bf16_t b = { (uint16_t) h };
+        const float f = ggml_bf16_to_fp32(b);
+        ok = f32_bits(f) == h << 16;
+        if (!std::isnan(f)) {
+            ok = ok && ggml_fp32_to_bf16(f).bits == h;
+        }
+    }
+
+    // the lengths cover the vector loops and their leftovers
+    const int n = 1000 + 7;
+    std::vector<float> x(n);
+    for (int i = 0; i < n; ++i) {
+        x[i] = f32_from_bits((uint32_t) rand() ^ ((uint32_t) rand() << 16));
+    }
+    x[3] = NAN;
+    x[17] = -INFINITY;
+    x[42] = f32_from_bits(0x00000001); // denormal
+
+    std::vector<ggml_bf16_t> y(n);
+    std::vector<float> z(n);
+    ggml_fp32_to_bf16_row(x.data(), y.data(), n);
+    ggml_bf16_to_fp32_row(y.data(), z.data(), n);
+    for (int i = 0; i < n && ok; ++i) {
+        ok = y[i].bits == ggml_fp32_to_bf16(x[i]).bits && f32_bits(z[i]) == f32_bits(ggml_bf16_to_fp32(y[i]));
+    }
+
+    printf("%s: %s\n", __func__, ok ? "OK" : "FAILED");
+
+    return ok;
+}
+
+// a mul_mat with BF16 weights gives the dot products of the BF16 values, with src1 rounded to BF16
+// get_rows and cpy convert between BF16 and F32
+static bool test_ops(int64_t n_embd, int64_t n_rows, int64_t n_tokens, int n_threads, std::vector<uint8_t> & work_buffer) {
+    struct ggml_init_params params = {
+        /* .mem_size   = */ 64*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    struct ggml_tensor * w = ggml_new_tensor_2d(ctx0, GGML_TYPE_BF16, n_embd, n_rows);
+    struct ggml_tensor * x = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32,  n_embd, n_tokens);
+
+    std::vector<float> wf(n_embd*n_rows);
+    for (auto & v : wf) {
+        v = frand()*2.0f - 1.0f;
+    }
+    ggml_fp32_to_bf16_row(wf.data(), (ggml_bf16_t *) w->data, n_embd*n_rows);
+
+    for (int64_t i = 0; i < ggml_nelements(x); ++i) {
+        ((float *) x->data)[i] = frand()*2.0f - 1.0f;
+    }
+
+    struct ggml_tensor * ids = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, 3);
+    ((int32_t *) ids->data)[0] = n_rows - 1;
+    ((int32_t *) ids->data)[1] = 0;
+    ((int32_t *) ids->data)[2] = n_rows/2;
+
+    struct ggml_tensor * r  = ggml_mul_mat(ctx0, w, x);
+    struct ggml_tensor * g  = ggml_get_rows(ctx0, w, ids);
+    // F32 -> BF16 into a transposed view, then back to F32
+    struct ggml_tensor * xt = ggml_new_tensor_2d(ctx0, GGML_TYPE_BF16, n_tokens, n_embd);
+    struct ggml_tensor * c0 = ggml_cpy(ctx0, x, ggml_transpose(ctx0, xt));
+    struct ggml_tensor * c1 = ggml_cpy(ctx0, c0, ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_embd, n_tokens));
+
+    ggml_cgraph * gf = ggml_new_graph(ctx0);
+
+    ggml_build_forward_expand(gf, r);
+    ggml_build_forward_expand(gf, g);
+    ggml_build_forward_expand(gf, c1);
+
+    ggml_graph_compute_helper(work_buffer, gf, n_threads);
+
+    double max_err = 0.0;
+    for (int64_t j = 0; j < n_tokens; ++j) {
+        for (int64_t i = 0; i < n_rows; ++i) {
+            double sum = 0.0;
+            for (int64_t k = 0; k < n_embd; ++k) {
+                const float wk = ggml_bf16_to_fp32(((ggml_bf16_t *) w->data)[i*n_embd + k]);
+                const float xk = ggml_bf16_to_fp32(ggml_fp32_to_bf16(((float *) x->data)[j*n_embd + k]));
+                sum += (double) wk*xk;
+            }
+            const float v = ((float *) r->data)[j*n_rows + i];
+            max_err = std::max(max_err, fabs(v - sum)/std::max(1.0, fabs(sum)));
+        }
+    }
+
+    bool ok_rows = true;
+    for (int64_t j = 0; j < 3; ++j) {
+        const int64_t row = ((int32_t *) ids->data)[j];
+        for (int64_t k = 0; k < n_embd; ++k) {
+            ok_rows = ok_rows && ((float *) g->data)[j*n_embd + k] == ggml_bf16_to_fp32(((ggml_bf16_t *) w->data)[row*n_embd + k]);
+        }
+    }
+
+    bool ok_cpy = true;
+    for (int64_t i = 0; i < ggml_nelements(x); ++i) {
+        ok_cpy = ok_cpy && ((float *) c1->data)[i] == ggml_bf16_to_fp32(ggml_fp32_to_bf16(((float *) x->data)[i]));
+    }
+
+    // the sums are in FP32, in a different order than the reference
+    const bool ok = max_err < 1e-5 && ok_rows && ok_cpy;
+
+    printf("%s: n_embd = %4d, n_rows = %3d, n_tokens = %2d, n_threads = %d: max err = %g, get_rows %s, cpy %s: %s\n", __func__,
+            (int) n_embd, (int) n_rows, (int) n_tokens, n_threads, max_err, ok_rows ? "OK" : "FAILED", ok_cpy ? "OK" : "FAILED", ok ? "OK" : "FAILED");
+
+    ggml_free(ctx0);
+
+    return ok;
+}
+
+int main(int /*argc*/, const char ** /*argv*/) {
+    std::vector<uint8_t> work_buffer;
+
+    int n_failed = 0;
+
+    n_failed += !test_convert();
+
+    n_failed += !test_ops(256,  64,  1, 1, work_buffer);
+    n_failed += !test_ops(100,  33,  5, 4, work_buffer);
+    n_failed += !test_ops(768, 130, 17, 3, work_buffer);
+
+    return n_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+#include "ggml.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4244 4267) // possible loss of data
+#endif
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic ignored "-Wdouble-promotion"
+#endif
+
+static float frand(void) {
+    return (float)rand()/(float)RAND_MAX;
+}
+
+static void set_random(struct ggml_tensor * t, float fmin, float fmax) {
+    const int64_t n = ggml_nelements(t);
+
+    for (int64_t i = 0; i < n; i++) {
+        const float v = frand()*(fmax - fmin) + fmin;
+        if (t->type == GGML_TYPE_F16) {
+            ((ggml_fp16_t *) t->data)[i] = ggml_fp32_to_fp16(v);
+        } else {
+            ((float *) t->data)[i] = v;
+        }
+    }
+}
+
+static void ggml_graph_compute_helper(std::vector<uint8_t> & buf, ggml_cgraph * graph, int n_threads) {
+    struct ggml_cplan plan = ggml_graph_plan(graph, n_threads);
+
+    if (plan.work_size > 0) {
+        buf.resize(plan.work_size);
+        plan.work_data = buf.data();
+    }
+
+    ggml_graph_compute(graph, &plan);
+}
+
+// compare ggml_flash_attn_ext with the separate ops used by llm_build_kqv
+static bool test_flash_attn_ext(ggml_type type_kv, int64_t n_tokens, int64_t n_past, float max_bias, std::vector<uint8_t> & work_buffer) {
+    struct ggml_init_params params = {
+        /* .mem_size   = */ 128*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    const int64_t n_embd_head = 64;
+    const int64_t n_head      = 8;
+    const int64_t n_head_kv   = 2;
+    const int64_t n_kv        = n_past + n_tokens;
+
+    const float scale = 1.0f/sqrtf(float(n_embd_head));
+
+    struct ggml_tensor * q_cur = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, n_embd_head, n_head, n_tokens);
+    struct ggml_tensor * k     = ggml_new_tensor_3d(ctx0, type_kv,       n_embd_head, n_kv, n_head_kv);
+    struct ggml_tensor * v     = ggml_new_tensor_3d(ctx0, type_kv,       n_kv, n_embd_head, n_head_kv);
+    struct ggml_tensor * mask  = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_kv, n_tokens);
+
+    set_random(q_cur, -1.0f, 1.0f);
+    set_random(k,     -1.0f, 1.0f);
+    set_random(v,     -1.0f, 1.0f);
+
+    // causal mask
+    for (int64_t i = 0; i < n_tokens; i++) {
+        for (int64_t j = 0; j < n_kv; j++) {
+            ((float *) mask->data)[i*n_kv + j] = j > n_past + i ? -INFINITY : 0.0f;
+        }
+    }
+
+    struct ggml_tensor * q = ggml_permute(ctx0, q_cur, 0, 2, 1, 3);
+
+    struct ggml_tensor * kq_scale = ggml_new_f32(ctx0, scale);
+
+    struct ggml_tensor * kq = ggml_mul_mat(ctx0, k, q);
+    kq = ggml_scale(ctx0, kq, kq_scale);
+    if (max_bias > 0.0f) {
+        kq = ggml_alibi(ctx0, kq, 0, n_head, max_bias);
+    }
+    kq = ggml_add(ctx0, kq, mask);
+    kq = ggml_soft_max(ctx0, kq);
+
+    struct ggml_tensor * kqv = ggml_mul_mat(ctx0, v, kq);
+    struct ggml_tensor * r0  = ggml_cont(ctx0, ggml_permute(ctx0, kqv, 0, 2, 1, 3));
+
+    struct ggml_tensor * r1 = ggml_flash_attn_ext(ctx0, q, k, v, mask, scale, max_bias);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx0);
+
+    ggml_build_forward_expand(gf, r0);
+    ggml_build_forward_expand(gf, r1);
+
+    ggml_graph_compute_helper(work_buffer, gf, 4);
+
+    double sum0 = 0.0;
+    double diff = 0.0;
+
+    const float * r0_data = (float *) r0->data;
+    const float * r1_data = (float *) r1->data;
+
+    const int64_t n_elements = ggml_nelements(r0);
+
+    GGML_ASSERT(ggml_nelements(r1) == n_elements);
+
+    for (int64_t i = 0; i < n_elements; ++i) {
+        sum0 += fabs(r0_data[i]);
+        diff += fabs(r0_data[i] - r1_data[i]);
+    }
+
+    const bool ok = diff / sum0 < 0.001;
+
+    printf("type_kv = %s, n_tokens = %3d, n_past = %4d, max_bias = %.1f: rel err = %f %s\n",
+            ggml_type_name(type_kv), (int) n_tokens, (int) n_past, max_bias, diff / sum0, ok ? "OK" : "FAILED");
+
+    ggml_free(ctx0);
+
+    return ok;
+}
+
+int main(int /*argc*/, const char ** /*argv*/) {
+    std::vector<uint8_t> work_buffer;
+
+    int n_failed = 0;
+
+    for (ggml_type type_kv : { GGML_TYPE_F16, GGML_TYPE_F32 }) {
+        for (float max_bias : { 0.0f, 8.0f }) {
+            // generation, a batch spanning several blocks of rows, and a long context spanning several steps of KV positions
+            n_failed += !test_flash_attn_ext(type_kv,  1, 300, max_bias, work_buffer);
+            n_failed += !test_flash_attn_ext(type_kv, 37, 500, max_bias, work_buffer);
+            n_failed += !test_flash_attn_ext(type_kv, 19,   0, max_bias, work_buffer);
+            n_failed += !test_flash_attn_ext(type_kv,  3, 4500, max_bias, work_buffer);
+        }
+    }
+
+    return n_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+#include "ggml.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4244 4267) // possible loss of data
+#endif
+
+static float frand(void) {
+    return (float)rand()/(float)RAND_MAX;
+}
+
+static struct ggml_tensor * new_random(struct ggml_context * ctx, int64_t ne0, int64_t ne1, float fmin, float fmax) {
+    struct ggml_tensor * t = ne1 > 0 ? ggml_new_tensor_2d(ctx, GGML_TYPE_F32, ne0, ne1) : ggml_new_tensor_1d(ctx, GGML_TYPE_F32, ne0);
+
+    for (int64_t i = 0; i < ggml_nelements(t); i++) {
+        ((float *) t->data)[i] = frand()*(fmax - fmin) + fmin;
+    }
+
+    return t;
+}
+
+static void ggml_graph_compute_helper(std::vector<uint8_t> & buf, ggml_cgraph * graph, int n_threads) {
+    struct ggml_cplan plan = ggml_graph_plan(graph, n_threads);
+
+    if (plan.work_size > 0) {
+        buf.resize(plan.work_size);
+        plan.work_data = buf.data();
+    }
+
+    ggml_graph_compute(graph, &plan);
+}
+
+struct test_weights {
+    struct ggml_tensor * attn_norm;
+    struct ggml_tensor * wo;
+    struct ggml_tensor * ffn_norm;
+    struct ggml_tensor * ffn_gate;
+    struct ggml_tensor * ffn_up;
+    struct ggml_tensor * ffn_down;
+    struct ggml_tensor * output_norm;
+};
+
+// a layer of the llama graph, with the attention replaced by a single matrix
+static struct ggml_tensor * build_layer(struct ggml_context * ctx, const test_weights & w, struct ggml_tensor * inp, float eps) {
+    struct ggml_tensor * cur = ggml_mul(ctx, ggml_rms_norm(ctx, inp, eps), w.attn_norm);
+    cur = ggml_mul_mat(ctx, w.wo, cur);
+
+    struct ggml_tensor * ffn_inp = ggml_add(ctx, cur, inp);
+
+    cur = ggml_mul(ctx, ggml_rms_norm(ctx, ffn_inp, eps), w.ffn_norm);
+
+    struct ggml_tensor * up = ggml_mul_mat(ctx, w.ffn_up, cur);
+    cur = ggml_mul_mat(ctx, w.ffn_gate, cur);
+    cur = ggml_mul(ctx, ggml_silu(ctx, cur), up);
+    cur = ggml_mul_mat(ctx, w.ffn_down, cur);
+
+    cur = ggml_add(ctx, cur, ffn_inp);
+
+    return ggml_mul(ctx, ggml_rms_norm(ctx, cur, eps), w.output_norm);
+}
+
+static int count_op(const ggml_cgraph * gf, ggml_op op) {
+    int n = 0;
+    for (int i = 0; i < gf->n_nodes; ++i) {
+        n += gf->nodes[i]->op == op;
+    }
+    return n;
+}
+
+static bool test_fused_ops(int64_t n_embd, int64_t n_ff, int64_t n_tokens, std::vector<uint8_t> & work_buffer) {
+    struct ggml_init_params params = {
+        /* .mem_size   = */ 64*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    const float eps = 1e-5f;
+
+    test_weights w;
+    w.attn_norm   = new_random(ctx0, n_embd, 0, 0.5f, 1.5f);
+    w.wo          = new_random(ctx0, n_embd, n_embd, -0.1f, 0.1f);
+    w.ffn_norm    = new_random(ctx0, n_embd, 0, 0.5f, 1.5f);
+    w.ffn_gate    = new_random(ctx0, n_embd, n_ff, -0.1f, 0.1f);
+    w.ffn_up      = new_random(ctx0, n_embd, n_ff, -0.1f, 0.1f);
+    w.ffn_down    = new_random(ctx0, n_ff, n_embd, -0.1f, 0.1f);
+    w.output_norm = new_random(ctx0, n_embd, 0, 0.5f, 1.5f);
+
+    struct ggml_tensor * inp = new_random(ctx0, n_embd, n_tokens, -1.0f, 1.0f);
+
+    struct ggml_tensor * r0 = build_layer(ctx0, w, inp, eps);
+    struct ggml_tensor * r1 = build_layer(ctx0, w, inp, eps);
+
+    ggml_cgraph * gf0 = ggml_new_graph(ctx0);
+    ggml_cgraph * gf1 = ggml_new_graph(ctx0);
+
+    ggml_build_forward_expand(gf0, r0);
+    ggml_build_forward_expand(gf1, r1);
+
+    ggml_graph_fuse(ctx0, gf1);
+
+    // the attention norm is fused with its weight, the two other norms with the residual adds before them
+    const bool ok_ops =
+        count_op(gf1, GGML_OP_RMS_NORM)     == 0 &&
+        count_op(gf1, GGML_OP_RMS_NORM_MUL) == 1 &&
+        count_op(gf1, GGML_OP_ADD_RMS_NORM) == 2 &&
+        count_op(gf1, GGML_OP_SWIGLU)       == 1 &&
+        count_op(gf1, GGML_OP_ADD)          == 0 &&
+        count_op(gf1, GGML_OP_MUL)          == 0 &&
+        count_op(gf1, GGML_OP_UNARY)        == 0;
+
+    ggml_graph_compute_helper(work_buffer, gf0, 4);
+    ggml_graph_compute_helper(work_buffer, gf1, 4);
+
+    // the fused ops round in the same order as the separate ops
+    const bool ok = ok_ops && memcmp(r0->data, r1->data, ggml_nbytes(r0)) == 0;
+
+    printf("n_embd = %4d, n_ff = %4d, n_tokens = %2d: nodes %d -> %d %s\n",
+            (int) n_embd, (int) n_ff, (int) n_tokens, gf0->n_nodes, gf1->n_nodes, ok ? "OK" : "FAILED");
+
+    ggml_free(ctx0);
+
+    return ok;
+}
+
+int main(int /*argc*/, const char ** /*argv*/) {
+    std::vector<uint8_t> work_buffer;
+
+    int n_failed = 0;
+
+    n_failed += !test_fused_ops(256,  688,  1, work_buffer);
+    n_failed += !test_fused_ops(256,  688,  7, work_buffer);
+    n_failed += !test_fused_ops(100,  300, 33, work_buffer);
+
+    return n_failed == 0 ? 0 : 1;
+}
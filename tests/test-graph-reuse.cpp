@@ -0,0 +1,106 @@
+#include "test-model.h"
+
+#include <cstdio>
+#include <vector>
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4244 4267) // possible loss of data
+#endif
+
+// the same decode calls on a context that reuses its graph and on one that builds a new graph for each call
+struct test_pair {
+    llama_context * reuse;
+    llama_context * build;
+};
+
+static void decode_both(const test_pair & p, llama_seq_id seq_id, const std::vector<llama_token> & tokens, int pos0, const char * what) {
+    std::vector<float> logits[2];
+
+    const bool ok =
+        decode_at(p.reuse, seq_id, tokens, pos0, logits[0]) &&
+        decode_at(p.build, seq_id, tokens, pos0, logits[1]);
+
+    check(ok && same_logits(logits[0], logits[1]), what);
+}
+
+// generate n tokens one at a time from pos0, the graph of the first one is reused by the next ones
+static void generate_both(const test_pair & p, llama_seq_id seq_id, int n, int pos0, const char * what) {
+    const auto tokens = make_tokens(n, 100 + pos0);
+    for (int i = 0; i < n; ++i) {
+        decode_both(p, seq_id, { tokens[i] }, pos0 + i, what);
+    }
+}
+
+static void test_graph_reuse(llama_model * model, llama_context_params cparams) {
+    printf("%s: kv_paged = %d\n", __func__, cparams.kv_paged);
+
+    test_pair p;
+
+    cparams.reuse_graph = true;
+    p.reuse = llama_new_context_with_model(model, cparams);
+
+    cparams.reuse_graph = false;
+    p.build = llama_new_context_with_model(model, cparams);
+
+    llama_context * ctxs[2] = { p.reuse, p.build };
+
+    decode_both(p, 0, make_tokens(20, 1), 0, "decode the prompt");
+    generate_both(p, 0, 8, 20, "generate after the prompt");
+
+    // the cells from 12 on are freed, the head of the cache moves back to them for the next tokens
+    for (auto * ctx : ctxs) {
+        llama_kv_cache_seq_rm(ctx, 0, 12, -1);
+    }
+
+    generate_both(p, 0, 8, 12, "generate after seq_rm");
+
+    // a second sequence, its tokens go after the ones of the first sequence
+    decode_both(p, 1, make_tokens(4, 2), 0, "decode the prompt of sequence 1");
+    generate_both(p, 1, 6, 4, "generate on sequence 1");
+
+    // the head moves back to the freed cells of sequence 0, in the middle of the cells of sequence 1
+    for (auto * ctx : ctxs) {
+        llama_kv_cache_seq_rm(ctx, 0, 4, -1);
+    }
+
+    generate_both(p, 0, 6, 4, "generate on sequence 0 after seq_rm");
+    generate_both(p, 1, 4, 10, "generate on sequence 1 after sequence 0");
+
+    llama_free(p.build);
+    llama_free(p.reuse);
+}
+
+int main(int /*argc*/, const char ** /*argv*/) {
+    const char * fname = "test-graph-reuse.gguf";
+
+    write_model(fname);
+
+    llama_backend_init(false);
+
+    llama_model * model = llama_load_model_from_file(fname, llama_model_default_params());
+    if (model == NULL) {
+        fprintf(stderr, "%s: error: failed to load '%s'\n", __func__, fname);
+        return 1;
+    }
+
+    auto cparams = llama_context_default_params();
+    cparams.seed            = 1;
+    cparams.n_ctx           = 256;
+    cparams.n_batch         = 256;
+    cparams.n_threads       = 2;
+    cparams.n_threads_batch = 2;
+
+    // the contiguous slot moves the views that store the new K and V when the graph is reused, the paged cache does not
+    cparams.kv_paged = false;
+    test_graph_reuse(model, cparams);
+
+    cparams.kv_paged = true;
+    test_graph_reuse(model, cparams);
+
+    llama_free_model(model);
+    llama_backend_free();
+
+    remove(fname);
+
+    return n_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,101 @@
+#include "ggml.h"
+#include "ggml-alloc.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4244 4267) // possible loss of data
+#endif
+
+static void ggml_graph_compute_helper(std::vector<uint8_t> & buf, ggml_cgraph * graph, int n_threads) {
+    struct ggml_cplan plan = ggml_graph_plan(graph, n_threads);
+
+    if (plan.work_size > 0) {
+        buf.resize(plan.work_size);
+        plan.work_data = buf.data();
+    }
+
+    ggml_graph_compute(graph, &plan);
+}
+
+// a chain of n_nodes ops, larger than the default graph size, in a graph of the given capacity
+// the tensors are allocated with ggml-alloc, whose hash table is sized from the graph
+static bool test_graph_size(int n_nodes, size_t size, int n_threads, std::vector<uint8_t> & work_buffer) {
+    const int64_t ne0 = 64;
+
+    struct ggml_init_params params = {
+        /* .mem_size   = */ ggml_tensor_overhead()*(2*n_nodes + 8) + ggml_graph_overhead_custom(size, false)*2,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    // the inputs are leafs, one every 8 nodes
+    std::vector<ggml_tensor *> inputs;
+
+    struct ggml_tensor * cur = nullptr;
+    for (int i = 0; i < n_nodes; ++i) {
+        if (i % 8 == 0) {
+            inputs.push_back(ggml_new_tensor_1d(ctx0, GGML_TYPE_F32, ne0));
+        }
+        cur = cur == nullptr ? ggml_dup(ctx0, inputs.back()) : ggml_add(ctx0, cur, inputs.back());
+    }
+
+    struct ggml_cgraph * gf = ggml_new_graph_custom(ctx0, size, false);
+    ggml_build_forward_expand(gf, cur);
+
+    // the copy has the same nodes and can be extended independently
+    struct ggml_cgraph * gd = ggml_graph_dup(ctx0, gf);
+
+    bool ok = gf->n_nodes == n_nodes && gd->n_nodes == gf->n_nodes && gd->n_leafs == gf->n_leafs;
+
+    // enough for all the tensors, even if the allocator reused none of them
+    std::vector<uint8_t> buf((ggml_nbytes(cur) + 32)*(inputs.size() + n_nodes) + 32);
+
+    struct ggml_allocr * alloc = ggml_allocr_new(buf.data(), buf.size(), 32);
+    for (auto * t : inputs) {
+        ggml_allocr_alloc(alloc, t);
+        for (int64_t j = 0; j < ne0; ++j) {
+            ((float *) t->data)[j] = (float) j;
+        }
+    }
+    ggml_allocr_alloc_graph(alloc, gf);
+
+    ggml_graph_compute_helper(work_buffer, gf, n_threads);
+
+    // the first node copies its input, the others add theirs
+    double max_err = 0.0;
+    for (int64_t j = 0; j < ne0; ++j) {
+        max_err = std::max(max_err, (double) fabsf(((float *) cur->data)[j] - (float) j*n_nodes)/(j*n_nodes + 1));
+    }
+    ok = ok && max_err < 1e-6;
+
+    printf("n_nodes = %5d, size = %5d, n_leafs = %4d, graph overhead = %7zu bytes: max err = %g %s\n",
+            gf->n_nodes, (int) size, gf->n_leafs, ggml_graph_overhead_custom(size, false), max_err, ok ? "OK" : "FAILED");
+
+    ggml_allocr_free(alloc);
+    ggml_free(ctx0);
+
+    return ok;
+}
+
+int main(int /*argc*/, const char ** /*argv*/) {
+    std::vector<uint8_t> work_buffer;
+
+    int n_failed = 0;
+
+    n_failed += !test_graph_size(  100,   128, 1, work_buffer);
+    n_failed += !test_graph_size( 2000, GGML_DEFAULT_GRAPH_SIZE, 4, work_buffer);
+    n_failed += !test_graph_size(20000, 20000, 4, work_buffer);
+
+    // the overhead of a graph is proportional to its size
+    n_failed += !(ggml_graph_overhead_custom(128, false) < ggml_graph_overhead_custom(GGML_DEFAULT_GRAPH_SIZE, false));
+    n_failed += !(ggml_graph_overhead_custom(GGML_DEFAULT_GRAPH_SIZE, false) < ggml_graph_overhead_custom(GGML_DEFAULT_GRAPH_SIZE, true));
+
+    return n_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+#include "test-model.h"
+
+#include <cstdio>
+#include <vector>
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4244 4267) // possible loss of data
+#endif
+
+// the same decode calls and KV cache operations, on a context with the paged KV cache and on one with the contiguous slot
+struct test_pair {
+    llama_context * paged;
+    llama_context * slot;
+};
+
+// decode tokens at the positions [pos0, pos0 + n) of seq_id on both contexts, and compare the logits of the last token
+static void decode_both(const test_pair & p, llama_seq_id seq_id, const std::vector<llama_token> & tokens, int pos0, const char * what) {
+    std::vector<float> logits[2];
+
+    const bool ok =
+        decode_at(p.paged, seq_id, tokens, pos0, logits[0]) &&
+        decode_at(p.slot,  seq_id, tokens, pos0, logits[1]);
+
+    check(ok && same_logits(logits[0], logits[1]), what);
+}
+
+int main(int /*argc*/, const char ** /*argv*/) {
+    const char * fname = "test-kv-paged.gguf";
+
+    write_model(fname);
+
+    llama_backend_init(false);
+
+    llama_model * model = llama_load_model_from_file(fname, llama_model_default_params());
+    if (model == NULL) {
+        fprintf(stderr, "%s: error: failed to load '%s'\n", __func__, fname);
+        return 1;
+    }
+
+    auto cparams = llama_context_default_params();
+    cparams.seed            = 1;
+    cparams.n_ctx           = 256;
+    cparams.n_batch         = 256;
+    cparams.n_threads       = 2;
+    cparams.n_threads_batch = 2;
+
+    test_pair p;
+
+    cparams.kv_paged = true;
+    p.paged = llama_new_context_with_model(model, cparams);
+
+    cparams.kv_paged = false;
+    p.slot = llama_new_context_with_model(model, cparams);
+
+    llama_context * ctxs[2] = { p.paged, p.slot };
+
+    // the same prompt on two sequences, that continue with different tokens
+    const auto prompt = make_tokens(40, 1);
+
+    decode_both(p, 0, prompt, 0, "decode the prompt");
+
+    for (auto * ctx : ctxs) {
+        llama_kv_cache_seq_cp(ctx, 0, 1, -1, -1);
+    }
+
+    decode_both(p, 0, make_tokens(10, 2), 40, "decode the end of sequence 0");
+    decode_both(p, 1, make_tokens(10, 3), 40, "decode the end of sequence 1 after seq_cp");
+
+    // the removed cells are in the middle of the used ones, the next tokens of sequence 0 go to them
+    for (auto * ctx : ctxs) {
+        llama_kv_cache_seq_rm(ctx, 0, 45, -1);
+    }
+
+    decode_both(p, 0, make_tokens(8, 4), 45, "decode sequence 0 after seq_rm");
+
+    for (int k = 0; k < 4; ++k) {
+        decode_both(p, k % 2, make_tokens(1, 5 + k), k % 2 == 0 ? 53 + k/2 : 50 + k/2, "decode one token after seq_rm");
+    }
+
+    // the context shift of sequence 1: its tokens [10, 20) are removed and the next ones are moved back
+    for (auto * ctx : ctxs) {
+        llama_kv_cache_seq_rm   (ctx, 1, 10, 20);
+        llama_kv_cache_seq_shift(ctx, 1, 20, -1, -10);
+    }
+
+    decode_both(p, 1, make_tokens(5, 6), 42, "decode sequence 1 after seq_shift");
+
+    // only sequence 1 is kept, the freed cells of sequence 0 are reused
+    for (auto * ctx : ctxs) {
+        llama_kv_cache_seq_keep(ctx, 1);
+    }
+
+    decode_both(p, 1, make_tokens(30, 7), 47, "decode sequence 1 after seq_keep");
+    decode_both(p, 2, make_tokens(20, 8),  0, "decode a new sequence after seq_keep");
+
+    llama_free(p.slot);
+    llama_free(p.paged);
+    llama_free_model(model);
+    llama_backend_free();
+
+    remove(fname);
+
+    return n_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+// a small random LLaMA model for the tests that decode, with the 256 byte tokens of the SPM vocab and the 3 special tokens
+
+#include "ggml.h"
+#include "llama.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+static const int n_vocab   = 259;
+static const int n_embd    = 64;
+static const int n_head    = 4;
+static const int n_head_kv = 2;
+static const int n_ff      = 128;
+static const int n_layer   = 2;
+
+static uint32_t rng_state = 1234;
+
+inline float frand(void) {
+    rng_state = rng_state*1664525 + 1013904223;
+    return (float) (rng_state >> 8)/(float) (1 << 24);
+}
+
+inline void add_tensor(struct gguf_context * gguf, struct ggml_context * ctx, const char * name, int64_t ne0, int64_t ne1, bool norm) {
+    struct ggml_tensor * t = ne1 > 1 ? ggml_new_tensor_2d(ctx, GGML_TYPE_F32, ne0, ne1) : ggml_new_tensor_1d(ctx, GGML_TYPE_F32, ne0);
+    ggml_set_name(t, name);
+
+    // uniform weights with a variance of 1/ne0, so that the activations stay around 1
+    const float scale = sqrtf(3.0f/ne0);
+    for (int64_t i = 0; i < ggml_nelements(t); ++i) {
+        ((float *) t->data)[i] = norm ? 1.0f + 0.1f*(2.0f*frand() - 1.0f) : scale*(2.0f*frand() - 1.0f);
+    }
+
+    gguf_add_tensor(gguf, t);
+}
+
+inline void write_model(const char * fname) {
+    struct gguf_context * gguf = gguf_init_empty();
+
+    gguf_set_val_str(gguf, "general.architecture", "llama");
+    gguf_set_val_str(gguf, "general.name", fname);
+    gguf_set_val_u32(gguf, "llama.context_length", 512);
+    gguf_set_val_u32(gguf, "llama.embedding_length", n_embd);
+    gguf_set_val_u32(gguf, "llama.block_count", n_layer);
+    gguf_set_val_u32(gguf, "llama.feed_forward_length", n_ff);
+    gguf_set_val_u32(gguf, "llama.rope.dimension_count", n_embd/n_head);
+    gguf_set_val_u32(gguf, "llama.attention.head_count", n_head);
+    gguf_set_val_u32(gguf, "llama.attention.head_count_kv", n_head_kv);
+    gguf_set_val_f32(gguf, "llama.attention.layer_norm_rms_epsilon", 1e-5f);
+
+    std::vector<std::string> tokens = { "<unk>", "<s>", "</s>" };
+    std::vector<int32_t> types = { LLAMA_TOKEN_TYPE_UNKNOWN, LLAMA_TOKEN_TYPE_CONTROL, LLAMA_TOKEN_TYPE_CONTROL };
+    for (int i = 0; i < 256; ++i) {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "<0x%02X>", i);
+        tokens.push_back(buf);
+        types.push_back(LLAMA_TOKEN_TYPE_BYTE);
+    }
+    std::vector<const char *> token_strs;
+    for (const auto & token : tokens) {
+        token_strs.push_back(token.c_str());
+    }
+
+    gguf_set_val_str (gguf, "tokenizer.ggml.model", "llama");
+    gguf_set_arr_str (gguf, "tokenizer.ggml.tokens", token_strs.data(), (int) token_strs.size());
+    gguf_set_arr_data(gguf, "tokenizer.ggml.token_type", GGUF_TYPE_INT32, types.data(), (int) types.size());
+
+    struct ggml_init_params params = {
+        /* .mem_size   = */ 8*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+
+    struct ggml_context * ctx = ggml_init(params);
+
+    const int n_embd_gqa = n_embd/n_head*n_head_kv;
+
+    add_tensor(gguf, ctx, "token_embd.weight", n_embd, n_vocab, false);
+    for (int il = 0; il < n_layer; ++il) {
+        char name[64];
+        snprintf(name, sizeof(name), "blk.%d.attn_norm.weight",   il); add_tensor(gguf, ctx, name, n_embd,     1,          true);
+        snprintf(name, sizeof(name), "blk.%d.attn_q.weight",      il); add_tensor(gguf, ctx, name, n_embd,     n_embd,     false);
+        snprintf(name, sizeof(name), "blk.%d.attn_k.weight",      il); add_tensor(gguf, ctx, name, n_embd,     n_embd_gqa, false);
+        snprintf(name, sizeof(name), "blk.%d.attn_v.weight",      il); add_tensor(gguf, ctx, name, n_embd,     n_embd_gqa, false);
+        snprintf(name, sizeof(name), "blk.%d.attn_output.weight", il); add_tensor(gguf, ctx, name, n_embd,     n_embd,     false);
+        snprintf(name, sizeof(name), "blk.%d.ffn_norm.weight",    il); add_tensor(gguf, ctx, name, n_embd,     1,          true);
+        snprintf(name, sizeof(name), "blk.%d.ffn_gate.weight",    il); add_tensor(gguf, ctx, name, n_embd,     n_ff,       false);
+        snprintf(name, sizeof(name), "blk.%d.ffn_up.weight",      il); add_tensor(gguf, ctx, name, n_embd,     n_ff,       false);
+        snprintf(name, sizeof(name), "blk.%d.ffn_down.weight",    il); add_tensor(gguf, ctx, name, n_ff,       n_embd,     false);
+    }
+    add_tensor(gguf, ctx, "output_norm.weight", n_embd, 1, true);
+    add_tensor(gguf, ctx, "output.weight", n_embd, n_vocab, false);
+
+    gguf_write_to_file(gguf, fname, false);
+
+    ggml_free(ctx);
+    gguf_free(gguf);
+}
+
+// the tokens [k*n, (k + 1)*n) of a pseudo-random stream, different streams for different k
+inline std::vector<llama_token> make_tokens(int n, int k) {
+    std::vector<llama_token> tokens(n);
+    for (int i = 0; i < n; ++i) {
+        tokens[i] = 3 + (k*97 + i*31 + (i*i)%13) % (n_vocab - 3);
+    }
+    return tokens;
+}
+
+inline std::vector<llama_token> concat(std::vector<llama_token> a, const std::vector<llama_token> & b) {
+    a.insert(a.end(), b.begin(), b.end());
+    return a;
+}
+
+// decode tokens at the positions [pos0, pos0 + n) of seq_id, the logits of the last token are returned in logits
+inline bool decode_at(llama_context * ctx, llama_seq_id seq_id, const std::vector<llama_token> & tokens, int pos0, std::vector<float> & logits) {
+    llama_batch batch = llama_batch_init((int32_t) tokens.size(), 0, 1);
+
+    for (int i = 0; i < (int) tokens.size(); ++i) {
+        const int k = batch.n_tokens++;
+        batch.token[k]     = tokens[i];
+        batch.pos[k]       = pos0 + i;
+        batch.n_seq_id[k]  = 1;
+        batch.seq_id[k][0] = seq_id;
+        batch.logits[k]    = i + 1 == (int) tokens.size();
+    }
+
+    const bool ok = llama_decode(ctx, batch) == 0;
+    if (ok) {
+        const float * l = llama_get_logits_ith(ctx, batch.n_tokens - 1);
+        logits.assign(l, l + n_vocab);
+    }
+
+    llama_batch_free(batch);
+
+    return ok;
+}
+
+// decode tokens [p0, end) at their positions on seq_id
+inline bool decode(llama_context * ctx, llama_seq_id seq_id, const std::vector<llama_token> & tokens, int p0, std::vector<float> & logits) {
+    return decode_at(ctx, seq_id, std::vector<llama_token>(tokens.begin() + p0, tokens.end()), p0, logits);
+}
+
+inline bool same_logits(const std::vector<float> & a, const std::vector<float> & b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    // the cells are not always in the order of the positions, which changes the rounding of the sums
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (fabsf(a[i] - b[i]) > 1e-3f*std::max(1.0f, fabsf(b[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int n_failed = 0;
+
+inline void check(bool ok, const char * what) {
+    printf("%s: %s: %s\n", __func__, what, ok ? "OK" : "FAILED");
+    n_failed += !ok;
+}
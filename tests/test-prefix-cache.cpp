@@ -0,0 +1,139 @@
+#include "test-model.h"
+
+#include <cstdio>
+#include <vector>
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4244 4267) // possible loss of data
+#endif
+
+// the logits of the last token of tokens, decoded from position 0 in a context without the prefix cache
+static std::vector<float> reference(llama_context * ref, const std::vector<llama_token> & tokens) {
+    std::vector<float> logits;
+    llama_kv_cache_clear(ref);
+    decode(ref, 0, tokens, 0, logits);
+    return logits;
+}
+
+int main(int /*argc*/, const char ** /*argv*/) {
+    const char * fname = "test-prefix-cache.gguf";
+
+    write_model(fname);
+
+    llama_backend_init(false);
+
+    llama_model * model = llama_load_model_from_file(fname, llama_model_default_params());
+    if (model == NULL) {
+        fprintf(stderr, "%s: error: failed to load '%s'\n", __func__, fname);
+        return 1;
+    }
+
+    auto cparams = llama_context_default_params();
+    cparams.seed            = 1;
+    cparams.n_ctx           = 256;
+    cparams.n_batch         = 256;
+    cparams.n_threads       = 2;
+    cparams.n_threads_batch = 2;
+
+    // the reference stores the K and V in a contiguous slot, so that it does not run the code of the paged cache
+    cparams.kv_paged = false;
+
+    llama_context * ref = llama_new_context_with_model(model, cparams);
+
+    cparams.kv_paged     = true;
+    cparams.prefix_cache = true;
+
+    llama_context * ctx = llama_new_context_with_model(model, cparams);
+
+    std::vector<float> logits;
+
+    const auto head = make_tokens(40, 1);
+    const auto a    = concat(head, make_tokens(20, 2));
+    const auto b    = concat(head, make_tokens(20, 3));
+
+    // the cells of a stay in the prefix cache after it is removed, b reuses the 40 tokens of the common head
+    check(decode(ctx, 0, a, 0, logits), "decode a");
+    llama_kv_cache_seq_rm(ctx, 0, -1, -1);
+
+    int n = llama_kv_cache_seq_attach(ctx, 1, b.data(), (int32_t) b.size() - 1);
+    check(n == (int) head.size(), "attach the head of b");
+    check(decode(ctx, 1, b, n, logits) && same_logits(logits, reference(ref, b)), "decode the rest of b");
+
+    // after removing its end, the sequence attaches the removed tokens again
+    llama_kv_cache_seq_rm(ctx, 1, 50, -1);
+    n = llama_kv_cache_seq_attach(ctx, 1, b.data(), (int32_t) b.size() - 1);
+    check(n == (int) b.size() - 1, "attach the removed end of b");
+    check(decode(ctx, 1, b, n, logits) && same_logits(logits, reference(ref, b)), "decode the last token of b");
+
+    // copying a sequence onto itself keeps its path, its next tokens still go to the tree
+    const auto b2 = concat(b, make_tokens(5, 6));
+    llama_kv_cache_seq_cp(ctx, 1, 1, -1, -1);
+    check(decode(ctx, 1, b2, (int) b.size(), logits), "decode b2 after copying its sequence onto itself");
+    n = llama_kv_cache_seq_attach(ctx, 10, b2.data(), (int32_t) b2.size() - 1);
+    check(n == (int) b2.size() - 1, "attach b2");
+    llama_kv_cache_seq_rm(ctx, 10, -1, -1);
+
+    // or continues on another branch
+    const auto c = concat(std::vector<llama_token>(b.begin(), b.begin() + 50), make_tokens(10, 4));
+    llama_kv_cache_seq_rm(ctx, 1, 50, -1);
+    n = llama_kv_cache_seq_attach(ctx, 1, c.data(), (int32_t) c.size() - 1);
+    check(n == 50, "attach the common start of b and c");
+    check(decode(ctx, 1, c, n, logits) && same_logits(logits, reference(ref, c)), "decode the rest of c");
+    llama_kv_cache_seq_rm(ctx, 1, -1, -1);
+
+    // prompts that do not fit in the cache together, the least recently used ones are evicted to make room
+    std::vector<std::vector<llama_token>> prompts;
+    bool ok = true;
+    for (int k = 0; k < 6; ++k) {
+        prompts.push_back(make_tokens(60 + 7*k, 10 + k));
+        ok = ok && decode(ctx, 2, prompts.back(), 0, logits);
+        llama_kv_cache_seq_rm(ctx, 2, -1, -1);
+    }
+    check(ok, "decode the prompts under pressure");
+
+    n = llama_kv_cache_seq_attach(ctx, 3, prompts[0].data(), (int32_t) prompts[0].size() - 1);
+    check(n >= 0 && n < (int) prompts[0].size() - 1, "attach the evicted first prompt");
+    llama_kv_cache_seq_rm(ctx, 3, -1, -1);
+
+    // the cells of a sequence that does not start at position 0 are not kept, removing them leaves holes before the cells of e
+    const auto filler = make_tokens(80, 20);
+    const auto e      = make_tokens(60, 21);
+    ok = decode(ctx, 6, filler, 1, logits) && decode(ctx, 7, e, 0, logits);
+    llama_kv_cache_seq_rm(ctx, 6, -1, -1);
+    llama_kv_cache_seq_rm(ctx, 7, -1, -1);
+    check(ok, "decode e after a sequence that is not kept");
+
+    // the tree follows the cells moved by the defragmentation
+    llama_kv_cache_defrag(ctx);
+
+    n = llama_kv_cache_seq_attach(ctx, 8, e.data(), (int32_t) e.size() - 1);
+    check(n == (int) e.size() - 1, "attach e after the defragmentation");
+    check(decode(ctx, 8, e, n, logits) && same_logits(logits, reference(ref, e)), "decode the last token of e");
+
+    const auto f = concat(std::vector<llama_token>(e.begin(), e.begin() + 30), make_tokens(20, 22));
+    n = llama_kv_cache_seq_attach(ctx, 9, f.data(), (int32_t) f.size() - 1);
+    check(n == 30, "attach the common start of e and f");
+    check(decode(ctx, 9, f, n, logits) && same_logits(logits, reference(ref, f)), "decode the rest of f");
+
+    // removing the tokens of all the sequences also removes them from the prefix cache
+    llama_kv_cache_seq_rm(ctx, -1, 20, -1);
+    n = llama_kv_cache_seq_attach(ctx, 11, e.data(), (int32_t) e.size() - 1);
+    check(n == 20, "attach e after removing the positions from 20 on");
+    check(decode(ctx, 11, e, n, logits) && same_logits(logits, reference(ref, e)), "decode the rest of e");
+
+    llama_kv_cache_seq_rm(ctx, -1, -1, -1);
+    n = llama_kv_cache_seq_attach(ctx, 12, e.data(), (int32_t) e.size() - 1);
+    check(n == 0, "attach e after removing all the tokens");
+
+    // without the prefix cache, nothing is attached
+    check(llama_kv_cache_seq_attach(ref, 1, b.data(), (int32_t) b.size() - 1) == -1, "attach without the prefix cache");
+
+    llama_free(ctx);
+    llama_free(ref);
+    llama_free_model(model);
+    llama_backend_free();
+
+    remove(fname);
+
+    return n_failed == 0 ? 0 : 1;
+}
@@ -6,6 +6,7 @@
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -18,6 +19,8 @@ constexpr float MAX_QUANTIZATION_TOTAL_ERROR = 0.002f;
 constexpr float MAX_QUANTIZATION_TOTAL_ERROR_2BITS = 0.0075f;
 constexpr float MAX_QUANTIZATION_TOTAL_ERROR_3BITS = 0.0040f;
 constexpr float MAX_DOT_PRODUCT_ERROR = 0.02f;
+constexpr float MAX_DOT_PRODUCT_DEQUANTIZED_ERROR = 0.0001f;
+constexpr float MAX_DOT_PRODUCT_TILE_ERROR = 0.00001f;
 
 static const char* RESULT_STR[] = {"ok", "FAILED"};
 
@@ -92,6 +95,72 @@ static float dot_product_error(
     return fabsf(result - dot_ref) / test_size;
 }
 
+// Dot product error relative to the dot product of the dequantized vectors
+// this checks the SIMD implementations of vec_dot, independently of the quantization error
+static float dot_product_dequantized_error(
+    ggml_type_traits_t & qfns, size_t test_size, const float * test_data1, const float * test_data2
+) {
+    std::vector<uint8_t> tmp_q1(2*test_size);
+    std::vector<uint8_t> tmp_q2(2*test_size);
+    std::vector<float>   tmp_out1(test_size);
+    std::vector<float>   tmp_out2(test_size);
+
+    auto vdot = ggml_internal_get_type_traits(qfns.vec_dot_type);
+
+    qfns.from_float(test_data1, tmp_q1.data(), test_size);
+    vdot.from_float(test_data2, tmp_q2.data(), test_size);
+
+    qfns.to_float(tmp_q1.data(), tmp_out1.data(), test_size);
+    vdot.to_float(tmp_q2.data(), tmp_out2.data(), test_size);
+
+    float result = INFINITY;
+    qfns.vec_dot(test_size, &result, tmp_q1.data(), tmp_q2.data());
+
+    const float dot_ref = dot_product(tmp_out1.data(), tmp_out2.data(), test_size);
+
+    return fabsf(result - dot_ref) / test_size;
+}
+
+// Max difference between the tile dot product and the single row dot product
+static float dot_product_tile_error(
+    ggml_type_traits_t & qfns, size_t test_size, const float * test_data1, const float * test_data2
+) {
+    const int nr = qfns.vec_dot_tile_nr;
+    const int nc = qfns.vec_dot_tile_nc;
+
+    auto vdot = ggml_internal_get_type_traits(qfns.vec_dot_type);
+
+    const size_t bx = test_size*qfns.type_size/qfns.blck_size;
+    const size_t by = test_size*vdot.type_size/vdot.blck_size;
+
+    std::vector<uint8_t> tmp_q1(nr*bx);
+    std::vector<uint8_t> tmp_q2(nc*by);
+
+    // use a different part of the test data for each row and column
+    for (int r = 0; r < nr; r++) {
+        qfns.from_float(test_data1 + r*(test_size/nr), tmp_q1.data() + r*bx, test_size - r*(test_size/nr));
+        qfns.from_float(test_data2, tmp_q1.data() + r*bx + (test_size - r*(test_size/nr))*qfns.type_size/qfns.blck_size, r*(test_size/nr));
+    }
+    for (int c = 0; c < nc; c++) {
+        vdot.from_float(test_data2 + c*(test_size/nc), tmp_q2.data() + c*by, test_size - c*(test_size/nc));
+        vdot.from_float(test_data1, tmp_q2.data() + c*by + (test_size - c*(test_size/nc))*vdot.type_size/vdot.blck_size, c*(test_size/nc));
+    }
+
+    std::vector<float> result(nr*nc, INFINITY);
+    qfns.vec_dot_tile(test_size, result.data(), nr, tmp_q1.data(), bx, tmp_q2.data(), by);
+
+    float max_error = 0.0f;
+    for (int c = 0; c < nc; c++) {
+        for (int r = 0; r < nr; r++) {
+            float ref = INFINITY;
+            qfns.vec_dot(test_size, &ref, tmp_q1.data() + r*bx, tmp_q2.data() + c*by);
+            max_error = std::max(max_error, fabsf(result[c*nr + r] - ref) / test_size);
+        }
+    }
+
+    return max_error;
+}
+
 int main(int argc, char * argv[]) {
     bool verbose = false;
     const size_t test_size = 32 * 128;
@@ -136,7 +205,8 @@ int main(int argc, char * argv[]) {
 
         printf("Testing %s\n", ggml_type_name((ggml_type) i));
 
-        if (qfns.from_float && qfns.to_float) {
+        // types only used for the dot products (q8_K) have no reference quantization and no vec_dot
+        if (qfns.from_float && qfns.to_float && qfns.vec_dot) {
             const float total_error = total_quantization_error(qfns, test_size, test_data.data());
             const float max_quantization_error =
                 type == GGML_TYPE_Q2_K ? MAX_QUANTIZATION_TOTAL_ERROR_2BITS :
@@ -160,6 +230,24 @@ int main(int argc, char * argv[]) {
             if (failed || verbose) {
                 printf("%5s dot product error:              %s (%f)\n", ggml_type_name(type), RESULT_STR[failed], vec_dot_error);
             }
+
+            if (ggml_internal_get_type_traits(qfns.vec_dot_type).to_float) {
+                const float vec_dot_dequantized_error = dot_product_dequantized_error(qfns, test_size, test_data.data(), test_data2.data());
+                failed = !(vec_dot_dequantized_error < MAX_DOT_PRODUCT_DEQUANTIZED_ERROR);
+                num_failed += failed;
+                if (failed || verbose) {
+                    printf("%5s dequantized dot product error:  %s (%f)\n", ggml_type_name(type), RESULT_STR[failed], vec_dot_dequantized_error);
+                }
+            }
+
+            if (qfns.vec_dot_tile) {
+                const float vec_dot_tile_error = dot_product_tile_error(qfns, test_size, test_data.data(), test_data2.data());
+                failed = !(vec_dot_tile_error < MAX_DOT_PRODUCT_TILE_ERROR);
+                num_failed += failed;
+                if (failed || verbose) {
+                    printf("%5s tile dot product error:         %s (%f)\n", ggml_type_name(type), RESULT_STR[failed], vec_dot_tile_error);
+                }
+            }
         }
     }
 
@@ -124,7 +124,7 @@ static void usage(char * argv[]) {
         ggml_type type = (ggml_type) i;
         ggml_type_traits_t qfns = ggml_internal_get_type_traits(type);
         if (ggml_type_name(type) != NULL) {
-            if (qfns.from_float && qfns.to_float) {
+            if (qfns.from_float && qfns.to_float && qfns.vec_dot) {
                 printf(" %s", ggml_type_name(type));
             }
         }
@@ -268,6 +268,11 @@ int main(int argc, char * argv[]) {
     };
     struct ggml_context * ctx = ggml_init(ggml_params);
 
+    // the SIMD implementations that are benchmarked depend on the instruction sets enabled at build time
+    printf("AVX = %d | AVX2 = %d | AVX512 = %d | AVX512_VNNI = %d | FMA = %d | NEON = %d | ARM_FMA = %d\n\n",
+            ggml_cpu_has_avx(), ggml_cpu_has_avx2(), ggml_cpu_has_avx512(), ggml_cpu_has_avx512_vnni(),
+            ggml_cpu_has_fma(), ggml_cpu_has_neon(), ggml_cpu_has_arm_fma());
+
     for (int i = 0; i < GGML_TYPE_COUNT; i++) {
         ggml_type type = (ggml_type) i;
         ggml_type_traits_t qfns = ggml_internal_get_type_traits(type);
@@ -275,7 +280,8 @@ int main(int argc, char * argv[]) {
             continue;
         }
 
-        if (qfns.from_float && qfns.to_float) {
+        // types only used for the dot products (q8_K) have no reference quantization and no vec_dot
+        if (qfns.from_float && qfns.to_float && qfns.vec_dot) {
             printf("%s\n", ggml_type_name(type));
 
             if (params.op_quantize_row_q_reference) {
@@ -338,8 +344,9 @@ int main(int argc, char * argv[]) {
 
             if (params.op_vec_dot_q) {
                 printf("  vec_dot_q\n");
+                auto vdot = ggml_internal_get_type_traits(qfns.vec_dot_type);
                 qfns.from_float(test_data1, test_q1, largest);
-                qfns.from_float(test_data2, test_q2, largest);
+                vdot.from_float(test_data2, test_q2, largest);
                 for (size_t size : params.test_sizes) {
                     printf("    %zu values (%.2f MB)\n", size, 4*size/(float)(1024*1024));
                     auto quantize_fn = [&](void) -> float {
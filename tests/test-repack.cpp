@@ -0,0 +1,100 @@
+#include "ggml.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4244 4267) // possible loss of data
+#endif
+
+static float frand(void) {
+    return (float)rand()/(float)RAND_MAX;
+}
+
+static void ggml_graph_compute_helper(std::vector<uint8_t> & buf, ggml_cgraph * graph, int n_threads) {
+    struct ggml_cplan plan = ggml_graph_plan(graph, n_threads);
+
+    if (plan.work_size > 0) {
+        buf.resize(plan.work_size);
+        plan.work_data = buf.data();
+    }
+
+    ggml_graph_compute(graph, &plan);
+}
+
+// a mul_mat with repacked weights must give the same result as with the original weights
+// the number of columns covers the tiles of vec_dot_tile and the single columns left over
+static bool test_repack(ggml_type type, int64_t n_embd, int64_t n_rows, int64_t n_tokens, int n_threads, std::vector<uint8_t> & work_buffer) {
+    struct ggml_init_params params = {
+        /* .mem_size   = */ 64*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    std::vector<float> data(n_embd*n_rows);
+    for (auto & v : data) {
+        v = frand()*2.0f - 1.0f;
+    }
+
+    struct ggml_tensor * w0 = ggml_new_tensor_2d(ctx0, type,                   n_embd, n_rows);
+    struct ggml_tensor * w1 = ggml_new_tensor_2d(ctx0, ggml_repack_type(type), n_embd, n_rows);
+
+    std::vector<int64_t> hist(1 << 4);
+    ggml_quantize_chunk(type, data.data(), w0->data, 0, n_embd*n_rows, hist.data());
+
+    ggml_repack(type, w0->data, w1->data, n_embd, n_rows);
+
+    struct ggml_tensor * x = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_embd, n_tokens);
+    for (int64_t i = 0; i < ggml_nelements(x); ++i) {
+        ((float *) x->data)[i] = frand()*2.0f - 1.0f;
+    }
+
+    struct ggml_tensor * r0 = ggml_mul_mat(ctx0, w0, x);
+    struct ggml_tensor * r1 = ggml_mul_mat(ctx0, w1, x);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx0);
+
+    ggml_build_forward_expand(gf, r0);
+    ggml_build_forward_expand(gf, r1);
+
+    ggml_graph_compute_helper(work_buffer, gf, n_threads);
+
+    double max_err = 0.0;
+    for (int64_t i = 0; i < ggml_nelements(r0); ++i) {
+        const float v0 = ((float *) r0->data)[i];
+        const float v1 = ((float *) r1->data)[i];
+
+        max_err = std::max(max_err, (double) fabsf(v0 - v1)/std::max(1.0f, fabsf(v0)));
+    }
+
+    // the kernels may sum the products in a different order than vec_dot
+    const bool ok = max_err < 1e-5;
+
+    printf("type = %-7s, n_embd = %4d, n_rows = %3d, n_tokens = %2d, n_threads = %d: max err = %g %s\n",
+            ggml_type_name(ggml_repack_type(type)), (int) n_embd, (int) n_rows, (int) n_tokens, n_threads, max_err, ok ? "OK" : "FAILED");
+
+    ggml_free(ctx0);
+
+    return ok;
+}
+
+int main(int /*argc*/, const char ** /*argv*/) {
+    std::vector<uint8_t> work_buffer;
+
+    int n_failed = 0;
+
+    for (ggml_type type : { GGML_TYPE_Q4_0, GGML_TYPE_Q8_0, GGML_TYPE_Q4_K }) {
+        n_failed += !test_repack(type, 256,  64,  1, 1, work_buffer);
+        n_failed += !test_repack(type, 512, 132,  1, 4, work_buffer);
+        n_failed += !test_repack(type, 256,  68,  7, 3, work_buffer);
+        n_failed += !test_repack(type, 768, 260, 33, 4, work_buffer);
+    }
+
+    return n_failed == 0 ? 0 : 1;
+}
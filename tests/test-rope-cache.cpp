@@ -0,0 +1,145 @@
+#include "ggml.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4244 4267) // possible loss of data
+#endif
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic ignored "-Wdouble-promotion"
+#endif
+
+static float frand(void) {
+    return (float)rand()/(float)RAND_MAX;
+}
+
+static void ggml_graph_compute_helper(std::vector<uint8_t> & buf, ggml_cgraph * graph, int n_threads) {
+    struct ggml_cplan plan = ggml_graph_plan(graph, n_threads);
+
+    if (plan.work_size > 0) {
+        buf.resize(plan.work_size);
+        plan.work_data = buf.data();
+    }
+
+    ggml_graph_compute(graph, &plan);
+}
+
+// rotation of the pairs (x[i0], x[i1]) by p*freq_scale*theta_scale^k, computed in double precision
+static void rope_ref(const float * x, double * y, int64_t ne0, int n_dims, int mode, int p, float freq_base, float freq_scale) {
+    const bool is_neox = mode & 2;
+
+    for (int64_t i = 0; i < ne0; ++i) {
+        y[i] = x[i];
+    }
+
+    for (int64_t k = 0; k < (is_neox ? n_dims/2 : ne0/2); ++k) {
+        const double theta = p*freq_scale*pow(freq_base, -2.0*k/n_dims);
+
+        const int64_t i0 = is_neox ? k            : 2*k;
+        const int64_t i1 = is_neox ? k + n_dims/2 : 2*k + 1;
+
+        y[i0] = x[i0]*cos(theta) - x[i1]*sin(theta);
+        y[i1] = x[i0]*sin(theta) + x[i1]*cos(theta);
+    }
+}
+
+// ggml_rope_custom_cached must give the same result as ggml_rope_custom, with the positions inside and outside of the cache
+static bool test_rope_cache(ggml_type type, int mode, int64_t n_rot, int64_t n_head, int64_t n_tokens, int p0, int n_pos, std::vector<uint8_t> & work_buffer) {
+    struct ggml_init_params params = {
+        /* .mem_size   = */ 64*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    const float freq_base  = 10000.0f;
+    const float freq_scale = mode & 2 ? 1.0f : 0.5f;
+
+    const int64_t ne0 = n_rot;
+
+    struct ggml_tensor * x   = ggml_new_tensor_3d(ctx0, type, ne0, n_head, n_tokens);
+    struct ggml_tensor * pos = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+
+    std::vector<float> x_f32(ggml_nelements(x));
+    for (auto & v : x_f32) {
+        v = frand()*2.0f - 1.0f;
+    }
+
+    if (type == GGML_TYPE_F16) {
+        for (size_t i = 0; i < x_f32.size(); ++i) {
+            ((ggml_fp16_t *) x->data)[i] = ggml_fp32_to_fp16(x_f32[i]);
+            x_f32[i] = ggml_fp16_to_fp32(((ggml_fp16_t *) x->data)[i]);
+        }
+    } else {
+        memcpy(x->data, x_f32.data(), ggml_nbytes(x));
+    }
+
+    for (int i = 0; i < n_tokens; ++i) {
+        ((int32_t *) pos->data)[i] = p0 + i;
+    }
+
+    struct ggml_tensor * cache = ggml_rope_cache(ctx0, ne0, n_pos, n_rot, mode, 0, 0, freq_base, freq_scale, 0.0f, 1.0f, 0.0f, 0.0f);
+
+    struct ggml_tensor * r0 = ggml_rope_custom       (ctx0, x, pos,        n_rot, mode, 0, 0, freq_base, freq_scale, 0.0f, 1.0f, 0.0f, 0.0f);
+    struct ggml_tensor * r1 = ggml_rope_custom_cached(ctx0, x, pos, cache, n_rot, mode, 0, 0, freq_base, freq_scale, 0.0f, 1.0f, 0.0f, 0.0f);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx0);
+
+    ggml_build_forward_expand(gf, r0);
+    ggml_build_forward_expand(gf, r1);
+
+    ggml_graph_compute_helper(work_buffer, gf, 4);
+
+    const bool ok_cache = memcmp(r0->data, r1->data, ggml_nbytes(r0)) == 0;
+
+    std::vector<double> y(ne0);
+
+    double max_err = 0.0;
+
+    for (int64_t i2 = 0; i2 < n_tokens; ++i2) {
+        for (int64_t i1 = 0; i1 < n_head; ++i1) {
+            const int64_t ir = i2*n_head + i1;
+
+            rope_ref(x_f32.data() + ir*ne0, y.data(), ne0, n_rot, mode, p0 + i2, freq_base, freq_scale);
+
+            for (int64_t i0 = 0; i0 < ne0; ++i0) {
+                const float v = type == GGML_TYPE_F16 ? ggml_fp16_to_fp32(((ggml_fp16_t *) r0->data)[ir*ne0 + i0]) : ((float *) r0->data)[ir*ne0 + i0];
+                max_err = std::max(max_err, fabs(v - y[i0]));
+            }
+        }
+    }
+
+    // the rotations of the large positions lose some precision in theta
+    const bool ok = ok_cache && max_err < (type == GGML_TYPE_F16 ? 2e-3 : 1e-3);
+
+    printf("type = %s, mode = %d, n_rot = %3d, pos = [%4d, %4d), n_pos = %4d: cache %s, max err = %g %s\n",
+            ggml_type_name(type), mode, (int) n_rot, p0, p0 + (int) n_tokens, n_pos, ok_cache ? "same" : "different", max_err, ok ? "OK" : "FAILED");
+
+    ggml_free(ctx0);
+
+    return ok;
+}
+
+int main(int /*argc*/, const char ** /*argv*/) {
+    std::vector<uint8_t> work_buffer;
+
+    int n_failed = 0;
+
+    for (ggml_type type : { GGML_TYPE_F32, GGML_TYPE_F16 }) {
+        for (int mode : { 0, 2 }) {
+            // positions in the cache, partly past its end, and negative as in a K-shift
+            n_failed += !test_rope_cache(type, mode, 128, 8, 33,   0, 512, work_buffer);
+            n_failed += !test_rope_cache(type, mode,  64, 4, 17, 500, 512, work_buffer);
+            n_failed += !test_rope_cache(type, mode,  36, 3,  9, -20, 512, work_buffer);
+        }
+    }
+
+    return n_failed == 0 ? 0 : 1;
+}
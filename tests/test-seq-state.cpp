@@ -0,0 +1,91 @@
+#include "test-model.h"
+
+#include <cstdio>
+#include <vector>
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4244 4267) // possible loss of data
+#endif
+
+static void test_seq_state(llama_model * model, const llama_context_params & cparams) {
+    printf("%s: kv_paged = %d\n", __func__, cparams.kv_paged);
+
+    llama_context * src = llama_new_context_with_model(model, cparams);
+    llama_context * dst = llama_new_context_with_model(model, cparams);
+
+    std::vector<float> logits;
+    std::vector<float> logits_src;
+    std::vector<float> logits_dst;
+
+    const auto prompt = make_tokens(40, 1);
+    const auto next   = make_tokens(1, 2);
+
+    // the cells of sequence 0 are after and between the ones of sequence 1
+    bool ok =
+        decode(src, 1, make_tokens(10, 3), 0, logits) &&
+        decode(src, 0, prompt, 0, logits);
+    llama_kv_cache_seq_rm(src, 1, 5, -1);
+    ok = ok && decode_at(src, 0, make_tokens(5, 4), 40, logits);
+    check(ok, "decode sequence 0 in the source context");
+
+    const size_t size = llama_seq_state_get_size(src, 0);
+
+    std::vector<uint8_t> state(size);
+    check(llama_seq_state_copy(src, 0, state.data(), state.size()) == size, "copy the state of sequence 0");
+    check(llama_seq_state_copy(src, 0, state.data(), state.size() - 1) == 0, "copy to a destination that is too small");
+
+    check(decode_at(src, 0, next, 45, logits_src), "decode the next token in the source context");
+
+    // the state is restored into another sequence, of a context that already has the cells of another sequence
+    check(decode(dst, 2, make_tokens(20, 5), 0, logits), "decode sequence 2 in the destination context");
+    check(llama_seq_state_set(dst, 7, state.data(), state.size()) == size, "set the state of sequence 7");
+
+    // a state that is too small is rejected, without touching the sequence
+    check(llama_seq_state_set(dst, 7, state.data(), state.size() - 1) == 0, "set from a state that is too small");
+    check(llama_seq_state_set(dst, 7, state.data(), 4) == 0, "set from a state smaller than its header");
+
+    check(decode_at(dst, 7, next, 45, logits_dst) && same_logits(logits_dst, logits_src), "decode the next token of sequence 7");
+
+    // the sequence ids past LLAMA_MAX_SEQ are rejected
+    check(llama_seq_state_get_size(dst, LLAMA_MAX_SEQ) == 0, "get the size of sequence LLAMA_MAX_SEQ");
+    check(llama_seq_state_copy(dst, LLAMA_MAX_SEQ, state.data(), state.size()) == 0, "copy sequence LLAMA_MAX_SEQ");
+    check(llama_seq_state_set(dst, LLAMA_MAX_SEQ, state.data(), state.size()) == 0, "set sequence LLAMA_MAX_SEQ");
+    check(llama_seq_state_set(dst, -1, state.data(), state.size()) == 0, "set sequence -1");
+
+    llama_free(dst);
+    llama_free(src);
+}
+
+int main(int /*argc*/, const char ** /*argv*/) {
+    const char * fname = "test-seq-state.gguf";
+
+    write_model(fname);
+
+    llama_backend_init(false);
+
+    llama_model * model = llama_load_model_from_file(fname, llama_model_default_params());
+    if (model == NULL) {
+        fprintf(stderr, "%s: error: failed to load '%s'\n", __func__, fname);
+        return 1;
+    }
+
+    auto cparams = llama_context_default_params();
+    cparams.seed            = 1;
+    cparams.n_ctx           = 256;
+    cparams.n_batch         = 256;
+    cparams.n_threads       = 2;
+    cparams.n_threads_batch = 2;
+
+    cparams.kv_paged = true;
+    test_seq_state(model, cparams);
+
+    cparams.kv_paged = false;
+    test_seq_state(model, cparams);
+
+    llama_free_model(model);
+    llama_backend_free();
+
+    remove(fname);
+
+    return n_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#include "ggml.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4244 4267) // possible loss of data
+#endif
+
+static float frand(void) {
+    return (float)rand()/(float)RAND_MAX;
+}
+
+static void ggml_graph_compute_helper(std::vector<uint8_t> & buf, ggml_cgraph * graph, int n_threads) {
+    struct ggml_cplan plan = ggml_graph_plan(graph, n_threads);
+
+    if (plan.work_size > 0) {
+        buf.resize(plan.work_size);
+        plan.work_data = buf.data();
+    }
+
+    ggml_graph_compute(graph, &plan);
+}
+
+static float to_f32(const struct ggml_tensor * t, int64_t i0, int64_t i1) {
+    const char * p = (const char *) t->data + i0*t->nb[0] + i1*t->nb[1];
+
+    switch (t->type) {
+        case GGML_TYPE_F32:  return *(const float *) p;
+        case GGML_TYPE_F16:  return ggml_fp16_to_fp32(*(const ggml_fp16_t *) p);
+        case GGML_TYPE_BF16: return ggml_bf16_to_fp32(*(const ggml_bf16_t *) p);
+        default:             return NAN;
+    }
+}
+
+// the rows of b go to the rows ids of a, stored as K (rows) and as V (columns of a transposed matrix) in the KV cache
+// the other rows of a keep their value
+static bool test_set_rows(ggml_type type, bool transposed, int64_t n_embd, int64_t n_cells, int64_t n_tokens, int n_threads, std::vector<uint8_t> & work_buffer) {
+    struct ggml_init_params params = {
+        /* .mem_size   = */ 16*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    struct ggml_tensor * cache = transposed ? ggml_new_tensor_2d(ctx0, type, n_cells, n_embd) : ggml_new_tensor_2d(ctx0, type, n_embd, n_cells);
+    struct ggml_tensor * a     = transposed ? ggml_transpose(ctx0, cache) : cache;
+    struct ggml_tensor * b     = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_embd, n_tokens);
+    struct ggml_tensor * ids   = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+
+    ggml_set_f32(cache, -1.0f);
+
+    for (int64_t i = 0; i < ggml_nelements(b); ++i) {
+        ((float *) b->data)[i] = frand()*2.0f - 1.0f;
+    }
+
+    // the cells of the tokens are not contiguous and not in order
+    std::vector<int> row_of(n_cells, -1);
+    for (int64_t i = 0; i < n_tokens; ++i) {
+        const int32_t r = (int32_t) ((i*7 + 3) % n_cells);
+        ((int32_t *) ids->data)[i] = r;
+        row_of[r] = (int) i;
+    }
+
+    struct ggml_tensor * r = ggml_set_rows(ctx0, a, b, ids);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx0);
+    ggml_build_forward_expand(gf, r);
+
+    ggml_graph_compute_helper(work_buffer, gf, n_threads);
+
+    // the values are rounded to the type of the cache
+    const float eps = type == GGML_TYPE_F32 ? 0.0f : type == GGML_TYPE_F16 ? 1e-3f : 1e-2f;
+
+    bool ok = r->data == cache->data;
+    for (int64_t i1 = 0; i1 < n_cells && ok; ++i1) {
+        for (int64_t i0 = 0; i0 < n_embd && ok; ++i0) {
+            const float expected = row_of[i1] < 0 ? -1.0f : ((float *) b->data)[row_of[i1]*n_embd + i0];
+            ok = fabsf(to_f32(a, i0, i1) - expected) <= eps;
+        }
+    }
+
+    printf("%s: type = %4s, transposed = %d, n_embd = %3d, n_cells = %3d, n_tokens = %2d, n_threads = %d: %s\n", __func__,
+            ggml_type_name(type), transposed, (int) n_embd, (int) n_cells, (int) n_tokens, n_threads, ok ? "OK" : "FAILED");
+
+    ggml_free(ctx0);
+
+    return ok;
+}
+
+int main(int /*argc*/, const char ** /*argv*/) {
+    std::vector<uint8_t> work_buffer;
+
+    int n_failed = 0;
+
+    for (ggml_type type : { GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_BF16 }) {
+        for (bool transposed : { false, true }) {
+            n_failed += !test_set_rows(type, transposed, 128,  64,  1, 1, work_buffer);
+            n_failed += !test_set_rows(type, transposed, 100, 256, 33, 4, work_buffer);
+            n_failed += !test_set_rows(type, transposed,  37,  96, 17, 3, work_buffer);
+        }
+    }
+
+    return n_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,131 @@
+#include "ggml.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4244 4267) // possible loss of data
+#endif
+
+static float frand(void) {
+    return (float)rand()/(float)RAND_MAX;
+}
+
+static struct ggml_tensor * new_random(struct ggml_context * ctx, ggml_type type, int64_t ne0, int64_t ne1) {
+    std::vector<float> data(ne0*ne1);
+
+    for (auto & v : data) {
+        v = frand()*2.0f - 1.0f;
+    }
+
+    struct ggml_tensor * t = ggml_new_tensor_2d(ctx, type, ne0, ne1);
+
+    if (type == GGML_TYPE_F32) {
+        memcpy(t->data, data.data(), ggml_nbytes(t));
+    } else {
+        std::vector<int64_t> hist(1 << 4);
+        ggml_quantize_chunk(type, data.data(), t->data, 0, ne0*ne1, hist.data());
+    }
+
+    return t;
+}
+
+static size_t graph_compute(std::vector<uint8_t> & buf, ggml_cgraph * graph, int n_threads) {
+    struct ggml_cplan plan = ggml_graph_plan(graph, n_threads);
+
+    if (plan.work_size > 0) {
+        buf.resize(plan.work_size);
+        plan.work_data = buf.data();
+    }
+
+    ggml_graph_compute(graph, &plan);
+
+    return plan.work_size;
+}
+
+static int count_op(const ggml_cgraph * gf, ggml_op op) {
+    int n = 0;
+    for (int i = 0; i < gf->n_nodes; ++i) {
+        n += gf->nodes[i]->op == op;
+    }
+    return n;
+}
+
+// the projections of an attention layer and of a feed-forward network, with weights of different types
+static struct ggml_tensor * build_layer(struct ggml_context * ctx, struct ggml_tensor ** w, struct ggml_tensor * inp) {
+    struct ggml_tensor * q = ggml_mul_mat(ctx, w[0], inp);
+    struct ggml_tensor * k = ggml_mul_mat(ctx, w[1], inp);
+    struct ggml_tensor * v = ggml_mul_mat(ctx, w[2], inp);
+
+    struct ggml_tensor * cur = ggml_add(ctx, ggml_add(ctx, q, k), v);
+
+    struct ggml_tensor * up   = ggml_mul_mat(ctx, w[3], cur);
+    struct ggml_tensor * gate = ggml_mul_mat(ctx, w[4], cur);
+
+    return ggml_mul(ctx, up, gate);
+}
+
+static bool test_share_src1(int64_t n_embd, int64_t n_tokens, int n_threads, std::vector<uint8_t> & work_buffer) {
+    struct ggml_init_params params = {
+        /* .mem_size   = */ 64*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    // q (q4_K) and k (q6_K) share the q8_K conversion of the input, v (q4_0) converts it to q8_0 on its own
+    // up and gate share the f16 conversion of their input
+    struct ggml_tensor * w[5] = {
+        new_random(ctx0, GGML_TYPE_Q4_K, n_embd, n_embd),
+        new_random(ctx0, GGML_TYPE_Q6_K, n_embd, n_embd),
+        new_random(ctx0, GGML_TYPE_Q4_0, n_embd, n_embd),
+        new_random(ctx0, GGML_TYPE_F16,  n_embd, n_embd),
+        new_random(ctx0, GGML_TYPE_F16,  n_embd, n_embd),
+    };
+
+    struct ggml_tensor * inp = new_random(ctx0, GGML_TYPE_F32, n_embd, n_tokens);
+
+    struct ggml_tensor * r0 = build_layer(ctx0, w, inp);
+    struct ggml_tensor * r1 = build_layer(ctx0, w, inp);
+
+    ggml_cgraph * gf0 = ggml_new_graph(ctx0);
+    ggml_cgraph * gf1 = ggml_new_graph(ctx0);
+
+    ggml_build_forward_expand(gf0, r0);
+    ggml_build_forward_expand(gf1, r1);
+
+    ggml_graph_share_src1(ctx0, gf1);
+
+    const bool ok_ops =
+        count_op(gf1, GGML_OP_CPY)     == 2 &&
+        count_op(gf1, GGML_OP_MUL_MAT) == 5;
+
+    const size_t work_size0 = graph_compute(work_buffer, gf0, n_threads);
+    const size_t work_size1 = graph_compute(work_buffer, gf1, n_threads);
+
+    // the inputs are converted by the same functions as in the INIT pass of mul_mat
+    const bool ok = ok_ops && work_size1 < work_size0 && memcmp(r0->data, r1->data, ggml_nbytes(r0)) == 0;
+
+    printf("n_embd = %4d, n_tokens = %2d, n_threads = %d: nodes %d -> %d, work size %zu -> %zu %s\n",
+            (int) n_embd, (int) n_tokens, n_threads, gf0->n_nodes, gf1->n_nodes, work_size0, work_size1, ok ? "OK" : "FAILED");
+
+    ggml_free(ctx0);
+
+    return ok;
+}
+
+int main(int /*argc*/, const char ** /*argv*/) {
+    std::vector<uint8_t> work_buffer;
+
+    int n_failed = 0;
+
+    n_failed += !test_share_src1(256,  1, 1, work_buffer);
+    n_failed += !test_share_src1(256,  1, 4, work_buffer);
+    n_failed += !test_share_src1(512, 17, 4, work_buffer);
+
+    return n_failed == 0 ? 0 : 1;
+}
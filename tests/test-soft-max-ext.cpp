@@ -0,0 +1,126 @@
+#include "ggml.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#if defined(_MSC_VER)
+#pragma warning(disable: 4244 4267) // possible loss of data
+#endif
+
+static float frand(void) {
+    return (float)rand()/(float)RAND_MAX;
+}
+
+static struct ggml_tensor * new_random(struct ggml_context * ctx, int64_t ne0, int64_t ne1, int64_t ne2, float fmin, float fmax) {
+    struct ggml_tensor * t = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, ne0, ne1, ne2);
+
+    for (int64_t i = 0; i < ggml_nelements(t); i++) {
+        ((float *) t->data)[i] = frand()*(fmax - fmin) + fmin;
+    }
+
+    return t;
+}
+
+static void ggml_graph_compute_helper(std::vector<uint8_t> & buf, ggml_cgraph * graph, int n_threads) {
+    struct ggml_cplan plan = ggml_graph_plan(graph, n_threads);
+
+    if (plan.work_size > 0) {
+        buf.resize(plan.work_size);
+        plan.work_data = buf.data();
+    }
+
+    ggml_graph_compute(graph, &plan);
+}
+
+// compare ggml_soft_max_ext with a reference in double precision and with the separate ops used by llm_build_kqv
+// the scores are drawn from [-range, range], a large range exercises the underflow of exp
+static bool test_soft_max_ext(int64_t n_kv, int64_t n_tokens, int64_t n_head, float range, std::vector<uint8_t> & work_buffer) {
+    struct ggml_init_params params = {
+        /* .mem_size   = */ 64*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    const float scale = 0.125f;
+
+    struct ggml_tensor * kq   = new_random(ctx0, n_kv, n_tokens, n_head, -range/scale, range/scale);
+    struct ggml_tensor * mask = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_kv, n_tokens);
+
+    // causal mask
+    const int64_t n_past = n_kv - n_tokens;
+    for (int64_t i = 0; i < n_tokens; i++) {
+        for (int64_t j = 0; j < n_kv; j++) {
+            ((float *) mask->data)[i*n_kv + j] = j > n_past + i ? -INFINITY : 0.0f;
+        }
+    }
+
+    struct ggml_tensor * r0 = ggml_soft_max(ctx0, ggml_add(ctx0, ggml_scale(ctx0, kq, ggml_new_f32(ctx0, scale)), mask));
+    struct ggml_tensor * r1 = ggml_soft_max_ext(ctx0, kq, mask, scale);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx0);
+
+    ggml_build_forward_expand(gf, r0);
+    ggml_build_forward_expand(gf, r1);
+
+    ggml_graph_compute_helper(work_buffer, gf, 4);
+
+    const float * kq_data = (float *) kq->data;
+    const float * r0_data = (float *) r0->data;
+    const float * r1_data = (float *) r1->data;
+
+    double max_err = 0.0;
+    double max_err_ops = 0.0;
+
+    std::vector<double> ref(n_kv);
+
+    for (int64_t ir = 0; ir < n_tokens*n_head; ++ir) {
+        const float * mp = (float *) mask->data + (ir % n_tokens)*n_kv;
+
+        double max = -INFINITY;
+        for (int64_t j = 0; j < n_kv; ++j) {
+            ref[j] = (double) kq_data[ir*n_kv + j]*scale + mp[j];
+            max = std::max(max, ref[j]);
+        }
+
+        double sum = 0.0;
+        for (int64_t j = 0; j < n_kv; ++j) {
+            ref[j] = exp(ref[j] - max);
+            sum += ref[j];
+        }
+
+        for (int64_t j = 0; j < n_kv; ++j) {
+            ref[j] /= sum;
+
+            max_err     = std::max(max_err,     fabs(r1_data[ir*n_kv + j] - ref[j]));
+            max_err_ops = std::max(max_err_ops, fabs(r1_data[ir*n_kv + j] - r0_data[ir*n_kv + j]));
+        }
+    }
+
+    const bool ok = max_err < 1e-6 && max_err_ops < 1e-6;
+
+    printf("n_kv = %4d, n_tokens = %2d, n_head = %d, range = %5.1f: max err = %g, max err vs ops = %g %s\n",
+            (int) n_kv, (int) n_tokens, (int) n_head, range, max_err, max_err_ops, ok ? "OK" : "FAILED");
+
+    ggml_free(ctx0);
+
+    return ok;
+}
+
+int main(int /*argc*/, const char ** /*argv*/) {
+    std::vector<uint8_t> work_buffer;
+
+    int n_failed = 0;
+
+    // rows that are not a multiple of the vector width, and ranges that reach the underflow of exp
+    n_failed += !test_soft_max_ext( 32,  1, 8,   8.0f, work_buffer);
+    n_failed += !test_soft_max_ext(307, 13, 4,  10.0f, work_buffer);
+    n_failed += !test_soft_max_ext(512, 32, 2, 150.0f, work_buffer);
+    n_failed += !test_soft_max_ext( 19,  7, 3, 300.0f, work_buffer);
+
+    return n_failed == 0 ? 0 : 1;
+}